@@ -5,6 +5,7 @@
 #include <boost/lexical_cast.hpp>
 #include <gflags/gflags.h>
 #include "util.h"
+#include "timer.h"
 #include "string_util.h"
 #include "common/resource_util.h"
 
@@ -18,6 +19,7 @@ DECLARE_int32(agent_heart_beat_interval);
 DECLARE_int32(agent_port_range_start);
 DECLARE_int32(agent_sync_container_stat_interval);
 DECLARE_int32(agent_port_range_end);
+DECLARE_int32(agent_removed_pod_log_size);
 DECLARE_double(agent_memory_rate);
 DECLARE_double(agent_cpu_rate);
 
@@ -36,7 +38,16 @@ AgentImpl::AgentImpl():thread_pool_(4),
   engine_(NULL),
   resource_mgr_(NULL),
   ins_(NULL),
-  ins_watcher_(NULL){
+  ins_watcher_(NULL),
+  hostname_(),
+  version_(0),
+  removed_pods_(),
+  removed_floor_(0){
+  // start version from current time, so the version that master got
+  // from the previous agent process is out of delta and master gets
+  // a full snapshot
+  version_ = ::baidu::common::timer::get_micros();
+  removed_floor_ = version_;
   rpc_client_ = new RpcClient();
   c_set_ = new ContainerSet();
   resource_mgr_ = new ResourceMgr();
@@ -51,70 +62,120 @@ void AgentImpl::Poll(RpcController* controller,
                      PollAgentResponse* response,
                      Closure* done) {
   ::baidu::common::MutexLock lock(&mutex_);
+  int64_t since = request->version();
+  // a version out of the removed pod log needs a full snapshot
+  bool full = since < removed_floor_ || since > version_;
   const ContainerPodNameIdx& pod_name_idx = c_set_->get<p_name_tag>();
   ContainerPodNameIdx::const_iterator pod_name_it = pod_name_idx.begin();
-  PodStatus* pod = NULL;
-  std::string last_pod_name = "";
-  for (; pod_name_it != pod_name_idx.end(); ++pod_name_it) {
-    if (last_pod_name != pod_name_it->pod_name_) {
-      pod = response->mutable_status()->add_pstatus();
+  while (pod_name_it != pod_name_idx.end()) {
+    // the containers of a pod are in [pod_name_it, pod_end)
+    ContainerPodNameIdx::const_iterator pod_end = pod_name_it;
+    bool changed = full;
+    for (; pod_end != pod_name_idx.end()
+           && pod_end->pod_name_ == pod_name_it->pod_name_; ++pod_end) {
+      if (pod_end->status_->version() > since) {
+        changed = true;
+      }
+    }
+    if (changed) {
+      PodStatus* pod = response->mutable_status()->add_pstatus();
       pod->set_name(pod_name_it->pod_name_);
       pod->set_state(kPodRunning);
-      last_pod_name = pod_name_it->pod_name_;
+      pod->mutable_desc()->set_type(pod_name_it->pod_type_);
+      for (; pod_name_it != pod_end; ++pod_name_it) {
+        ContainerStatus* status = pod->add_cstatus();
+        status->CopyFrom(*pod_name_it->status_);
+      }
+    }
+    pod_name_it = pod_end;
+  }
+  if (!full) {
+    std::deque<std::pair<int64_t, std::string> >::reverse_iterator r_it = removed_pods_.rbegin();
+    for (; r_it != removed_pods_.rend() && r_it->first > since; ++r_it) {
+      response->add_removed_pods(r_it->second);
     }
-    ContainerStatus* status = pod->add_cstatus();
-    status->CopyFrom(*pod_name_it->status_);
   }
+  response->set_version(version_);
+  response->set_full(full);
   resource_mgr_->Stat(response->mutable_status()->mutable_resource());
   done->Run();
 }
 
+void AgentImpl::TouchContainer(ContainerStatus* status) {
+  mutex_.AssertHeld();
+  status->set_version(++version_);
+}
+
+void AgentImpl::RecordRemovedPod(const std::string& pod_name) {
+  mutex_.AssertHeld();
+  removed_pods_.push_back(std::make_pair(++version_, pod_name));
+  while (removed_pods_.size() > (size_t)FLAGS_agent_removed_pod_log_size) {
+    removed_floor_ = removed_pods_.front().first;
+    removed_pods_.pop_front();
+  }
+}
+
 void AgentImpl::Run(RpcController* controller,
                     const RunPodRequest* request,
                     RunPodResponse* response,
                     Closure* done) {
   ::baidu::common::MutexLock lock(&mutex_);
+  response->set_status(RunPod(request->pod_name(), request->pod()));
+  done->Run();
+}
+
+void AgentImpl::RunPods(RpcController* controller,
+                        const RunPodsRequest* request,
+                        RunPodsResponse* response,
+                        Closure* done) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  for (int32_t index = 0; index < request->pods_size(); ++index) {
+    const RunPodRequest& pod = request->pods(index);
+    PodResult* result = response->add_results();
+    result->set_pod_name(pod.pod_name());
+    result->set_status(RunPod(pod.pod_name(), pod.pod()));
+  }
+  response->set_status(kRpcOk);
+  done->Run();
+}
+
+RpcStatus AgentImpl::RunPod(const std::string& pod_name,
+                            const PodSpec& pod) {
+  mutex_.AssertHeld();
   Resource pod_require;
-  for (int32_t cindex = 0; cindex < request->pod().containers_size(); cindex ++) {
-    bool plus_ok = ResourceUtil::Plus(request->pod().containers(cindex).requirement(), 
+  for (int32_t cindex = 0; cindex < pod.containers_size(); cindex ++) {
+    bool plus_ok = ResourceUtil::Plus(pod.containers(cindex).requirement(), 
                                         &pod_require);
     if (!plus_ok) {
-      LOG(WARNING, "fail to calc total requirement for pod %s", request->pod_name().c_str());
-      response->set_status(kRpcError);
-      done->Run();
-      return;
+      LOG(WARNING, "fail to calc total requirement for pod %s", pod_name.c_str());
+      return kRpcError;
     }
   }
-  bool alloc_ok = resource_mgr_->Alloc(pod_require);
-  if (!alloc_ok) {
-    response->set_status(kRpcNoResource);
-    done->Run();
-    return;
-  }
   const ContainerPodNameIdx& pod_name_idx = c_set_->get<p_name_tag>();
   const ContainerNameIdx& c_name_idx = c_set_->get<c_name_tag>();
-  ContainerPodNameIdx::const_iterator pod_name_it = pod_name_idx.find(request->pod_name());
+  ContainerPodNameIdx::const_iterator pod_name_it = pod_name_idx.find(pod_name);
   if (pod_name_it != pod_name_idx.end()) {
-    LOG(WARNING, "pod name %s exists in agent", request->pod_name().c_str());
-    response->set_status(kRpcNameExist);
-    done->Run();
-    return;
+    LOG(WARNING, "pod name %s exists in agent", pod_name.c_str());
+    return kRpcNameExist;
   }
   std::deque<std::string> avilable_name;
-  for (int32_t offset = 0; offset < request->pod().containers_size(); ++offset) { 
-    std::string c_name = boost::lexical_cast<std::string>(offset) + "_container." + request->pod_name();
+  for (int32_t offset = 0; offset < pod.containers_size(); ++offset) { 
+    std::string c_name = boost::lexical_cast<std::string>(offset) + "_container." + pod_name;
     if (c_name_idx.find(c_name) != c_name_idx.end()) {
       LOG(WARNING, "container name %s exists in agent ", c_name.c_str());
-      response->set_status(kRpcNameExist);
-      done->Run();
-      return;
+      return kRpcNameExist;
     }
     avilable_name.push_back(c_name);
   }
-  for (int32_t index = 0; index < request->pod().containers_size(); ++index) {
+  // alloc after the name checks, so the rejected pod holds no resource
+  bool alloc_ok = resource_mgr_->Alloc(pod_require);
+  if (!alloc_ok) {
+    return kRpcNoResource;
+  }
+  for (int32_t index = 0; index < pod.containers_size(); ++index) {
     std::string c_name = avilable_name.front();
     avilable_name.pop_front();
-    const Container& spec = request->pod().containers(index);
+    const Container& spec = pod.containers(index);
     LOG(INFO, "add container %s with cpu %d memory %s restart strategy %s",
         c_name.c_str(),
         spec.requirement().cpu().limit(),
@@ -122,17 +183,18 @@ void AgentImpl::Run(RpcController* controller,
         RestartStrategy_Name(spec.restart_strategy()).c_str());
     ContainerIdx idx;
     idx.name_ = c_name;
-    idx.pod_name_ = request->pod_name();
+    idx.pod_name_ = pod_name;
+    idx.pod_type_ = pod.type();
     idx.status_ = new ContainerStatus();
     idx.status_->set_name(c_name);
     idx.status_->set_state(kContainerPending);
     idx.status_->mutable_spec()->CopyFrom(spec);
+    TouchContainer(idx.status_);
     idx.logs_ = new std::deque<PodLog>();
     c_set_->insert(idx);
     thread_pool_.AddTask(boost::bind(&AgentImpl::KeepContainer, this, c_name));
   }
-  response->set_status(kRpcOk);
-  done->Run();
+  return kRpcOk;
 }
 
 bool AgentImpl::Start() {
@@ -181,23 +243,41 @@ void AgentImpl::Delete(RpcController* controller,
                        DeletePodResponse* response,
                        Closure* done) {
   ::baidu::common::MutexLock lock(&mutex_);
-  LOG(INFO, "delete pod %s", request->name().c_str());
+  response->set_status(DeletePod(request->name()));
+  done->Run();
+}
+
+void AgentImpl::DeletePods(RpcController* controller,
+                           const DeletePodsRequest* request,
+                           DeletePodsResponse* response,
+                           Closure* done) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  for (int32_t index = 0; index < request->names_size(); ++index) {
+    PodResult* result = response->add_results();
+    result->set_pod_name(request->names(index));
+    result->set_status(DeletePod(request->names(index)));
+  }
+  response->set_status(kRpcOk);
+  done->Run();
+}
+
+RpcStatus AgentImpl::DeletePod(const std::string& pod_name) {
+  mutex_.AssertHeld();
+  LOG(INFO, "delete pod %s", pod_name.c_str());
   const ContainerPodNameIdx& pod_name_idx = c_set_->get<p_name_tag>();
-  ContainerPodNameIdx::const_iterator pod_name_it = pod_name_idx.find(request->name());
+  ContainerPodNameIdx::const_iterator pod_name_it = pod_name_idx.find(pod_name);
   if (pod_name_it == pod_name_idx.end()) {
-    LOG(WARNING, "pod name %s does not exist on agent", request->name().c_str());
-    response->set_status(kRpcNotFound);
-    done->Run();
-    return;
+    LOG(WARNING, "pod name %s does not exist on agent", pod_name.c_str());
+    return kRpcNotFound;
   }
   for (; pod_name_it != pod_name_idx.end(); ++pod_name_it) {
-    if (pod_name_it->pod_name_ != request->name()) {
+    if (pod_name_it->pod_name_ != pod_name) {
       break;
     }
     pod_name_it->status_->set_state(kContainerKilled);
+    TouchContainer(pod_name_it->status_);
   }
-  response->set_status(kRpcOk);
-  done->Run();
+  return kRpcOk;
 }
 
 void AgentImpl::WaitContainer(const std::string& c_name) {
@@ -223,10 +303,19 @@ void AgentImpl::WaitContainer(const std::string& c_name) {
                              boost::bind(&AgentImpl::WaitContainer, this, c_name));
   } else {
     resource_mgr_->Release(c_name_it->status_->spec().requirement());
+    std::string pod_name = c_name_it->pod_name_;
     // delete container successfully and clean container in dos agent
     delete c_name_it->status_;
     delete c_name_it->desc_;
     c_set_->erase(c_name);
+    const ContainerPodNameIdx& pod_name_idx = c_set_->get<p_name_tag>();
+    ContainerPodNameIdx::const_iterator pod_name_it = pod_name_idx.find(pod_name);
+    if (pod_name_it == pod_name_idx.end()) {
+      RecordRemovedPod(pod_name);
+    } else {
+      // the pod has lost a container
+      TouchContainer(pod_name_it->status_);
+    }
   }
 }
 
@@ -262,6 +351,7 @@ void AgentImpl::KeepContainer(const std::string& c_name) {
     }else {
       c_name_it->status_->set_state(kContainerRunning);
     }
+    TouchContainer(c_name_it->status_);
   } else if (current_state == kContainerRunning
              || current_state == kContainerBooting
              || current_state == kContainerPulling) {
@@ -340,6 +430,7 @@ bool AgentImpl::SyncContainerStat(ContainerStatus* status) {
     LOG(WARNING, "fail to sync container %s stat from engine for rpc err",
         status->name().c_str());
     status->set_state(kContainerError);
+    TouchContainer(status);
     return true;
   }
   if (response.status() != kRpcOk) {
@@ -347,15 +438,22 @@ bool AgentImpl::SyncContainerStat(ContainerStatus* status) {
         status->name().c_str(),
         RpcStatus_Name(response.status()).c_str());
     status->set_state(kContainerError);
+    TouchContainer(status);
     return true;
   }
   if (response.containers_size() == 0) {
     LOG(WARNING, "container %s does not exist in engine",
         status->name().c_str());
     status->set_state(kContainerError);
+    TouchContainer(status);
     return true;
   }
   const ContainerOverview& overview = response.containers(0);
+  if (status->state() != overview.state()
+      || status->start_time() != overview.start_time()
+      || status->boot_time() != overview.boot_time()) {
+    TouchContainer(status);
+  }
   status->set_state(overview.state());
   status->set_start_time(overview.start_time());
   status->set_boot_time(overview.boot_time());
@@ -32,8 +32,11 @@ struct ContainerIdx {
   ContainerStatus* status_;
   Container* desc_;
   std::deque<PodLog>* logs_;
+  // the type of pod, master uses it to choose the victims of preemption
+  PodType pod_type_;
   ContainerIdx():name_(), pod_name_(),
-  status_(NULL), desc_(NULL), logs_(NULL){}
+  status_(NULL), desc_(NULL), logs_(NULL),
+  pod_type_(kPodBesteffort){}
   ~ContainerIdx(){}
 };
 
@@ -71,8 +74,20 @@ public:
               const DeletePodRequest* request,
               DeletePodResponse* response,
               Closure* done);
+  // run or delete a batch of pods, every pod has its own result
+  void RunPods(RpcController* controller,
+               const RunPodsRequest* request,
+               RunPodsResponse* response,
+               Closure* done);
+  void DeletePods(RpcController* controller,
+                  const DeletePodsRequest* request,
+                  DeletePodsResponse* response,
+                  Closure* done);
   bool Start();
 private:
+  RpcStatus RunPod(const std::string& pod_name,
+                   const PodSpec& pod);
+  RpcStatus DeletePod(const std::string& pod_name);
   void HeartBeat();
   void HeartBeatCallback(const HeartBeatRequest* request,
                          HeartBeatResponse* response,
@@ -85,6 +100,10 @@ private:
   bool RunContainer(const ContainerStatus* status);
   bool SyncContainerStat(ContainerStatus* status);
   void HandleMasterChange(const std::string& endpoint);
+  // container status changed, move agent version forward
+  void TouchContainer(ContainerStatus* status);
+  // the last container of pod has been removed
+  void RecordRemovedPod(const std::string& pod_name);
 private:
   ::baidu::common::ThreadPool thread_pool_;
   Master_Stub* master_;
@@ -96,6 +115,12 @@ private:
   InsSDK* ins_;
   InsWatcher* ins_watcher_;
   std::string hostname_;
+  // the version of container status changes
+  int64_t version_;
+  // the bounded log of removed pods with the version when they were removed
+  std::deque<std::pair<int64_t, std::string> > removed_pods_;
+  // the removed pods with version after it are all in removed_pods_
+  int64_t removed_floor_;
 };
 
 }// end of dos
@@ -274,6 +274,11 @@ void StartAgent() {
 }
 
 void StartInitd() {
+  // block SIGCHLD before any thread starts, the exits of tasks are
+  // found by the child reaper of initd
+  if (!dos::ChildReaper::BlockSignal()) {
+    exit(1);
+  }
   if (FLAGS_ce_enable_ns) {
     std::string oc_path = ".";
     dos::Oc oc(oc_path, FLAGS_ce_initd_conf_path);
@@ -303,6 +308,7 @@ void StartInitd() {
     exit(1);
   }
   LOG(INFO, "start initd on port %s", FLAGS_ce_initd_port.c_str());
+  initd->NotifyReady();
   signal(SIGINT, SignalIntHandler);
   signal(SIGTERM, SignalIntHandler);
   while (!s_quit) {
@@ -311,6 +317,11 @@ void StartInitd() {
 }
 
 void StartEngine() { 
+  // block SIGCHLD before any thread starts, the children are reaped
+  // by the child reaper of engine
+  if (!dos::ChildReaper::BlockSignal()) {
+    exit(1);
+  }
   sofa::pbrpc::RpcServerOptions options;
   sofa::pbrpc::RpcServer rpc_server(options);
   dos::EngineImpl* engine = new dos::EngineImpl(FLAGS_ce_work_dir, FLAGS_ce_gc_dir);
@@ -447,6 +458,10 @@ void AddJob() {
   }
   job.name= node["job"]["name"].as<std::string>();
   job.deploy_step_size = node["job"]["deploy_step"].as<uint32_t>(); 
+  job.gang = false;
+  if (node["job"]["gang"]) {
+    job.gang = node["job"]["gang"].as<bool>();
+  }
   ::dos::CDescriptor container;
   if (!node["job"]["type"]){
     fprintf(stderr, "type is required in job\n");
@@ -2,12 +2,10 @@
 #define KERNEL_COMMON_BLOCKING_QUEUE_H
 
 #include <queue>
+#include <string>
 #include "mutex.h"
-#include "logging.h"
 
 using ::baidu::common::MutexLock;
-using ::baidu::common::INFO;
-using ::baidu::common::WARNING;
 
 namespace dos {
 
@@ -26,7 +24,6 @@ public:
   T Pop() {
     MutexLock lock(&mutex_);
     while (queue_.size() <= 0) {
-      LOG(INFO, "%s queue is empty", name_.c_str());
       cond_.Wait();
     }
     T t = queue_.front();
@@ -38,7 +35,6 @@ public:
   void Push(const T& t) {
     MutexLock lock(&mutex_);
     while (queue_.size() >= capacity_) {
-      LOG(WARNING, "%s queue is full", name_.c_str());
       cond_.Wait();
     }
     queue_.push(t);
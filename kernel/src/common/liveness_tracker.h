@@ -0,0 +1,292 @@
+#ifndef KERNEL_COMMON_LIVENESS_TRACKER_H
+#define KERNEL_COMMON_LIVENESS_TRACKER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include "mutex.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+namespace dos {
+
+// track the liveness of keys with a hierarchical timing wheel. a touch
+// only stores the time of the key, the wheel is driven by one ticking
+// thread which checks a key when its deadline comes and moves it to the
+// new deadline when it has been touched, so every key is moved at most
+// once a timeout however often it is touched. the key that is not touched
+// for timeout is untracked and passed to callback in the ticking thread
+class LivenessTracker {
+
+public:
+  typedef boost::function<void (const std::string& key)> ExpireCallback;
+
+  LivenessTracker(int32_t timeout, int32_t tick,
+                  const ExpireCallback& callback):mutex_(),
+    timeout_(timeout),
+    tick_(tick > 0 ? tick : 1),
+    callback_(callback),
+    start_(0),
+    current_tick_(0),
+    size_(0),
+    chunks_(NULL),
+    free_ids_(),
+    wheels_(),
+    pool_(1),
+    running_(false) {
+    start_ = NowMs();
+    chunks_ = new Entry*[kMaxChunks];
+    for (uint32_t index = 0; index < kMaxChunks; ++index) {
+      chunks_[index] = NULL;
+    }
+    wheels_.resize(kLevels * kSlots);
+  }
+
+  ~LivenessTracker() {
+    Stop();
+    for (uint32_t index = 0; index < kMaxChunks; ++index) {
+      delete[] chunks_[index];
+    }
+    delete[] chunks_;
+  }
+
+  void Start() {
+    ::baidu::common::MutexLock lock(&mutex_);
+    if (running_) {
+      return;
+    }
+    running_ = true;
+    pool_.DelayTask(tick_, boost::bind(&LivenessTracker::TickLoop, this));
+  }
+
+  void Stop() {
+    {
+      ::baidu::common::MutexLock lock(&mutex_);
+      running_ = false;
+    }
+    pool_.Stop(true);
+  }
+
+  // start tracking key as touched now and return the id for touching it,
+  // the same key tracked twice has two ids
+  int64_t Track(const std::string& key) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    uint32_t index = 0;
+    if (!free_ids_.empty()) {
+      index = free_ids_.back();
+      free_ids_.pop_back();
+    } else {
+      index = size_;
+      if ((index >> kChunkBits) >= kMaxChunks) {
+        return -1;
+      }
+      if (chunks_[index >> kChunkBits] == NULL) {
+        chunks_[index >> kChunkBits] = new Entry[1 << kChunkBits];
+      }
+    }
+    Entry* entry = GetEntry(index);
+    entry->key_ = key;
+    entry->last_touch_ = NowMs();
+    // publish the entry before the id is visible to touch
+    __sync_synchronize();
+    if (index == size_) {
+      size_++;
+    }
+    int64_t id = (static_cast<int64_t>(entry->gen_) << 32) | index;
+    Schedule(id, DeadlineTick(entry->last_touch_));
+    return id;
+  }
+
+  // record that key is alive now, return false when the id has expired
+  // or been untracked. it does not take any lock, a touch racing with the
+  // untracking of the same id may refresh the next owner of the entry once
+  bool Touch(int64_t id) {
+    Entry* entry = FindEntry(id);
+    if (entry == NULL) {
+      return false;
+    }
+    entry->last_touch_ = NowMs();
+    return true;
+  }
+
+  void Untrack(int64_t id) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    if (FindEntry(id) == NULL) {
+      return;
+    }
+    Release(static_cast<uint32_t>(id & 0xffffffff));
+  }
+
+  // the count of tracked keys
+  uint32_t Size() {
+    ::baidu::common::MutexLock lock(&mutex_);
+    return size_ - free_ids_.size();
+  }
+
+private:
+  // 4 levels of 64 slots cover 2^24 ticks
+  static const uint32_t kLevels = 4;
+  static const uint32_t kSlotBits = 6;
+  static const uint32_t kSlots = 1 << kSlotBits;
+  // entries are allocated in chunks that never move, so touch reads
+  // them without lock
+  static const uint32_t kChunkBits = 10;
+  static const uint32_t kMaxChunks = 4096;
+
+  struct Entry {
+    std::string key_;
+    volatile int64_t last_touch_;
+    // moves forward when the entry is released, so the stale ids and
+    // the stale items in wheel are ignored
+    volatile uint32_t gen_;
+    Entry():key_(), last_touch_(0), gen_(0){}
+  };
+
+  static int64_t NowMs() {
+    return ::baidu::common::timer::get_micros() / 1000;
+  }
+
+  Entry* GetEntry(uint32_t index) {
+    return &chunks_[index >> kChunkBits][index & ((1 << kChunkBits) - 1)];
+  }
+
+  Entry* FindEntry(int64_t id) {
+    if (id < 0) {
+      return NULL;
+    }
+    uint32_t index = static_cast<uint32_t>(id & 0xffffffff);
+    if (index >= *static_cast<volatile uint32_t*>(&size_)) {
+      return NULL;
+    }
+    Entry* entry = GetEntry(index);
+    if (entry->gen_ != static_cast<uint32_t>(id >> 32)) {
+      return NULL;
+    }
+    return entry;
+  }
+
+  void Release(uint32_t index) {
+    mutex_.AssertHeld();
+    Entry* entry = GetEntry(index);
+    entry->gen_++;
+    entry->key_.clear();
+    free_ids_.push_back(index);
+  }
+
+  // the first tick at or after the deadline of a touch at time
+  int64_t DeadlineTick(int64_t time) {
+    int64_t deadline = time + timeout_ - start_;
+    return deadline <= 0 ? 0 : (deadline + tick_ - 1) / tick_;
+  }
+
+  // put id into the slot of tick, the level is chosen by the distance to
+  // current tick and the lower levels are filled by cascading
+  void Schedule(int64_t id, int64_t tick) {
+    mutex_.AssertHeld();
+    if (tick <= current_tick_) {
+      tick = current_tick_ + 1;
+    }
+    int64_t delta = tick - current_tick_;
+    // the deadline beyond the wheels is checked at the end of wheels
+    // and scheduled again
+    if (delta >= (1LL << (kSlotBits * kLevels))) {
+      delta = (1LL << (kSlotBits * kLevels)) - 1;
+      tick = current_tick_ + delta;
+    }
+    uint32_t level = 0;
+    while (level + 1 < kLevels && delta >= (1LL << (kSlotBits * (level + 1)))) {
+      level++;
+    }
+    uint32_t slot = (tick >> (kSlotBits * level)) & (kSlots - 1);
+    wheels_[level * kSlots + slot].push_back(std::make_pair(id, tick));
+  }
+
+  // move the ticks forward to now, collect the expired keys
+  void Advance(int64_t now, std::vector<std::string>* expired) {
+    mutex_.AssertHeld();
+    int64_t target = (now - start_) / tick_;
+    std::vector<std::pair<int64_t, int64_t> > items;
+    while (current_tick_ < target) {
+      current_tick_++;
+      // cascade the higher levels whose window starts at this tick
+      for (uint32_t level = 1; level < kLevels; ++level) {
+        if ((current_tick_ & ((1LL << (kSlotBits * level)) - 1)) != 0) {
+          break;
+        }
+        uint32_t slot = (current_tick_ >> (kSlotBits * level)) & (kSlots - 1);
+        items.clear();
+        items.swap(wheels_[level * kSlots + slot]);
+        for (size_t index = 0; index < items.size(); ++index) {
+          if (items[index].second <= current_tick_) {
+            // the slot of current tick is checked right after cascading
+            wheels_[current_tick_ & (kSlots - 1)].push_back(items[index]);
+          } else {
+            Schedule(items[index].first, items[index].second);
+          }
+        }
+      }
+      items.clear();
+      items.swap(wheels_[current_tick_ & (kSlots - 1)]);
+      for (size_t index = 0; index < items.size(); ++index) {
+        Check(items[index].first, now, expired);
+      }
+    }
+  }
+
+  // check the key whose deadline comes
+  void Check(int64_t id, int64_t now, std::vector<std::string>* expired) {
+    mutex_.AssertHeld();
+    Entry* entry = FindEntry(id);
+    if (entry == NULL) {
+      return;
+    }
+    int64_t last_touch = entry->last_touch_;
+    if (last_touch + timeout_ > now) {
+      Schedule(id, DeadlineTick(last_touch));
+      return;
+    }
+    expired->push_back(entry->key_);
+    Release(static_cast<uint32_t>(id & 0xffffffff));
+  }
+
+  void TickLoop() {
+    std::vector<std::string> expired;
+    {
+      ::baidu::common::MutexLock lock(&mutex_);
+      if (!running_) {
+        return;
+      }
+      Advance(NowMs(), &expired);
+    }
+    for (size_t index = 0; index < expired.size(); ++index) {
+      callback_(expired[index]);
+    }
+    ::baidu::common::MutexLock lock(&mutex_);
+    if (running_) {
+      pool_.DelayTask(tick_, boost::bind(&LivenessTracker::TickLoop, this));
+    }
+  }
+
+private:
+  ::baidu::common::Mutex mutex_;
+  // the unit of timeout and tick is ms
+  int32_t timeout_;
+  int32_t tick_;
+  ExpireCallback callback_;
+  // the time(ms) of tick 0
+  int64_t start_;
+  int64_t current_tick_;
+  // the count of entries that have been allocated
+  uint32_t size_;
+  Entry** chunks_;
+  std::vector<uint32_t> free_ids_;
+  // the slots of all levels, an item is the id and its deadline tick
+  std::vector<std::vector<std::pair<int64_t, int64_t> > > wheels_;
+  ::baidu::common::ThreadPool pool_;
+  bool running_;
+};
+
+}
+#endif
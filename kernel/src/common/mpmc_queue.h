@@ -0,0 +1,241 @@
+#ifndef KERNEL_COMMON_MPMC_QUEUE_H
+#define KERNEL_COMMON_MPMC_QUEUE_H
+
+#include <stdint.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+#include "mutex.h"
+
+namespace dos {
+
+// a bounded multi producer multi consumer queue on a ring buffer,
+// every cell has a sequence that tells whether it is ready for
+// push or pop, so producers and consumers only race on their own
+// position with cas. the blocking calls spin for a while and then
+// sleep on a condvar that is only touched when someone is sleeping.
+// to avoid copying big object please using pointer type
+template <typename T>
+class BoundedMpmcQueue {
+
+public:
+  BoundedMpmcQueue(uint32_t capacity, const std::string& name):cells_(NULL),
+    mask_(0),
+    enqueue_pos_(0),
+    dequeue_pos_(0),
+    waiting_consumers_(0),
+    waiting_producers_(0),
+    mutex_(),
+    not_empty_(&mutex_),
+    not_full_(&mutex_),
+    name_(name){
+    // round capacity up to power of 2 for masking
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_ = new Cell[size];
+    for (size_t index = 0; index < size; ++index) {
+      cells_[index].seq_ = index;
+    }
+  }
+
+  ~BoundedMpmcQueue() {
+    delete[] cells_;
+  }
+
+  // return false when queue is full
+  bool TryPush(const T& t) {
+    if (!DoPush(t)) {
+      return false;
+    }
+    if (__sync_fetch_and_add(&waiting_consumers_, 0) > 0) {
+      ::baidu::common::MutexLock lock(&mutex_);
+      not_empty_.Signal();
+    }
+    return true;
+  }
+
+  // return false when queue is empty
+  bool TryPop(T* t) {
+    if (!DoPop(t)) {
+      return false;
+    }
+    if (__sync_fetch_and_add(&waiting_producers_, 0) > 0) {
+      ::baidu::common::MutexLock lock(&mutex_);
+      not_full_.Signal();
+    }
+    return true;
+  }
+
+  // block until there is room for t
+  void Push(const T& t) {
+    for (int32_t spin = 0; spin < kSpinCount; ++spin) {
+      if (TryPush(t)) {
+        return;
+      }
+      sched_yield();
+    }
+    ::baidu::common::MutexLock lock(&mutex_);
+    // count self before checking again, so a consumer that pops
+    // after the check must see the counter and signal
+    __sync_fetch_and_add(&waiting_producers_, 1);
+    while (!DoPush(t)) {
+      not_full_.Wait();
+    }
+    __sync_fetch_and_sub(&waiting_producers_, 1);
+    if (__sync_fetch_and_add(&waiting_consumers_, 0) > 0) {
+      not_empty_.Signal();
+    }
+  }
+
+  // block until queue is not empty
+  T Pop() {
+    T t;
+    PopBlocking(&t);
+    return t;
+  }
+
+  // block until queue is not empty, then pop at most max_size
+  // elements into batch without blocking, return the count of them
+  size_t PopBatch(std::vector<T>* batch, size_t max_size) {
+    if (max_size == 0) {
+      return 0;
+    }
+    T t;
+    PopBlocking(&t);
+    batch->push_back(t);
+    size_t count = 1;
+    while (count < max_size && TryPop(&t)) {
+      batch->push_back(t);
+      count++;
+    }
+    return count;
+  }
+
+  // it is a snapshot when other threads are pushing or popping
+  size_t Size() const {
+    size_t enqueue_pos = enqueue_pos_;
+    size_t dequeue_pos = dequeue_pos_;
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+  }
+
+  const std::string& Name() const {
+    return name_;
+  }
+
+private:
+  static const int32_t kSpinCount = 64;
+
+  struct Cell {
+    volatile size_t seq_;
+    T data_;
+  };
+
+  bool DoPush(const T& t) {
+    Cell* cell = NULL;
+    size_t pos = enqueue_pos_;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t seq = LoadAcquire(&cell->seq_);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (__sync_bool_compare_and_swap(&enqueue_pos_, pos, pos + 1)) {
+          break;
+        }
+        pos = enqueue_pos_;
+      } else if (diff < 0) {
+        // the cell has not been popped since last round
+        return false;
+      } else {
+        pos = enqueue_pos_;
+      }
+    }
+    cell->data_ = t;
+    StoreRelease(&cell->seq_, pos + 1);
+    return true;
+  }
+
+  bool DoPop(T* t) {
+    Cell* cell = NULL;
+    size_t pos = dequeue_pos_;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t seq = LoadAcquire(&cell->seq_);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (__sync_bool_compare_and_swap(&dequeue_pos_, pos, pos + 1)) {
+          break;
+        }
+        pos = dequeue_pos_;
+      } else if (diff < 0) {
+        // the cell has not been pushed in this round
+        return false;
+      } else {
+        pos = dequeue_pos_;
+      }
+    }
+    *t = cell->data_;
+    StoreRelease(&cell->seq_, pos + mask_ + 1);
+    return true;
+  }
+
+  void PopBlocking(T* t) {
+    for (int32_t spin = 0; spin < kSpinCount; ++spin) {
+      if (TryPop(t)) {
+        return;
+      }
+      sched_yield();
+    }
+    ::baidu::common::MutexLock lock(&mutex_);
+    __sync_fetch_and_add(&waiting_consumers_, 1);
+    while (!DoPop(t)) {
+      not_empty_.Wait();
+    }
+    __sync_fetch_and_sub(&waiting_consumers_, 1);
+    if (__sync_fetch_and_add(&waiting_producers_, 0) > 0) {
+      not_full_.Signal();
+    }
+  }
+
+  // x86 does not reorder loads with loads or stores with stores,
+  // a compiler barrier is enough for acquire and release there
+  static size_t LoadAcquire(volatile size_t* p) {
+    size_t v = *p;
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("" ::: "memory");
+#else
+    __sync_synchronize();
+#endif
+    return v;
+  }
+
+  static void StoreRelease(volatile size_t* p, size_t v) {
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("" ::: "memory");
+#else
+    __sync_synchronize();
+#endif
+    *p = v;
+  }
+
+private:
+  Cell* cells_;
+  size_t mask_;
+  // keep the positions on their own cache lines
+  char pad0_[64];
+  volatile size_t enqueue_pos_;
+  char pad1_[64];
+  volatile size_t dequeue_pos_;
+  char pad2_[64];
+  volatile int32_t waiting_consumers_;
+  volatile int32_t waiting_producers_;
+  ::baidu::common::Mutex mutex_;
+  ::baidu::common::CondVar not_empty_;
+  ::baidu::common::CondVar not_full_;
+  std::string name_;
+};
+
+}
+#endif
@@ -1,7 +1,7 @@
 #ifndef KERNEL_COMMON_RESOURCE_UTIL_H
 #define KERNEL_COMMON_RESOURCE_UTIL_H
 
-#include <set>
+#include <string>
 
 #include "logging.h"
 
@@ -40,20 +40,9 @@ public:
     }
     target->mutable_cpu()->set_assigned(target->cpu().assigned() - alloc.cpu().limit());
     target->mutable_memory()->set_assigned(target->memory().assigned() - alloc.memory().limit());
-    // handle process ports
-    std::set<uint32_t> assigned_ports;
-    for (int32_t index = 0; index < target->port().assigned_size(); ++index) {
-      assigned_ports.insert(target->port().assigned(index));
-    }
-    // clear old assigned ports
-    target->mutable_port()->clear_assigned();
+    // the ports that pod used are assigned property
     for (int32_t index = 0; index < alloc.port().assigned_size(); ++index) {
-      // the ports that pod used are assigned property
-      assigned_ports.erase(alloc.port().assigned(index));
-    }
-    std::set<uint32_t>::iterator port_it = assigned_ports.begin();
-    for (; port_it != assigned_ports.end(); ++port_it) {
-      target->mutable_port()->add_assigned(*port_it);
+      MarkPort(alloc.port().assigned(index), false, target->mutable_port());
     }
     return true;
   }
@@ -77,11 +66,7 @@ public:
       return false;
     }
     // compare ports, use right port assigned property to compare
-    // left (range - assigned)
-    std::set<uint32_t> assigned_ports;
-    for (int32_t index = 0; index < left->port().assigned_size(); ++index) {
-      assigned_ports.insert(left->port().assigned(index));
-    }
+    // left (range - bitmap)
     for (int32_t index = 0; index < right->port().assigned_size(); ++index) {
       uint32_t port = right->port().assigned(index);
       if (port < left->port().range().start() 
@@ -91,7 +76,7 @@ public:
             left->port().range().end());
         return false;
       }
-      if (assigned_ports.find(port) != assigned_ports.end()) {
+      if (IsPortAssigned(port, left->port())) {
         LOG(DEBUG, "the port %d has been assigned", port);
         return false;
       }
@@ -117,21 +102,46 @@ public:
     target->mutable_memory()->set_assigned(target->memory().assigned() +  sub.memory().limit());
 
     // alloc port
-    std::set<uint32_t> assigned_ports;
-    for (int32_t index = 0; index < target->port().assigned_size(); ++index) {
-      assigned_ports.insert(target->port().assigned(index));
-    }
-    target->mutable_port()->clear_assigned();
     for (int32_t index = 0; index < sub.port().assigned_size(); ++index) {
       LOG(DEBUG, "alloc port %d", sub.port().assigned(index));
-      assigned_ports.insert(sub.port().assigned(index));
-    }
-    std::set<uint32_t>::iterator port_it = assigned_ports.begin();
-    for (; port_it != assigned_ports.end(); ++port_it) {
-      target->mutable_port()->add_assigned(*port_it);
+      MarkPort(sub.port().assigned(index), true, target->mutable_port());
     }
     return true;
   }
+
+  static bool IsPortAssigned(uint32_t port, const Port& ports) {
+    if (port < ports.range().start()) {
+      return false;
+    }
+    uint32_t offset = port - ports.range().start();
+    if ((offset >> 3) >= ports.bitmap().size()) {
+      return false;
+    }
+    return (ports.bitmap()[offset >> 3] >> (offset & 7)) & 1;
+  }
+
+private:
+  static void MarkPort(uint32_t port, bool assigned, Port* ports) {
+    if (port < ports->range().start()
+        || port > ports->range().end()) {
+      return;
+    }
+    uint32_t offset = port - ports->range().start();
+    std::string* bitmap = ports->mutable_bitmap();
+    if ((offset >> 3) >= bitmap->size()) {
+      if (!assigned) {
+        return;
+      }
+      // alloc the bitmap for the whole range once
+      uint32_t size = ((ports->range().end() - ports->range().start()) >> 3) + 1;
+      bitmap->resize(size, '\0');
+    }
+    if (assigned) {
+      (*bitmap)[offset >> 3] |= (1 << (offset & 7));
+    } else {
+      (*bitmap)[offset >> 3] &= ~(1 << (offset & 7));
+    }
+  }
 };
 
 }
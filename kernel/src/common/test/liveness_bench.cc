@@ -0,0 +1,166 @@
+// compare the heart beat cost of LivenessTracker with the delay tasks
+// that master used, every heart beat of the delay task way cancels the
+// timeout task of agent and adds a new one under one mutex
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include "common/liveness_tracker.h"
+#include "logging.h"
+#include "mutex.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+const int32_t kAgents = 10000;
+const int64_t kTotalBeats = 1000000;
+// the timeout is long enough that no agent expires while beating
+const int32_t kBeatTimeout = 600000;
+
+enum BeatMode {
+  kDelayTask,
+  kLivenessTracker
+};
+
+struct BenchContext {
+  BeatMode mode;
+  ::baidu::common::Mutex mutex;
+  ::baidu::common::ThreadPool* pool;
+  dos::LivenessTracker* tracker;
+  // the delay task id or tracker id of every agent
+  std::vector<int64_t> ids;
+  int64_t beats_per_thread;
+  int32_t seed;
+};
+
+static void Timeout(const std::string&) {}
+
+static void* Beat(void* arg) {
+  BenchContext* ctx = static_cast<BenchContext*>(arg);
+  uint32_t seed = __sync_fetch_and_add(&ctx->seed, 1);
+  for (int64_t index = 0; index < ctx->beats_per_thread; ++index) {
+    int32_t agent = rand_r(&seed) % kAgents;
+    if (ctx->mode == kDelayTask) {
+      ::baidu::common::MutexLock lock(&ctx->mutex);
+      ctx->pool->CancelTask(ctx->ids[agent]);
+      ctx->ids[agent] = ctx->pool->DelayTask(kBeatTimeout,
+                                             boost::bind(&Timeout, std::string()));
+    } else {
+      ctx->tracker->Touch(ctx->ids[agent]);
+    }
+  }
+  return NULL;
+}
+
+// return the consumed us of all heart beats
+static int64_t Run(BeatMode mode, int32_t threads) {
+  BenchContext ctx;
+  ctx.mode = mode;
+  ctx.pool = new ::baidu::common::ThreadPool(4);
+  ctx.tracker = new dos::LivenessTracker(kBeatTimeout, 100, boost::bind(&Timeout, _1));
+  ctx.tracker->Start();
+  ctx.beats_per_thread = kTotalBeats / threads;
+  ctx.seed = 0;
+  for (int32_t index = 0; index < kAgents; ++index) {
+    char endpoint[32];
+    snprintf(endpoint, sizeof(endpoint), "agent%d:8221", index);
+    if (mode == kDelayTask) {
+      ctx.ids.push_back(ctx.pool->DelayTask(kBeatTimeout,
+                                            boost::bind(&Timeout, std::string())));
+    } else {
+      ctx.ids.push_back(ctx.tracker->Track(endpoint));
+    }
+  }
+  std::vector<pthread_t> tids(threads);
+  int64_t start = ::baidu::common::timer::get_micros();
+  for (int32_t index = 0; index < threads; ++index) {
+    pthread_create(&tids[index], NULL, Beat, &ctx);
+  }
+  for (int32_t index = 0; index < threads; ++index) {
+    pthread_join(tids[index], NULL);
+  }
+  int64_t used = ::baidu::common::timer::get_micros() - start;
+  ctx.pool->Stop(false);
+  delete ctx.pool;
+  delete ctx.tracker;
+  return used;
+}
+
+// the expired agents and the time(ms) they expire
+struct ExpiryCollector {
+  std::vector<std::string> keys;
+  std::vector<int64_t> times;
+  void Expire(const std::string& key) {
+    keys.push_back(key);
+    times.push_back(::baidu::common::timer::get_micros() / 1000);
+  }
+};
+
+// touch the even agents and check that only the odd ones expire,
+// return the max delay(ms) between timeout and expiry or -1 on error
+static int64_t CheckExpiry() {
+  const int32_t agents = 1000;
+  const int32_t timeout = 1000;
+  const int32_t tick = 10;
+  ExpiryCollector collector;
+  dos::LivenessTracker tracker(timeout, tick,
+                               boost::bind(&ExpiryCollector::Expire, &collector, _1));
+  std::vector<int64_t> ids;
+  int64_t start = ::baidu::common::timer::get_micros() / 1000;
+  for (int32_t index = 0; index < agents; ++index) {
+    char endpoint[32];
+    snprintf(endpoint, sizeof(endpoint), "%d", index);
+    ids.push_back(tracker.Track(endpoint));
+  }
+  tracker.Start();
+  while (::baidu::common::timer::get_micros() / 1000 - start < timeout * 2) {
+    for (int32_t index = 0; index < agents; index += 2) {
+      tracker.Touch(ids[index]);
+    }
+    usleep(tick * 1000);
+  }
+  // the callback runs in the ticking thread, so collector is only read
+  // after tracker stops
+  tracker.Stop();
+  if (collector.keys.size() != (size_t)agents / 2) {
+    fprintf(stderr, "%u agents expire, expected %d\n",
+            (uint32_t)collector.keys.size(), agents / 2);
+    return -1;
+  }
+  int64_t delay = 0;
+  for (size_t index = 0; index < collector.keys.size(); ++index) {
+    if (atoi(collector.keys[index].c_str()) % 2 == 0) {
+      fprintf(stderr, "agent %s expires with heart beats\n",
+              collector.keys[index].c_str());
+      return -1;
+    }
+    delay = std::max(delay, collector.times[index] - start - timeout);
+  }
+  return delay;
+}
+
+int main(int argc, char** argv) {
+  ::baidu::common::SetLogLevel(::baidu::common::FATAL);
+  const int32_t thread_counts[] = {1, 4, 16};
+  const char* mode_names[] = {"delay task", "liveness tracker"};
+  fprintf(stdout, "%d agents, %ld heart beats\n", kAgents, kTotalBeats);
+  for (size_t tindex = 0; tindex < sizeof(thread_counts) / sizeof(int32_t); ++tindex) {
+    int32_t threads = thread_counts[tindex];
+    for (int32_t mode = kDelayTask; mode <= kLivenessTracker; ++mode) {
+      int64_t used = Run(static_cast<BeatMode>(mode), threads);
+      fprintf(stdout, "threads %2d %-16s: %8ld us, %8.1f ns/beat\n",
+              threads, mode_names[mode], used,
+              used * 1000.0 / (kTotalBeats / threads * threads));
+    }
+  }
+  int64_t delay = CheckExpiry();
+  if (delay < 0) {
+    return 1;
+  }
+  fprintf(stdout, "expiry check passed, the odd agents expire within %ld ms after timeout\n",
+          delay);
+  return 0;
+}
@@ -0,0 +1,132 @@
+// compare the bitmap port allocator in ResourceUtil with the
+// std::set based allocator it replaced, on a 2000 ports range
+#include <set>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "proto/dos.pb.h"
+#include "common/resource_util.h"
+#include "timer.h"
+
+namespace dos {
+
+// the set based implementation, ports are kept in assigned property
+class SetPortUtil {
+
+public:
+  static bool Satisfy(const Resource& left, const Resource& right) {
+    std::set<uint32_t> assigned_ports;
+    for (int32_t index = 0; index < left.port().assigned_size(); ++index) {
+      assigned_ports.insert(left.port().assigned(index));
+    }
+    for (int32_t index = 0; index < right.port().assigned_size(); ++index) {
+      uint32_t port = right.port().assigned(index);
+      if (port < left.port().range().start() 
+          || port > left.port().range().end()) {
+        return false;
+      }
+      if (assigned_ports.find(port) != assigned_ports.end()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool Alloc(const Resource& sub, Resource* target) {
+    if (!Satisfy(*target, sub)) {
+      return false;
+    }
+    std::set<uint32_t> assigned_ports;
+    for (int32_t index = 0; index < target->port().assigned_size(); ++index) {
+      assigned_ports.insert(target->port().assigned(index));
+    }
+    target->mutable_port()->clear_assigned();
+    for (int32_t index = 0; index < sub.port().assigned_size(); ++index) {
+      assigned_ports.insert(sub.port().assigned(index));
+    }
+    std::set<uint32_t>::iterator port_it = assigned_ports.begin();
+    for (; port_it != assigned_ports.end(); ++port_it) {
+      target->mutable_port()->add_assigned(*port_it);
+    }
+    return true;
+  }
+
+  static bool Release(const Resource& alloc, Resource* target) {
+    std::set<uint32_t> assigned_ports;
+    for (int32_t index = 0; index < target->port().assigned_size(); ++index) {
+      assigned_ports.insert(target->port().assigned(index));
+    }
+    target->mutable_port()->clear_assigned();
+    for (int32_t index = 0; index < alloc.port().assigned_size(); ++index) {
+      assigned_ports.erase(alloc.port().assigned(index));
+    }
+    std::set<uint32_t>::iterator port_it = assigned_ports.begin();
+    for (; port_it != assigned_ports.end(); ++port_it) {
+      target->mutable_port()->add_assigned(*port_it);
+    }
+    return true;
+  }
+};
+
+}
+
+const uint32_t kRangeStart = 4000;
+const uint32_t kRangeEnd = 6000;
+const int32_t kRounds = 20000;
+
+int main(int argc, char** argv) {
+  int32_t used = 1000;
+  if (argc > 1) {
+    used = atoi(argv[1]);
+  }
+  // the agent with half of ports used and the requirement of 2 ports
+  dos::Resource bitmap_agent;
+  dos::Resource set_agent;
+  bitmap_agent.mutable_port()->mutable_range()->set_start(kRangeStart);
+  bitmap_agent.mutable_port()->mutable_range()->set_end(kRangeEnd);
+  set_agent.mutable_port()->mutable_range()->set_start(kRangeStart);
+  set_agent.mutable_port()->mutable_range()->set_end(kRangeEnd);
+  for (int32_t index = 0; index < used; ++index) {
+    dos::Resource one;
+    one.mutable_port()->add_assigned(kRangeStart + index * 2);
+    dos::ResourceUtil::Alloc(one, &bitmap_agent);
+    dos::SetPortUtil::Alloc(one, &set_agent);
+  }
+  std::vector<dos::Resource> requirements(kRounds);
+  for (int32_t index = 0; index < kRounds; ++index) {
+    requirements[index].mutable_port()->add_assigned(kRangeStart + ::rand() % (kRangeEnd - kRangeStart + 1));
+    requirements[index].mutable_port()->add_assigned(kRangeStart + ::rand() % (kRangeEnd - kRangeStart + 1));
+  }
+
+  int32_t bitmap_ok = 0;
+  int64_t start = ::baidu::common::timer::get_micros();
+  for (int32_t index = 0; index < kRounds; ++index) {
+    if (dos::ResourceUtil::Alloc(requirements[index], &bitmap_agent)) {
+      dos::ResourceUtil::Release(requirements[index], &bitmap_agent);
+      bitmap_ok++;
+    }
+  }
+  int64_t bitmap_consumed = ::baidu::common::timer::get_micros() - start;
+
+  int32_t set_ok = 0;
+  start = ::baidu::common::timer::get_micros();
+  for (int32_t index = 0; index < kRounds; ++index) {
+    if (dos::SetPortUtil::Alloc(requirements[index], &set_agent)) {
+      dos::SetPortUtil::Release(requirements[index], &set_agent);
+      set_ok++;
+    }
+  }
+  int64_t set_consumed = ::baidu::common::timer::get_micros() - start;
+
+  fprintf(stdout, "range [%u, %u] used %d, %d rounds of alloc and release\n",
+          kRangeStart, kRangeEnd, used, kRounds);
+  fprintf(stdout, "bitmap: %ld us, %.3f us/round, %d alloc ok\n",
+          bitmap_consumed, bitmap_consumed * 1.0 / kRounds, bitmap_ok);
+  fprintf(stdout, "set   : %ld us, %.3f us/round, %d alloc ok\n",
+          set_consumed, set_consumed * 1.0 / kRounds, set_ok);
+  if (bitmap_ok != set_ok) {
+    fprintf(stderr, "the results of bitmap and set are different\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,113 @@
+// compare the throughput of BoundedMpmcQueue with FixedBlockingQueue,
+// producers push into one queue and one consumer drains it like the
+// watch loops of master do
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "common/blocking_queue.h"
+#include "common/mpmc_queue.h"
+#include "logging.h"
+#include "timer.h"
+
+const uint32_t kCapacity = 2 * 10240;
+const int64_t kTotalItems = 2000000;
+const size_t kBatchSize = 64;
+
+enum ConsumeMode {
+  kBlockingPop,
+  kMpmcPop,
+  kMpmcPopBatch
+};
+
+struct BenchContext {
+  dos::FixedBlockingQueue<int64_t>* blocking_queue;
+  dos::BoundedMpmcQueue<int64_t>* mpmc_queue;
+  int64_t items_per_producer;
+  int64_t consumed_sum;
+};
+
+static void* BlockingProduce(void* arg) {
+  BenchContext* ctx = static_cast<BenchContext*>(arg);
+  for (int64_t index = 1; index <= ctx->items_per_producer; ++index) {
+    ctx->blocking_queue->Push(index);
+  }
+  return NULL;
+}
+
+static void* MpmcProduce(void* arg) {
+  BenchContext* ctx = static_cast<BenchContext*>(arg);
+  for (int64_t index = 1; index <= ctx->items_per_producer; ++index) {
+    ctx->mpmc_queue->Push(index);
+  }
+  return NULL;
+}
+
+// return the consumed us, the sum of items is checked by caller
+static int64_t Run(ConsumeMode mode, int32_t producers, int64_t* sum) {
+  BenchContext ctx;
+  ctx.blocking_queue = new dos::FixedBlockingQueue<int64_t>(kCapacity, "bench");
+  ctx.mpmc_queue = new dos::BoundedMpmcQueue<int64_t>(kCapacity, "bench");
+  ctx.items_per_producer = kTotalItems / producers;
+  int64_t total = ctx.items_per_producer * producers;
+  std::vector<pthread_t> threads(producers);
+  int64_t start = ::baidu::common::timer::get_micros();
+  for (int32_t index = 0; index < producers; ++index) {
+    pthread_create(&threads[index], NULL,
+                   mode == kBlockingPop ? BlockingProduce : MpmcProduce,
+                   &ctx);
+  }
+  *sum = 0;
+  int64_t consumed = 0;
+  std::vector<int64_t> batch;
+  while (consumed < total) {
+    if (mode == kBlockingPop) {
+      *sum += ctx.blocking_queue->Pop();
+      consumed++;
+    } else if (mode == kMpmcPop) {
+      *sum += ctx.mpmc_queue->Pop();
+      consumed++;
+    } else {
+      batch.clear();
+      ctx.mpmc_queue->PopBatch(&batch, kBatchSize);
+      for (size_t index = 0; index < batch.size(); ++index) {
+        *sum += batch[index];
+      }
+      consumed += batch.size();
+    }
+  }
+  int64_t used = ::baidu::common::timer::get_micros() - start;
+  for (int32_t index = 0; index < producers; ++index) {
+    pthread_join(threads[index], NULL);
+  }
+  delete ctx.blocking_queue;
+  delete ctx.mpmc_queue;
+  return used;
+}
+
+int main(int argc, char** argv) {
+  // the blocking queue logs on every empty pop and full push
+  ::baidu::common::SetLogLevel(::baidu::common::FATAL);
+  const int32_t producer_counts[] = {1, 4, 16};
+  const char* mode_names[] = {"blocking pop", "mpmc pop", "mpmc pop batch"};
+  fprintf(stdout, "%ld items, capacity %u, batch size %u\n",
+          kTotalItems, kCapacity, (uint32_t)kBatchSize);
+  for (size_t pindex = 0; pindex < sizeof(producer_counts) / sizeof(int32_t); ++pindex) {
+    int32_t producers = producer_counts[pindex];
+    int64_t per_producer = kTotalItems / producers;
+    int64_t expected = per_producer * (per_producer + 1) / 2 * producers;
+    for (int32_t mode = kBlockingPop; mode <= kMpmcPopBatch; ++mode) {
+      int64_t sum = 0;
+      int64_t used = Run(static_cast<ConsumeMode>(mode), producers, &sum);
+      fprintf(stdout, "producers %2d %-15s: %8ld us, %6.2f M items/s\n",
+              producers, mode_names[mode], used,
+              per_producer * producers * 1.0 / used);
+      if (sum != expected) {
+        fprintf(stderr, "lost items with %s, sum %ld expected %ld\n",
+                mode_names[mode], sum, expected);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include "engine/child_reaper.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <boost/bind.hpp>
+#include "logging.h"
+
+using ::baidu::common::INFO;
+using ::baidu::common::WARNING;
+using ::baidu::common::DEBUG;
+
+namespace dos {
+
+ChildReaper::ChildReaper(const ChildExitCallback& callback):callback_(callback),
+  signal_fd_(-1),
+  stop_fd_(-1),
+  epoll_fd_(-1),
+  thread_pool_(NULL),
+  running_(false){
+  thread_pool_ = new ::baidu::common::ThreadPool(1);
+}
+
+ChildReaper::~ChildReaper() {
+  Stop();
+  delete thread_pool_;
+  if (signal_fd_ >= 0) {
+    ::close(signal_fd_);
+  }
+  if (stop_fd_ >= 0) {
+    ::close(stop_fd_);
+  }
+  if (epoll_fd_ >= 0) {
+    ::close(epoll_fd_);
+  }
+}
+
+bool ChildReaper::BlockSignal() {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  int ret = pthread_sigmask(SIG_BLOCK, &mask, NULL);
+  if (ret != 0) {
+    LOG(WARNING, "fail to block SIGCHLD for %s", strerror(ret));
+    return false;
+  }
+  return true;
+}
+
+bool ChildReaper::Start() {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  signal_fd_ = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signal_fd_ < 0) {
+    LOG(WARNING, "fail to create signalfd for %s", strerror(errno));
+    return false;
+  }
+  stop_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (stop_fd_ < 0) {
+    LOG(WARNING, "fail to create eventfd for %s", strerror(errno));
+    return false;
+  }
+  epoll_fd_ = ::epoll_create(2);
+  if (epoll_fd_ < 0) {
+    LOG(WARNING, "fail to create epoll for %s", strerror(errno));
+    return false;
+  }
+  int fds[] = {signal_fd_, stop_fd_};
+  for (size_t index = 0; index < sizeof(fds) / sizeof(int); ++index) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fds[index];
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fds[index], &event) != 0) {
+      LOG(WARNING, "fail to add fd %d to epoll for %s", fds[index], strerror(errno));
+      return false;
+    }
+  }
+  running_ = true;
+  thread_pool_->AddTask(boost::bind(&ChildReaper::Loop, this));
+  LOG(INFO, "start child reaper successfully");
+  return true;
+}
+
+void ChildReaper::Stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  uint64_t value = 1;
+  if (::write(stop_fd_, &value, sizeof(value)) != sizeof(value)) {
+    LOG(WARNING, "fail to wake up child reaper for %s", strerror(errno));
+  }
+  thread_pool_->Stop(true);
+}
+
+void ChildReaper::Loop() {
+  // the children that exit before start are reaped here
+  Reap();
+  struct epoll_event events[2];
+  while (running_) {
+    int count = ::epoll_wait(epoll_fd_, events, 2, -1);
+    if (count < 0) {
+      if (errno != EINTR) {
+        LOG(WARNING, "fail to wait epoll for %s", strerror(errno));
+      }
+      continue;
+    }
+    for (int index = 0; index < count; ++index) {
+      if (events[index].data.fd != signal_fd_) {
+        continue;
+      }
+      // the signals of children that exit together are merged into one,
+      // drain signalfd and reap all of them
+      struct signalfd_siginfo info;
+      while (::read(signal_fd_, &info, sizeof(info)) == sizeof(info)) {
+      }
+      Reap();
+    }
+  }
+  LOG(INFO, "child reaper stops");
+}
+
+void ChildReaper::Reap() {
+  while (true) {
+    int status = 0;
+    // __WALL reaps the children cloned without SIGCHLD too
+    pid_t pid = ::waitpid(-1, &status, WNOHANG | __WALL);
+    if (pid <= 0) {
+      break;
+    }
+    int32_t exit_code = -1;
+    if (WIFEXITED(status)) {
+      exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+      exit_code = 128 + WTERMSIG(status);
+    } else {
+      continue;
+    }
+    LOG(INFO, "child %d exits with code %d", pid, exit_code);
+    callback_(pid, exit_code);
+  }
+}
+
+} // namespace dos
@@ -0,0 +1,42 @@
+#ifndef KERNEL_ENGINE_CHILD_REAPER_H
+#define KERNEL_ENGINE_CHILD_REAPER_H
+
+#include <stdint.h>
+#include <boost/function.hpp>
+#include "thread_pool.h"
+
+namespace dos {
+
+// the pid of child and the exit code, the exit code of the
+// child killed by signal is 128 + signal
+typedef boost::function<void (int32_t pid, int32_t exit_code)> ChildExitCallback;
+
+// reap all children of process with signalfd and epoll in one
+// dedicated thread, the exit of every child is passed to callback
+// in the reaping thread.
+// SIGCHLD must be blocked in all threads, so invoke BlockSignal before
+// any thread is created, and the children must unblock it before exec
+class ChildReaper {
+
+public:
+  ChildReaper(const ChildExitCallback& callback);
+  ~ChildReaper();
+  static bool BlockSignal();
+  bool Start();
+  void Stop();
+private:
+  void Loop();
+  // reap the children that have exited without blocking
+  void Reap();
+private:
+  ChildExitCallback callback_;
+  int signal_fd_;
+  // wake up the epoll when stopping
+  int stop_fd_;
+  int epoll_fd_;
+  ::baidu::common::ThreadPool* thread_pool_;
+  volatile bool running_;
+};
+
+} // namespace dos
+#endif
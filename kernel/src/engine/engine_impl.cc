@@ -20,6 +20,9 @@ DECLARE_string(ce_bin_path);
 DECLARE_string(ce_image_fetcher_name);
 DECLARE_string(ce_process_default_user);
 DECLARE_int32(ce_image_fetch_status_check_interval);
+DECLARE_int32(ce_image_pull_threads);
+DECLARE_string(ce_image_store_dir);
+DECLARE_int32(ce_image_store_budget);
 DECLARE_int32(ce_initd_boot_check_max_times);
 DECLARE_int32(ce_initd_boot_check_interval);
 DECLARE_int32(ce_process_status_check_interval);
@@ -27,6 +30,7 @@ DECLARE_int32(ce_container_log_max_size);
 DECLARE_int32(ce_resource_collect_interval);
 DECLARE_string(ce_cgroup_root);
 DECLARE_string(ce_isolators);
+DECLARE_string(ce_port);
 
 namespace dos {
 
@@ -52,7 +56,13 @@ EngineImpl::EngineImpl(const std::string& work_dir,
   rpc_client_(NULL),
   ports_(NULL),
   user_mgr_(NULL),
-  collector_(NULL){
+  collector_(NULL),
+  reaper_(NULL),
+  image_store_(NULL),
+  puller_pool_(NULL),
+  pulls_(),
+  layer_mgr_(NULL),
+  peer_pulled_bytes_(0){
   containers_ = new Containers();
   thread_pool_ = new ::baidu::common::ThreadPool(20);
   fsm_ = new FSM();
@@ -69,16 +79,34 @@ EngineImpl::EngineImpl(const std::string& work_dir,
   }
   user_mgr_ = new UserMgr();
   collector_ = new CgroupResourceCollector();
+  reaper_ = new ChildReaper(boost::bind(&EngineImpl::HandleChildExit, this, _1, _2));
+  image_store_ = new ImageStore(FLAGS_ce_image_store_dir,
+                                static_cast<int64_t>(FLAGS_ce_image_store_budget) * 1024);
+  puller_pool_ = new ::baidu::common::ThreadPool(FLAGS_ce_image_pull_threads);
+  layer_mgr_ = new LayerMgr(boost::bind(&EngineImpl::LookupLayer, this, _1, _2),
+                            boost::bind(&EngineImpl::ListLayers, this, _1));
 }
 
 EngineImpl::~EngineImpl() {}
 
-void EngineImpl::WaitInitd() {
-  int status = 0;
-  LOG(INFO, "start to wait children Process");
-  pid_t pid = ::wait(&status);
-  LOG(INFO, "pid %d status changes", pid);
-  thread_pool_->AddTask(boost::bind(&EngineImpl::WaitInitd, this));
+void EngineImpl::HandleChildExit(int32_t pid, int32_t exit_code) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  Containers::iterator it = containers_->begin();
+  for (; it != containers_->end(); ++it) {
+    ContainerInfo* info = it->second;
+    if (info->pid != pid) {
+      continue;
+    }
+    LOG(WARNING, "initd %d of container %s exits with code %d in state %s",
+        pid, info->status.name().c_str(), exit_code,
+        ContainerState_Name(info->status.state()).c_str());
+    info->pid = -1;
+    info->initd_exited = true;
+    info->initd_exit_code = exit_code;
+    WakeUpFSM(info);
+    return;
+  }
+  LOG(INFO, "child %d does not belong to any container", pid);
 }
 
 bool EngineImpl::BuildIsolator(ContainerInfo* info) {
@@ -123,6 +151,20 @@ bool EngineImpl::BuildIsolator(ContainerInfo* info) {
 
 bool EngineImpl::Init() {
   std::string name = FLAGS_ce_image_fetcher_name;
+  if (!reaper_->Start()) {
+    LOG(WARNING, "fail to start child reaper");
+    return false;
+  }
+  std::vector<std::string> garbage;
+  if (!image_store_->Init(&garbage)) {
+    LOG(WARNING, "fail to init image store");
+    return false;
+  }
+  thread_pool_->AddTask(boost::bind(&EngineImpl::RemoveImageDirs, this, garbage));
+  if (!layer_mgr_->Start()) {
+    LOG(WARNING, "fail to start layer manager");
+    return false;
+  }
   {
     ::baidu::common::MutexLock lock(&mutex_);
     LOG(INFO, "start system container %s", name.c_str());
@@ -153,7 +195,6 @@ bool EngineImpl::Init() {
         LOG(INFO, "start system container %s successfully", name.c_str());
         collector_->SetInterval(FLAGS_ce_resource_collect_interval);
         collector_->Start();
-        thread_pool_->AddTask(boost::bind(&EngineImpl::WaitInitd, this));
         return true;
       }
       LOG(WARNING, "wait to system container %s to be running current state is %s ",
@@ -225,7 +266,16 @@ void EngineImpl::ShowContainer(RpcController* controller,
     int64_t cpu_idle = it->second->status.spec().requirement().cpu().limit() - it->second->status.resource().cpu().sys_used() - \
                        it->second->status.resource().cpu().user_used();
     container->set_cpu_idle(cpu_idle);
+    container->set_image_cache_hit(it->second->image_cache_hit);
+    std::map<std::string, PullProgress*>::iterator pull_it = pulls_.find(it->second->image_key);
+    if (pull_it != pulls_.end()) {
+      container->set_image_pulled_bytes(pull_it->second->received);
+      container->set_image_total_bytes(pull_it->second->total);
+    }
   }
+  image_store_->GetStat(response->mutable_image_cache());
+  response->mutable_image_cache()->set_peer_pulled(peer_pulled_bytes_);
+  response->mutable_image_cache()->set_peer_served(layer_mgr_->GetServedBytes());
   response->set_status(kRpcOk);
   done->Run();
 }
@@ -328,14 +378,14 @@ void EngineImpl::HandlePullImage(const ContainerState& pre_state,
         AppendLog(kContainerPulling, kContainerBooting, "pull image ok", info);
         break;
       } else if (info->status.spec().type() == kOci) {
-        // fetch oci rootfs by wget
+        // pull oci rootfs to image store
         LOG(INFO, "start to pull image for container %s from uri %s", 
             name.c_str(), info->status.spec().uri().c_str());
         it = containers_->find(FLAGS_ce_image_fetcher_name);
         ContainerInfo* fetcher = it->second;
         if (fetcher->status.state() != kContainerRunning) {
           LOG(WARNING, "fetcher is in invalidate state %s", 
-              ContainerState(fetcher->status.state()));
+              ContainerState_Name(fetcher->status.state()).c_str());
           AppendLog(kContainerPulling, kContainerError,
               "fetcher is no avilable", info);
           target_state = kContainerError;
@@ -345,51 +395,35 @@ void EngineImpl::HandlePullImage(const ContainerState& pre_state,
         if (fetcher->initd_stub == NULL) {
           rpc_client_->GetStub(fetcher->initd_endpoint, &fetcher->initd_stub);
         }
-        info->fetcher_name = "fetcher_for_" + name;
-        //TODO optimalize fetch cmd builder 
-        // add limit and retry
-        std::string cmd = "cd " + info->work_dir;
-        cmd += " && wget -O rootfs.tar.gz " + info->status.spec().uri();
-        cmd += " && tar -zxvf rootfs.tar.gz && cp " + FLAGS_ce_bin_path + " ./rootfs/bin/dsh";
-        ForkRequest request;
-        ForkResponse response;
-        Process fetch_process;
-        request.mutable_process()->add_args("bash");
-        request.mutable_process()->add_args("-c");
-        request.mutable_process()->add_args(cmd);
-        request.mutable_process()->set_name(info->fetcher_name);
-        request.mutable_process()->set_terminal(false);
-        request.mutable_process()->set_interceptor("/bin/bash");
-        // user root for fetcher
-        request.mutable_process()->mutable_user()->set_name("root");
-        bool process_user_ok = HandleProcessUser(request.mutable_process());
-        if (!process_user_ok) {
-          LOG(WARNING, "fail to process user %s", request.process().user().name().c_str());
-          target_state = kContainerError;
-          exec_task_interval = 0;
-          AppendLog(kContainerPulling, kContainerError, "fail to process user ",
-              info);
-          break;
-        }
-        bool rpc_ok = rpc_client_->SendRequest(fetcher->initd_stub, 
-                                               &Initd_Stub::Fork,
-                                               &request, &response, 5, 1);
-        if (!rpc_ok || response.status() != kRpcOk) {
-          LOG(WARNING, "fail to send fetch cmd %s for container %s",
-              cmd.c_str(), name.c_str());
-          target_state = kContainerError;
+        info->image_key = ImageStore::GetKey(info->status.spec().uri(),
+                                             info->status.spec().digest());
+        ImageState image_state = image_store_->Acquire(info->image_key,
+                                                       info->status.spec().uri(),
+                                                       name);
+        info->image_cache_hit = image_state != kImageMissing;
+        if (image_state != kImageMissing) {
+          // the image has been fetched or is being fetched by other container
+          target_state = kContainerPulling;
           exec_task_interval = 0;
-          AppendLog(kContainerPulling, kContainerError, "fail to send fetch cmd to initd",
-              info);
+          if (image_state == kImageFetching) {
+            exec_task_interval = FLAGS_ce_image_fetch_status_check_interval;
+          }
+          AppendLog(kContainerPulling, kContainerPulling, "hit image in image store", info);
           break;
-        } else {
-          LOG(INFO, "send fetch cmd %s for container %s successfully",
-              cmd.c_str(), name.c_str());
-          target_state = kContainerPulling;
-          exec_task_interval = FLAGS_ce_image_fetch_status_check_interval;
-          AppendLog(kContainerPulling, kContainerPulling, "send fetch cmd to inid successfully",
-              info);
         }
+        // the image is pulled in engine, the fetcher only copies it to work dir
+        PullProgress* progress = new PullProgress();
+        pulls_[info->image_key] = progress;
+        puller_pool_->AddTask(boost::bind(&EngineImpl::PullImage, this,
+                                          info->image_key,
+                                          info->status.spec().uri(),
+                                          info->status.spec().digest(),
+                                          progress));
+        LOG(INFO, "start to pull image %s for container %s",
+            info->image_key.c_str(), name.c_str());
+        target_state = kContainerPulling;
+        exec_task_interval = FLAGS_ce_image_fetch_status_check_interval;
+        AppendLog(kContainerPulling, kContainerPulling, "start to pull image", info);
       }
     } while(0);
   } else if (pre_state == kContainerPulling) {
@@ -400,7 +434,7 @@ void EngineImpl::HandlePullImage(const ContainerState& pre_state,
         ContainerInfo* fetcher = it->second;
         if (fetcher->status.state() != kContainerRunning) {
           LOG(WARNING, "fetcher is in invalidate state %s", 
-              ContainerState(fetcher->status.state()));
+              ContainerState_Name(fetcher->status.state()).c_str());
           target_state = kContainerError;
           exec_task_interval = 0;
           AppendLog(kContainerPulling, kContainerError, "fetcher is in validate state",
@@ -410,41 +444,47 @@ void EngineImpl::HandlePullImage(const ContainerState& pre_state,
         if (fetcher->initd_stub == NULL) {
           rpc_client_->GetStub(fetcher->initd_endpoint, &fetcher->initd_stub);
         }
-        WaitRequest request;
-        request.add_names(info->fetcher_name);
-        WaitResponse response;
-        bool rpc_ok = rpc_client_->SendRequest(fetcher->initd_stub, 
-                                               &Initd_Stub::Wait,
-                                               &request, &response, 5, 1);
-        if (!rpc_ok || response.status() != kRpcOk) {
+        // wait image to be ready and copy it to work dir
+        if (info->fetcher_name.empty()) {
+          bool check_ok = CheckImage(name, info, fetcher);
+          if (!check_ok) {
+            target_state = kContainerError;
+            exec_task_interval = 0;
+            AppendLog(kContainerPulling, kContainerError, "fail to fetch image", info);
+            break;
+          }
+          target_state = kContainerPulling;
+          exec_task_interval = FLAGS_ce_image_fetch_status_check_interval;
+          break;
+        }
+        Process status;
+        bool exist = false;
+        bool wait_ok = WaitInFetcher(info->fetcher_name, fetcher, &status, &exist);
+        if (!wait_ok || !exist) {
           LOG(WARNING, "fail to wait fetch status for container %s", name.c_str());
           target_state = kContainerError;
           exec_task_interval = 0;
           AppendLog(kContainerPulling, kContainerError, "fail to wait fetch status", info);
           break;
+        } else if (status.running()) {
+          target_state = kContainerPulling;
+          LOG(DEBUG, "container %s is under copying rootfs", name.c_str());
+          exec_task_interval = FLAGS_ce_image_fetch_status_check_interval;
+        } else if (status.exit_code() == 0) {
+          LOG(INFO, "fetch container %s rootfs successfully", name.c_str());
+          target_state = kContainerBooting;
+          AppendLog(kContainerPulling, kContainerBooting, "pull image ok", info);
+          exec_task_interval = 0;
+          // clean fetcher process 
+          CleanProcessInInitd(info->fetcher_name, fetcher);
         } else {
-          const Process& status = response.processes(0);
-          if (status.running()) {
-            target_state = kContainerPulling;
-            LOG(DEBUG, "container %s is under fetching rootfs", name.c_str());
-            exec_task_interval = FLAGS_ce_image_fetch_status_check_interval;
-          }else if (status.exit_code() == 0) {
-            LOG(INFO, "fetch container %s rootfs successfully", name.c_str());
-            target_state = kContainerBooting;
-            AppendLog(kContainerPulling, kContainerBooting, "pull image ok", info);
-            exec_task_interval = 0;
-            // clean fetcher process 
-            CleanProcessInInitd(info->fetcher_name, fetcher);
-          } else {
-            LOG(WARNING, "fail to fetch container %s rootfs", name.c_str());
-            target_state = kContainerError;
-            exec_task_interval = 0;
-            AppendLog(kContainerPulling, kContainerError, "fail to fetch container rootfs", info);
-            // clean fetcher process
-            CleanProcessInInitd(info->fetcher_name, fetcher);
-          }
+          LOG(WARNING, "fail to copy container %s rootfs", name.c_str());
+          target_state = kContainerError;
+          exec_task_interval = 0;
+          AppendLog(kContainerPulling, kContainerError, "fail to copy container rootfs", info);
+          // clean fetcher process
+          CleanProcessInInitd(info->fetcher_name, fetcher);
         }
-
       }
     } while(0); 
   }
@@ -455,19 +495,85 @@ void EngineImpl::ProcessHandleResult(const ContainerState& target_state,
                                      const ContainerState& current_state,
                                      const std::string& name,
                                      int32_t exec_task_interval) {
+  mutex_.AssertHeld();
   FSM::iterator fsm_it = fsm_->find(target_state);
   if (fsm_it == fsm_->end()) {
     LOG(WARNING, "container %s has no fsm config with state %s",
           name.c_str(), ContainerState_Name(target_state).c_str());
     return;
   }
-
+  Containers::iterator it = containers_->find(name);
+  ContainerInfo* info = NULL;
+  if (it != containers_->end()) {
+    info = it->second;
+    info->fsm_task_id = -1;
+  }
   if (exec_task_interval <= 0) {
     thread_pool_->AddTask(boost::bind(fsm_it->second, current_state, name));
   } else {
-    thread_pool_->DelayTask(exec_task_interval, 
+    int64_t task_id = thread_pool_->DelayTask(exec_task_interval, 
         boost::bind(fsm_it->second, current_state, name));
+    if (info != NULL) {
+      info->fsm_task_id = task_id;
+      info->fsm_target_state = target_state;
+      info->fsm_current_state = current_state;
+    }
+  }
+}
+
+void EngineImpl::WakeUpFSM(ContainerInfo* info) {
+  mutex_.AssertHeld();
+  if (info->fsm_task_id < 0) {
+    return;
   }
+  // the check that has started will see the change by itself
+  bool cancel_ok = thread_pool_->CancelTask(info->fsm_task_id, true);
+  info->fsm_task_id = -1;
+  if (!cancel_ok) {
+    return;
+  }
+  LOG(DEBUG, "wake up fsm of container %s in state %s",
+      info->status.name().c_str(),
+      ContainerState_Name(info->status.state()).c_str());
+  FSM::iterator fsm_it = fsm_->find(info->fsm_target_state);
+  thread_pool_->AddTask(boost::bind(fsm_it->second,
+                                    info->fsm_current_state,
+                                    info->status.name()));
+}
+
+void EngineImpl::Notify(RpcController* controller,
+                        const NotifyRequest* request,
+                        NotifyResponse* response,
+                        Closure* done) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  LOG(DEBUG, "receive event %s of process %s from initd of container %s",
+      InitdEvent_Name(request->event()).c_str(),
+      request->process().c_str(),
+      request->container().c_str());
+  Containers::iterator it = containers_->begin();
+  for (; it != containers_->end(); ++it) {
+    ContainerInfo* info = it->second;
+    if (request->event() == kInitdReady) {
+      if (info->status.name() == request->container()
+          && info->status.state() == kContainerBooting) {
+        WakeUpFSM(info);
+      }
+      continue;
+    }
+    // the copy process runs in the initd of image fetcher
+    if (request->container() == FLAGS_ce_image_fetcher_name
+        && info->status.state() == kContainerPulling
+        && info->fetcher_name == request->process()) {
+      WakeUpFSM(info);
+    } else if (info->status.name() == request->container()
+        && info->status.state() == kContainerRunning
+        && (request->process() == request->container()
+          || info->batch_process.find(request->process()) != info->batch_process.end())) {
+      WakeUpFSM(info);
+    }
+  }
+  response->set_status(kRpcOk);
+  done->Run();
 }
 
 void EngineImpl::HandleBootInitd(const ContainerState& pre_state,
@@ -484,6 +590,9 @@ void EngineImpl::HandleBootInitd(const ContainerState& pre_state,
   if (ProcessInterruption(name, pre_state, info)) {
     return;
   } 
+  if (ProcessInitdExit(name, info)) {
+    return;
+  }
   info->status.set_state(kContainerBooting);
   do {
     // boot initd
@@ -519,9 +628,10 @@ void EngineImpl::HandleBootInitd(const ContainerState& pre_state,
         break;
       }
       //TODO read from runtime.json 
-      int flag = CLONE_FLAGS;
+      // SIGCHLD notifies the child reaper when initd exits
+      int flag = CLONE_FLAGS | SIGCHLD;
       if (info->status.spec().type() == kSystem) {
-        flag = CLONE_NEWUTS;
+        flag = CLONE_NEWUTS | SIGCHLD;
       }
       int32_t pid = info->initd_proc.Clone(initd, flag);
       if (pid == -1) {
@@ -618,6 +728,185 @@ void EngineImpl::HandleCompleteContainer(const ContainerState& pre_state,
   LOG(WARNING, "container %s go to %s state", name.c_str(), ContainerState_Name(info->status.state()).c_str());
 }
 
+bool EngineImpl::ForkInFetcher(const std::string& name,
+                               const std::string& cmd,
+                               ContainerInfo* fetcher) {
+  mutex_.AssertHeld();
+  ForkRequest request;
+  ForkResponse response;
+  request.mutable_process()->add_args("bash");
+  request.mutable_process()->add_args("-c");
+  request.mutable_process()->add_args(cmd);
+  request.mutable_process()->set_name(name);
+  request.mutable_process()->set_terminal(false);
+  request.mutable_process()->set_interceptor("/bin/bash");
+  // user root for fetcher
+  request.mutable_process()->mutable_user()->set_name("root");
+  bool process_user_ok = HandleProcessUser(request.mutable_process());
+  if (!process_user_ok) {
+    LOG(WARNING, "fail to process user %s", request.process().user().name().c_str());
+    return false;
+  }
+  bool rpc_ok = rpc_client_->SendRequest(fetcher->initd_stub, 
+                                         &Initd_Stub::Fork,
+                                         &request, &response, 5, 1);
+  if (!rpc_ok || response.status() != kRpcOk) {
+    LOG(WARNING, "fail to fork process %s in image fetcher", name.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool EngineImpl::WaitInFetcher(const std::string& name,
+                               ContainerInfo* fetcher,
+                               Process* process,
+                               bool* exist) {
+  mutex_.AssertHeld();
+  WaitRequest request;
+  request.add_names(name);
+  WaitResponse response;
+  bool rpc_ok = rpc_client_->SendRequest(fetcher->initd_stub, 
+                                         &Initd_Stub::Wait,
+                                         &request, &response, 5, 1);
+  if (!rpc_ok || response.status() != kRpcOk) {
+    LOG(WARNING, "fail to wait process %s in image fetcher", name.c_str());
+    return false;
+  }
+  *exist = response.processes_size() > 0;
+  if (*exist) {
+    process->CopyFrom(response.processes(0));
+  }
+  return true;
+}
+
+bool EngineImpl::CheckImage(const std::string& name,
+                            ContainerInfo* info,
+                            ContainerInfo* fetcher) {
+  mutex_.AssertHeld();
+  ImageState image_state = image_store_->GetState(info->image_key);
+  if (image_state == kImageFetching) {
+    std::map<std::string, PullProgress*>::iterator it = pulls_.find(info->image_key);
+    if (it != pulls_.end()) {
+      LOG(DEBUG, "container %s is waiting for image %s with %ld/%ld bytes received",
+          name.c_str(), info->image_key.c_str(), it->second->received,
+          it->second->total);
+    }
+    return true;
+  }
+  if (image_state != kImageReady) {
+    LOG(WARNING, "fail to fetch image %s for container %s",
+        info->image_key.c_str(), name.c_str());
+    return false;
+  }
+  info->fetcher_name = "fetcher_for_" + name;
+  std::string cmd = "cp -a " + image_store_->GetImageDir(info->image_key)
+                    + "/. " + info->work_dir;
+  bool fork_ok = ForkInFetcher(info->fetcher_name, cmd, fetcher);
+  if (!fork_ok) {
+    return false;
+  }
+  AppendLog(kContainerPulling, kContainerPulling, "copy image to work dir", info);
+  return true;
+}
+
+void EngineImpl::PullImage(const std::string& key,
+                           const std::string& uri,
+                           const std::string& digest,
+                           PullProgress* progress) {
+  std::string fetch_dir;
+  std::string image_dir;
+  std::string blob_path;
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    fetch_dir = image_store_->GetFetchDir(key);
+    image_dir = image_store_->GetImageDir(key);
+    blob_path = image_store_->GetBlobPath(key);
+  }
+  int64_t start = ::baidu::common::timer::get_micros();
+  // the dir left by a failed pulling is removed first
+  bool ok = RemoveRecur(fetch_dir) && MkdirRecur(fetch_dir);
+  ImagePuller puller(uri, fetch_dir, digest);
+  // the image without digest is always pulled from its uri
+  if (!digest.empty()) {
+    std::vector<std::string> peers;
+    layer_mgr_->GetPeers(key, &peers);
+    puller.SetPeers(peers);
+  }
+  if (layer_mgr_->IsServing()) {
+    puller.SetBlobPath(blob_path);
+  }
+  if (ok && !puller.Pull(progress)) {
+    LOG(WARNING, "fail to pull image %s from %s for %s", key.c_str(),
+        uri.c_str(), puller.GetError().c_str());
+    ok = false;
+  }
+  ok = ok && CopyFile(FLAGS_ce_bin_path, fetch_dir + "/rootfs/bin/dsh");
+  if (ok) {
+    std::ofstream size_file((fetch_dir + "/" + ImageStore::GetSizeFile()).c_str());
+    int64_t blob_size = puller.HasBlob() ? progress->received : 0;
+    size_file << (puller.GetExtractedBytes() + blob_size) / 1024 + 1;
+    size_file.close();
+    ok = size_file.good() && ::rename(fetch_dir.c_str(), image_dir.c_str()) == 0;
+  }
+  LOG(INFO, "pull image %s from %s %s with %ld bytes in %ld ms", key.c_str(),
+      uri.c_str(), ok ? "successfully" : "fails", progress->received,
+      (::baidu::common::timer::get_micros() - start) / 1000);
+  std::vector<std::string> garbage;
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    peer_pulled_bytes_ += puller.GetPeerBytes();
+    image_store_->FetchDone(key, ok, &garbage);
+    pulls_.erase(key);
+    delete progress;
+    Containers::iterator it = containers_->begin();
+    for (; it != containers_->end(); ++it) {
+      ContainerInfo* info = it->second;
+      if (info->image_key == key
+          && info->fetcher_name.empty()
+          && info->status.state() == kContainerPulling) {
+        WakeUpFSM(info);
+      }
+    }
+  }
+  RemoveImageDirs(garbage);
+}
+
+bool EngineImpl::LookupLayer(const std::string& key, std::string* path) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  if (image_store_->GetState(key) != kImageReady) {
+    return false;
+  }
+  *path = image_store_->GetBlobPath(key);
+  return true;
+}
+
+void EngineImpl::ListLayers(std::vector<std::string>* keys) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  image_store_->GetBlobKeys(keys);
+}
+
+void EngineImpl::ReleaseImage(const std::string& name, ContainerInfo* info) {
+  mutex_.AssertHeld();
+  if (info->image_key.empty()) {
+    return;
+  }
+  std::vector<std::string> garbage;
+  image_store_->Release(info->image_key, name, &garbage);
+  thread_pool_->AddTask(boost::bind(&EngineImpl::RemoveImageDirs, this, garbage));
+  info->image_key = "";
+}
+
+void EngineImpl::RemoveImageDirs(const std::vector<std::string>& dirs) {
+  for (size_t index = 0; index < dirs.size(); ++index) {
+    if (dirs[index].empty()) {
+      continue;
+    }
+    bool ok = RemoveRecur(dirs[index]);
+    LOG(INFO, "remove image dir %s %s", dirs[index].c_str(),
+        ok ? "successfully" : "fails");
+  }
+}
+
 void EngineImpl::CleanProcessInInitd(const std::string& name, ContainerInfo* info) {
   mutex_.AssertHeld();
   KillRequest request;
@@ -685,6 +974,9 @@ void EngineImpl::HandleRunContainer(const ContainerState& pre_state,
   if (ProcessInterruption(name, pre_state, info)) {
     return;
   }
+  if (ProcessInitdExit(name, info)) {
+    return;
+  }
   ContainerState target_state = kContainerRunning;
   ContainerState current_state = kContainerRunning;
   int32_t exec_task_interval = 0;
@@ -726,7 +1018,8 @@ void EngineImpl::HandleRunContainer(const ContainerState& pre_state,
         break;
       } else {
         info->status.set_start_time(::baidu::common::timer::get_micros());
-        LOG(INFO, "fork process for container %s successfully", name.c_str());
+        LOG(INFO, "fork process for container %s successfully, it takes %ld ms from pending to running",
+            name.c_str(), (info->status.start_time() - info->start_pull_time) / 1000);
         info->status.set_state(kContainerRunning);
         AppendLog(kContainerRunning, kContainerRunning, "start user process ok", info);
         exec_task_interval = FLAGS_ce_process_status_check_interval;
@@ -897,6 +1190,7 @@ void EngineImpl::HandleDeleteContainer(const ContainerState& pre_state,
   ContainerInfo* info = it->second;
   info->status.set_start_time(0);
   LOG(INFO, "start to delete container %s", info->status.name().c_str());
+  ReleaseImage(name, info);
   bool freeze_ok = info->freezer->Freeze();
   if (!freeze_ok) {
     LOG(INFO, "fail to freeze container %s", info->status.name().c_str());
@@ -948,6 +1242,7 @@ void EngineImpl::DeleteContainer(RpcController* controller,
             it->second);
   // mark fsm is interrupted
   it->second->interrupted = true;
+  WakeUpFSM(it->second);
   collector_->RemoveTask(request->name());
   response->set_status(kRpcOk);
   done->Run();
@@ -968,6 +1263,21 @@ bool EngineImpl::ProcessInterruption(const std::string& name,
   return true;
 }
 
+bool EngineImpl::ProcessInitdExit(const std::string& name,
+                                  ContainerInfo* info) {
+  mutex_.AssertHeld();
+  if (!info->initd_exited) {
+    return false;
+  }
+  ContainerState current_state = info->status.state();
+  LOG(WARNING, "container %s goes to error as initd exits with code %d",
+      name.c_str(), info->initd_exit_code);
+  info->status.set_state(kContainerError);
+  AppendLog(current_state, kContainerError, "initd exits", info);
+  ProcessHandleResult(kContainerError, current_state, name, 0);
+  return true;
+}
+
 std::string EngineImpl::CurrentDatetimeStr() {
   int64_t now = ::baidu::common::timer::get_micros();
   char buffer[100];
@@ -1004,6 +1314,7 @@ bool EngineImpl::BuildInitdFlags(const std::string& work_dir,
   flags << "--ce_container_name=" << info->status.name() << "\n";
   flags << "--ce_cgroup_root=" << FLAGS_ce_cgroup_root << "\n";
   flags << "--ce_isolators=" << FLAGS_ce_isolators << "\n";
+  flags << "--ce_initd_engine_endpoint=127.0.0.1:" << FLAGS_ce_port << "\n";
   flags << "--ce_initd_port=" << port;
   flags.close();
   return true;
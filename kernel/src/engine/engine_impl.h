@@ -14,6 +14,10 @@
 #include "proto/initd.pb.h"
 #include "engine/isolator.h"
 #include "engine/collector.h"
+#include "engine/child_reaper.h"
+#include "engine/image_store.h"
+#include "engine/image_puller.h"
+#include "engine/layer_mgr.h"
 
 using ::google::protobuf::RpcController;
 using ::google::protobuf::Closure;
@@ -34,7 +38,11 @@ struct ContainerInfo {
   ProcessMgr initd_proc; 
   Initd_Stub* initd_stub;
   int32_t initd_status_check_times;
+  // the process that copies image to work_dir in image fetcher
   std::string fetcher_name;
+  // the key of image in image store, empty when holding no image
+  std::string image_key;
+  bool image_cache_hit;
   std::deque<ContainerLog> logs;
   int64_t start_pull_time;
   // some batch or temp process
@@ -42,25 +50,40 @@ struct ContainerInfo {
   int32_t pid;
   uint32_t retry_connect_to_initd;
   bool interrupted;
+  // set by the child reaper when initd exits
+  bool initd_exited;
+  int32_t initd_exit_code;
   // when cpu_isolator is NULL, it means that it's disable
   CpuIsolator* cpu_isolator;
   // freezer
   ContainerFreezer* freezer;
   MemoryIsolator* mem_isolator;
+  // the delayed status check of fsm, the events from initd cancel it
+  // and run the check at once, -1 means no check is delayed
+  int64_t fsm_task_id;
+  ContainerState fsm_target_state;
+  ContainerState fsm_current_state;
   ContainerInfo():status(),
   work_dir(), gc_dir(), initd_endpoint(),
   initd_proc(),
   initd_stub(NULL),
   initd_status_check_times(0),
   fetcher_name(),
+  image_key(),
+  image_cache_hit(false),
   logs(),
   start_pull_time(0),
   pid(-1),
   retry_connect_to_initd(5),
   interrupted(false),
+  initd_exited(false),
+  initd_exit_code(-1),
   cpu_isolator(NULL),
   freezer(NULL),
-  mem_isolator(NULL){}
+  mem_isolator(NULL),
+  fsm_task_id(-1),
+  fsm_target_state(kContainerPending),
+  fsm_current_state(kContainerPending){}
   ~ContainerInfo() {
     delete initd_stub; 
     delete cpu_isolator;
@@ -99,6 +122,11 @@ public:
                        const DeleteContainerRequest* request,
                        DeleteContainerResponse* response,
                        Closure* done);
+  // the events from initd of containers
+  void Notify(RpcController* controller,
+              const NotifyRequest* request,
+              NotifyResponse* response,
+              Closure* done);
 private:
   // fill the  isolator property, and init the 
   // isolator
@@ -130,6 +158,9 @@ private:
                            const std::string& name,
                            int32_t exec_task_interval);
 
+  // run the delayed status check of container at once
+  void WakeUpFSM(ContainerInfo* info);
+
   // record container state log
   void AppendLog(const ContainerState& cfrom, 
                  const ContainerState& cto,
@@ -154,6 +185,10 @@ private:
   bool ProcessInterruption(const std::string& name,
                            const ContainerState& pre_state,
                            ContainerInfo* info);
+  // move container to kContainerError if its initd has exited
+  // return true if initd has exited
+  bool ProcessInitdExit(const std::string& name,
+                        ContainerInfo* info);
   std::string CurrentDatetimeStr();
 
   bool DoStartProcess(const std::string& name, ContainerInfo* info);
@@ -163,7 +198,36 @@ private:
                        ContainerInfo* info);
   bool FillResourceStat(ContainerInfo* info);
 
-  void WaitInitd();
+  // run cmd as process with name in image fetcher
+  bool ForkInFetcher(const std::string& name,
+                     const std::string& cmd,
+                     ContainerInfo* fetcher);
+  // get the status of process in image fetcher, exist is false
+  // when image fetcher has no such process
+  bool WaitInFetcher(const std::string& name,
+                     ContainerInfo* fetcher,
+                     Process* process,
+                     bool* exist);
+  // check the image of container, start copying it to work_dir
+  // when it's ready, return false when image is failed
+  bool CheckImage(const std::string& name,
+                  ContainerInfo* info,
+                  ContainerInfo* fetcher);
+  // pull the image into image store in puller pool, the containers
+  // waiting for it are woken up when it's done
+  void PullImage(const std::string& key,
+                 const std::string& uri,
+                 const std::string& digest,
+                 PullProgress* progress);
+  void ReleaseImage(const std::string& name, ContainerInfo* info);
+  // remove the dirs of evicted images out of lock
+  void RemoveImageDirs(const std::vector<std::string>& dirs);
+  // the blobs of ready images are served to peers
+  bool LookupLayer(const std::string& key, std::string* path);
+  void ListLayers(std::vector<std::string>* keys);
+
+  // route the exit of child to the container it belongs to
+  void HandleChildExit(int32_t pid, int32_t exit_code);
 private:
   ::baidu::common::Mutex mutex_;
   typedef std::map<std::string, ContainerInfo*> Containers;
@@ -176,6 +240,13 @@ private:
   std::queue<int32_t>* ports_;
   UserMgr* user_mgr_;
   CgroupResourceCollector* collector_;
+  ChildReaper* reaper_;
+  ImageStore* image_store_;
+  ::baidu::common::ThreadPool* puller_pool_;
+  // the progress of images being pulled by key
+  std::map<std::string, PullProgress*> pulls_;
+  LayerMgr* layer_mgr_;
+  int64_t peer_pulled_bytes_;
 };
 
 } // namespace dos
@@ -0,0 +1,1304 @@
+#include "engine/image_puller.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include <algorithm>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include "engine/layer_fetcher.h"
+#include "logging.h"
+#include "thread_pool.h"
+
+using ::baidu::common::INFO;
+using ::baidu::common::WARNING;
+using ::baidu::common::DEBUG;
+
+namespace dos {
+
+// the size of chunk passed from reading thread to extracting thread
+const static int64_t kChunkSize = 64 * 1024;
+// the count of chunks in queue, with kChunkSize it bounds the memory
+// of a pulling to 1MB
+const static uint32_t kQueueChunks = 16;
+const static int32_t kMaxRedirects = 5;
+const static int32_t kIoTimeout = 30;
+const static size_t kMaxHeaderLine = 8192;
+const static size_t kMaxMetaSize = 1024 * 1024;
+// the fd of shell that wget exit code is written to
+const static int kWgetStatusFd = 3;
+
+// sha256 of fips 180-4
+class Sha256 {
+
+public:
+  Sha256():length_(0), buffer_size_(0) {
+    static const uint32_t init[8] = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(state_, init, sizeof(state_));
+  }
+
+  void Update(const char* data, size_t size) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    length_ += size;
+    while (size > 0) {
+      size_t n = std::min(size, sizeof(buffer_) - buffer_size_);
+      memcpy(buffer_ + buffer_size_, p, n);
+      buffer_size_ += n;
+      p += n;
+      size -= n;
+      if (buffer_size_ == sizeof(buffer_)) {
+        Transform(buffer_);
+        buffer_size_ = 0;
+      }
+    }
+  }
+
+  std::string HexDigest() {
+    uint64_t bits = length_ * 8;
+    unsigned char pad = 0x80;
+    Update(reinterpret_cast<const char*>(&pad), 1);
+    unsigned char zero = 0;
+    while (buffer_size_ != 56) {
+      Update(reinterpret_cast<const char*>(&zero), 1);
+    }
+    unsigned char size[8];
+    for (int32_t index = 0; index < 8; ++index) {
+      size[index] = static_cast<unsigned char>(bits >> (56 - index * 8));
+    }
+    Update(reinterpret_cast<const char*>(size), 8);
+    char hex[65];
+    for (int32_t index = 0; index < 8; ++index) {
+      snprintf(hex + index * 8, 9, "%08x", state_[index]);
+    }
+    return std::string(hex, 64);
+  }
+
+private:
+  static uint32_t Rotr(uint32_t x, uint32_t n) {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  void Transform(const unsigned char* block) {
+    static const uint32_t k[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    for (int32_t index = 0; index < 16; ++index) {
+      w[index] = (static_cast<uint32_t>(block[index * 4]) << 24)
+                 | (static_cast<uint32_t>(block[index * 4 + 1]) << 16)
+                 | (static_cast<uint32_t>(block[index * 4 + 2]) << 8)
+                 | static_cast<uint32_t>(block[index * 4 + 3]);
+    }
+    for (int32_t index = 16; index < 64; ++index) {
+      uint32_t s0 = Rotr(w[index - 15], 7) ^ Rotr(w[index - 15], 18) ^ (w[index - 15] >> 3);
+      uint32_t s1 = Rotr(w[index - 2], 17) ^ Rotr(w[index - 2], 19) ^ (w[index - 2] >> 10);
+      w[index] = w[index - 16] + s0 + w[index - 7] + s1;
+    }
+    uint32_t v[8];
+    memcpy(v, state_, sizeof(v));
+    for (int32_t index = 0; index < 64; ++index) {
+      uint32_t s1 = Rotr(v[4], 6) ^ Rotr(v[4], 11) ^ Rotr(v[4], 25);
+      uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+      uint32_t t1 = v[7] + s1 + ch + k[index] + w[index];
+      uint32_t s0 = Rotr(v[0], 2) ^ Rotr(v[0], 13) ^ Rotr(v[0], 22);
+      uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+      uint32_t t2 = s0 + maj;
+      v[7] = v[6];
+      v[6] = v[5];
+      v[5] = v[4];
+      v[4] = v[3] + t1;
+      v[3] = v[2];
+      v[2] = v[1];
+      v[1] = v[0];
+      v[0] = t1 + t2;
+    }
+    for (int32_t index = 0; index < 8; ++index) {
+      state_[index] += v[index];
+    }
+  }
+
+private:
+  uint32_t state_[8];
+  uint64_t length_;
+  unsigned char buffer_[64];
+  size_t buffer_size_;
+};
+
+class FileSource : public ByteSource {
+
+public:
+  FileSource(const std::string& path, int64_t offset):path_(path),
+    offset_(offset), fd_(-1){}
+  ~FileSource() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  bool Open(int64_t* length) {
+    fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+      LOG(WARNING, "fail to open %s for %s", path_.c_str(), strerror(errno));
+      return false;
+    }
+    if (offset_ > 0 && ::lseek(fd_, offset_, SEEK_SET) != offset_) {
+      LOG(WARNING, "fail to seek %s to %ld for %s", path_.c_str(), offset_,
+          strerror(errno));
+      return false;
+    }
+    struct stat st;
+    *length = -1;
+    if (::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode)) {
+      *length = st.st_size - offset_;
+    }
+    return true;
+  }
+
+  int64_t Read(char* buf, size_t size) {
+    ssize_t n = 0;
+    do {
+      n = ::read(fd_, buf, size);
+    } while (n < 0 && errno == EINTR);
+    return n;
+  }
+
+private:
+  std::string path_;
+  int64_t offset_;
+  int fd_;
+};
+
+// the bytes of https:// from the stdout of wget, the engine has no tls.
+// the child reaper of engine reaps wget, so the shell writes the exit
+// code of wget to a status pipe and a failed download is an error at the end
+class WgetSource : public ByteSource {
+
+public:
+  WgetSource(const std::string& uri, int64_t offset):uri_(uri),
+    offset_(offset), pid_(-1), fd_(-1), status_fd_(-1){}
+  ~WgetSource() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+    if (status_fd_ >= 0) {
+      ::close(status_fd_);
+    }
+    if (pid_ > 0) {
+      // stop the download that is given up
+      ::kill(-pid_, SIGKILL);
+      ::waitpid(pid_, NULL, 0);
+    }
+  }
+
+  bool Open(int64_t* length) {
+    *length = -1;
+    int data[2];
+    int status[2];
+    if (::pipe2(data, O_CLOEXEC) != 0) {
+      LOG(WARNING, "fail to create pipe for %s", strerror(errno));
+      return false;
+    }
+    if (::pipe2(status, O_CLOEXEC) != 0) {
+      LOG(WARNING, "fail to create pipe for %s", strerror(errno));
+      ::close(data[0]);
+      ::close(data[1]);
+      return false;
+    }
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      ::setpgid(0, 0);
+      ::dup2(data[1], STDOUT_FILENO);
+      // the status pipe is fd 3 of shell, the fds dup2 to are inherited
+      if (status[1] == kWgetStatusFd) {
+        ::fcntl(kWgetStatusFd, F_SETFD, 0);
+      } else {
+        ::dup2(status[1], kWgetStatusFd);
+      }
+      // the engine blocks SIGCHLD for its child reaper
+      sigset_t mask;
+      sigemptyset(&mask);
+      sigprocmask(SIG_SETMASK, &mask, NULL);
+      ::execl("/bin/sh", "sh", "-c",
+              "wget -q -O - -- \"$1\" 3>&-; echo $? >&3",
+              "sh", uri_.c_str(), static_cast<char*>(NULL));
+      ::_exit(127);
+    }
+    ::close(data[1]);
+    ::close(status[1]);
+    fd_ = data[0];
+    status_fd_ = status[0];
+    if (pid < 0) {
+      LOG(WARNING, "fail to fork wget for %s", strerror(errno));
+      return false;
+    }
+    ::setpgid(pid, pid);
+    pid_ = pid;
+    LOG(INFO, "pull %s with wget %d", uri_.c_str(), pid_);
+    return true;
+  }
+
+  int64_t Read(char* buf, size_t size) {
+    // wget gets the whole content, so the bytes before offset are skipped
+    while (offset_ > 0) {
+      int64_t n = ReadPipe(buf, std::min(size, static_cast<size_t>(offset_)));
+      if (n <= 0) {
+        return n;
+      }
+      offset_ -= n;
+    }
+    return ReadPipe(buf, size);
+  }
+
+private:
+  int64_t ReadPipe(char* buf, size_t size) {
+    ssize_t n = 0;
+    do {
+      n = ::read(fd_, buf, size);
+    } while (n < 0 && errno == EINTR);
+    if (n != 0) {
+      return n;
+    }
+    std::string status;
+    char tmp[16];
+    do {
+      n = ::read(status_fd_, tmp, sizeof(tmp));
+      if (n > 0) {
+        status.append(tmp, n);
+      }
+    } while (n > 0 || (n < 0 && errno == EINTR));
+    ::waitpid(pid_, NULL, 0);
+    pid_ = -1;
+    boost::trim(status);
+    if (status != "0") {
+      LOG(WARNING, "wget fails to get %s with code %s", uri_.c_str(),
+          status.empty() ? "unknown" : status.c_str());
+      return -1;
+    }
+    return 0;
+  }
+
+private:
+  std::string uri_;
+  int64_t offset_;
+  pid_t pid_;
+  int fd_;
+  int status_fd_;
+};
+
+HttpSource::HttpSource(const std::string& uri,
+                       int64_t offset,
+                       int64_t end):uri_(uri),
+  offset_(offset),
+  end_(end),
+  fd_(-1),
+  buf_(),
+  pos_(0),
+  chunked_(false),
+  chunk_left_(0),
+  chunk_crlf_(false),
+  body_left_(-1),
+  range_left_(-1),
+  eof_(false),
+  total_(-1),
+  partial_(false){}
+
+HttpSource::~HttpSource() {
+  Close();
+}
+
+bool HttpSource::Open(int64_t* length) {
+  std::string uri = uri_;
+  bool ranged = offset_ > 0 || end_ >= 0;
+  for (int32_t redirect = 0; redirect <= kMaxRedirects; ++redirect) {
+    std::string host;
+    std::string port;
+    std::string path;
+    if (!ParseUri(uri, &host, &port, &path)) {
+      LOG(WARNING, "invalid http uri %s", uri.c_str());
+      return false;
+    }
+    Close();
+    if (!Connect(host, port)) {
+      return false;
+    }
+    std::string request = "GET " + path + " HTTP/1.1\r\n";
+    request += "Host: " + host + (port == "80" ? "" : ":" + port) + "\r\n";
+    if (ranged) {
+      request += "Range: bytes=" + boost::lexical_cast<std::string>(offset_) + "-";
+      if (end_ >= 0) {
+        request += boost::lexical_cast<std::string>(end_);
+      }
+      request += "\r\n";
+    }
+    request += "User-Agent: dos\r\nAccept: */*\r\nConnection: close\r\n\r\n";
+    if (!SendAll(request)) {
+      LOG(WARNING, "fail to send request to %s for %s", uri.c_str(), strerror(errno));
+      return false;
+    }
+    std::string line;
+    if (!ReadLine(&line)) {
+      LOG(WARNING, "fail to read response from %s", uri.c_str());
+      return false;
+    }
+    // HTTP/1.1 200 OK
+    std::vector<std::string> parts;
+    boost::split(parts, line, boost::is_any_of(" "));
+    if (parts.size() < 2 || !boost::starts_with(parts[0], "HTTP/")) {
+      LOG(WARNING, "invalid status line %s from %s", line.c_str(), uri.c_str());
+      return false;
+    }
+    int32_t code = atoi(parts[1].c_str());
+    std::string location;
+    std::string content_range;
+    int64_t content_length = -1;
+    chunked_ = false;
+    while (true) {
+      if (!ReadLine(&line)) {
+        LOG(WARNING, "fail to read headers from %s", uri.c_str());
+        return false;
+      }
+      if (line.empty()) {
+        break;
+      }
+      size_t colon = line.find(':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+      std::string name = boost::to_lower_copy(line.substr(0, colon));
+      std::string value = boost::trim_copy(line.substr(colon + 1));
+      if (name == "content-length") {
+        content_length = atoll(value.c_str());
+      } else if (name == "transfer-encoding") {
+        chunked_ = boost::icontains(value, "chunked");
+      } else if (name == "location") {
+        location = value;
+      } else if (name == "content-range") {
+        content_range = value;
+      }
+    }
+    if ((code == 301 || code == 302 || code == 303 || code == 307 || code == 308)
+        && !location.empty()) {
+      if (boost::starts_with(location, "/")) {
+        location = "http://" + host + ":" + port + location;
+      }
+      LOG(INFO, "redirect %s to %s", uri.c_str(), location.c_str());
+      uri = location;
+      continue;
+    }
+    body_left_ = chunked_ ? -1 : content_length;
+    if (code == 206 && ranged) {
+      // bytes offset-end/total
+      int64_t start = -1;
+      if (sscanf(content_range.c_str(), "bytes %ld-%*d/%ld", &start, &total_) < 1
+          || start != offset_) {
+        LOG(WARNING, "invalid content range %s from %s", content_range.c_str(),
+            uri.c_str());
+        return false;
+      }
+      partial_ = true;
+      *length = body_left_;
+      return true;
+    }
+    if (code != 200) {
+      LOG(WARNING, "get %s with status %d", uri.c_str(), code);
+      return false;
+    }
+    total_ = content_length;
+    // the server ignores range, skip the bytes before offset
+    char skip[4096];
+    for (int64_t left = offset_; left > 0;) {
+      int64_t n = ReadBody(skip, std::min(left, static_cast<int64_t>(sizeof(skip))));
+      if (n <= 0) {
+        LOG(WARNING, "fail to skip %ld bytes of %s", offset_, uri.c_str());
+        return false;
+      }
+      left -= n;
+    }
+    if (end_ >= 0) {
+      range_left_ = end_ - offset_ + 1;
+    }
+    *length = -1;
+    if (content_length >= 0) {
+      *length = content_length - offset_;
+      if (range_left_ >= 0) {
+        *length = std::min(*length, range_left_);
+      }
+    }
+    return true;
+  }
+  LOG(WARNING, "%s redirects too many times", uri_.c_str());
+  return false;
+}
+
+int64_t HttpSource::Read(char* buf, size_t size) {
+  if (range_left_ == 0) {
+    return 0;
+  }
+  if (range_left_ > 0) {
+    size = std::min(size, static_cast<size_t>(range_left_));
+  }
+  int64_t n = ReadBody(buf, size);
+  if (n > 0 && range_left_ > 0) {
+    range_left_ -= n;
+  }
+  return n;
+}
+
+int64_t HttpSource::ReadBody(char* buf, size_t size) {
+  if (!chunked_) {
+    if (body_left_ == 0) {
+      return 0;
+    }
+    if (body_left_ > 0) {
+      size = std::min(size, static_cast<size_t>(body_left_));
+    }
+    int64_t n = ReadRaw(buf, size);
+    if (n == 0 && body_left_ > 0) {
+      LOG(WARNING, "%s is truncated", uri_.c_str());
+      return -1;
+    }
+    if (n > 0 && body_left_ > 0) {
+      body_left_ -= n;
+    }
+    return n;
+  }
+  if (chunk_left_ == 0) {
+    if (eof_) {
+      return 0;
+    }
+    std::string line;
+    if (chunk_crlf_) {
+      if (!ReadLine(&line)) {
+        return -1;
+      }
+      chunk_crlf_ = false;
+    }
+    if (!ReadLine(&line)) {
+      return -1;
+    }
+    // the chunk extensions after ; are ignored
+    chunk_left_ = strtoll(line.c_str(), NULL, 16);
+    if (chunk_left_ < 0) {
+      return -1;
+    }
+    if (chunk_left_ == 0) {
+      eof_ = true;
+      // skip trailers
+      while (ReadLine(&line) && !line.empty()) {
+      }
+      return 0;
+    }
+  }
+  int64_t n = ReadRaw(buf, std::min(size, static_cast<size_t>(chunk_left_)));
+  if (n <= 0) {
+    LOG(WARNING, "%s is truncated", uri_.c_str());
+    return -1;
+  }
+  chunk_left_ -= n;
+  if (chunk_left_ == 0) {
+    chunk_crlf_ = true;
+  }
+  return n;
+}
+
+bool HttpSource::ParseUri(const std::string& uri, std::string* host,
+                          std::string* port, std::string* path) {
+  const std::string scheme = "http://";
+  if (!boost::starts_with(uri, scheme)) {
+    return false;
+  }
+  std::string rest = uri.substr(scheme.size());
+  size_t slash = rest.find('/');
+  std::string host_port = rest.substr(0, slash);
+  *path = slash == std::string::npos ? "/" : rest.substr(slash);
+  size_t colon = host_port.rfind(':');
+  if (colon == std::string::npos) {
+    *host = host_port;
+    *port = "80";
+  } else {
+    *host = host_port.substr(0, colon);
+    *port = host_port.substr(colon + 1);
+  }
+  return !host->empty() && !port->empty();
+}
+
+bool HttpSource::Connect(const std::string& host, const std::string& port) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addrs = NULL;
+  int ret = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs);
+  if (ret != 0) {
+    LOG(WARNING, "fail to resolve %s for %s", host.c_str(), gai_strerror(ret));
+    return false;
+  }
+  for (struct addrinfo* addr = addrs; addr != NULL; addr = addr->ai_next) {
+    fd_ = ::socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+    if (fd_ < 0) {
+      continue;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = kIoTimeout;
+    timeout.tv_usec = 0;
+    ::setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (::connect(fd_, addr->ai_addr, addr->ai_addrlen) == 0) {
+      break;
+    }
+    ::close(fd_);
+    fd_ = -1;
+  }
+  ::freeaddrinfo(addrs);
+  if (fd_ < 0) {
+    LOG(WARNING, "fail to connect %s:%s", host.c_str(), port.c_str());
+    return false;
+  }
+  return true;
+}
+
+void HttpSource::Close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  buf_.clear();
+  pos_ = 0;
+  chunk_left_ = 0;
+  chunk_crlf_ = false;
+  eof_ = false;
+}
+
+bool HttpSource::SendAll(const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = ::send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+int64_t HttpSource::ReadRaw(char* buf, size_t size) {
+  if (pos_ < buf_.size()) {
+    size_t n = std::min(size, buf_.size() - pos_);
+    memcpy(buf, buf_.data() + pos_, n);
+    pos_ += n;
+    return n;
+  }
+  ssize_t n = 0;
+  do {
+    n = ::recv(fd_, buf, size, 0);
+  } while (n < 0 && errno == EINTR);
+  return n;
+}
+
+bool HttpSource::ReadLine(std::string* line) {
+  while (true) {
+    size_t end = buf_.find("\r\n", pos_);
+    if (end != std::string::npos) {
+      line->assign(buf_, pos_, end - pos_);
+      pos_ = end + 2;
+      return true;
+    }
+    if (buf_.size() - pos_ > kMaxHeaderLine) {
+      return false;
+    }
+    buf_.erase(0, pos_);
+    pos_ = 0;
+    char tmp[4096];
+    ssize_t n = 0;
+    do {
+      n = ::recv(fd_, tmp, sizeof(tmp), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+      return false;
+    }
+    buf_.append(tmp, n);
+  }
+}
+
+ByteSource* ByteSource::Create(const std::string& uri, int64_t offset) {
+  if (boost::starts_with(uri, "http://")) {
+    return new HttpSource(uri, offset, -1);
+  }
+  if (boost::starts_with(uri, "https://")) {
+    return new WgetSource(uri, offset);
+  }
+  if (boost::starts_with(uri, "file://")) {
+    return new FileSource(uri.substr(7), offset);
+  }
+  if (boost::starts_with(uri, "/")) {
+    return new FileSource(uri, offset);
+  }
+  LOG(WARNING, "the scheme of uri %s is not supported", uri.c_str());
+  return NULL;
+}
+
+// pass the bytes to extractor, inflate them when they start with
+// the magic of gzip
+class GzipStream {
+
+public:
+  GzipStream(TarExtractor* out):out_(out), head_(), detected_(false),
+    gzip_(false), inited_(false), ended_(false), error_() {
+    memset(&zs_, 0, sizeof(zs_));
+  }
+
+  ~GzipStream() {
+    if (inited_) {
+      inflateEnd(&zs_);
+    }
+  }
+
+  bool Write(const char* data, size_t size) {
+    if (detected_) {
+      return Process(data, size);
+    }
+    head_.append(data, size);
+    if (head_.size() < 2) {
+      return true;
+    }
+    detected_ = true;
+    gzip_ = static_cast<unsigned char>(head_[0]) == 0x1f
+            && static_cast<unsigned char>(head_[1]) == 0x8b;
+    if (gzip_) {
+      // 16 makes zlib decode gzip header and trailer
+      if (inflateInit2(&zs_, 16 + MAX_WBITS) != Z_OK) {
+        error_ = "fail to init zlib";
+        return false;
+      }
+      inited_ = true;
+    }
+    std::string head;
+    head.swap(head_);
+    return Process(head.data(), head.size());
+  }
+
+  bool Finish() {
+    if (!detected_ && !head_.empty()) {
+      error_ = "the image is too short";
+      return false;
+    }
+    if (gzip_ && !ended_) {
+      error_ = "the gzip stream is truncated";
+      return false;
+    }
+    if (!out_->Finish()) {
+      error_ = out_->GetError();
+      return false;
+    }
+    return true;
+  }
+
+  const std::string& GetError() const {
+    return error_;
+  }
+
+private:
+  bool Process(const char* data, size_t size) {
+    if (!gzip_) {
+      if (!out_->Write(data, size)) {
+        error_ = out_->GetError();
+        return false;
+      }
+      return true;
+    }
+    zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs_.avail_in = size;
+    while (zs_.avail_in > 0) {
+      if (ended_) {
+        // the bytes after the end of gzip are concatenated members or
+        // padding, the padding after the end of tar is ignored
+        Bytef* next_in = zs_.next_in;
+        uInt avail_in = zs_.avail_in;
+        inflateReset(&zs_);
+        zs_.next_in = next_in;
+        zs_.avail_in = avail_in;
+        ended_ = false;
+      }
+      zs_.next_out = reinterpret_cast<Bytef*>(out_buf_);
+      zs_.avail_out = sizeof(out_buf_);
+      int ret = inflate(&zs_, Z_NO_FLUSH);
+      size_t produced = sizeof(out_buf_) - zs_.avail_out;
+      if (produced > 0 && !out_->Write(out_buf_, produced)) {
+        error_ = out_->GetError();
+        return false;
+      }
+      if (ret == Z_STREAM_END) {
+        ended_ = true;
+        continue;
+      }
+      if (ret == Z_DATA_ERROR && out_->IsDone()) {
+        ended_ = true;
+        return true;
+      }
+      if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        error_ = std::string("fail to inflate image for ") + (zs_.msg ? zs_.msg : "unknown");
+        return false;
+      }
+      if (ret == Z_BUF_ERROR && produced == 0) {
+        break;
+      }
+    }
+    return true;
+  }
+
+private:
+  TarExtractor* out_;
+  std::string head_;
+  bool detected_;
+  bool gzip_;
+  bool inited_;
+  bool ended_;
+  z_stream zs_;
+  char out_buf_[64 * 1024];
+  std::string error_;
+};
+
+static bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::write(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+static int64_t ParseNumber(const char* field, size_t size) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(field);
+  int64_t value = 0;
+  // base-256 for the numbers that octal can not hold
+  if (p[0] & 0x80) {
+    value = p[0] & 0x3f;
+    for (size_t index = 1; index < size; ++index) {
+      value = (value << 8) | p[index];
+    }
+    return value;
+  }
+  size_t index = 0;
+  while (index < size && (p[index] == ' ' || p[index] == '\0')) {
+    index++;
+  }
+  for (; index < size && p[index] >= '0' && p[index] <= '7'; ++index) {
+    value = (value << 3) | (p[index] - '0');
+  }
+  return value;
+}
+
+static std::string ParseString(const char* field, size_t size) {
+  size_t len = 0;
+  while (len < size && field[len] != '\0') {
+    len++;
+  }
+  return std::string(field, len);
+}
+
+TarExtractor::TarExtractor(const std::string& dir):dir_(dir),
+  header_size_(0),
+  entry_left_(0),
+  padding_left_(0),
+  entry_type_(0),
+  entry_path_(),
+  entry_link_(),
+  entry_mode_(0),
+  entry_uid_(0),
+  entry_gid_(0),
+  entry_mtime_(0),
+  meta_(),
+  long_name_(),
+  long_link_(),
+  pax_size_(-1),
+  fd_(-1),
+  zero_blocks_(0),
+  done_(false),
+  chown_(::geteuid() == 0),
+  checked_parent_(),
+  extracted_(0),
+  error_(){}
+
+TarExtractor::~TarExtractor() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+bool TarExtractor::Write(const char* data, size_t size) {
+  while (size > 0 && !done_) {
+    if (entry_left_ > 0) {
+      size_t n = std::min(size, static_cast<size_t>(entry_left_));
+      if (!WriteEntry(data, n)) {
+        return false;
+      }
+      data += n;
+      size -= n;
+      entry_left_ -= n;
+      if (entry_left_ == 0 && !EndEntry()) {
+        return false;
+      }
+      continue;
+    }
+    if (padding_left_ > 0) {
+      size_t n = std::min(size, static_cast<size_t>(padding_left_));
+      data += n;
+      size -= n;
+      padding_left_ -= n;
+      continue;
+    }
+    size_t n = std::min(size, sizeof(header_) - header_size_);
+    memcpy(header_ + header_size_, data, n);
+    header_size_ += n;
+    data += n;
+    size -= n;
+    if (header_size_ == sizeof(header_)) {
+      header_size_ = 0;
+      if (!ProcessHeader()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool TarExtractor::Finish() {
+  // some writers omit the two zero blocks at the end
+  if (entry_left_ > 0 || header_size_ > 0) {
+    return Fail("the tar stream is truncated");
+  }
+  return true;
+}
+
+bool TarExtractor::ProcessHeader() {
+  bool zero = true;
+  uint32_t sum = 0;
+  for (size_t index = 0; index < sizeof(header_); ++index) {
+    unsigned char c = header_[index];
+    zero = zero && c == 0;
+    // the checksum field is counted as spaces
+    sum += (index >= 148 && index < 156) ? ' ' : c;
+  }
+  if (zero) {
+    if (++zero_blocks_ >= 2) {
+      done_ = true;
+    }
+    return true;
+  }
+  zero_blocks_ = 0;
+  if (static_cast<int64_t>(sum) != ParseNumber(header_ + 148, 8)) {
+    return Fail("bad checksum of tar header");
+  }
+  int64_t size = ParseNumber(header_ + 124, 12);
+  if (pax_size_ >= 0) {
+    size = pax_size_;
+    pax_size_ = -1;
+  }
+  entry_type_ = header_[156];
+  entry_left_ = size;
+  padding_left_ = (512 - size % 512) % 512;
+  meta_.clear();
+  if (entry_type_ == 'L' || entry_type_ == 'K'
+      || entry_type_ == 'x' || entry_type_ == 'g') {
+    if (size > static_cast<int64_t>(kMaxMetaSize)) {
+      return Fail("the tar meta entry is too big");
+    }
+  } else {
+    std::string name = ParseString(header_, 100);
+    if (memcmp(header_ + 257, "ustar", 5) == 0) {
+      std::string prefix = ParseString(header_ + 345, 155);
+      if (!prefix.empty()) {
+        name = prefix + "/" + name;
+      }
+    }
+    entry_path_ = long_name_.empty() ? name : long_name_;
+    entry_link_ = long_link_.empty() ? ParseString(header_ + 157, 100) : long_link_;
+    long_name_.clear();
+    long_link_.clear();
+    entry_mode_ = static_cast<int32_t>(ParseNumber(header_ + 100, 8)) & 07777;
+    entry_uid_ = static_cast<int32_t>(ParseNumber(header_ + 108, 8));
+    entry_gid_ = static_cast<int32_t>(ParseNumber(header_ + 116, 8));
+    entry_mtime_ = ParseNumber(header_ + 136, 12);
+    if (!BeginEntry()) {
+      return false;
+    }
+  }
+  if (entry_left_ == 0) {
+    return EndEntry();
+  }
+  return true;
+}
+
+bool TarExtractor::BeginEntry() {
+  std::string path = SafePath(entry_path_);
+  if (path.empty()) {
+    return Fail("refuse tar entry " + entry_path_);
+  }
+  if (path != dir_ && !CheckParent(path)) {
+    return false;
+  }
+  entry_path_ = path;
+  switch (entry_type_) {
+    case '0':
+    case '\0':
+    case '7':
+      if (::unlink(path.c_str()) != 0 && errno != ENOENT) {
+        return Fail("fail to replace " + path + " for " + strerror(errno));
+      }
+      fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+      if (fd_ < 0) {
+        return Fail("fail to create " + path + " for " + strerror(errno));
+      }
+      break;
+    case '5': {
+      struct stat st;
+      if (::lstat(path.c_str(), &st) != 0) {
+        if (::mkdir(path.c_str(), 0700) != 0) {
+          return Fail("fail to create dir " + path + " for " + strerror(errno));
+        }
+      } else if (!S_ISDIR(st.st_mode)) {
+        return Fail("refuse to replace " + path + " with dir");
+      }
+      if (chown_) {
+        ::lchown(path.c_str(), entry_uid_, entry_gid_);
+      }
+      ::chmod(path.c_str(), entry_mode_);
+      break;
+    }
+    case '2':
+      ::unlink(path.c_str());
+      if (::symlink(entry_link_.c_str(), path.c_str()) != 0) {
+        return Fail("fail to create symlink " + path + " for " + strerror(errno));
+      }
+      if (chown_) {
+        ::lchown(path.c_str(), entry_uid_, entry_gid_);
+      }
+      // the checked parent may be a symlink now
+      checked_parent_.clear();
+      break;
+    case '1': {
+      std::string target = SafePath(entry_link_);
+      if (target.empty()) {
+        return Fail("refuse hard link to " + entry_link_);
+      }
+      // link follows the symlinks in the parents of target, which may
+      // link a file out of dir into image
+      if (!CheckParent(target)) {
+        return false;
+      }
+      ::unlink(path.c_str());
+      if (::link(target.c_str(), path.c_str()) != 0) {
+        return Fail("fail to create link " + path + " for " + strerror(errno));
+      }
+      break;
+    }
+    default:
+      // devices and fifos are left to the runtime of container
+      LOG(DEBUG, "skip tar entry %s with type %c", path.c_str(), entry_type_);
+      break;
+  }
+  return true;
+}
+
+bool TarExtractor::WriteEntry(const char* data, size_t size) {
+  if (entry_type_ == 'L' || entry_type_ == 'K'
+      || entry_type_ == 'x' || entry_type_ == 'g') {
+    meta_.append(data, size);
+    return true;
+  }
+  if (fd_ < 0) {
+    return true;
+  }
+  while (size > 0) {
+    ssize_t n = ::write(fd_, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return Fail("fail to write " + entry_path_ + " for " + strerror(errno));
+    }
+    data += n;
+    size -= n;
+    extracted_ += n;
+  }
+  return true;
+}
+
+bool TarExtractor::EndEntry() {
+  if (entry_type_ == 'L') {
+    long_name_ = ParseString(meta_.data(), meta_.size());
+  } else if (entry_type_ == 'K') {
+    long_link_ = ParseString(meta_.data(), meta_.size());
+  } else if (entry_type_ == 'x') {
+    if (!ParsePax(meta_)) {
+      return false;
+    }
+  }
+  meta_.clear();
+  if (fd_ < 0) {
+    return true;
+  }
+  // chown before chmod, as chown clears the set-user-id bit
+  if (chown_) {
+    ::fchown(fd_, entry_uid_, entry_gid_);
+  }
+  ::fchmod(fd_, entry_mode_);
+  struct timeval times[2];
+  times[0].tv_sec = entry_mtime_;
+  times[0].tv_usec = 0;
+  times[1] = times[0];
+  ::futimes(fd_, times);
+  ::close(fd_);
+  fd_ = -1;
+  return true;
+}
+
+bool TarExtractor::ParsePax(const std::string& records) {
+  // every record is "length key=value\n"
+  size_t pos = 0;
+  while (pos < records.size()) {
+    size_t space = records.find(' ', pos);
+    if (space == std::string::npos) {
+      return Fail("bad pax header");
+    }
+    size_t length = strtoul(records.c_str() + pos, NULL, 10);
+    if (length == 0 || pos + length > records.size()) {
+      return Fail("bad pax header");
+    }
+    std::string record = records.substr(space + 1, pos + length - space - 2);
+    pos += length;
+    size_t equal = record.find('=');
+    if (equal == std::string::npos) {
+      continue;
+    }
+    std::string key = record.substr(0, equal);
+    std::string value = record.substr(equal + 1);
+    if (key == "path") {
+      long_name_ = value;
+    } else if (key == "linkpath") {
+      long_link_ = value;
+    } else if (key == "size") {
+      pax_size_ = atoll(value.c_str());
+    }
+  }
+  return true;
+}
+
+std::string TarExtractor::SafePath(const std::string& name) {
+  std::vector<std::string> parts;
+  boost::split(parts, name, boost::is_any_of("/"));
+  std::string path = dir_;
+  for (size_t index = 0; index < parts.size(); ++index) {
+    if (parts[index].empty() || parts[index] == ".") {
+      continue;
+    }
+    if (parts[index] == "..") {
+      return "";
+    }
+    path += "/" + parts[index];
+  }
+  return path;
+}
+
+bool TarExtractor::CheckParent(const std::string& path) {
+  std::string parent = path.substr(0, path.rfind('/'));
+  if (parent == checked_parent_) {
+    return true;
+  }
+  // create the missing dirs and refuse to go through any symlink
+  size_t pos = dir_.size();
+  while (pos < parent.size()) {
+    size_t next = parent.find('/', pos + 1);
+    if (next == std::string::npos) {
+      next = parent.size();
+    }
+    std::string current = parent.substr(0, next);
+    struct stat st;
+    if (::lstat(current.c_str(), &st) != 0) {
+      if (errno != ENOENT || ::mkdir(current.c_str(), 0755) != 0) {
+        return Fail("fail to create dir " + current + " for " + strerror(errno));
+      }
+    } else if (!S_ISDIR(st.st_mode)) {
+      return Fail("refuse tar entry " + path + " under non dir " + current);
+    }
+    pos = next;
+  }
+  checked_parent_ = parent;
+  return true;
+}
+
+bool TarExtractor::Fail(const std::string& error) {
+  error_ = error;
+  LOG(WARNING, "fail to extract tar into %s: %s", dir_.c_str(), error.c_str());
+  return false;
+}
+
+ImagePuller::ImagePuller(const std::string& uri,
+                         const std::string& dir,
+                         const std::string& digest):uri_(uri),
+  dir_(dir),
+  digest_(boost::to_lower_copy(digest)),
+  peers_(),
+  blob_path_(),
+  chunks_(NULL),
+  aborted_(false),
+  read_ok_(false),
+  read_digest_(),
+  read_error_(),
+  has_blob_(false),
+  extracted_(0),
+  peer_bytes_(0),
+  error_(){
+  if (boost::starts_with(digest_, "sha256:")) {
+    digest_ = digest_.substr(7);
+  }
+  chunks_ = new BoundedMpmcQueue<Chunk*>(kQueueChunks, "image_puller");
+}
+
+ImagePuller::~ImagePuller() {
+  delete chunks_;
+}
+
+bool ImagePuller::Pull(PullProgress* progress) {
+  LayerFetcher* fetcher = NULL;
+  ByteSource* source = NULL;
+  // nothing checks the bytes of peers without digest, and any host
+  // can announce a layer, so peers are only used with digest
+  if (peers_.empty() || digest_.empty()) {
+    source = ByteSource::Create(uri_);
+  } else {
+    fetcher = new LayerFetcher(uri_, peers_);
+    source = fetcher;
+  }
+  if (source == NULL) {
+    error_ = "the scheme of uri is not supported";
+    return false;
+  }
+  int64_t length = -1;
+  if (!source->Open(&length)) {
+    delete source;
+    error_ = "fail to open uri";
+    return false;
+  }
+  progress->total = length;
+  TarExtractor extractor(dir_);
+  GzipStream stream(&extractor);
+  bool extract_ok = true;
+  {
+    ::baidu::common::ThreadPool reader(1);
+    reader.AddTask(boost::bind(&ImagePuller::ReadLoop, this, source, progress));
+    // drain the queue to its end even if extracting fails, so the
+    // reading thread is never blocked
+    while (true) {
+      Chunk* chunk = chunks_->Pop();
+      if (chunk == NULL) {
+        break;
+      }
+      if (extract_ok) {
+        extract_ok = stream.Write(chunk->data, chunk->size);
+        progress->extracted = extractor.GetExtractedBytes();
+        aborted_ = !extract_ok;
+      }
+      delete chunk;
+    }
+    reader.Stop(true);
+  }
+  if (fetcher != NULL) {
+    peer_bytes_ = fetcher->GetPeerBytes();
+  }
+  delete source;
+  extracted_ = extractor.GetExtractedBytes();
+  if (!extract_ok) {
+    error_ = stream.GetError();
+  } else if (!read_ok_) {
+    error_ = read_error_;
+  } else if (!stream.Finish()) {
+    error_ = stream.GetError();
+  } else if (!digest_.empty() && digest_ != read_digest_) {
+    error_ = "the digest " + read_digest_ + " does not match " + digest_;
+  } else {
+    LOG(INFO, "pull %s into %s with %ld bytes received, %ld bytes from peers and %ld bytes extracted",
+        uri_.c_str(), dir_.c_str(), progress->received, peer_bytes_, extracted_);
+    return true;
+  }
+  if (has_blob_) {
+    ::unlink(blob_path_.c_str());
+    has_blob_ = false;
+  }
+  return false;
+}
+
+void ImagePuller::ReadLoop(ByteSource* source, PullProgress* progress) {
+  Sha256 sha;
+  read_ok_ = true;
+  int blob_fd = -1;
+  if (!blob_path_.empty()) {
+    blob_fd = ::open(blob_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (blob_fd < 0) {
+      LOG(WARNING, "fail to create blob %s for %s", blob_path_.c_str(), strerror(errno));
+    }
+  }
+  while (!aborted_) {
+    Chunk* chunk = new Chunk(kChunkSize);
+    int64_t n = source->Read(chunk->data, kChunkSize);
+    if (n <= 0) {
+      delete chunk;
+      if (n < 0) {
+        read_ok_ = false;
+        read_error_ = "fail to read uri";
+      }
+      break;
+    }
+    chunk->size = n;
+    sha.Update(chunk->data, n);
+    progress->received += n;
+    if (blob_fd >= 0 && !WriteAll(blob_fd, chunk->data, n)) {
+      LOG(WARNING, "fail to write blob %s for %s", blob_path_.c_str(), strerror(errno));
+      ::close(blob_fd);
+      ::unlink(blob_path_.c_str());
+      blob_fd = -1;
+    }
+    chunks_->Push(chunk);
+  }
+  if (read_ok_) {
+    read_digest_ = sha.HexDigest();
+  }
+  if (blob_fd >= 0) {
+    ::close(blob_fd);
+    has_blob_ = true;
+  }
+  // the end of chunks
+  chunks_->Push(NULL);
+}
+
+} // namespace dos
@@ -0,0 +1,211 @@
+#ifndef KERNEL_ENGINE_IMAGE_PULLER_H
+#define KERNEL_ENGINE_IMAGE_PULLER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "common/mpmc_queue.h"
+
+namespace dos {
+
+// the byte progress of pulling, it's written by puller and read
+// by others without lock
+struct PullProgress {
+  // the bytes received from uri
+  volatile int64_t received;
+  // the content length of uri, -1 when it's unknown
+  volatile int64_t total;
+  // the bytes of files extracted
+  volatile int64_t extracted;
+  PullProgress():received(0), total(-1), extracted(0){}
+};
+
+// the bytes of http://, https://, file:// or local path
+class ByteSource {
+
+public:
+  virtual ~ByteSource(){}
+  // length is -1 when it's unknown
+  virtual bool Open(int64_t* length) = 0;
+  // return the count of bytes read, 0 at the end and -1 on error
+  virtual int64_t Read(char* buf, size_t size) = 0;
+  // return NULL when the scheme of uri is not supported, the bytes
+  // before offset are skipped
+  static ByteSource* Create(const std::string& uri, int64_t offset = 0);
+};
+
+// http/1.1 get with content length, chunked encoding and redirects
+class HttpSource : public ByteSource {
+
+public:
+  // get the bytes in [offset, end] of uri, end is -1 for the end of
+  // content. the bytes are skipped when server ignores the range
+  HttpSource(const std::string& uri, int64_t offset, int64_t end);
+  ~HttpSource();
+  bool Open(int64_t* length);
+  int64_t Read(char* buf, size_t size);
+  // the size of whole content, -1 when it's unknown
+  int64_t GetTotal() const {
+    return total_;
+  }
+  // server responds the range with 206
+  bool IsPartial() const {
+    return partial_;
+  }
+private:
+  static bool ParseUri(const std::string& uri, std::string* host,
+                       std::string* port, std::string* path);
+  bool Connect(const std::string& host, const std::string& port);
+  void Close();
+  bool SendAll(const std::string& data);
+  int64_t ReadBody(char* buf, size_t size);
+  // the bytes buffered by reading lines are returned first
+  int64_t ReadRaw(char* buf, size_t size);
+  bool ReadLine(std::string* line);
+private:
+  std::string uri_;
+  int64_t offset_;
+  int64_t end_;
+  int fd_;
+  std::string buf_;
+  size_t pos_;
+  bool chunked_;
+  int64_t chunk_left_;
+  // the crlf after chunk data is not read
+  bool chunk_crlf_;
+  int64_t body_left_;
+  // the bytes of range that are left, -1 for no limit
+  int64_t range_left_;
+  bool eof_;
+  int64_t total_;
+  bool partial_;
+};
+
+// extract the tar stream to dir without buffering the whole archive,
+// the entries out of dir or under a symlink are refused
+class TarExtractor {
+
+public:
+  TarExtractor(const std::string& dir);
+  ~TarExtractor();
+  bool Write(const char* data, size_t size);
+  // return false when the archive is truncated
+  bool Finish();
+  // the end of archive is reached
+  bool IsDone() const {
+    return done_;
+  }
+  int64_t GetExtractedBytes() const {
+    return extracted_;
+  }
+  const std::string& GetError() const {
+    return error_;
+  }
+private:
+  bool ProcessHeader();
+  bool BeginEntry();
+  bool WriteEntry(const char* data, size_t size);
+  bool EndEntry();
+  bool ParsePax(const std::string& records);
+  // return the path under dir, empty when it's refused
+  std::string SafePath(const std::string& name);
+  bool CheckParent(const std::string& path);
+  bool Fail(const std::string& error);
+private:
+  std::string dir_;
+  char header_[512];
+  size_t header_size_;
+  // the bytes of current entry and its padding that are left
+  int64_t entry_left_;
+  int64_t padding_left_;
+  char entry_type_;
+  std::string entry_path_;
+  std::string entry_link_;
+  int32_t entry_mode_;
+  int32_t entry_uid_;
+  int32_t entry_gid_;
+  int64_t entry_mtime_;
+  // the meta entry whose data is kept, eg gnu long name and pax header
+  std::string meta_;
+  std::string long_name_;
+  std::string long_link_;
+  // the size of next entry in pax header
+  int64_t pax_size_;
+  int fd_;
+  int32_t zero_blocks_;
+  bool done_;
+  bool chown_;
+  // the parent dir that has been checked
+  std::string checked_parent_;
+  int64_t extracted_;
+  std::string error_;
+};
+
+// pull the image tarball at uri and unpack it into dir, the download
+// runs in its own thread and passes bounded chunks to the thread that
+// decompresses and extracts them, so they overlap and the memory is
+// bounded by the queue. gzip is detected by magic, and the sha256 of
+// the received bytes is checked when digest is given
+class ImagePuller {
+
+public:
+  ImagePuller(const std::string& uri,
+              const std::string& dir,
+              const std::string& digest);
+  ~ImagePuller();
+  // pull the chunks of image from the uris of peers that hold it, and
+  // fall back to uri when no peer works. peers are ignored without
+  // digest, as the bytes from them can not be checked
+  void SetPeers(const std::vector<std::string>& peers) {
+    peers_ = peers;
+  }
+  // keep the received bytes in blob path, so they can be served to
+  // peers. the blob is removed when it can not be written
+  void SetBlobPath(const std::string& blob_path) {
+    blob_path_ = blob_path;
+  }
+  bool Pull(PullProgress* progress);
+  const std::string& GetError() const {
+    return error_;
+  }
+  int64_t GetExtractedBytes() const {
+    return extracted_;
+  }
+  // the bytes received from peers
+  int64_t GetPeerBytes() const {
+    return peer_bytes_;
+  }
+  bool HasBlob() const {
+    return has_blob_;
+  }
+private:
+  struct Chunk {
+    char* data;
+    int64_t size;
+    Chunk(int64_t cap):data(new char[cap]), size(0){}
+    ~Chunk() {
+      delete[] data;
+    }
+  };
+  void ReadLoop(ByteSource* source, PullProgress* progress);
+private:
+  std::string uri_;
+  std::string dir_;
+  std::string digest_;
+  std::vector<std::string> peers_;
+  std::string blob_path_;
+  BoundedMpmcQueue<Chunk*>* chunks_;
+  // set by extracting thread to stop reading
+  volatile bool aborted_;
+  // written by reading thread before it pushes the end
+  bool read_ok_;
+  std::string read_digest_;
+  std::string read_error_;
+  bool has_blob_;
+  int64_t extracted_;
+  int64_t peer_bytes_;
+  std::string error_;
+};
+
+} // namespace dos
+#endif
@@ -0,0 +1,268 @@
+#include "engine/image_store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <boost/lexical_cast.hpp>
+#include "engine/utils.h"
+#include "logging.h"
+#include "timer.h"
+
+using ::baidu::common::INFO;
+using ::baidu::common::WARNING;
+using ::baidu::common::DEBUG;
+
+namespace dos {
+
+ImageStore::ImageStore(const std::string& root,
+                       int64_t budget):root_(root),
+  budget_(budget),
+  images_(),
+  lru_(),
+  used_(0),
+  hits_(0),
+  misses_(0),
+  evictions_(0),
+  garbage_seq_(0){}
+
+ImageStore::~ImageStore() {}
+
+bool ImageStore::Init(std::vector<std::string>* garbage) {
+  if (!MkdirRecur(root_)) {
+    LOG(WARNING, "fail to create image store %s", root_.c_str());
+    return false;
+  }
+  DIR* dir = ::opendir(root_.c_str());
+  if (dir == NULL) {
+    LOG(WARNING, "fail to open image store %s for %s", root_.c_str(),
+        strerror(errno));
+    return false;
+  }
+  std::vector<std::string> names;
+  std::vector<std::string> blobs;
+  struct dirent* dirp = NULL;
+  const std::string blob_suffix = ".blob";
+  while ((dirp = ::readdir(dir)) != NULL) {
+    std::string name(dirp->d_name);
+    if (name == "." || name == "..") {
+      continue;
+    }
+    if (name.size() > blob_suffix.size()
+        && name.compare(name.size() - blob_suffix.size(), blob_suffix.size(), blob_suffix) == 0) {
+      blobs.push_back(name.substr(0, name.size() - blob_suffix.size()));
+      continue;
+    }
+    names.push_back(name);
+  }
+  ::closedir(dir);
+  for (size_t index = 0; index < names.size(); ++index) {
+    const std::string& name = names[index];
+    std::string path = root_ + "/" + name;
+    std::ifstream size_file((path + "/" + GetSizeFile()).c_str());
+    int64_t size = 0;
+    // the image dir is named by key and it has size file only when
+    // fetching is done
+    if (name.find('.') != std::string::npos
+        || !size_file.is_open()
+        || !(size_file >> size)) {
+      garbage->push_back(MoveToGarbage(path));
+      continue;
+    }
+    ImageEntry& entry = images_[name];
+    entry.key = name;
+    entry.state = kImageReady;
+    entry.size = size;
+    entry.lru_it = lru_.insert(lru_.end(), name);
+    entry.in_lru = true;
+    used_ += size;
+  }
+  for (size_t index = 0; index < blobs.size(); ++index) {
+    std::map<std::string, ImageEntry>::iterator it = images_.find(blobs[index]);
+    if (it == images_.end()) {
+      garbage->push_back(MoveToGarbage(GetBlobPath(blobs[index])));
+      continue;
+    }
+    it->second.blob = true;
+  }
+  LOG(INFO, "load %u images with %ld KB from image store %s",
+      images_.size(), used_, root_.c_str());
+  Evict(garbage);
+  return true;
+}
+
+std::string ImageStore::GetKey(const std::string& uri,
+                               const std::string& digest) {
+  // fnv-1a of uri and digest
+  uint64_t hash = 14695981039346656037ULL;
+  std::string content = uri + "\n" + digest;
+  for (size_t index = 0; index < content.size(); ++index) {
+    hash ^= static_cast<unsigned char>(content[index]);
+    hash *= 1099511628211ULL;
+  }
+  char key[17];
+  snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+  return key;
+}
+
+std::string ImageStore::GetImageDir(const std::string& key) {
+  return root_ + "/" + key;
+}
+
+std::string ImageStore::GetFetchDir(const std::string& key) {
+  return root_ + "/" + key + ".fetching";
+}
+
+std::string ImageStore::GetSizeFile() {
+  return ".image_size";
+}
+
+std::string ImageStore::GetBlobPath(const std::string& key) {
+  return root_ + "/" + key + ".blob";
+}
+
+void ImageStore::GetBlobKeys(std::vector<std::string>* keys) {
+  std::map<std::string, ImageEntry>::iterator it = images_.begin();
+  for (; it != images_.end(); ++it) {
+    if (it->second.state == kImageReady && it->second.blob) {
+      keys->push_back(it->first);
+    }
+  }
+}
+
+ImageState ImageStore::Acquire(const std::string& key,
+                               const std::string& uri,
+                               const std::string& holder) {
+  std::map<std::string, ImageEntry>::iterator it = images_.find(key);
+  if (it == images_.end()) {
+    misses_++;
+    ImageEntry& entry = images_[key];
+    entry.key = key;
+    entry.uri = uri;
+    entry.state = kImageFetching;
+    entry.holders.insert(holder);
+    LOG(INFO, "image %s with uri %s is missing, container %s fetches it",
+        key.c_str(), uri.c_str(), holder.c_str());
+    return kImageMissing;
+  }
+  hits_++;
+  ImageEntry& entry = it->second;
+  if (entry.in_lru) {
+    lru_.erase(entry.lru_it);
+    entry.in_lru = false;
+  }
+  entry.holders.insert(holder);
+  LOG(INFO, "container %s hits image %s in state %d", holder.c_str(),
+      key.c_str(), entry.state);
+  return entry.state;
+}
+
+ImageState ImageStore::GetState(const std::string& key) {
+  std::map<std::string, ImageEntry>::iterator it = images_.find(key);
+  if (it == images_.end()) {
+    return kImageMissing;
+  }
+  return it->second.state;
+}
+
+void ImageStore::FetchDone(const std::string& key, bool ok,
+                           std::vector<std::string>* garbage) {
+  std::map<std::string, ImageEntry>::iterator it = images_.find(key);
+  if (it == images_.end() || it->second.state != kImageFetching) {
+    return;
+  }
+  ImageEntry& entry = it->second;
+  int64_t size = 0;
+  if (ok) {
+    std::ifstream size_file((GetImageDir(key) + "/" + GetSizeFile()).c_str());
+    ok = size_file.is_open() && (size_file >> size);
+  }
+  if (!ok) {
+    LOG(WARNING, "fail to fetch image %s with uri %s", key.c_str(),
+        entry.uri.c_str());
+    images_.erase(it);
+    garbage->push_back(MoveToGarbage(GetFetchDir(key)));
+    garbage->push_back(MoveToGarbage(GetBlobPath(key)));
+    return;
+  }
+  entry.state = kImageReady;
+  entry.size = size;
+  entry.blob = ::access(GetBlobPath(key).c_str(), R_OK) == 0;
+  used_ += size;
+  LOG(INFO, "fetch image %s with uri %s and %ld KB, %u containers hold it",
+      key.c_str(), entry.uri.c_str(), size, entry.holders.size());
+  // all the containers that wait for it have been deleted
+  if (entry.holders.empty()) {
+    entry.lru_it = lru_.insert(lru_.end(), key);
+    entry.in_lru = true;
+  }
+  Evict(garbage);
+}
+
+void ImageStore::Release(const std::string& key,
+                         const std::string& holder,
+                         std::vector<std::string>* garbage) {
+  std::map<std::string, ImageEntry>::iterator it = images_.find(key);
+  if (it == images_.end()) {
+    return;
+  }
+  ImageEntry& entry = it->second;
+  entry.holders.erase(holder);
+  if (!entry.holders.empty() || entry.in_lru) {
+    return;
+  }
+  // the fetching image is kept in the book until fetching is done
+  if (entry.state == kImageReady) {
+    entry.lru_it = lru_.insert(lru_.end(), key);
+    entry.in_lru = true;
+    Evict(garbage);
+  }
+}
+
+void ImageStore::Evict(std::vector<std::string>* garbage) {
+  while (used_ > budget_ && !lru_.empty()) {
+    std::string key = lru_.front();
+    lru_.pop_front();
+    std::map<std::string, ImageEntry>::iterator it = images_.find(key);
+    if (it == images_.end()) {
+      continue;
+    }
+    used_ -= it->second.size;
+    evictions_++;
+    LOG(INFO, "evict image %s with %ld KB, the store uses %ld KB",
+        key.c_str(), it->second.size, used_);
+    images_.erase(it);
+    garbage->push_back(MoveToGarbage(GetImageDir(key)));
+    garbage->push_back(MoveToGarbage(GetBlobPath(key)));
+  }
+}
+
+std::string ImageStore::MoveToGarbage(const std::string& dir) {
+  // rename it at once, so the same image can be fetched again while
+  // the old dir is being removed
+  std::string garbage = dir + ".gc." + boost::lexical_cast<std::string>(
+      ::baidu::common::timer::get_micros()) + "."
+      + boost::lexical_cast<std::string>(garbage_seq_++);
+  if (::rename(dir.c_str(), garbage.c_str()) != 0) {
+    if (errno == ENOENT) {
+      return "";
+    }
+    LOG(WARNING, "fail to rename %s for %s", dir.c_str(), strerror(errno));
+    return dir;
+  }
+  return garbage;
+}
+
+void ImageStore::GetStat(ImageCacheStat* stat) {
+  stat->set_hits(hits_);
+  stat->set_misses(misses_);
+  stat->set_evictions(evictions_);
+  stat->set_images(images_.size());
+  stat->set_used(used_);
+  stat->set_budget(budget_);
+}
+
+} // namespace dos
@@ -0,0 +1,101 @@
+#ifndef KERNEL_ENGINE_IMAGE_STORE_H
+#define KERNEL_ENGINE_IMAGE_STORE_H
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "proto/engine.pb.h"
+
+namespace dos {
+
+enum ImageState {
+  kImageMissing = 0,
+  kImageFetching,
+  kImageReady
+};
+
+struct ImageEntry {
+  std::string key;
+  std::string uri;
+  ImageState state;
+  // the containers that use the image
+  std::set<std::string> holders;
+  // the disk usage(KB) of image
+  int64_t size;
+  // the position in lru list when no container holds it
+  std::list<std::string>::iterator lru_it;
+  bool in_lru;
+  // the blob of image is kept to serve peers
+  bool blob;
+  ImageEntry():key(), uri(), state(kImageMissing),
+  holders(), size(0), lru_it(), in_lru(false), blob(false){}
+};
+
+// the node level store of unpacked images, an image is keyed by its uri
+// and digest, and it's fetched and unpacked once for all the containers
+// that use it. the images that no container holds are evicted in lru
+// order when the store goes beyond its disk budget.
+// the store only keeps the book, fetching image is done by image puller
+// and it's not thread safe, the engine guards it with its mutex
+class ImageStore {
+
+public:
+  // budget is the disk usage(KB) of store
+  ImageStore(const std::string& root, int64_t budget);
+  ~ImageStore();
+  // load the ready images left by last engine, the unfinished ones
+  // are returned in garbage
+  bool Init(std::vector<std::string>* garbage);
+  static std::string GetKey(const std::string& uri,
+                            const std::string& digest);
+  // the dir that ready image lives in
+  std::string GetImageDir(const std::string& key);
+  // the dir that image is fetched into, it's renamed to image dir
+  // when fetching is done
+  std::string GetFetchDir(const std::string& key);
+  // the file in image dir that records the disk usage of image
+  static std::string GetSizeFile();
+  // the bytes got from the uri of image, they are served to peers
+  std::string GetBlobPath(const std::string& key);
+  // the ready images that have blob
+  void GetBlobKeys(std::vector<std::string>* keys);
+
+  // hold the image for container, return the state before holding.
+  // the missing image turns to kImageFetching and the caller must fetch it
+  ImageState Acquire(const std::string& key,
+                     const std::string& uri,
+                     const std::string& holder);
+  ImageState GetState(const std::string& key);
+  // the failed image is dropped, the containers waiting for it
+  // see kImageMissing
+  void FetchDone(const std::string& key, bool ok,
+                 std::vector<std::string>* garbage);
+  void Release(const std::string& key,
+               const std::string& holder,
+               std::vector<std::string>* garbage);
+  void GetStat(ImageCacheStat* stat);
+private:
+  // evict the lru images until store is in budget, the dirs of them
+  // are renamed and returned in garbage to be removed, the empty
+  // path in garbage means nothing to remove
+  void Evict(std::vector<std::string>* garbage);
+  std::string MoveToGarbage(const std::string& dir);
+private:
+  std::string root_;
+  int64_t budget_;
+  std::map<std::string, ImageEntry> images_;
+  // the keys of images that no container holds, the front is the
+  // least recently used
+  std::list<std::string> lru_;
+  int64_t used_;
+  int64_t hits_;
+  int64_t misses_;
+  int64_t evictions_;
+  int64_t garbage_seq_;
+};
+
+} // namespace dos
+#endif
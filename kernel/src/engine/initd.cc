@@ -14,10 +14,10 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/bind.hpp>
 
-DECLARE_int32(ce_initd_process_wait_interval);
 DECLARE_string(ce_isolators);
 DECLARE_string(ce_initd_cgroup_root);
 DECLARE_string(ce_container_name);
+DECLARE_string(ce_initd_engine_endpoint);
 
 using ::baidu::common::INFO;
 using ::baidu::common::WARNING;
@@ -25,22 +25,72 @@ using ::baidu::common::DEBUG;
 
 namespace dos {
 
-InitdImpl::InitdImpl():tasks_(NULL), mutex_(), workers_(NULL),
-  proc_mgr_(NULL){
+InitdImpl::InitdImpl():tasks_(NULL), mutex_(),
+  proc_mgr_(NULL), rpc_client_(NULL), engine_(NULL), reaper_(NULL){
   tasks_ = new std::map<std::string, Process>();
-  workers_ = new ::baidu::common::ThreadPool(4);
   proc_mgr_ = new ProcessMgr();
+  rpc_client_ = new RpcClient();
+  reaper_ = new ChildReaper(boost::bind(&InitdImpl::HandleChildExit, this, _1, _2));
 }
 
 InitdImpl::~InitdImpl(){
-  delete workers_;
+  delete reaper_;
   delete tasks_;
+  delete engine_;
+  delete rpc_client_;
 }
 
 bool InitdImpl::Init() {
+  if (!reaper_->Start()) {
+    LOG(WARNING, "fail to start child reaper");
+    return false;
+  }
+  if (FLAGS_ce_initd_engine_endpoint.empty()) {
+    LOG(INFO, "notifying engine is disabled");
+    return true;
+  }
+  bool ok = rpc_client_->GetStub(FLAGS_ce_initd_engine_endpoint, &engine_);
+  if (!ok) {
+    LOG(WARNING, "fail to get engine stub with endpoint %s",
+        FLAGS_ce_initd_engine_endpoint.c_str());
+    return false;
+  }
   return true;
 }
 
+void InitdImpl::NotifyReady() {
+  NotifyEngine(kInitdReady, "");
+}
+
+void InitdImpl::NotifyEngine(const InitdEvent& event,
+                             const std::string& process) {
+  if (engine_ == NULL) {
+    return;
+  }
+  NotifyRequest* request = new NotifyRequest();
+  request->set_container(FLAGS_ce_container_name);
+  request->set_event(event);
+  request->set_process(process);
+  NotifyResponse* response = new NotifyResponse();
+  boost::function<void (const NotifyRequest*, NotifyResponse*, bool, int)> callback;
+  callback = boost::bind(&InitdImpl::NotifyEngineCallback, this, _1, _2, _3, _4);
+  rpc_client_->AsyncRequest(engine_, &Engine_Stub::Notify,
+                            request, response, callback, 5, 1);
+}
+
+void InitdImpl::NotifyEngineCallback(const NotifyRequest* request,
+                                     NotifyResponse* response,
+                                     bool failed, int) {
+  // engine finds the change by the status checking when notifying fails
+  if (failed || response->status() != kRpcOk) {
+    LOG(WARNING, "fail to notify engine event %s of process %s",
+        InitdEvent_Name(request->event()).c_str(),
+        request->process().c_str());
+  }
+  delete request;
+  delete response;
+}
+
 void InitdImpl::Fork(RpcController*,
                      const ForkRequest* request,
                      ForkResponse* response,
@@ -75,8 +125,8 @@ bool InitdImpl::Launch(const Process& process) {
     LOG(WARNING, "process name is empty");
     return false;
   }
-  bool ok = proc_mgr_->Exec(process);
-  if (!ok) {
+  int32_t pid = proc_mgr_->Exec(process);
+  if (pid <= 0) {
     LOG(WARNING, "fail to fork process name %s", process.name().c_str());
     return false;
   }else {
@@ -84,34 +134,33 @@ bool InitdImpl::Launch(const Process& process) {
   }
   Process copied_process;
   copied_process.CopyFrom(process);
+  copied_process.set_pid(pid);
   copied_process.set_running(true);
   tasks_->insert(std::make_pair(process.name(), copied_process));
-  workers_->DelayTask(FLAGS_ce_initd_process_wait_interval, boost::bind(&InitdImpl::CheckStatus, this,process.name()));
   return true;
 }
 
-void InitdImpl::CheckStatus(const std::string& name) {
-  ::baidu::common::MutexLock lock(&mutex_);
-  std::map<std::string, Process>::iterator it = tasks_->find(name);
-  if (it == tasks_->end()) {
-    LOG(WARNING, "fail to find task with name %s", name.c_str());
-    return;
-  }
-  dos::Process p;
-  bool ok = proc_mgr_->Wait(name, &p);
-  if (!ok) {
-    LOG(WARNING, "fail to wait task %s", name.c_str());
-    // clean task in proc_mgr;
-    proc_mgr_->Kill(name, 9);
-    return;
-  }
-  it->second.CopyFrom(p);
-  if (p.running()) {
-    workers_->DelayTask(FLAGS_ce_initd_process_wait_interval,
-                  boost::bind(&InitdImpl::CheckStatus, this, name));
-  }else {
-    LOG(INFO, "task with name %s is dead", name.c_str());
+void InitdImpl::HandleChildExit(int32_t pid, int32_t exit_code) {
+  std::string name;
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    std::map<std::string, Process>::iterator it = tasks_->begin();
+    for (; it != tasks_->end(); ++it) {
+      if (it->second.pid() == pid && it->second.running()) {
+        break;
+      }
+    }
+    if (it == tasks_->end()) {
+      // initd is the init of container, the orphans are reaped here too
+      LOG(DEBUG, "child %d does not belong to any task", pid);
+      return;
+    }
+    it->second.set_running(false);
+    it->second.set_exit_code(exit_code);
+    name = it->first;
   }
+  LOG(INFO, "task with name %s is dead with exit code %d", name.c_str(), exit_code);
+  NotifyEngine(kProcessExit, name);
 }
 
 void InitdImpl::Wait(RpcController* controller,
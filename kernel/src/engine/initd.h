@@ -5,6 +5,7 @@
 #define KERNEL_ENGINE_INITD_H
 
 #include "proto/initd.pb.h"
+#include "proto/engine.pb.h"
 
 #include <map>
 #include <set>
@@ -12,6 +13,8 @@
 #include "thread_pool.h"
 #include "engine/process_mgr.h"
 #include "engine/isolator.h"
+#include "engine/child_reaper.h"
+#include "rpc/rpc_client.h"
 
 using ::google::protobuf::RpcController;
 using ::google::protobuf::Closure;
@@ -40,15 +43,28 @@ public:
              const StatusRequest* request,
              StatusResponse* response,
              Closure* done);
+  // tell engine that initd is ready to serve, invoke it after
+  // the rpc server starts
+  void NotifyReady();
 private:
   bool Launch(const Process& Process);
-  void CheckStatus(const std::string& name);
+  // the child reaper passes the exit of every child here, the exit of
+  // task is pushed to engine at once
+  void HandleChildExit(int32_t pid, int32_t exit_code);
   void AttachPid(int32_t pid);
+  // push the event to engine, the fsm of container checks the state
+  // once it receives the event
+  void NotifyEngine(const InitdEvent& event, const std::string& process);
+  void NotifyEngineCallback(const NotifyRequest* request,
+                            NotifyResponse* response,
+                            bool failed, int error);
 private:
   std::map<std::string, Process>* tasks_;
   ::baidu::common::Mutex mutex_;
-  ::baidu::common::ThreadPool* workers_; 
   ProcessMgr* proc_mgr_;
+  RpcClient* rpc_client_;
+  Engine_Stub* engine_;
+  ChildReaper* reaper_;
 };
 
 } // namespace dos
@@ -0,0 +1,130 @@
+#include "engine/layer_fetcher.h"
+
+#include <algorithm>
+#include <gflags/gflags.h>
+#include "logging.h"
+#include "timer.h"
+
+DECLARE_int32(ce_layer_chunk_size);
+
+using ::baidu::common::INFO;
+using ::baidu::common::WARNING;
+using ::baidu::common::DEBUG;
+
+namespace dos {
+
+LayerFetcher::LayerFetcher(const std::string& origin,
+                           const std::vector<std::string>& peers):origin_(origin),
+  peers_(peers),
+  failed_(peers.size(), false),
+  next_peer_(0),
+  current_peer_(0),
+  current_(NULL),
+  from_origin_(peers.empty()),
+  offset_(0),
+  chunk_end_(-1),
+  total_(-1),
+  peer_bytes_(0),
+  origin_bytes_(0){
+  // the engines that pull the same layer start at different peers
+  if (!peers_.empty()) {
+    next_peer_ = ::baidu::common::timer::get_micros() % peers_.size();
+  }
+}
+
+LayerFetcher::~LayerFetcher() {
+  delete current_;
+}
+
+bool LayerFetcher::Open(int64_t* length) {
+  if (!OpenNext()) {
+    return false;
+  }
+  if (from_origin_) {
+    return current_->Open(length);
+  }
+  *length = total_;
+  return true;
+}
+
+bool LayerFetcher::OpenNext() {
+  delete current_;
+  current_ = NULL;
+  int64_t chunk_size = static_cast<int64_t>(FLAGS_ce_layer_chunk_size) * 1024;
+  for (size_t tries = 0; !from_origin_ && tries < peers_.size(); ++tries) {
+    size_t index = next_peer_++ % peers_.size();
+    if (failed_[index]) {
+      continue;
+    }
+    int64_t end = offset_ + chunk_size - 1;
+    if (total_ >= 0) {
+      end = std::min(end, total_ - 1);
+    }
+    HttpSource* source = new HttpSource(peers_[index], offset_, end);
+    int64_t length = -1;
+    // the peer must hold the whole layer, and all peers hold the same one
+    if (source->Open(&length) && source->IsPartial() && source->GetTotal() > 0
+        && (total_ < 0 || source->GetTotal() == total_)) {
+      total_ = source->GetTotal();
+      current_ = source;
+      current_peer_ = index;
+      chunk_end_ = std::min(end, total_ - 1);
+      LOG(DEBUG, "get bytes [%ld, %ld] of %s from peer %s", offset_, chunk_end_,
+          origin_.c_str(), peers_[index].c_str());
+      return true;
+    }
+    LOG(WARNING, "peer %s fails to serve %s", peers_[index].c_str(), origin_.c_str());
+    failed_[index] = true;
+    delete source;
+  }
+  if (!from_origin_) {
+    LOG(INFO, "no peer serves %s, fall back to origin at offset %ld",
+        origin_.c_str(), offset_);
+    from_origin_ = true;
+  }
+  current_ = ByteSource::Create(origin_, offset_);
+  if (current_ == NULL) {
+    return false;
+  }
+  // the origin of the first chunk is opened by Open
+  if (offset_ == 0 && total_ < 0) {
+    return true;
+  }
+  int64_t length = -1;
+  return current_->Open(&length);
+}
+
+int64_t LayerFetcher::Read(char* buf, size_t size) {
+  while (true) {
+    if (current_ == NULL) {
+      if (total_ >= 0 && offset_ >= total_) {
+        return 0;
+      }
+      if (!OpenNext()) {
+        return -1;
+      }
+    }
+    int64_t n = current_->Read(buf, size);
+    if (n > 0) {
+      offset_ += n;
+      if (from_origin_) {
+        origin_bytes_ += n;
+      } else {
+        peer_bytes_ += n;
+      }
+      return n;
+    }
+    if (from_origin_) {
+      return n;
+    }
+    delete current_;
+    current_ = NULL;
+    if (n < 0 || offset_ != chunk_end_ + 1) {
+      LOG(WARNING, "peer %s breaks at offset %ld of %s",
+          peers_[current_peer_].c_str(), offset_, origin_.c_str());
+      failed_[current_peer_] = true;
+    }
+  }
+}
+
+} // namespace dos
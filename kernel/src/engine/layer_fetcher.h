@@ -1,13 +1,51 @@
 #ifndef KERNEL_ENGINE_LAYER_FETCHER_H
 #define KERNEL_ENGINE_LAYER_FETCHER_H
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "engine/image_puller.h"
+
 namespace dos {
 
-class LayerFetcher {
+// the bytes of a layer pulled from the peers that hold it. the layer is
+// got in chunks by http range, every chunk goes to the next peer so the
+// load spreads over peers, a failed peer is never used again and the
+// rest bytes come from origin when no peer works
+class LayerFetcher : public ByteSource {
 
 public:
-  bool Pull(const std::string& layer_id)
+  // peers are the uris of layer in the layer servers of peers
+  LayerFetcher(const std::string& origin,
+               const std::vector<std::string>& peers);
+  ~LayerFetcher();
+  bool Open(int64_t* length);
+  int64_t Read(char* buf, size_t size);
+  int64_t GetPeerBytes() const {
+    return peer_bytes_;
+  }
+  int64_t GetOriginBytes() const {
+    return origin_bytes_;
+  }
+private:
+  // open the chunk at offset on the next peer, or open origin
+  bool OpenNext();
+private:
+  std::string origin_;
+  std::vector<std::string> peers_;
+  std::vector<bool> failed_;
+  size_t next_peer_;
+  size_t current_peer_;
+  ByteSource* current_;
+  bool from_origin_;
+  int64_t offset_;
+  // the last byte of current chunk
+  int64_t chunk_end_;
+  // the size of layer, -1 when it's unknown
+  int64_t total_;
+  int64_t peer_bytes_;
+  int64_t origin_bytes_;
 };
 
-}
+} // namespace dos
 #endif
@@ -0,0 +1,167 @@
+#include "engine/layer_mgr.h"
+
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <gflags/gflags.h>
+#include "logging.h"
+
+DECLARE_string(ins_servers);
+DECLARE_string(my_ip);
+DECLARE_string(dos_root_path);
+DECLARE_string(master_endpoint);
+DECLARE_int32(ce_layer_port);
+DECLARE_int32(ce_layer_serve_threads);
+DECLARE_string(ce_layer_tracker);
+DECLARE_int32(ce_layer_announce_interval);
+
+using ::baidu::common::INFO;
+using ::baidu::common::WARNING;
+using ::baidu::common::DEBUG;
+
+namespace dos {
+
+LayerMgr::LayerMgr(const LayerLookup& lookup,
+                   const LayerList& list):mutex_(),
+  lookup_(lookup),
+  list_(list),
+  server_(NULL),
+  endpoint_(),
+  rpc_client_(NULL),
+  tracker_addr_(),
+  tracker_(NULL),
+  ins_(NULL),
+  ins_watcher_(NULL),
+  thread_pool_(NULL){
+  rpc_client_ = new RpcClient();
+  thread_pool_ = new ::baidu::common::ThreadPool(1);
+}
+
+LayerMgr::~LayerMgr() {
+  thread_pool_->Stop(true);
+  delete thread_pool_;
+  delete server_;
+  delete ins_watcher_;
+  delete ins_;
+  delete tracker_;
+  delete rpc_client_;
+}
+
+bool LayerMgr::Start() {
+  if (FLAGS_ce_layer_port >= 0) {
+    server_ = new LayerServer(lookup_, FLAGS_ce_layer_serve_threads);
+    if (!server_->Start(FLAGS_ce_layer_port)) {
+      LOG(WARNING, "fail to start layer server");
+      return false;
+    }
+    std::string ip = FLAGS_my_ip;
+    if (ip.empty()) {
+      char hostname[256] = {0};
+      ::gethostname(hostname, sizeof(hostname) - 1);
+      ip = hostname;
+    }
+    endpoint_ = ip + ":" + boost::lexical_cast<std::string>(server_->GetPort());
+  }
+  if (!FLAGS_ce_layer_tracker.empty()) {
+    HandleTrackerChange(FLAGS_ce_layer_tracker);
+  } else if (!FLAGS_ins_servers.empty()) {
+    // the tracker lives in master
+    ins_ = new InsSDK(FLAGS_ins_servers);
+    ins_watcher_ = new InsWatcher(FLAGS_dos_root_path + FLAGS_master_endpoint, ins_,
+                                  boost::bind(&LayerMgr::HandleTrackerChange, this, _1));
+    if (!ins_watcher_->Watch()) {
+      LOG(WARNING, "fail to watch master endpoint for layer tracker");
+      return false;
+    }
+  } else {
+    LOG(WARNING, "no layer tracker, layers are pulled from origin only");
+    return true;
+  }
+  if (server_ != NULL) {
+    thread_pool_->AddTask(boost::bind(&LayerMgr::Announce, this));
+  }
+  return true;
+}
+
+void LayerMgr::HandleTrackerChange(const std::string& endpoint) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  if (tracker_ != NULL) {
+    delete tracker_;
+    tracker_ = NULL;
+  }
+  tracker_addr_ = "";
+  LOG(INFO, "connect to layer tracker %s", endpoint.c_str());
+  if (!rpc_client_->GetStub(endpoint, &tracker_)) {
+    LOG(WARNING, "fail to build layer tracker stub");
+    return;
+  }
+  tracker_addr_ = endpoint;
+}
+
+void LayerMgr::GetPeers(const std::string& key, std::vector<std::string>* peers) {
+  GetLayerPeersRequest request;
+  std::string tracker_addr;
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    if (tracker_ == NULL) {
+      return;
+    }
+    tracker_addr = tracker_addr_;
+    request.set_key(key);
+    request.set_endpoint(endpoint_);
+  }
+  // the mutex is not held during the request, so a slow tracker does not
+  // block the others, and tracker_ may be replaced by then, so send with
+  // a stub of this call
+  Master_Stub* tracker = NULL;
+  if (!rpc_client_->GetStub(tracker_addr, &tracker)) {
+    LOG(WARNING, "fail to build stub of layer tracker %s", tracker_addr.c_str());
+    return;
+  }
+  GetLayerPeersResponse response;
+  bool rpc_ok = rpc_client_->SendRequest(tracker, &Master_Stub::GetLayerPeers,
+                                         &request, &response, 2, 1);
+  delete tracker;
+  if (!rpc_ok || response.status() != kRpcOk) {
+    LOG(WARNING, "fail to get peers of layer %s", key.c_str());
+    return;
+  }
+  for (int32_t index = 0; index < response.peers_size(); ++index) {
+    peers->push_back("http://" + response.peers(index) + LayerServer::GetLayerPath(key));
+  }
+  LOG(INFO, "layer %s has %u peers", key.c_str(), peers->size());
+}
+
+void LayerMgr::Announce() {
+  std::vector<std::string> keys;
+  list_(&keys);
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    if (tracker_ != NULL) {
+      AnnounceLayersRequest* request = new AnnounceLayersRequest();
+      AnnounceLayersResponse* response = new AnnounceLayersResponse();
+      request->set_endpoint(endpoint_);
+      for (size_t index = 0; index < keys.size(); ++index) {
+        request->add_keys(keys[index]);
+      }
+      boost::function<void (const AnnounceLayersRequest*, AnnounceLayersResponse*, bool, int)> callback;
+      callback = boost::bind(&LayerMgr::AnnounceCallback, this, _1, _2, _3, _4);
+      rpc_client_->AsyncRequest(tracker_, &Master_Stub::AnnounceLayers,
+                                request, response, callback, 5, 1);
+    }
+  }
+  thread_pool_->DelayTask(FLAGS_ce_layer_announce_interval,
+                          boost::bind(&LayerMgr::Announce, this));
+}
+
+void LayerMgr::AnnounceCallback(const AnnounceLayersRequest* request,
+                                AnnounceLayersResponse* response,
+                                bool failed, int) {
+  if (failed || response->status() != kRpcOk) {
+    LOG(WARNING, "fail to announce %d layers to tracker", request->keys_size());
+  }
+  delete request;
+  delete response;
+}
+
+} // namespace dos
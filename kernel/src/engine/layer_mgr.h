@@ -0,0 +1,62 @@
+#ifndef KERNEL_ENGINE_LAYER_MGR_H
+#define KERNEL_ENGINE_LAYER_MGR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include "common/ins_watcher.h"
+#include "engine/layer_server.h"
+#include "mutex.h"
+#include "proto/master.pb.h"
+#include "rpc/rpc_client.h"
+#include "thread_pool.h"
+
+namespace dos {
+
+// list the layers that can be served to peers
+typedef boost::function<void (std::vector<std::string>* keys)> LayerList;
+
+// the engine side of dlfs, see doc/dlfs.md. it serves the layers in
+// image store to peers, announces them to the tracker in master and
+// finds the peers of a layer before pulling it
+class LayerMgr {
+
+public:
+  LayerMgr(const LayerLookup& lookup, const LayerList& list);
+  ~LayerMgr();
+  bool Start();
+  // the layers are kept for peers only when layer server runs
+  bool IsServing() const {
+    return server_ != NULL;
+  }
+  // get the uris of layer on peers, empty when no tracker is reachable
+  void GetPeers(const std::string& key, std::vector<std::string>* peers);
+  int64_t GetServedBytes() const {
+    return server_ == NULL ? 0 : server_->GetServedBytes();
+  }
+private:
+  void Announce();
+  void AnnounceCallback(const AnnounceLayersRequest* request,
+                        AnnounceLayersResponse* response,
+                        bool failed, int error);
+  // the master changes
+  void HandleTrackerChange(const std::string& endpoint);
+private:
+  ::baidu::common::Mutex mutex_;
+  LayerLookup lookup_;
+  LayerList list_;
+  LayerServer* server_;
+  // the endpoint of layer server that peers connect to
+  std::string endpoint_;
+  RpcClient* rpc_client_;
+  // the endpoint of tracker, empty when there is no tracker stub
+  std::string tracker_addr_;
+  Master_Stub* tracker_;
+  InsSDK* ins_;
+  InsWatcher* ins_watcher_;
+  ::baidu::common::ThreadPool* thread_pool_;
+};
+
+} // namespace dos
+#endif
@@ -0,0 +1,239 @@
+#include "engine/layer_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include "logging.h"
+
+using ::baidu::common::INFO;
+using ::baidu::common::WARNING;
+using ::baidu::common::DEBUG;
+
+namespace dos {
+
+const static size_t kMaxRequestSize = 8192;
+const static int32_t kServeTimeout = 30;
+
+LayerServer::LayerServer(const LayerLookup& lookup,
+                         int32_t threads):lookup_(lookup),
+  listen_fd_(-1),
+  port_(0),
+  running_(false),
+  served_bytes_(0),
+  accept_pool_(NULL),
+  serve_pool_(NULL){
+  accept_pool_ = new ::baidu::common::ThreadPool(1);
+  serve_pool_ = new ::baidu::common::ThreadPool(threads);
+}
+
+LayerServer::~LayerServer() {
+  Stop();
+  delete accept_pool_;
+  delete serve_pool_;
+  if (listen_fd_ >= 0) {
+    ::close(listen_fd_);
+  }
+}
+
+std::string LayerServer::GetLayerPath(const std::string& key) {
+  return "/layers/" + key;
+}
+
+bool LayerServer::Start(int32_t port) {
+  listen_fd_ = ::socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    LOG(WARNING, "fail to create layer server socket for %s", strerror(errno));
+    return false;
+  }
+  int on = 1;
+  ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  // accept ipv4 peers on the same socket
+  int off = 0;
+  ::setsockopt(listen_fd_, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  struct sockaddr_in6 addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (::bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+      || ::listen(listen_fd_, 128) != 0) {
+    LOG(WARNING, "fail to listen layer server on port %d for %s", port, strerror(errno));
+    return false;
+  }
+  socklen_t len = sizeof(addr);
+  ::getsockname(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), &len);
+  port_ = ntohs(addr.sin6_port);
+  running_ = true;
+  accept_pool_->AddTask(boost::bind(&LayerServer::AcceptLoop, this));
+  LOG(INFO, "start layer server on port %d", port_);
+  return true;
+}
+
+void LayerServer::Stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  // wake up accept
+  ::shutdown(listen_fd_, SHUT_RDWR);
+  accept_pool_->Stop(true);
+  serve_pool_->Stop(true);
+}
+
+void LayerServer::AcceptLoop() {
+  while (running_) {
+    int conn = ::accept4(listen_fd_, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0) {
+      if (errno != EINTR && errno != ECONNABORTED && running_) {
+        LOG(WARNING, "fail to accept peer for %s", strerror(errno));
+        // avoid spinning on running out of fds
+        ::usleep(100 * 1000);
+      }
+      continue;
+    }
+    serve_pool_->AddTask(boost::bind(&LayerServer::Serve, this, conn));
+  }
+}
+
+void LayerServer::Serve(int conn) {
+  struct timeval timeout;
+  timeout.tv_sec = kServeTimeout;
+  timeout.tv_usec = 0;
+  ::setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  ::setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  std::string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    if (request.size() > kMaxRequestSize) {
+      ::close(conn);
+      return;
+    }
+    ssize_t n = ::recv(conn, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      ::close(conn);
+      return;
+    }
+    request.append(buf, n);
+  }
+  std::vector<std::string> lines;
+  boost::split(lines, request, boost::is_any_of("\n"));
+  std::vector<std::string> parts;
+  boost::split(parts, boost::trim_copy(lines[0]), boost::is_any_of(" "));
+  const std::string prefix = GetLayerPath("");
+  if (parts.size() != 3 || parts[0] != "GET" || !boost::starts_with(parts[1], prefix)) {
+    SendError(conn, 400, "Bad Request");
+    return;
+  }
+  std::string key = parts[1].substr(prefix.size());
+  std::string path;
+  // the key of layer has no path separator
+  if (key.empty() || key.find('/') != std::string::npos
+      || key.find("..") != std::string::npos || !lookup_(key, &path)) {
+    SendError(conn, 404, "Not Found");
+    return;
+  }
+  int64_t start = 0;
+  int64_t end = -1;
+  bool ranged = false;
+  for (size_t index = 1; index < lines.size(); ++index) {
+    std::string line = boost::trim_copy(lines[index]);
+    if (!boost::istarts_with(line, "range:")) {
+      continue;
+    }
+    std::string range = boost::trim_copy(line.substr(6));
+    if (!boost::starts_with(range, "bytes=")
+        || sscanf(range.c_str() + 6, "%ld-%ld", &start, &end) < 1) {
+      SendError(conn, 416, "Range Not Satisfiable");
+      return;
+    }
+    ranged = true;
+  }
+  // the file opened is kept even if the layer is evicted while serving
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st) != 0) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    SendError(conn, 404, "Not Found");
+    return;
+  }
+  int64_t size = st.st_size;
+  if (end < 0 || end >= size) {
+    end = size - 1;
+  }
+  if (start < 0 || start > end) {
+    ::close(fd);
+    SendError(conn, 416, "Range Not Satisfiable");
+    return;
+  }
+  std::string header;
+  int64_t length = end - start + 1;
+  if (ranged) {
+    header = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes "
+             + boost::lexical_cast<std::string>(start) + "-"
+             + boost::lexical_cast<std::string>(end) + "/"
+             + boost::lexical_cast<std::string>(size) + "\r\n";
+  } else {
+    header = "HTTP/1.1 200 OK\r\n";
+  }
+  header += "Content-Length: " + boost::lexical_cast<std::string>(length)
+            + "\r\nContent-Type: application/octet-stream\r\nConnection: close\r\n\r\n";
+  if (SendAll(conn, header)) {
+    off_t offset = start;
+    while (length > 0) {
+      ssize_t n = ::sendfile(conn, fd, &offset, std::min(length, static_cast<int64_t>(1 << 20)));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        LOG(WARNING, "fail to send layer %s for %s", key.c_str(), strerror(errno));
+        break;
+      }
+      length -= n;
+      __sync_fetch_and_add(&served_bytes_, n);
+    }
+  }
+  LOG(DEBUG, "serve bytes [%ld, %ld] of layer %s", start, end, key.c_str());
+  ::close(fd);
+  ::close(conn);
+}
+
+void LayerServer::SendError(int conn, int32_t code, const std::string& reason) {
+  std::string response = "HTTP/1.1 " + boost::lexical_cast<std::string>(code)
+                         + " " + reason + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  SendAll(conn, response);
+  ::close(conn);
+}
+
+bool LayerServer::SendAll(int conn, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = ::send(conn, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+} // namespace dos
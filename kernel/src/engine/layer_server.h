@@ -0,0 +1,48 @@
+#ifndef KERNEL_ENGINE_LAYER_SERVER_H
+#define KERNEL_ENGINE_LAYER_SERVER_H
+
+#include <stdint.h>
+#include <string>
+#include <boost/function.hpp>
+#include "thread_pool.h"
+
+namespace dos {
+
+// get the path of layer blob by key, return false when it's not held
+typedef boost::function<bool (const std::string& key, std::string* path)> LayerLookup;
+
+// serve the layer blobs to peers by http, GET /layers/<key> with an
+// optional range. a layer is served as the bytes that are got from its
+// origin uri, so the peers unpack and check it in the same way
+class LayerServer {
+
+public:
+  LayerServer(const LayerLookup& lookup, int32_t threads);
+  ~LayerServer();
+  // port 0 picks a free port
+  bool Start(int32_t port);
+  void Stop();
+  int32_t GetPort() const {
+    return port_;
+  }
+  int64_t GetServedBytes() const {
+    return served_bytes_;
+  }
+  static std::string GetLayerPath(const std::string& key);
+private:
+  void AcceptLoop();
+  void Serve(int conn);
+  void SendError(int conn, int32_t code, const std::string& reason);
+  bool SendAll(int conn, const std::string& data);
+private:
+  LayerLookup lookup_;
+  int listen_fd_;
+  int32_t port_;
+  volatile bool running_;
+  volatile int64_t served_bytes_;
+  ::baidu::common::ThreadPool* accept_pool_;
+  ::baidu::common::ThreadPool* serve_pool_;
+};
+
+} // namespace dos
+#endif
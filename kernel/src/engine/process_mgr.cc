@@ -9,6 +9,7 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <signal.h>
 #include <sys/mount.h>
 #include <pwd.h>
 #include <sys/ioctl.h>
@@ -38,6 +39,10 @@ int ProcessMgr::LaunchProcess(void* args) {
     int fd = *fd_it;
     ::close(fd);
   }
+  // the engine blocks SIGCHLD for its child reaper
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigprocmask(SIG_SETMASK, &mask, NULL);
   char* argv[] = {
       const_cast<char*>("dsh"),
       const_cast<char*>("-f"),
@@ -96,6 +101,10 @@ int32_t ProcessMgr::Exec(const Process& process) {
     for (; fd_it !=  openfds.end(); ++fd_it) {
       close(*fd_it);
     }
+    // the initd blocks SIGCHLD for its child reaper
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
     char* args[] = {
       const_cast<char*>("dsh"),
       const_cast<char*>("-f"),
@@ -0,0 +1,157 @@
+// compare how soon initd finds the exit of its tasks, initd used to
+// wait every task with waitpid in a delay task of
+// ce_initd_process_wait_interval, now the child reaper finds the exits
+// by signalfd and initd pushes them to engine at once
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <boost/bind.hpp>
+#include "engine/child_reaper.h"
+#include "logging.h"
+#include "mutex.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+const int32_t kTasks = 200;
+// the tasks exit in [0, kMaxLifetime) ms after they are forked
+const int32_t kMaxLifetime = 3000;
+// the default of ce_initd_process_wait_interval before tasks are reaped
+const int32_t kWaitInterval = 1000;
+
+enum WaitMode {
+  kDelayWait,
+  kChildReaper
+};
+
+struct BenchContext {
+  ::baidu::common::Mutex mutex;
+  ::baidu::common::CondVar cond;
+  ::baidu::common::ThreadPool* pool;
+  // the time(us) every task exits, it's written by the tasks
+  volatile int64_t* exited;
+  // pid and index of the tasks that have not been found
+  std::map<int32_t, int32_t> running;
+  // the time(us) the exit of every task is found
+  std::vector<int64_t> found;
+  BenchContext():mutex(), cond(&mutex), pool(NULL), exited(NULL),
+    running(), found(){}
+};
+
+static void Found(BenchContext* ctx, int32_t pid) {
+  ::baidu::common::MutexLock lock(&ctx->mutex);
+  std::map<int32_t, int32_t>::iterator it = ctx->running.find(pid);
+  if (it == ctx->running.end()) {
+    return;
+  }
+  ctx->found[it->second] = ::baidu::common::timer::get_micros();
+  ctx->running.erase(it);
+  if (ctx->running.empty()) {
+    ctx->cond.Signal();
+  }
+}
+
+// the way initd checked its tasks before
+static void DelayWait(BenchContext* ctx, int32_t pid) {
+  int status = 0;
+  if (::waitpid(pid, &status, WNOHANG) == pid) {
+    Found(ctx, pid);
+    return;
+  }
+  ctx->pool->DelayTask(kWaitInterval, boost::bind(&DelayWait, ctx, pid));
+}
+
+static void ChildExit(BenchContext* ctx, int32_t pid, int32_t) {
+  Found(ctx, pid);
+}
+
+static int64_t Percentile(std::vector<int64_t>& values, double percent) {
+  size_t index = static_cast<size_t>(values.size() * percent);
+  if (index >= values.size()) {
+    index = values.size() - 1;
+  }
+  return values[index];
+}
+
+// return false when a task fails to fork
+static bool Run(WaitMode mode) {
+  BenchContext ctx;
+  ctx.pool = new ::baidu::common::ThreadPool(4);
+  ctx.exited = static_cast<int64_t*>(::mmap(NULL, sizeof(int64_t) * kTasks,
+                                            PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+  if (ctx.exited == MAP_FAILED) {
+    fprintf(stderr, "fail to map shared memory\n");
+    return false;
+  }
+  ctx.found.resize(kTasks, 0);
+  dos::ChildReaper reaper(boost::bind(&ChildExit, &ctx, _1, _2));
+  if (mode == kChildReaper && !reaper.Start()) {
+    fprintf(stderr, "fail to start child reaper\n");
+    return false;
+  }
+  srand(kTasks);
+  {
+    // the reaper waits for the mutex until the task is recorded
+    ::baidu::common::MutexLock lock(&ctx.mutex);
+    for (int32_t index = 0; index < kTasks; ++index) {
+      int32_t lifetime = rand() % kMaxLifetime;
+      pid_t pid = ::fork();
+      if (pid < 0) {
+        fprintf(stderr, "fail to fork task %d\n", index);
+        return false;
+      }
+      if (pid == 0) {
+        usleep(lifetime * 1000);
+        ctx.exited[index] = ::baidu::common::timer::get_micros();
+        _exit(0);
+      }
+      ctx.running[pid] = index;
+      if (mode == kDelayWait) {
+        ctx.pool->DelayTask(kWaitInterval, boost::bind(&DelayWait, &ctx, pid));
+      }
+    }
+    while (!ctx.running.empty()) {
+      ctx.cond.Wait();
+    }
+  }
+  reaper.Stop();
+  ctx.pool->Stop(false);
+  delete ctx.pool;
+  std::vector<int64_t> delays;
+  for (int32_t index = 0; index < kTasks; ++index) {
+    delays.push_back(ctx.found[index] - ctx.exited[index]);
+  }
+  ::munmap(const_cast<int64_t*>(ctx.exited), sizeof(int64_t) * kTasks);
+  std::sort(delays.begin(), delays.end());
+  int64_t total = 0;
+  for (size_t index = 0; index < delays.size(); ++index) {
+    total += delays[index];
+  }
+  fprintf(stdout, "%-13s: exit to found ms avg %.2f p50 %.2f p99 %.2f max %.2f\n",
+          mode == kDelayWait ? "delay wait" : "child reaper",
+          total / 1000.0 / delays.size(),
+          Percentile(delays, 0.5) / 1000.0,
+          Percentile(delays, 0.99) / 1000.0,
+          delays.back() / 1000.0);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  ::baidu::common::SetLogLevel(::baidu::common::FATAL);
+  // the reaper needs SIGCHLD blocked before any thread starts
+  if (!dos::ChildReaper::BlockSignal()) {
+    return 1;
+  }
+  fprintf(stdout, "%d tasks exit in %d ms, wait interval %d ms\n",
+          kTasks, kMaxLifetime, kWaitInterval);
+  if (!Run(kDelayWait) || !Run(kChildReaper)) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,349 @@
+#include "engine/image_puller.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <fstream>
+#include <sstream>
+#include <boost/lexical_cast.hpp>
+#include "engine/utils.h"
+#include "gtest/gtest.h"
+
+namespace dos {
+
+static void AppendEntry(std::string* tar, const std::string& name,
+                        char type, const std::string& content,
+                        const std::string& link) {
+  char header[512];
+  memset(header, 0, sizeof(header));
+  strncpy(header, name.c_str(), 100);
+  snprintf(header + 100, 8, "%07o", 0644);
+  snprintf(header + 108, 8, "%07o", 0);
+  snprintf(header + 116, 8, "%07o", 0);
+  snprintf(header + 124, 12, "%011o", static_cast<unsigned int>(content.size()));
+  snprintf(header + 136, 12, "%011o", 1400000000);
+  header[156] = type;
+  strncpy(header + 157, link.c_str(), 100);
+  memcpy(header + 257, "ustar\0" "00", 8);
+  memset(header + 148, ' ', 8);
+  unsigned int sum = 0;
+  for (size_t index = 0; index < sizeof(header); ++index) {
+    sum += static_cast<unsigned char>(header[index]);
+  }
+  snprintf(header + 148, 8, "%06o", sum);
+  tar->append(header, sizeof(header));
+  tar->append(content);
+  tar->append((512 - content.size() % 512) % 512, '\0');
+}
+
+static std::string Gzip(const std::string& data) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&zs, data.size()) + 64, '\0');
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  zs.avail_in = data.size();
+  zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  zs.avail_out = out.size();
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+static std::string ReadFile(const std::string& path) {
+  std::ifstream file(path.c_str());
+  std::stringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+// a http server on localhost that serves one body for every request
+class LocalHttpServer {
+
+public:
+  LocalHttpServer(const std::string& body, bool chunked):body_(body),
+    chunked_(chunked), fd_(-1), port_(0), requests_(0){
+    fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    ::bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd_, reinterpret_cast<struct sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    ::listen(fd_, 8);
+    pthread_create(&thread_, NULL, &LocalHttpServer::Run, this);
+  }
+
+  ~LocalHttpServer() {
+    ::shutdown(fd_, SHUT_RDWR);
+    pthread_join(thread_, NULL);
+    ::close(fd_);
+  }
+
+  std::string GetUri(const std::string& path) {
+    return "http://127.0.0.1:" + boost::lexical_cast<std::string>(port_) + path;
+  }
+
+  int32_t GetRequests() {
+    return requests_;
+  }
+
+private:
+  static void* Run(void* args) {
+    LocalHttpServer* server = static_cast<LocalHttpServer*>(args);
+    while (true) {
+      int conn = ::accept(server->fd_, NULL, NULL);
+      if (conn < 0) {
+        break;
+      }
+      server->Serve(conn);
+      ::close(conn);
+    }
+    return NULL;
+  }
+
+  void Serve(int conn) {
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos) {
+      ssize_t n = ::recv(conn, buf, sizeof(buf), 0);
+      if (n <= 0) {
+        return;
+      }
+      request.append(buf, n);
+    }
+    requests_++;
+    std::string response;
+    // the old path is redirected to the image
+    if (request.find("GET /old ") == 0) {
+      response = "HTTP/1.1 302 Found\r\nLocation: /image.tar.gz\r\n"
+                 "Content-Length: 0\r\n\r\n";
+    } else if (request.find("GET /image.tar.gz ") != 0) {
+      response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    } else if (chunked_) {
+      response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+      for (size_t pos = 0; pos < body_.size(); pos += 1000) {
+        std::string chunk = body_.substr(pos, 1000);
+        char size[32];
+        snprintf(size, sizeof(size), "%zx;ext=1\r\n", chunk.size());
+        response += size + chunk + "\r\n";
+      }
+      response += "0\r\nX-Trailer: 1\r\n\r\n";
+    } else {
+      response = "HTTP/1.1 200 OK\r\nContent-Length: "
+                 + boost::lexical_cast<std::string>(body_.size())
+                 + "\r\n\r\n" + body_;
+    }
+    size_t sent = 0;
+    while (sent < response.size()) {
+      ssize_t n = ::send(conn, response.data() + sent, response.size() - sent,
+                         MSG_NOSIGNAL);
+      if (n <= 0) {
+        return;
+      }
+      sent += n;
+    }
+  }
+
+private:
+  std::string body_;
+  bool chunked_;
+  int fd_;
+  int32_t port_;
+  volatile int32_t requests_;
+  pthread_t thread_;
+};
+
+class ImagePullerTest : public ::testing::Test {
+
+public:
+  ImagePullerTest(){}
+  ~ImagePullerTest(){}
+protected:
+  void SetUp() {
+    char dir[] = "/tmp/image_puller_test.XXXXXX";
+    ASSERT_TRUE(::mkdtemp(dir) != NULL);
+    dir_ = dir;
+    // a file bigger than the chunk of puller
+    big_.resize(300 * 1024);
+    for (size_t index = 0; index < big_.size(); ++index) {
+      big_[index] = static_cast<char>(rand() % 256);
+    }
+    AppendEntry(&tar_, "rootfs/", '5', "", "");
+    AppendEntry(&tar_, "rootfs/bin/sh", '0', "#!/bin/sh\n", "");
+    AppendEntry(&tar_, "rootfs/data/big", '0', big_, "");
+    AppendEntry(&tar_, "rootfs/bin/bash", '2', "", "sh");
+    tar_.append(1024, '\0');
+  }
+
+  void TearDown() {
+    RemoveRecur(dir_);
+  }
+
+  void CheckRootfs(const std::string& dir) {
+    EXPECT_EQ("#!/bin/sh\n", ReadFile(dir + "/rootfs/bin/sh"));
+    EXPECT_TRUE(big_ == ReadFile(dir + "/rootfs/data/big"));
+    char link[64] = {0};
+    EXPECT_EQ(2, ::readlink((dir + "/rootfs/bin/bash").c_str(), link, sizeof(link)));
+    EXPECT_STREQ("sh", link);
+    struct stat st;
+    ASSERT_EQ(0, ::stat((dir + "/rootfs/bin/sh").c_str(), &st));
+    EXPECT_EQ(0644, static_cast<int>(st.st_mode & 07777));
+    EXPECT_EQ(1400000000, st.st_mtime);
+  }
+
+  std::string dir_;
+  std::string big_;
+  std::string tar_;
+};
+
+TEST_F(ImagePullerTest, PullGzipWithContentLength) {
+  std::string body = Gzip(tar_);
+  LocalHttpServer server(body, false);
+  ImagePuller puller(server.GetUri("/image.tar.gz"), dir_, "");
+  PullProgress progress;
+  ASSERT_TRUE(puller.Pull(&progress));
+  EXPECT_EQ(static_cast<int64_t>(body.size()), progress.received);
+  EXPECT_EQ(static_cast<int64_t>(body.size()), progress.total);
+  EXPECT_EQ(static_cast<int64_t>(big_.size() + 10), puller.GetExtractedBytes());
+  CheckRootfs(dir_);
+}
+
+TEST_F(ImagePullerTest, PullChunkedAfterRedirect) {
+  LocalHttpServer server(Gzip(tar_), true);
+  ImagePuller puller(server.GetUri("/old"), dir_, "");
+  PullProgress progress;
+  ASSERT_TRUE(puller.Pull(&progress));
+  EXPECT_EQ(-1, progress.total);
+  EXPECT_EQ(2, server.GetRequests());
+  CheckRootfs(dir_);
+}
+
+TEST_F(ImagePullerTest, PullPlainTarFromFile) {
+  std::string path = dir_ + "/image.tar";
+  std::ofstream file(path.c_str());
+  file << tar_;
+  file.close();
+  ImagePuller puller("file://" + path, dir_ + "/out", "");
+  ASSERT_TRUE(MkdirRecur(dir_ + "/out"));
+  PullProgress progress;
+  ASSERT_TRUE(puller.Pull(&progress));
+  CheckRootfs(dir_ + "/out");
+}
+
+TEST_F(ImagePullerTest, CheckDigest) {
+  std::string body = Gzip(tar_);
+  LocalHttpServer server(body, false);
+  // sha256 of the body computed by the reference tool
+  std::string path = dir_ + "/image.tar.gz";
+  std::ofstream file(path.c_str());
+  file << body;
+  file.close();
+  std::string cmd = "sha256sum " + path;
+  FILE* pipe = ::popen(cmd.c_str(), "r");
+  ASSERT_TRUE(pipe != NULL);
+  char digest[65] = {0};
+  ASSERT_EQ(1u, fread(digest, 64, 1, pipe));
+  ::pclose(pipe);
+  ImagePuller ok_puller(server.GetUri("/image.tar.gz"), dir_ + "/ok",
+                        std::string("sha256:") + digest);
+  ASSERT_TRUE(MkdirRecur(dir_ + "/ok"));
+  PullProgress progress;
+  EXPECT_TRUE(ok_puller.Pull(&progress));
+  ImagePuller bad_puller(server.GetUri("/image.tar.gz"), dir_ + "/bad",
+                         std::string(64, '0'));
+  ASSERT_TRUE(MkdirRecur(dir_ + "/bad"));
+  PullProgress bad_progress;
+  EXPECT_FALSE(bad_puller.Pull(&bad_progress));
+}
+
+TEST_F(ImagePullerTest, RefuseEntryOutOfDir) {
+  std::string tar;
+  AppendEntry(&tar, "../evil", '0', "evil", "");
+  tar.append(1024, '\0');
+  LocalHttpServer server(Gzip(tar), false);
+  ASSERT_TRUE(MkdirRecur(dir_ + "/out"));
+  ImagePuller puller(server.GetUri("/image.tar.gz"), dir_ + "/out", "");
+  PullProgress progress;
+  EXPECT_FALSE(puller.Pull(&progress));
+  EXPECT_NE(0, ::access((dir_ + "/evil").c_str(), F_OK));
+}
+
+TEST_F(ImagePullerTest, RefuseEntryUnderSymlink) {
+  std::string tar;
+  AppendEntry(&tar, "escape", '2', "", dir_);
+  AppendEntry(&tar, "escape/evil", '0', "evil", "");
+  tar.append(1024, '\0');
+  LocalHttpServer server(Gzip(tar), false);
+  ASSERT_TRUE(MkdirRecur(dir_ + "/out"));
+  ImagePuller puller(server.GetUri("/image.tar.gz"), dir_ + "/out", "");
+  PullProgress progress;
+  EXPECT_FALSE(puller.Pull(&progress));
+  EXPECT_NE(0, ::access((dir_ + "/evil").c_str(), F_OK));
+}
+
+TEST_F(ImagePullerTest, RefuseHardLinkUnderSymlink) {
+  std::ofstream secret((dir_ + "/secret").c_str());
+  secret << "secret";
+  secret.close();
+  std::string tar;
+  AppendEntry(&tar, "escape", '2', "", dir_);
+  AppendEntry(&tar, "stolen", '1', "", "escape/secret");
+  tar.append(1024, '\0');
+  LocalHttpServer server(Gzip(tar), false);
+  ASSERT_TRUE(MkdirRecur(dir_ + "/out"));
+  ImagePuller puller(server.GetUri("/image.tar.gz"), dir_ + "/out", "");
+  PullProgress progress;
+  EXPECT_FALSE(puller.Pull(&progress));
+  EXPECT_NE(0, ::access((dir_ + "/out/stolen").c_str(), F_OK));
+}
+
+TEST_F(ImagePullerTest, FailOnTruncatedImage) {
+  std::string body = Gzip(tar_);
+  std::string path = dir_ + "/image.tar.gz";
+  std::ofstream file(path.c_str());
+  file << body.substr(0, body.size() / 2);
+  file.close();
+  ASSERT_TRUE(MkdirRecur(dir_ + "/out"));
+  ImagePuller puller(path, dir_ + "/out", "");
+  PullProgress progress;
+  EXPECT_FALSE(puller.Pull(&progress));
+}
+
+TEST_F(ImagePullerTest, FailOnMissingImage) {
+  LocalHttpServer server(tar_, false);
+  ImagePuller puller(server.GetUri("/missing"), dir_, "");
+  PullProgress progress;
+  EXPECT_FALSE(puller.Pull(&progress));
+}
+
+TEST_F(ImagePullerTest, FailOnHttpsError) {
+  // nothing listens on port 1, wget fails after the source is opened
+  ByteSource* source = ByteSource::Create("https://127.0.0.1:1/image.tar.gz");
+  ASSERT_TRUE(source != NULL);
+  int64_t length = 0;
+  ASSERT_TRUE(source->Open(&length));
+  EXPECT_EQ(-1, length);
+  char buf[1024];
+  EXPECT_EQ(-1, source->Read(buf, sizeof(buf)));
+  delete source;
+}
+
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,283 @@
+#include "engine/layer_fetcher.h"
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <fstream>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <gflags/gflags.h>
+#include "engine/image_puller.h"
+#include "engine/layer_server.h"
+#include "engine/utils.h"
+#include "gtest/gtest.h"
+
+DECLARE_int32(ce_layer_chunk_size);
+
+namespace dos {
+
+const static std::string kKey = "0123456789abcdef";
+
+static std::string ReadFile(const std::string& path) {
+  std::ifstream file(path.c_str());
+  std::stringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+static void WriteFile(const std::string& path, const std::string& content) {
+  std::ofstream file(path.c_str());
+  file << content;
+}
+
+static bool Lookup(const std::string& blob, bool hold,
+                   const std::string& key, std::string* path) {
+  if (!hold || key != kKey) {
+    return false;
+  }
+  *path = blob;
+  return true;
+}
+
+// a peer that claims the range but breaks in the middle of it
+class BrokenPeer {
+
+public:
+  BrokenPeer(const std::string& blob):blob_(blob), fd_(-1), port_(0){
+    fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd_, reinterpret_cast<struct sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    ::listen(fd_, 8);
+    pthread_create(&thread_, NULL, &BrokenPeer::Run, this);
+  }
+
+  ~BrokenPeer() {
+    ::shutdown(fd_, SHUT_RDWR);
+    pthread_join(thread_, NULL);
+    ::close(fd_);
+  }
+
+  int32_t GetPort() {
+    return port_;
+  }
+
+private:
+  static void* Run(void* args) {
+    BrokenPeer* peer = static_cast<BrokenPeer*>(args);
+    while (true) {
+      int conn = ::accept(peer->fd_, NULL, NULL);
+      if (conn < 0) {
+        break;
+      }
+      char buf[4096];
+      int64_t start = 0;
+      int64_t end = 0;
+      ssize_t n = ::recv(conn, buf, sizeof(buf) - 1, 0);
+      buf[n > 0 ? n : 0] = '\0';
+      const char* range = strstr(buf, "Range: bytes=");
+      if (range != NULL) {
+        sscanf(range, "Range: bytes=%ld-%ld", &start, &end);
+      }
+      std::string response = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes "
+          + boost::lexical_cast<std::string>(start) + "-"
+          + boost::lexical_cast<std::string>(end) + "/"
+          + boost::lexical_cast<std::string>(peer->blob_.size()) + "\r\nContent-Length: "
+          + boost::lexical_cast<std::string>(end - start + 1) + "\r\n\r\n"
+          + peer->blob_.substr(start, (end - start + 1) / 2);
+      ::send(conn, response.data(), response.size(), MSG_NOSIGNAL);
+      ::close(conn);
+    }
+    return NULL;
+  }
+
+private:
+  std::string blob_;
+  int fd_;
+  int32_t port_;
+  pthread_t thread_;
+};
+
+// every layer server stands for the engine of a node on localhost
+class LayerFetcherTest : public ::testing::Test {
+
+public:
+  LayerFetcherTest(){}
+  ~LayerFetcherTest(){}
+protected:
+  void SetUp() {
+    FLAGS_ce_layer_chunk_size = 64;
+    char dir[] = "/tmp/layer_fetcher_test.XXXXXX";
+    ASSERT_TRUE(::mkdtemp(dir) != NULL);
+    dir_ = dir;
+    // a plain tar holds a file of 500KB
+    content_.resize(500 * 1024);
+    for (size_t index = 0; index < content_.size(); ++index) {
+      content_[index] = static_cast<char>(rand() % 256);
+    }
+    char header[512];
+    memset(header, 0, sizeof(header));
+    strcpy(header, "rootfs/big");
+    snprintf(header + 100, 8, "%07o", 0644);
+    snprintf(header + 124, 12, "%011o", static_cast<unsigned int>(content_.size()));
+    header[156] = '0';
+    memset(header + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (size_t index = 0; index < sizeof(header); ++index) {
+      sum += static_cast<unsigned char>(header[index]);
+    }
+    snprintf(header + 148, 8, "%06o", sum);
+    blob_.append(header, sizeof(header));
+    blob_.append(content_);
+    blob_.append(1024, '\0');
+    origin_ = dir_ + "/origin.tar";
+    WriteFile(origin_, blob_);
+    blob_path_ = dir_ + "/" + kKey + ".blob";
+    WriteFile(blob_path_, blob_);
+  }
+
+  void TearDown() {
+    for (size_t index = 0; index < servers_.size(); ++index) {
+      delete servers_[index];
+    }
+    RemoveRecur(dir_);
+  }
+
+  // start a layer server that holds the layer or not
+  std::string StartPeer(bool hold) {
+    LayerServer* server = new LayerServer(boost::bind(&Lookup, blob_path_, hold, _1, _2), 2);
+    servers_.push_back(server);
+    if (!server->Start(0)) {
+      return "";
+    }
+    return "http://127.0.0.1:" + boost::lexical_cast<std::string>(server->GetPort())
+           + LayerServer::GetLayerPath(kKey);
+  }
+
+  // the sha256 of layer computed by the reference tool
+  std::string GetDigest() {
+    std::string cmd = "sha256sum " + origin_;
+    FILE* pipe = ::popen(cmd.c_str(), "r");
+    if (pipe == NULL) {
+      return "";
+    }
+    char digest[65] = {0};
+    size_t n = fread(digest, 64, 1, pipe);
+    ::pclose(pipe);
+    return n == 1 ? std::string("sha256:") + digest : "";
+  }
+
+  std::string ReadAll(LayerFetcher* fetcher) {
+    int64_t length = -1;
+    if (!fetcher->Open(&length)) {
+      return "";
+    }
+    std::string data;
+    char buf[10000];
+    while (true) {
+      int64_t n = fetcher->Read(buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      data.append(buf, n);
+    }
+    return data;
+  }
+
+  std::string dir_;
+  std::string content_;
+  std::string blob_;
+  std::string origin_;
+  std::string blob_path_;
+  std::vector<LayerServer*> servers_;
+};
+
+TEST_F(LayerFetcherTest, PullChunksFromPeers) {
+  std::vector<std::string> peers;
+  for (int32_t index = 0; index < 3; ++index) {
+    peers.push_back(StartPeer(true));
+  }
+  LayerFetcher fetcher(origin_, peers);
+  EXPECT_TRUE(blob_ == ReadAll(&fetcher));
+  EXPECT_EQ(static_cast<int64_t>(blob_.size()), fetcher.GetPeerBytes());
+  EXPECT_EQ(0, fetcher.GetOriginBytes());
+  // the chunks spread over all peers
+  for (size_t index = 0; index < servers_.size(); ++index) {
+    EXPECT_GT(servers_[index]->GetServedBytes(), 0);
+  }
+}
+
+TEST_F(LayerFetcherTest, SkipBadPeers) {
+  BrokenPeer broken(blob_);
+  std::vector<std::string> peers;
+  peers.push_back(StartPeer(false));
+  peers.push_back("http://127.0.0.1:" + boost::lexical_cast<std::string>(broken.GetPort())
+                  + LayerServer::GetLayerPath(kKey));
+  peers.push_back(StartPeer(true));
+  // nothing listens on the port of a stopped server
+  peers.push_back(StartPeer(true));
+  servers_.back()->Stop();
+  LayerFetcher fetcher(origin_, peers);
+  EXPECT_TRUE(blob_ == ReadAll(&fetcher));
+  EXPECT_EQ(static_cast<int64_t>(blob_.size()), fetcher.GetPeerBytes() + fetcher.GetOriginBytes());
+  EXPECT_GT(servers_[1]->GetServedBytes(), 0);
+}
+
+TEST_F(LayerFetcherTest, FallBackToOrigin) {
+  std::vector<std::string> peers;
+  peers.push_back(StartPeer(false));
+  LayerFetcher fetcher(origin_, peers);
+  EXPECT_TRUE(blob_ == ReadAll(&fetcher));
+  EXPECT_EQ(0, fetcher.GetPeerBytes());
+  EXPECT_EQ(static_cast<int64_t>(blob_.size()), fetcher.GetOriginBytes());
+}
+
+TEST_F(LayerFetcherTest, PullImageFromPeersAndKeepBlob) {
+  std::vector<std::string> peers;
+  peers.push_back(StartPeer(true));
+  peers.push_back(StartPeer(true));
+  std::string dir = dir_ + "/image";
+  std::string blob = dir_ + "/image.blob";
+  ASSERT_TRUE(MkdirRecur(dir));
+  ImagePuller puller(origin_, dir, GetDigest());
+  puller.SetPeers(peers);
+  puller.SetBlobPath(blob);
+  PullProgress progress;
+  ASSERT_TRUE(puller.Pull(&progress));
+  EXPECT_EQ(static_cast<int64_t>(blob_.size()), puller.GetPeerBytes());
+  EXPECT_TRUE(content_ == ReadFile(dir + "/rootfs/big"));
+  // the image pulled from peers can be served to other peers
+  EXPECT_TRUE(puller.HasBlob());
+  EXPECT_TRUE(blob_ == ReadFile(blob));
+}
+
+TEST_F(LayerFetcherTest, IgnorePeersWithoutDigest) {
+  std::vector<std::string> peers;
+  peers.push_back(StartPeer(true));
+  std::string dir = dir_ + "/image";
+  ASSERT_TRUE(MkdirRecur(dir));
+  ImagePuller puller(origin_, dir, "");
+  puller.SetPeers(peers);
+  PullProgress progress;
+  ASSERT_TRUE(puller.Pull(&progress));
+  EXPECT_EQ(0, puller.GetPeerBytes());
+  EXPECT_EQ(0, servers_[0]->GetServedBytes());
+  EXPECT_TRUE(content_ == ReadFile(dir + "/rootfs/big"));
+}
+
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
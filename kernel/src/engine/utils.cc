@@ -7,6 +7,8 @@
 #include <dirent.h>
 #include <errno.h>
 #include <string.h>
+#include <ftw.h>
+#include <stdio.h>
 #include "logging.h"
 
 using ::baidu::common::INFO;
@@ -40,4 +42,74 @@ bool MkdirRecur(const std::string& dir_path) {
   return Mkdir(dir_path);
 }
 
+static int RemoveEntry(const char* path, const struct stat*,
+                       int, struct FTW*) {
+  if (::remove(path) != 0) {
+    LOG(WARNING, "fail to remove %s for %s", path, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+bool RemoveRecur(const std::string& path) {
+  int ret = ::nftw(path.c_str(), RemoveEntry, 64, FTW_DEPTH | FTW_PHYS);
+  if (ret != 0 && errno != ENOENT) {
+    LOG(WARNING, "fail to remove %s", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool CopyFile(const std::string& from, const std::string& to) {
+  int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    LOG(WARNING, "fail to open %s for %s", from.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (::fstat(in, &st) != 0) {
+    LOG(WARNING, "fail to stat %s for %s", from.c_str(), strerror(errno));
+    ::close(in);
+    return false;
+  }
+  ::unlink(to.c_str());
+  int out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   st.st_mode & 07777);
+  if (out < 0) {
+    LOG(WARNING, "fail to create %s for %s", to.c_str(), strerror(errno));
+    ::close(in);
+    return false;
+  }
+  bool ok = true;
+  char buf[64 * 1024];
+  while (ok) {
+    ssize_t n = ::read(in, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      ok = n == 0;
+      break;
+    }
+    for (ssize_t written = 0; written < n;) {
+      ssize_t ret = ::write(out, buf + written, n - written);
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      if (ret <= 0) {
+        ok = false;
+        break;
+      }
+      written += ret;
+    }
+  }
+  if (!ok) {
+    LOG(WARNING, "fail to copy %s to %s for %s", from.c_str(), to.c_str(),
+        strerror(errno));
+  }
+  ::close(in);
+  ::close(out);
+  return ok;
+}
+
 }
@@ -4,5 +4,9 @@
 namespace dos {
 bool Mkdir(const std::string& path);
 bool MkdirRecur(const std::string& path);
+// remove path and all the files under it
+bool RemoveRecur(const std::string& path);
+// copy the content and mode of file from to file to
+bool CopyFile(const std::string& from, const std::string& to);
 }
 #endif
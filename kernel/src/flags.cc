@@ -7,6 +7,23 @@ DEFINE_string(dos_root_path, "/dos", "the root path of dos on nexus");
 DEFINE_string(master_lock_path, "/master_lock", "the lock path of master on nexus");
 DEFINE_string(master_endpoint, "/master_endpoint", "the endpoint of master on nexus");
 DEFINE_string(master_node_path_prefix, "/nodes", "the node prefix path of master on nexus");
+// the max count of agent changes that master keeps for scheduler incremental sync
+DEFINE_int32(master_agent_change_log_size, 40960, "the max size of agent change log");
+DEFINE_int32(master_agent_poll_interval, 5000, "the interval(ms) of master polling every agent");
+DEFINE_int32(master_agent_poll_jitter, 1000, "the max random delay(ms) added to agent poll interval");
+DEFINE_int32(master_agent_poll_max_inflight, 256, "the max count of agent polls in flight");
+DEFINE_int32(master_agent_poll_timeout, 5, "the timeout(s) of polling an agent");
+DEFINE_int32(master_agent_liveness_tick, 100, "the tick(ms) of the timing wheel that checks agent heart beat timeout");
+DEFINE_int32(master_queue_pop_batch_size, 64, "the max count of operations that master pops from queue at once");
+DEFINE_int32(master_pod_reservation_timeout, 60000, "the max time(ms) that master holds the resource of a scheduled pod before agent reports it");
+DEFINE_int32(master_pod_shard_count, 16, "the count of shards that master partitions pods into by job name");
+DEFINE_string(master_state_dir, "./master_state", "the local dir where master keeps snapshots and wals of jobs and pods");
+DEFINE_int32(master_state_flush_interval, 100, "the interval(ms) of master flushing wal");
+DEFINE_bool(master_state_sync, true, "sync wal to disk when master flushes it");
+DEFINE_int32(master_layer_announce_ttl, 15000, "the time(ms) that master keeps the layers of an engine after its last announcing");
+DEFINE_int32(master_layer_max_peers, 8, "the max count of peers that master returns for a layer");
+DEFINE_int32(master_state_snapshot_interval, 300000, "the interval(ms) of master writing snapshot");
+DEFINE_int32(master_restore_grace_period, 60000, "the time(ms) that master waits for the agents of restored pods before rescheduling the pods");
 
 DEFINE_string(agent_endpoint, "127.0.0.1:8527", "the endpoint of agent");
 // the time to check agent whether it's timeout
@@ -18,9 +35,15 @@ DEFINE_double(agent_memory_rate, 0.7, "the memory rate for sharing agent memory"
 DEFINE_int32(agent_port_range_start, 4000, "the port start range for agent");
 DEFINE_int32(agent_port_range_end, 6000, "the port end range for agent");
 DEFINE_int32(agent_sync_container_stat_interval, 1000, "the interval for agent sync container stat");
+DEFINE_int32(agent_removed_pod_log_size, 4096, "the max count of removed pods that agent keeps for delta poll");
 DEFINE_int32(scheduler_sync_agent_info_interval, 2000, "the interval of scheduler sync agent info from master");
 DEFINE_int32(scheduler_feasibility_factor, 3, "the factor of scheduler choosing feasibile agent count");
 DEFINE_int32(scheduler_max_pod_count, 20, "the max pod count on agent");
+DEFINE_int32(scheduler_propose_batch_size, 1000, "the max count of proposes in one propose request");
+DEFINE_int32(scheduler_scale_up_wait_timeout, 2000, "the max time(ms) that master holds get scale up pod request when no pending pods change");
+DEFINE_int32(scheduler_reservation_timeout, 10000, "the max time(ms) that scheduler holds the resource of a propose before master reports it");
+DEFINE_int32(scheduler_max_preempt_pods_per_round, 10, "the max count of pods that preempt others in one scheduling round");
+DEFINE_int32(scheduler_preempt_nominate_timeout, 30000, "the time(ms) that scheduler waits for the room of evicted pods before preempting for the same pod again");
 DEFINE_double(scheduler_score_longrun_pod_factor, 20.0, "the long run pod factor for scoring agent");
 DEFINE_double(scheduler_score_pod_factor, 10.0, "the pod factor for scoring agent");
 DEFINE_double(scheduler_score_cpu_factor, 10.0, "the cpu factor for scoring agent");
@@ -42,7 +65,15 @@ DEFINE_string(ce_bin_path,"./dos","the path of dos container engine");
 DEFINE_string(ce_gc_dir,"./gc_dir","the gc path of dos ce");
 DEFINE_string(ce_work_dir,"./work_dir","the work path of dos ce");
 DEFINE_string(ce_image_fetcher_name, "image_fetcher", "the name of image fetcher");
-DEFINE_int32(ce_image_fetch_status_check_interval, 2000, "the interval of checking download image");
+DEFINE_string(ce_image_store_dir, "./image_store", "the dir of images shared by containers");
+DEFINE_int32(ce_image_pull_threads, 4, "the count of images that are pulled at the same time");
+DEFINE_int32(ce_image_store_budget, 20480, "the disk budget(MB) of image store, the unused images are evicted beyond it");
+DEFINE_int32(ce_layer_port, 7677, "the port of layer server that serves image layers to peers, 0 picks a free port and -1 disables it");
+DEFINE_int32(ce_layer_serve_threads, 8, "the count of peers that layer server serves at the same time");
+DEFINE_string(ce_layer_tracker, "", "the endpoint of layer tracker, the master found by nexus is used when it's empty");
+DEFINE_int32(ce_layer_announce_interval, 5000, "the interval(ms) of announcing layers to tracker");
+DEFINE_int32(ce_layer_chunk_size, 4096, "the size(KB) of chunk pulled from a peer at once");
+DEFINE_int32(ce_image_fetch_status_check_interval, 10000, "the interval of checking download image, the exit of fetcher is notified by initd");
 DEFINE_int32(ce_resource_collect_interval, 6000, "the interval of collecting resource");
 DEFINE_string(ce_cgroup_root_collect_task_name, "/dos", "the name of root resource collect task");
 // the max times that try to connect to initd, when reaching the times, container will change
@@ -50,6 +81,6 @@ DEFINE_string(ce_cgroup_root_collect_task_name, "/dos", "the name of root resour
 DEFINE_int32(ce_initd_boot_check_max_times, 5, "the max times that try to connect initd ");
 // the interval to check initd whether it has been booted successfully
 DEFINE_int32(ce_initd_boot_check_interval, 4000, "the interval of check initd boot");
-DEFINE_int32(ce_process_status_check_interval, 2000, "the interval of check process status");
+DEFINE_int32(ce_process_status_check_interval, 10000, "the interval of check process status, the exit of process is notified by initd");
 DEFINE_int32(ce_container_log_max_size, 100, "the max size of container logs");
-DEFINE_int32(ce_initd_process_wait_interval, 1000, "the interval of initd to wait process status to change");
+DEFINE_string(ce_initd_engine_endpoint, "", "the engine endpoint that initd notifies its events to, empty to disable");
@@ -8,9 +8,11 @@ using ::baidu::common::WARNING;
 
 namespace dos {
 
-JobManager::JobManager(FixedBlockingQueue<JobOperation*>* job_opqueue):jobs_(NULL),
+JobManager::JobManager(BoundedMpmcQueue<JobOperation*>* job_opqueue,
+                       StateStore* state_store):jobs_(NULL),
   mutex_(),
-  job_opqueue_(job_opqueue){
+  job_opqueue_(job_opqueue),
+  state_store_(state_store){
   jobs_ = new JobSet();
 }
 
@@ -22,6 +24,41 @@ void JobManager::CleanJob(const std::string& name) {
   ::baidu::common::MutexLock lock(&mutex_); 
   JobNameIndex& name_index = jobs_->get<name_tag>();
   name_index.erase(name);
+  state_store_->DelJob(name);
+}
+
+void JobManager::Restore(const std::vector<JobStatus>& jobs) {
+  ::baidu::common::MutexLock lock(&mutex_); 
+  for (size_t index = 0; index < jobs.size(); ++index) {
+    JobStatus* job_status = new JobStatus(jobs[index]);
+    JobIndex job_index;
+    job_index.name_ = job_status->name();
+    job_index.user_name_ = job_status->user_name();
+    job_index.job_ = job_status;
+    jobs_->insert(job_index);
+    JobOperation* op = new JobOperation();
+    op->job_ = job_status;
+    op->type_ = job_status->state() == kJobRemoved ? kJobRemove : kJobNewAdd;
+    job_opqueue_->Push(op);
+  }
+  LOG(INFO, "restore %u jobs", jobs.size());
+}
+
+void JobManager::DumpState(RecordWriter* snapshot) {
+  // the same as PodManager::DumpState, never write with mutex_ held
+  std::vector<StateRecord> records;
+  {
+    ::baidu::common::MutexLock lock(&mutex_); 
+    const JobNameIndex& name_index = jobs_->get<name_tag>();
+    records.resize(name_index.size());
+    JobNameIndex::const_iterator it = name_index.begin();
+    for (size_t offset = 0; it != name_index.end(); ++it, ++offset) {
+      StateStore::BuildJobPut(*it->job_, &records[offset]);
+    }
+  }
+  for (size_t offset = 0; offset < records.size(); ++offset) {
+    snapshot->Append(records[offset]);
+  }
 }
 
 bool JobManager::GetJob(const std::string& name,
@@ -62,6 +99,7 @@ bool JobManager::Add(const std::string& user_name,
   job_index.user_name_ = user_name;
   job_index.job_ = job_status;
   jobs_->insert(job_index);
+  state_store_->PutJob(*job_status);
   LOG(INFO, "user %s create job %s successfully", user_name.c_str(),
       desc.name().c_str());
   JobOperation* op = new JobOperation();
@@ -72,6 +110,7 @@ bool JobManager::Add(const std::string& user_name,
 }
 
 bool JobManager::KillJob(const std::string& name) {
+  ::baidu::common::MutexLock lock(&mutex_); 
   const JobNameIndex& name_index = jobs_->get<name_tag>();
   JobNameIndex::const_iterator name_it = name_index.find(name);
   if (name_it == name_index.end()) {
@@ -79,6 +118,7 @@ bool JobManager::KillJob(const std::string& name) {
   }
   name_it->job_->set_state(kJobRemoved);
   name_it->job_->mutable_desc()->set_replica(0);
+  state_store_->PutJob(*name_it->job_);
   JobOperation* op = new JobOperation();
   op->job_ = name_it->job_;
   op->type_ = kJobRemove;
@@ -6,8 +6,9 @@
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/hashed_index.hpp>
 #include "master/master_internal_types.h"
-#include "common/blocking_queue.h"
+#include "common/mpmc_queue.h"
 #include "master/idx_tag.h"
+#include "master/state_store.h"
 #include "proto/master.pb.h"
 #include "mutex.h"
 
@@ -41,7 +42,8 @@ typedef boost::multi_index::index<JobSet, user_name_tag>::type JobUserNameIndex;
 class JobManager {
 
 public:
-  JobManager(FixedBlockingQueue<JobOperation*>* job_opqueue);
+  JobManager(BoundedMpmcQueue<JobOperation*>* job_opqueue,
+             StateStore* state_store);
   ~JobManager();
   bool Add(const std::string& user_name,
            const JobSpec& desc);
@@ -52,10 +54,17 @@ public:
   // clean job from jobset, this operation just modifies
   // master memory 
   void CleanJob(const std::string& name);
+  // restore jobs loaded from state store and push their operations
+  // again, pod manager adds the pods that have not been restored
+  void Restore(const std::vector<JobStatus>& jobs);
+  // write all jobs into snapshot
+  void DumpState(RecordWriter* snapshot);
 private:
   JobSet* jobs_;
   ::baidu::common::Mutex mutex_;
-  FixedBlockingQueue<JobOperation*>* job_opqueue_;
+  BoundedMpmcQueue<JobOperation*>* job_opqueue_;
+  // log the changes of jobs, it is owned by master
+  StateStore* state_store_;
 };
 
 }
@@ -0,0 +1,99 @@
+#include "master/layer_tracker.h"
+
+#include <algorithm>
+#include "logging.h"
+#include "timer.h"
+
+using ::baidu::common::INFO;
+using ::baidu::common::WARNING;
+using ::baidu::common::DEBUG;
+
+namespace dos {
+
+LayerTracker::LayerTracker(int64_t ttl):mutex_(),
+  ttl_(ttl * 1000),
+  last_expire_time_(0),
+  holders_(),
+  layers_(){}
+
+LayerTracker::~LayerTracker() {}
+
+void LayerTracker::Announce(const std::string& endpoint,
+                            const std::vector<std::string>& keys) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  int64_t now = ::baidu::common::timer::get_micros();
+  LayerHolder& holder = holders_[endpoint];
+  Remove(endpoint, &holder);
+  holder.keys_.clear();
+  holder.keys_.insert(keys.begin(), keys.end());
+  std::set<std::string>::iterator it = holder.keys_.begin();
+  for (; it != holder.keys_.end(); ++it) {
+    layers_[*it].insert(endpoint);
+  }
+  holder.announce_time_ = now;
+  LOG(DEBUG, "layer server %s announces %u layers", endpoint.c_str(), keys.size());
+  if (now - last_expire_time_ > ttl_) {
+    Expire(now);
+    last_expire_time_ = now;
+  }
+}
+
+void LayerTracker::GetPeers(const std::string& key,
+                            const std::string& requester,
+                            uint32_t max,
+                            std::vector<std::string>* peers) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  std::map<std::string, std::set<std::string> >::iterator layer_it = layers_.find(key);
+  if (layer_it == layers_.end()) {
+    return;
+  }
+  int64_t now = ::baidu::common::timer::get_micros();
+  std::set<std::string>::iterator it = layer_it->second.begin();
+  for (; it != layer_it->second.end(); ++it) {
+    if (*it == requester) {
+      continue;
+    }
+    std::map<std::string, LayerHolder>::iterator holder_it = holders_.find(*it);
+    if (holder_it == holders_.end()
+        || now - holder_it->second.announce_time_ > ttl_) {
+      continue;
+    }
+    peers->push_back(*it);
+  }
+  // spread the pulling of a layer over its holders
+  std::random_shuffle(peers->begin(), peers->end());
+  if (peers->size() > max) {
+    peers->resize(max);
+  }
+}
+
+void LayerTracker::Remove(const std::string& endpoint, LayerHolder* holder) {
+  std::set<std::string>::iterator it = holder->keys_.begin();
+  for (; it != holder->keys_.end(); ++it) {
+    std::map<std::string, std::set<std::string> >::iterator layer_it = layers_.find(*it);
+    if (layer_it == layers_.end()) {
+      continue;
+    }
+    layer_it->second.erase(endpoint);
+    if (layer_it->second.empty()) {
+      layers_.erase(layer_it);
+    }
+  }
+}
+
+void LayerTracker::Expire(int64_t now) {
+  mutex_.AssertHeld();
+  std::map<std::string, LayerHolder>::iterator it = holders_.begin();
+  while (it != holders_.end()) {
+    if (now - it->second.announce_time_ <= ttl_) {
+      ++it;
+      continue;
+    }
+    LOG(INFO, "layer server %s misses announcing, drop its %u layers",
+        it->first.c_str(), it->second.keys_.size());
+    Remove(it->first, &it->second);
+    holders_.erase(it++);
+  }
+}
+
+} // namespace dos
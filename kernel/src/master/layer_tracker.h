@@ -0,0 +1,49 @@
+#ifndef KERNEL_MASTER_LAYER_TRACKER_H
+#define KERNEL_MASTER_LAYER_TRACKER_H
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "mutex.h"
+
+namespace dos {
+
+struct LayerHolder {
+  std::set<std::string> keys_;
+  int64_t announce_time_;
+  LayerHolder():keys_(), announce_time_(0){}
+};
+
+// track the layers that the layer servers of engines hold. every engine
+// announces all its layers periodically, and the engine that misses
+// announcing in ttl is dropped
+class LayerTracker {
+
+public:
+  // the unit of ttl is ms
+  LayerTracker(int64_t ttl);
+  ~LayerTracker();
+  // replace the layers that endpoint holds
+  void Announce(const std::string& endpoint,
+                const std::vector<std::string>& keys);
+  // get at most max holders of layer except requester in random order
+  void GetPeers(const std::string& key,
+                const std::string& requester,
+                uint32_t max,
+                std::vector<std::string>* peers);
+private:
+  void Remove(const std::string& endpoint, LayerHolder* holder);
+  void Expire(int64_t now);
+private:
+  ::baidu::common::Mutex mutex_;
+  int64_t ttl_;
+  int64_t last_expire_time_;
+  std::map<std::string, LayerHolder> holders_;
+  // the endpoints that hold the layer
+  std::map<std::string, std::set<std::string> > layers_;
+};
+
+} // namespace dos
+#endif
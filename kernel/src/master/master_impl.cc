@@ -3,6 +3,7 @@
 #include <gflags/gflags.h>
 #include "ins_sdk.h"
 #include "util.h"
+#include "timer.h"
 
 DECLARE_string(ins_servers);
 DECLARE_string(my_ip);
@@ -10,6 +11,10 @@ DECLARE_string(dos_root_path);
 DECLARE_string(master_lock_path);
 DECLARE_string(master_port);
 DECLARE_string(master_endpoint);
+DECLARE_string(master_state_dir);
+DECLARE_int32(master_state_snapshot_interval);
+DECLARE_int32(master_layer_announce_ttl);
+DECLARE_int32(master_layer_max_peers);
 
 namespace dos {
 
@@ -23,18 +28,24 @@ MasterImpl::MasterImpl():node_manager_(NULL),
   ins_(NULL),
   gc_mutex_(),
   job_to_gc_(),
-  gc_pool_(NULL){
-  node_opqueue_ = new FixedBlockingQueue<NodeStatus*>(2 * 10240, "node statue queue");
-  pod_opqueue_ = new FixedBlockingQueue<PodOperation*>(2 * 10240, "pod operation queue");
-  job_opqueue_ = new FixedBlockingQueue<JobOperation*>(2 * 10240, "job operation queue");
+  gc_pool_(NULL),
+  state_store_(NULL),
+  layer_tracker_(NULL){
+  node_opqueue_ = new BoundedMpmcQueue<NodeStatus*>(2 * 10240, "node statue queue");
+  pod_opqueue_ = new BoundedMpmcQueue<PodOperation*>(2 * 10240, "pod operation queue");
+  job_opqueue_ = new BoundedMpmcQueue<JobOperation*>(2 * 10240, "job operation queue");
+  state_store_ = new StateStore(FLAGS_master_state_dir);
   node_manager_ = new NodeManager(node_opqueue_, pod_opqueue_);
   pod_manager_ = new PodManager(pod_opqueue_, 
                                 job_opqueue_,
-                                node_opqueue_);
-  job_manager_ = new JobManager(job_opqueue_);
+                                node_opqueue_,
+                                node_manager_,
+                                state_store_);
+  job_manager_ = new JobManager(job_opqueue_, state_store_);
   ins_ = new InsSDK(FLAGS_ins_servers);
   master_lock_ = new InsMutex(FLAGS_dos_root_path + FLAGS_master_lock_path, ins_);
   gc_pool_ = new ::baidu::common::ThreadPool(1);
+  layer_tracker_ = new LayerTracker(FLAGS_master_layer_announce_ttl);
 }
 
 MasterImpl::~MasterImpl() {
@@ -84,18 +95,82 @@ void MasterImpl::Start() {
     LOG(WARNING, "fail to set master addr");
     exit(1);
   }
-  pod_manager_->Start();
+  StartService();
+}
+
+void MasterImpl::StartService() {
+  std::vector<JobStatus> jobs;
+  std::vector<PodStatus> pods;
+  bool load_ok = state_store_->Load(&jobs, &pods);
+  if (!load_ok) {
+    LOG(WARNING, "fail to load state from %s", FLAGS_master_state_dir.c_str());
+    exit(1);
+  }
+  bool open_ok = state_store_->Open();
+  if (!open_ok) {
+    LOG(WARNING, "fail to open wal in %s", FLAGS_master_state_dir.c_str());
+    exit(1);
+  }
+  // operations are pushed when restoring, start the consumers first
+  // so the bounded queues never block
   node_manager_->Start();
+  pod_manager_->Restore(jobs, pods);
+  pod_manager_->Start();
+  job_manager_->Restore(jobs);
+  {
+    ::baidu::common::MutexLock lock(&gc_mutex_);
+    for (size_t index = 0; index < jobs.size(); ++index) {
+      if (jobs[index].state() == kJobRemoved) {
+        job_to_gc_.insert(jobs[index].name());
+      }
+    }
+  }
   SchedNextGc();
+  gc_pool_->DelayTask(FLAGS_master_state_snapshot_interval,
+                      boost::bind(&MasterImpl::SnapshotState, this));
+}
+
+void MasterImpl::SnapshotState() {
+  int64_t start = ::baidu::common::timer::get_micros();
+  int64_t seq = 0;
+  RecordWriter* snapshot = state_store_->BeginSnapshot(&seq);
+  if (snapshot == NULL) {
+    LOG(WARNING, "fail to begin snapshot");
+  } else {
+    job_manager_->DumpState(snapshot);
+    pod_manager_->DumpState(snapshot);
+    bool commit_ok = state_store_->CommitSnapshot(seq, snapshot);
+    LOG(INFO, "snapshot %ld %s in %ld ms", seq, commit_ok ? "done" : "fails",
+        (::baidu::common::timer::get_micros() - start) / 1000);
+  }
+  gc_pool_->DelayTask(FLAGS_master_state_snapshot_interval,
+                      boost::bind(&MasterImpl::SnapshotState, this));
 }
 
 void MasterImpl::GetScaleUpPod(RpcController* controller,
                                const GetScaleUpPodRequest* request,
                                GetScaleUpPodResponse* response,
                                Closure* done) {
+  if (request->wait_timeout() > 0) {
+    // hold the request until pending pods change or timeout
+    pod_manager_->WatchScaleUpPods(request->generation(),
+                                   request->wait_timeout(),
+                                   boost::bind(&MasterImpl::DoGetScaleUpPod, this,
+                                               request, response, done));
+    return;
+  }
+  DoGetScaleUpPod(request, response, done);
+}
+
+void MasterImpl::DoGetScaleUpPod(const GetScaleUpPodRequest* request,
+                                 GetScaleUpPodResponse* response,
+                                 Closure* done) {
   // get pods that need to be scheduled
+  int64_t generation = 0;
   pod_manager_->GetScaleUpPods(request->condition(),
-                               response->mutable_pods());
+                               response->mutable_pods(),
+                               &generation);
+  response->set_generation(generation);
   response->set_status(kRpcOk);
   done->Run();
 }
@@ -117,18 +192,55 @@ void MasterImpl::ScaleUpPropose(RpcController* controller,
     pods.push_back(boost::make_tuple(request->proposes(index).endpoint(),
                                      request->proposes(index).pod_name()));
   }
+  std::vector<RpcStatus> results;
+  pod_manager_->SchedPods(pods, &results);
+  int32_t conflicts = 0;
+  for (size_t index = 0; index < results.size(); ++index) {
+    ProposeResult* result = response->add_results();
+    result->set_pod_name(request->proposes(index).pod_name());
+    result->set_endpoint(request->proposes(index).endpoint());
+    result->set_status(results[index]);
+    if (results[index] == kRpcNoResource) {
+      conflicts++;
+    }
+  }
+  if (conflicts > 0) {
+    LOG(INFO, "reject %d of %d proposes for over committed agents",
+        conflicts, request->proposes_size());
+  }
+  response->set_status(kRpcOk);
+  done->Run();
+}
+
+void MasterImpl::Preempt(RpcController* controller,
+                         const PreemptRequest* request,
+                         PreemptResponse* response,
+                         Closure* done) {
+  std::vector<RpcStatus> results;
+  pod_manager_->PreemptPods(request, &results);
+  for (size_t index = 0; index < results.size(); ++index) {
+    ProposeResult* result = response->add_results();
+    result->set_pod_name(request->preemptions(index).pod_name());
+    result->set_endpoint(request->preemptions(index).endpoint());
+    result->set_status(results[index]);
+  }
   response->set_status(kRpcOk);
   done->Run();
-  pod_manager_->SchedPods(pods);
 }
 
 void MasterImpl::SyncAgentInfo(RpcController* controller,
                      const SyncAgentInfoRequest* request,
                      SyncAgentInfoResponse* response,
                      Closure* done) {
-  node_manager_->SyncAgentInfo(request->versions(),
+  int64_t cursor = 0;
+  bool full_sync = false;
+  node_manager_->SyncAgentInfo(request->cursor(),
                                response->mutable_diff_mod(),
-                               response->mutable_diff_del());
+                               response->mutable_diff_del(),
+                               &cursor,
+                               &full_sync);
+  response->set_cursor(cursor);
+  response->set_full_sync(full_sync);
   response->set_status(kRpcOk);
   done->Run();
 }
@@ -142,8 +254,11 @@ void MasterImpl::SubmitJob(RpcController* controller,
                                   request->job());
   if (!add_ok) {
     response->set_status(kRpcNameExist);
+    done->Run();
+    return;
   }
-  done->Run();
+  // answer client after the job is durable in wal
+  state_store_->Commit(boost::bind(&Closure::Run, done));
 }
 
 void MasterImpl::GetJob(RpcController* controller,
@@ -178,13 +293,41 @@ void MasterImpl::KillJob(RpcController* controller,
                          KillJobResponse* response,
                          Closure* done) {
   bool del_ok = job_manager_->KillJob(request->name());
-  if (del_ok) {
+  if (!del_ok) {
+    response->set_status(kRpcError);
+    done->Run();
+    return;
+  }
+  {
     ::baidu::common::MutexLock lock(&gc_mutex_);
     job_to_gc_.insert(request->name());
-    response->set_status(kRpcOk);
-  } else {
-    response->set_status(kRpcError);
   }
+  response->set_status(kRpcOk);
+  // answer client after the kill is durable in wal
+  state_store_->Commit(boost::bind(&Closure::Run, done));
+}
+
+void MasterImpl::AnnounceLayers(RpcController* /*controller*/,
+                                const AnnounceLayersRequest* request,
+                                AnnounceLayersResponse* response,
+                                Closure* done) {
+  std::vector<std::string> keys(request->keys().begin(), request->keys().end());
+  layer_tracker_->Announce(request->endpoint(), keys);
+  response->set_status(kRpcOk);
+  done->Run();
+}
+
+void MasterImpl::GetLayerPeers(RpcController* /*controller*/,
+                               const GetLayerPeersRequest* request,
+                               GetLayerPeersResponse* response,
+                               Closure* done) {
+  std::vector<std::string> peers;
+  layer_tracker_->GetPeers(request->key(), request->endpoint(),
+                           FLAGS_master_layer_max_peers, &peers);
+  for (size_t index = 0; index < peers.size(); ++index) {
+    response->add_peers(peers[index]);
+  }
+  response->set_status(kRpcOk);
   done->Run();
 }
 
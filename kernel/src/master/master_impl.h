@@ -4,10 +4,12 @@
 #include "master/node_manager.h"
 #include "master/pod_manager.h"
 #include "proto/master.pb.h"
-#include "common/blocking_queue.h"
+#include "common/mpmc_queue.h"
 #include "common/ins_mutex.h"
 #include "master/job_manager.h"
 #include "master/master_internal_types.h"
+#include "master/state_store.h"
+#include "master/layer_tracker.h"
 #include "ins_sdk.h"
 #include "thread_pool.h"
 #include "mutex.h"
@@ -24,6 +26,9 @@ public:
   ~MasterImpl();
 
   void Start();
+  // start managers without master election, Start calls it
+  // after getting master lock
+  void StartService();
   void SubmitJob(RpcController* controller,
                  const SubmitJobRequest* request,
                  SubmitJobResponse* response,
@@ -49,6 +54,11 @@ public:
                      ScaleUpProposeResponse* response,
                      Closure* done);
 
+  void Preempt(RpcController* controller,
+               const PreemptRequest* request,
+               PreemptResponse* response,
+               Closure* done);
+
   void GetJob(RpcController* controller,
                const GetJobRequest* request,
                GetJobResponse* response,
@@ -58,20 +68,37 @@ public:
                const KillJobRequest* request,
                KillJobResponse* response,
                Closure* done);
+
+  void AnnounceLayers(RpcController* controller,
+                      const AnnounceLayersRequest* request,
+                      AnnounceLayersResponse* response,
+                      Closure* done);
+
+  void GetLayerPeers(RpcController* controller,
+                     const GetLayerPeersRequest* request,
+                     GetLayerPeersResponse* response,
+                     Closure* done);
 private:
   void SchedNextGc();
+  // write snapshot of jobs and pods, so the wals before it can be removed
+  void SnapshotState();
+  void DoGetScaleUpPod(const GetScaleUpPodRequest* request,
+                       GetScaleUpPodResponse* response,
+                       Closure* done);
 private:
   NodeManager* node_manager_;
   JobManager* job_manager_;
   PodManager* pod_manager_;
-  FixedBlockingQueue<NodeStatus*>* node_opqueue_;
-  FixedBlockingQueue<PodOperation*>* pod_opqueue_;
-  FixedBlockingQueue<JobOperation*>* job_opqueue_;
+  BoundedMpmcQueue<NodeStatus*>* node_opqueue_;
+  BoundedMpmcQueue<PodOperation*>* pod_opqueue_;
+  BoundedMpmcQueue<JobOperation*>* job_opqueue_;
   InsMutex* master_lock_;
   InsSDK* ins_;
   ::baidu::common::Mutex gc_mutex_;
   std::set<std::string> job_to_gc_;
   ::baidu::common::ThreadPool* gc_pool_;
+  StateStore* state_store_;
+  LayerTracker* layer_tracker_;
 };
 
 }
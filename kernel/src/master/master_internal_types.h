@@ -10,9 +10,15 @@ enum PodOperationType {
   kRunPod
 };
 
+// the pod is copied, as pod manager may free the pod before node
+// manager handles the operation
 struct PodOperation {
   PodOperationType type_;
-  PodStatus* pod_;
+  std::string name_;
+  // the desc of pod to run, it's empty for kill
+  PodSpec desc_;
+  // the agent to operate on
+  std::string endpoint_;
 };
 
 enum JobOperationType {
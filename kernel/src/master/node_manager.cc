@@ -1,6 +1,7 @@
 #include "master/node_manager.h"
 
 #include <map>
+#include <boost/functional/hash.hpp>
 #include <gflags/gflags.h>
 #include "logging.h"
 #include "timer.h"
@@ -10,14 +11,114 @@ DECLARE_string(ins_servers);
 DECLARE_string(dos_root_path);
 DECLARE_string(master_node_path_prefix);
 DECLARE_int32(agent_heart_beat_timeout);
+DECLARE_int32(master_agent_liveness_tick);
+DECLARE_int32(master_agent_change_log_size);
+DECLARE_int32(master_agent_poll_interval);
+DECLARE_int32(master_agent_poll_jitter);
+DECLARE_int32(master_agent_poll_max_inflight);
+DECLARE_int32(master_agent_poll_timeout);
+DECLARE_int32(master_queue_pop_batch_size);
+DECLARE_int32(master_pod_reservation_timeout);
 
 using ::baidu::common::INFO;
 using ::baidu::common::WARNING;
+using ::baidu::common::DEBUG;
 
 namespace dos {
 
-NodeManager::NodeManager(FixedBlockingQueue<NodeStatus*>* node_status_queue,
-                         FixedBlockingQueue<PodOperation*>* pod_opqueue):mutex_(),
+static void HashPorts(const Port& port, size_t* seed) {
+  for (int32_t index = 0; index < port.assigned_size(); ++index) {
+    boost::hash_combine(*seed, port.assigned(index));
+  }
+}
+
+static bool SamePorts(const Port& left, const Port& right) {
+  if (left.assigned_size() != right.assigned_size()) {
+    return false;
+  }
+  for (int32_t index = 0; index < left.assigned_size(); ++index) {
+    if (left.assigned(index) != right.assigned(index)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// hash the resource fields that are exported to scheduler,
+// the used stat changes every poll and is ignored
+static uint64_t ResourceDigest(const Resource& resource) {
+  size_t seed = 0;
+  boost::hash_combine(seed, resource.cpu().limit());
+  boost::hash_combine(seed, resource.cpu().assigned());
+  boost::hash_combine(seed, resource.memory().limit());
+  boost::hash_combine(seed, resource.memory().assigned());
+  boost::hash_combine(seed, resource.port().range().start());
+  boost::hash_combine(seed, resource.port().range().end());
+  boost::hash_combine(seed, resource.port().bitmap());
+  HashPorts(resource.port(), &seed);
+  return seed;
+}
+
+// compare the fields that ResourceDigest hashes
+static bool SameResource(const Resource& left, const Resource& right) {
+  return left.cpu().limit() == right.cpu().limit()
+         && left.cpu().assigned() == right.cpu().assigned()
+         && left.memory().limit() == right.memory().limit()
+         && left.memory().assigned() == right.memory().assigned()
+         && left.port().range().start() == right.port().range().start()
+         && left.port().range().end() == right.port().range().end()
+         && left.port().bitmap() == right.port().bitmap()
+         && SamePorts(left.port(), right.port());
+}
+
+// hash the pod fields that FillPodsToAgentOverview exports
+static uint64_t PodsDigest(const ::google::protobuf::RepeatedPtrField<PodStatus>& pods) {
+  size_t seed = 0;
+  for (int32_t index = 0; index < pods.size(); ++index) {
+    const PodStatus& pod = pods.Get(index);
+    boost::hash_combine(seed, pod.name());
+    boost::hash_combine(seed, pod.job_name());
+    boost::hash_combine(seed, static_cast<int32_t>(pod.desc().type()));
+    for (int32_t cindex = 0; cindex < pod.cstatus_size(); ++cindex) {
+      const Resource& requirement = pod.cstatus(cindex).spec().requirement();
+      boost::hash_combine(seed, requirement.cpu().limit());
+      boost::hash_combine(seed, requirement.memory().limit());
+      HashPorts(requirement.port(), &seed);
+    }
+  }
+  return seed;
+}
+
+// compare the fields that PodsDigest hashes
+static bool SamePods(const ::google::protobuf::RepeatedPtrField<PodStatus>& left,
+                     const ::google::protobuf::RepeatedPtrField<PodStatus>& right) {
+  if (left.size() != right.size()) {
+    return false;
+  }
+  for (int32_t index = 0; index < left.size(); ++index) {
+    const PodStatus& lpod = left.Get(index);
+    const PodStatus& rpod = right.Get(index);
+    if (lpod.name() != rpod.name()
+        || lpod.job_name() != rpod.job_name()
+        || lpod.desc().type() != rpod.desc().type()
+        || lpod.cstatus_size() != rpod.cstatus_size()) {
+      return false;
+    }
+    for (int32_t cindex = 0; cindex < lpod.cstatus_size(); ++cindex) {
+      const Resource& lreq = lpod.cstatus(cindex).spec().requirement();
+      const Resource& rreq = rpod.cstatus(cindex).spec().requirement();
+      if (lreq.cpu().limit() != rreq.cpu().limit()
+          || lreq.memory().limit() != rreq.memory().limit()
+          || !SamePorts(lreq.port(), rreq.port())) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+NodeManager::NodeManager(BoundedMpmcQueue<NodeStatus*>* node_status_queue,
+                         BoundedMpmcQueue<PodOperation*>* pod_opqueue):mutex_(),
   nodes_(NULL),
   nexus_(NULL),
   node_metas_(NULL),
@@ -25,16 +126,33 @@ NodeManager::NodeManager(FixedBlockingQueue<NodeStatus*>* node_status_queue,
   thread_pool_(NULL),
   node_status_queue_(node_status_queue),
   pod_opqueue_(pod_opqueue),
-  rpc_client_(NULL){
+  rpc_client_(NULL),
+  agent_under_polling_(),
+  agent_waiting_polling_(),
+  agent_under_fisrt_polling_(),
+  cursor_(0),
+  changes_(),
+  reservations_(NULL),
+  exported_(NULL),
+  liveness_(NULL){
+  // start cursor from current time, so the cursor that scheduler got from
+  // the previous master will fall out of change log after master failover
+  cursor_ = ::baidu::common::timer::get_micros();
   nodes_ = new NodeSet();
   nexus_ = new ::galaxy::ins::sdk::InsSDK(FLAGS_ins_servers);
   node_metas_ = new boost::unordered_map<std::string, NodeMeta*>();
   agent_conns_ = new boost::unordered_map<std::string, Agent_Stub*>();
   thread_pool_ = new ::baidu::common::ThreadPool(4);
   rpc_client_ = new RpcClient();
+  reservations_ = new boost::unordered_map<std::string, std::map<std::string, PodReservation> >();
+  exported_ = new boost::unordered_map<std::string, ExportedAgent>();
+  liveness_ = new LivenessTracker(FLAGS_agent_heart_beat_timeout,
+                                  FLAGS_master_agent_liveness_tick,
+                                  boost::bind(&NodeManager::HandleNodeTimeout, this, _1));
 }
 
 NodeManager::~NodeManager() {
+  delete liveness_;
   delete nodes_;
   delete nexus_;
   delete node_metas_;
@@ -43,8 +161,8 @@ NodeManager::~NodeManager() {
 bool NodeManager::Start() {
   ::baidu::common::MutexLock lock(&mutex_);
   //bool load_ok = LoadNodeMeta();
-  ScheduleNextPoll();
   thread_pool_->AddTask(boost::bind(&NodeManager::WatchPodOpQueue, this));
+  liveness_->Start();
   return true;
 }
 
@@ -73,7 +191,7 @@ bool NodeManager::LoadNodeMeta() {
 
 void NodeManager::KeepAlive(const std::string& hostname,
                             const std::string& endpoint) {
-  MutexLock lock(&mutex_);
+  ::baidu::common::MutexLock lock(&mutex_);
   const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
   NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.find(endpoint);
   if (endpoint_it == endpoint_idx.end()) {
@@ -83,6 +201,7 @@ void NodeManager::KeepAlive(const std::string& hostname,
     index.endpoint_ = endpoint; 
     index.status_ = new NodeStatus();
     index.status_->set_version(0);
+    index.status_->set_poll_seq(0);
     boost::unordered_map<std::string, NodeMeta*>::iterator node_it = node_metas_->find(hostname);
     if (node_it == node_metas_->end()) {
       LOG(WARNING, "node %s has no meta in master", hostname.c_str());
@@ -91,28 +210,49 @@ void NodeManager::KeepAlive(const std::string& hostname,
     }else {
       index.status_->mutable_meta()->CopyFrom(*node_it->second);
     }
-    int64_t task_id = thread_pool_->DelayTask(FLAGS_agent_heart_beat_timeout, 
-                                              boost::bind(&NodeManager::HandleNodeTimeout,
-                                              this, endpoint));
-    index.status_->set_task_id(task_id);
+    index.status_->set_task_id(liveness_->Track(endpoint));
     nodes_->insert(index);
+    RecordChange(endpoint, kAgentAdd);
+    // every agent has its own poll schedule, spread the first
+    // poll over an interval to avoid polling agents together
+    ScheduleNextPoll(endpoint, 0, ::rand() % (FLAGS_master_agent_poll_interval + 1));
     return;
   }else {
-    thread_pool_->CancelTask(endpoint_it->status_->task_id());
-    int64_t task_id = thread_pool_->DelayTask(FLAGS_agent_heart_beat_timeout,
-                                              boost::bind(&NodeManager::HandleNodeTimeout,
-                                              this, endpoint));
-    endpoint_it->status_->set_task_id(task_id);
+    // a heart beat only stores the time, the agent that has expired
+    // is tracked again
+    if (!liveness_->Touch(endpoint_it->status_->task_id())) {
+      endpoint_it->status_->set_task_id(liveness_->Track(endpoint));
+    }
+    if (endpoint_it->status_->state() == kNodeOffline) {
+      LOG(INFO, "offline agent %s comes back", endpoint.c_str());
+      endpoint_it->status_->set_state(kNodeNormal);
+      // the pods on agent have been rescheduled, start with a full poll
+      endpoint_it->status_->set_agent_version(0);
+      endpoint_it->status_->set_version(endpoint_it->status_->version() + 1);
+      RecordChange(endpoint, kAgentAdd);
+      // the poll scheduled before agent went offline may be pending,
+      // start a new chain and let the old one die
+      endpoint_it->status_->set_poll_seq(endpoint_it->status_->poll_seq() + 1);
+      ScheduleNextPoll(endpoint, endpoint_it->status_->poll_seq(), 0);
+    }
   }
 }
 
-void NodeManager::PollNode(const std::string& endpoint) {
+bool NodeManager::PollNode(const std::string& endpoint, int64_t poll_seq) {
   mutex_.AssertHeld();
   const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
   NodeEndpointIndex::const_iterator e_it = endpoint_idx.find(endpoint);
   if (e_it == endpoint_idx.end()) {
     LOG(WARNING, "fail to find node with endpoint %s", endpoint.c_str());
-    return;
+    return false;
+  }
+  if (e_it->status_->state() == kNodeOffline) {
+    LOG(INFO, "stop polling offline agent %s", endpoint.c_str());
+    return false;
+  }
+  if (e_it->status_->poll_seq() != poll_seq) {
+    LOG(DEBUG, "drop stale poll of agent %s", endpoint.c_str());
+    return false;
   }
   boost::unordered_map<std::string, Agent_Stub*>::iterator agent_it = 
     agent_conns_->find(endpoint);
@@ -121,137 +261,361 @@ void NodeManager::PollNode(const std::string& endpoint) {
     bool get_stub_ok = rpc_client_->GetStub(endpoint, &agent);
     if (!get_stub_ok) {
       LOG(WARNING, "fail to make a rpc connection with agent %s", endpoint.c_str());
-      return;
+      ScheduleNextPoll(endpoint, poll_seq, FLAGS_master_agent_poll_interval);
+      return false;
     }
     agent_conns_->insert(std::make_pair(endpoint, agent));
     agent_it = agent_conns_->find(endpoint);
   }
   Agent_Stub* agent = agent_it->second;
   PollAgentRequest* request = new PollAgentRequest();
+  request->set_version(e_it->status_->agent_version());
   PollAgentResponse* response = new PollAgentResponse();
   boost::function<void (const PollAgentRequest*, PollAgentResponse*, bool, int)> callback;
   callback = boost::bind(&NodeManager::PollNodeCallback, this, endpoint, _1, _2, _3, _4, 
-      e_it->status_->version());
+      e_it->status_->version(), poll_seq);
   rpc_client_->AsyncRequest(agent, &Agent_Stub::Poll,
                             request, response,
-                            callback, 5, 1);
+                            callback, FLAGS_master_agent_poll_timeout, 1);
+  return true;
 }
 
 void NodeManager::PollNodeCallback(const std::string& endpoint,
     const PollAgentRequest* request, PollAgentResponse* response,
-    bool failed, int, int32_t version) {
+    bool failed, int, int32_t version, int64_t poll_seq) {
+  NodeStatus* changed_status = NULL;
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
+    NodeEndpointIndex::const_iterator e_it = endpoint_idx.find(endpoint);
+    if (e_it == endpoint_idx.end()) {
+      LOG(WARNING, "agent with endpoint %s does not exist in master", endpoint.c_str());
+    } else if (failed) {
+      // keep the last status, the agent will be polled again in next turn
+      LOG(WARNING, "fail to poll agent %s", endpoint.c_str());
+    } else if (e_it->status_->state() == kNodeOffline) {
+      LOG(INFO, "ignore poll result of offline agent %s", endpoint.c_str());
+    } else {
+      // if version changes when bind function , ignore changes from agent
+      if (e_it->status_->version() == version) {
+        bool pods_changed = MergePolledPods(response, e_it->status_);
+        e_it->status_->mutable_resource()->CopyFrom(response->status().resource());
+        ApplyReservations(endpoint, e_it->status_);
+        if (UpdateExported(endpoint, e_it->status_)) {
+          e_it->status_->set_version(1 + e_it->status_->version());
+          RecordChange(endpoint, kAgentMod);
+        }
+        // pod manager only cares about pods
+        if (pods_changed) {
+          changed_status = e_it->status_;
+        }
+      }
+    }
+    delete request;
+    delete response;
+    agent_under_polling_.erase(endpoint);
+    if (e_it != endpoint_idx.end()
+        && e_it->status_->state() != kNodeOffline
+        && e_it->status_->poll_seq() == poll_seq) {
+      int32_t jitter = FLAGS_master_agent_poll_jitter > 0 ?
+                       ::rand() % (FLAGS_master_agent_poll_jitter + 1) : 0;
+      ScheduleNextPoll(endpoint, poll_seq, FLAGS_master_agent_poll_interval + jitter);
+    }
+    PollWaitingNodes();
+  }
+  // push without mutex_, the push blocks when queue is full and pod
+  // manager may wait for mutex_ with shard mutex held in SchedPods
+  if (changed_status != NULL) {
+    node_status_queue_->Push(changed_status);
+  }
+}
+
+bool NodeManager::MergePolledPods(const PollAgentResponse* response,
+                                  NodeStatus* status) {
+  mutex_.AssertHeld();
+  status->set_agent_version(response->version());
+  if (response->full()) {
+    status->mutable_pstatus()->CopyFrom(response->status().pstatus());
+    return true;
+  }
+  if (response->removed_pods_size() == 0
+      && response->status().pstatus_size() == 0) {
+    return false;
+  }
+  // pod name and its offset in status pstatus
+  boost::unordered_map<std::string, int32_t> offsets;
+  for (int32_t index = 0; index < status->pstatus_size(); ++index) {
+    offsets[status->pstatus(index).name()] = index;
+  }
+  for (int32_t index = 0; index < response->removed_pods_size(); ++index) {
+    boost::unordered_map<std::string, int32_t>::iterator it =
+      offsets.find(response->removed_pods(index));
+    if (it == offsets.end()) {
+      continue;
+    }
+    // move the last pod to the removed one
+    int32_t last = status->pstatus_size() - 1;
+    if (it->second != last) {
+      status->mutable_pstatus()->SwapElements(it->second, last);
+      offsets[status->pstatus(it->second).name()] = it->second;
+    }
+    status->mutable_pstatus()->RemoveLast();
+    offsets.erase(it);
+  }
+  for (int32_t index = 0; index < response->status().pstatus_size(); ++index) {
+    const PodStatus& pod = response->status().pstatus(index);
+    boost::unordered_map<std::string, int32_t>::iterator it = offsets.find(pod.name());
+    if (it == offsets.end()) {
+      offsets[pod.name()] = status->pstatus_size();
+      status->add_pstatus()->CopyFrom(pod);
+    } else {
+      status->mutable_pstatus(it->second)->CopyFrom(pod);
+    }
+  }
+  return true;
+}
+
+void NodeManager::SyncAgentInfo(int64_t cursor,
+                                AgentOverviewList* agents,
+                                StringList* del_list,
+                                int64_t* latest_cursor,
+                                bool* full_sync) {
   ::baidu::common::MutexLock lock(&mutex_);
+  *latest_cursor = cursor_;
+  // all changes after cursor must be in change log
+  bool in_log = false;
+  if (cursor > 0 && cursor <= cursor_) {
+    if (changes_.empty()) {
+      in_log = cursor == cursor_;
+    } else {
+      in_log = cursor >= changes_.front().seq_ - 1;
+    }
+  }
   const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
-  NodeEndpointIndex::const_iterator e_it = endpoint_idx.find(endpoint);
-  if (e_it == endpoint_idx.end()) {
-    LOG(WARNING, "agent with endpoint %s does not exist in master", endpoint.c_str());
-  } else {
-    // if version changes when bind function , ignore changes from agent
-    if (e_it->status_->version() == version) {
-      // TODO add more propertise
-      if (e_it->status_->resource().cpu().limit() != response->status().resource().cpu().limit()) {
-        e_it->status_->set_version(1 + e_it->status_->version());
-      }
-      if (e_it->status_->resource().cpu().assigned() != response->status().resource().cpu().assigned()) {
-        e_it->status_->set_version(1 + e_it->status_->version());
+  if (!in_log) {
+    LOG(INFO, "cursor %ld has fallen out of change log, make a full sync",
+        cursor);
+    *full_sync = true;
+    NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.begin();
+    for (; endpoint_it != endpoint_idx.end(); ++endpoint_it) {
+      if (endpoint_it->status_->state() != kNodeNormal) {
+        continue;
       }
-      e_it->status_->mutable_resource()->CopyFrom(response->status().resource());
-      e_it->status_->mutable_pstatus()->CopyFrom(response->status().pstatus());
-      node_status_queue_->Push(e_it->status_);
+      FillAgentOverview(*endpoint_it, agents->Add());
     }
+    return;
+  }
+  *full_sync = false;
+  // no agent has changed since master started
+  if (changes_.empty()) {
+    return;
+  }
+  // the seqs in change log are continuous, so locate the first 
+  // change after cursor directly
+  // the last change of every agent decides whether it's deleted
+  std::map<std::string, AgentChangeType> changed;
+  size_t offset = cursor - changes_.front().seq_ + 1;
+  for (; offset < changes_.size(); ++offset) {
+    changed[changes_[offset].endpoint_] = changes_[offset].type_;
+  }
+  std::map<std::string, AgentChangeType>::iterator changed_it = changed.begin();
+  for (; changed_it != changed.end(); ++changed_it) {
+    if (changed_it->second == kAgentDel) {
+      del_list->Add()->assign(changed_it->first);
+      continue;
+    }
+    NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.find(changed_it->first);
+    // delete agent that has not been kNodeNormal
+    if (endpoint_it == endpoint_idx.end()
+        || endpoint_it->status_->state() != kNodeNormal) {
+      del_list->Add()->assign(changed_it->first);
+      continue;
+    }
+    FillAgentOverview(*endpoint_it, agents->Add());
   }
-  delete request;
-  delete response;
-  agent_under_polling_.erase(endpoint);
-  ScheduleNextPoll();
 }
 
-void NodeManager::DeletePod(const std::string& pod_name,
-                            const std::string& endpoint) {
+void NodeManager::RecordChange(const std::string& endpoint,
+                               AgentChangeType type) {
+  mutex_.AssertHeld();
+  AgentChange change;
+  change.seq_ = ++cursor_;
+  change.endpoint_ = endpoint;
+  change.type_ = type;
+  changes_.push_back(change);
+  while (changes_.size() > (size_t)FLAGS_master_agent_change_log_size) {
+    changes_.pop_front();
+  }
+}
+
+void NodeManager::FillAgentOverview(const NodeIndex& node,
+                                    AgentOverview* agent) {
+  agent->set_endpoint(node.endpoint_);
+  agent->set_version(node.status_->version());
+  agent->mutable_resource()->CopyFrom(node.status_->resource());
+  FillPodsToAgentOverview(node.status_, agent);
+  // the reserved pods hold resource too, and scheduler knows its
+  // proposes have been counted by master when they show up
+  boost::unordered_map<std::string, std::map<std::string, PodReservation> >::iterator r_it =
+    reservations_->find(node.endpoint_);
+  if (r_it == reservations_->end()) {
+    return;
+  }
+  std::map<std::string, PodReservation>::iterator pod_it = r_it->second.begin();
+  for (; pod_it != r_it->second.end(); ++pod_it) {
+    agent->add_pods()->CopyFrom(pod_it->second.pod_);
+  }
+}
+
+RpcStatus NodeManager::ReservePod(const std::string& endpoint,
+                                  const PodStatus& pod) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
+  NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.find(endpoint);
+  if (endpoint_it == endpoint_idx.end()
+      || endpoint_it->status_->state() != kNodeNormal) {
+    LOG(WARNING, "agent %s is not available for pod %s", endpoint.c_str(),
+        pod.name().c_str());
+    return kRpcNotFound;
+  }
+  PodReservation reservation;
+  for (int32_t cindex = 0; cindex < pod.desc().containers_size(); ++cindex) {
+    ResourceUtil::Plus(pod.desc().containers(cindex).requirement(),
+                       reservation.pod_.mutable_requirement());
+  }
+  if (!ResourceUtil::Alloc(reservation.pod_.requirement(),
+                           endpoint_it->status_->mutable_resource())) {
+    LOG(WARNING, "agent %s has no resource for pod %s", endpoint.c_str(),
+        pod.name().c_str());
+    return kRpcNoResource;
+  }
+  reservation.pod_.set_name(pod.name());
+  reservation.pod_.set_job_name(pod.job_name());
+  reservation.pod_.set_type(pod.desc().type());
+  reservation.time_ = ::baidu::common::timer::get_micros();
+  (*reservations_)[endpoint][pod.name()] = reservation;
+  UpdateExported(endpoint, endpoint_it->status_);
+  // scheduler tells the changed agent by version
+  endpoint_it->status_->set_version(endpoint_it->status_->version() + 1);
+  RecordChange(endpoint, kAgentMod);
+  return kRpcOk;
+}
+
+void NodeManager::CancelReservation(const std::string& endpoint,
+                                    const std::string& pod_name) {
   ::baidu::common::MutexLock lock(&mutex_);
-  LOG(INFO, "delete pod %s on agent %s", pod_name.c_str(), endpoint.c_str());
   const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
   NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.find(endpoint);
   if (endpoint_it == endpoint_idx.end()) {
-    LOG(WARNING, "agent with endpoint %s does not exist", endpoint.c_str());
+    reservations_->erase(endpoint);
     return;
   }
-  boost::unordered_map<std::string, Agent_Stub*>::iterator agent_it = agent_conns_->find(endpoint);
-  Agent_Stub* agent_stub = NULL;
-  if (agent_it ==  agent_conns_->end()) {
-    bool ok = rpc_client_->GetStub(endpoint, &agent_stub);
-    if (ok) {
-      LOG(WARNING, "fail to get agent stub with endpoint %s for pod %s",
-          endpoint.c_str(), pod_name.c_str());
-      return;
-    }
-    agent_conns_->insert(std::make_pair(endpoint, agent_stub));
-  } else {
-    agent_stub = agent_it->second;
-  }
-  DeletePodRequest* request = new DeletePodRequest();
-  request->set_name(pod_name);
-  DeletePodResponse* response = new DeletePodResponse();
-  boost::function<void (const DeletePodRequest*, DeletePodResponse*, bool, int)> call_back;
-  call_back = boost::bind(&NodeManager::DeletePodCallback, this, endpoint, _1, _2, _3, _4);
-  rpc_client_->AsyncRequest(agent_stub, &Agent_Stub::Delete,
-                            request, response, call_back,
-                            5, 0);
+  RemoveReservation(endpoint, pod_name, endpoint_it->status_);
 }
 
-void NodeManager::DeletePodCallback(const std::string& endpoint,
-                                    const DeletePodRequest* request,
-                                    DeletePodResponse* response,
-                                    bool failed, int) {
-  if (!failed) {
-    LOG(INFO, "send delete pod %s action to agent %s successfully", request->name().c_str(), endpoint.c_str());
-  } else {
-    LOG(WARNING, "fail to send delete pod %s action to agent %s ", request->name().c_str(), endpoint.c_str());
+bool NodeManager::HasAgent(const std::string& endpoint) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
+  return endpoint_idx.find(endpoint) != endpoint_idx.end();
+}
+
+void NodeManager::RemoveReservation(const std::string& endpoint,
+                                    const std::string& pod_name,
+                                    NodeStatus* status) {
+  mutex_.AssertHeld();
+  boost::unordered_map<std::string, std::map<std::string, PodReservation> >::iterator r_it =
+    reservations_->find(endpoint);
+  if (r_it == reservations_->end()) {
+    return;
   }
-  delete request;
-  delete response;
+  std::map<std::string, PodReservation>::iterator pod_it = r_it->second.find(pod_name);
+  if (pod_it == r_it->second.end()) {
+    return;
+  }
+  LOG(INFO, "release reservation of pod %s on agent %s", pod_name.c_str(),
+      endpoint.c_str());
+  ResourceUtil::Release(pod_it->second.pod_.requirement(), status->mutable_resource());
+  r_it->second.erase(pod_it);
+  if (r_it->second.empty()) {
+    reservations_->erase(r_it);
+  }
+  UpdateExported(endpoint, status);
+  status->set_version(status->version() + 1);
+  RecordChange(endpoint, kAgentMod);
 }
 
-void NodeManager::SyncAgentInfo(const AgentVersionList& versions,
-                                AgentOverviewList* agents,
-                                StringList* del_list) {
-  ::baidu::common::MutexLock lock(&mutex_);
-  boost::unordered_map<std::string, int32_t> version_dict;
-  for (int index = 0; index < versions.size(); ++index) {
-    version_dict.insert(std::make_pair(versions.Get(index).endpoint(),
-                                       versions.Get(index).version()));
+void NodeManager::ApplyReservations(const std::string& endpoint,
+                                    NodeStatus* status) {
+  mutex_.AssertHeld();
+  boost::unordered_map<std::string, std::map<std::string, PodReservation> >::iterator r_it =
+    reservations_->find(endpoint);
+  if (r_it == reservations_->end()) {
+    return;
   }
-  const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
-  NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.begin();
-  for (; endpoint_it != endpoint_idx.end(); ++ endpoint_it) {
-    boost::unordered_map<std::string, int32_t>::iterator version_it = 
-      version_dict.find(endpoint_it->endpoint_);
-    if (version_it != version_dict.end()) {
-      // delete agent that has not been kNodeNormal
-      if (endpoint_it->status_->state() != kNodeNormal) {
-        del_list->Add()->assign(endpoint_it->endpoint_);
-        continue;
-      }
-      // agent info has been updated
-      if (endpoint_it->status_->version() != version_it->second) {
-        AgentOverview* agent_overview = agents->Add();
-        agent_overview->set_endpoint(endpoint_it->endpoint_);
-        agent_overview->set_version(endpoint_it->status_->version());
-        agent_overview->mutable_resource()->CopyFrom(endpoint_it->status_->resource());
-        FillPodsToAgentOverview(endpoint_it->status_, agent_overview);
-        continue;
-      }
-    } else {
-      if (endpoint_it->status_->state() != kNodeNormal) {
-        continue;
+  std::set<std::string> reported;
+  for (int32_t index = 0; index < status->pstatus_size(); ++index) {
+    reported.insert(status->pstatus(index).name());
+  }
+  int64_t expired = ::baidu::common::timer::get_micros()
+                    - FLAGS_master_pod_reservation_timeout * 1000L;
+  std::map<std::string, PodReservation>::iterator pod_it = r_it->second.begin();
+  while (pod_it != r_it->second.end()) {
+    if (reported.find(pod_it->first) != reported.end()) {
+      // the resource of pod is in the stat of agent now
+      r_it->second.erase(pod_it++);
+      continue;
+    }
+    if (pod_it->second.time_ < expired) {
+      LOG(WARNING, "reservation of pod %s on agent %s expires",
+          pod_it->first.c_str(), endpoint.c_str());
+      r_it->second.erase(pod_it++);
+      continue;
+    }
+    ResourceUtil::Alloc(pod_it->second.pod_.requirement(), status->mutable_resource());
+    ++pod_it;
+  }
+  if (r_it->second.empty()) {
+    reservations_->erase(r_it);
+  }
+}
+
+bool NodeManager::UpdateExported(const std::string& endpoint,
+                                 NodeStatus* status) {
+  mutex_.AssertHeld();
+  uint64_t resource_digest = ResourceDigest(status->resource());
+  uint64_t pods_digest = PodsDigest(status->pstatus());
+  ExportedAgent& exported = (*exported_)[endpoint];
+  // the digests find most changes cheaply, the fields are compared
+  // only when they match in case two states collide in the hash
+  bool resource_changed = resource_digest != status->resource_digest()
+                          || !SameResource(status->resource(), exported.resource_);
+  bool pods_changed = pods_digest != status->pods_digest()
+                      || !SamePods(status->pstatus(), exported.pods_);
+  if (!resource_changed && !pods_changed) {
+    return false;
+  }
+  LOG(DEBUG, "agent %s changes resource %d pods %d", endpoint.c_str(),
+      resource_changed, pods_changed);
+  status->set_resource_digest(resource_digest);
+  status->set_pods_digest(pods_digest);
+  if (resource_changed) {
+    exported.resource_.CopyFrom(status->resource());
+  }
+  if (pods_changed) {
+    exported.pods_.Clear();
+    for (int32_t index = 0; index < status->pstatus_size(); ++index) {
+      const PodStatus& pod = status->pstatus(index);
+      PodStatus* kept = exported.pods_.Add();
+      kept->set_name(pod.name());
+      kept->set_job_name(pod.job_name());
+      kept->mutable_desc()->set_type(pod.desc().type());
+      for (int32_t cindex = 0; cindex < pod.cstatus_size(); ++cindex) {
+        kept->add_cstatus()->mutable_spec()->mutable_requirement()->CopyFrom(
+            pod.cstatus(cindex).spec().requirement());
       }
-      AgentOverview* agent_overview = agents->Add();
-      agent_overview->set_endpoint(endpoint_it->endpoint_);
-      agent_overview->set_version(endpoint_it->status_->version());
-      agent_overview->mutable_resource()->CopyFrom(endpoint_it->status_->resource());
-      FillPodsToAgentOverview(endpoint_it->status_, agent_overview);
     }
   }
+  return true;
 }
 
 void NodeManager::FillPodsToAgentOverview(const NodeStatus* status,
@@ -261,9 +625,10 @@ void NodeManager::FillPodsToAgentOverview(const NodeStatus* status,
     pod->set_name(status->pstatus(index).name());
     pod->set_job_name(status->pstatus(index).job_name());
     pod->set_type(status->pstatus(index).desc().type());
+    // the requirement that pod holds on agent, not the usage
     Resource total;
     for (int32_t cindex = 0; cindex < status->pstatus(index).cstatus_size(); cindex ++) {
-      bool plus_ok = ResourceUtil::Plus(status->pstatus(index).cstatus(cindex).resource(), &total);
+      bool plus_ok = ResourceUtil::Plus(status->pstatus(index).cstatus(cindex).spec().requirement(), &total);
       if (!plus_ok) {
         LOG(WARNING, "fail to calc resource for job %s", status->pstatus(index).job_name().c_str());
       }
@@ -273,115 +638,244 @@ void NodeManager::FillPodsToAgentOverview(const NodeStatus* status,
 }
 
 void NodeManager::HandleNodeTimeout(const std::string& endpoint) {
-  LOG(WARNING, "agent with endpoint %s timeout ", endpoint.c_str());
+  NodeStatus* offline_status = NULL;
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    LOG(WARNING, "agent with endpoint %s timeout ", endpoint.c_str());
+    const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
+    NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.find(endpoint);
+    if (endpoint_it == endpoint_idx.end()
+        || endpoint_it->status_->state() == kNodeOffline) {
+      return;
+    }
+    // the offline agent is removed from schedulers and is not polled
+    // any more, pod manager puts all pods on it into pending queue
+    endpoint_it->status_->set_state(kNodeOffline);
+    reservations_->erase(endpoint);
+    exported_->erase(endpoint);
+    RecordChange(endpoint, kAgentDel);
+    offline_status = endpoint_it->status_;
+  }
+  // the same as PollNodeCallback, never block on queue with mutex_ held
+  node_status_queue_->Push(offline_status);
 }
 
 void NodeManager::WatchPodOpQueue() {
-  PodOperation* pod_op = pod_opqueue_->Pop();
-  switch(pod_op->type_) {
-    case kKillPod:
-      DeletePod(pod_op->pod_->name(),
-                pod_op->pod_->endpoint());
-      break;
-    case kRunPod:
-      RunPod(pod_op->pod_->name(), 
-             pod_op->pod_->endpoint(),
-             pod_op->pod_->desc());
-      break;
-    default:
-      LOG(WARNING, "no handle for pod");
-  }
-  delete pod_op;
+  std::vector<PodOperation*> pod_ops;
+  pod_opqueue_->PopBatch(&pod_ops, FLAGS_master_queue_pop_batch_size);
+  // group ops by endpoint, every agent gets one request for
+  // the pods to run and one for the pods to kill
+  std::map<std::string, std::vector<PodOperation*> > runs;
+  std::map<std::string, std::vector<PodOperation*> > kills;
+  for (size_t offset = 0; offset < pod_ops.size(); ++offset) {
+    PodOperation* pod_op = pod_ops[offset];
+    switch(pod_op->type_) {
+      case kKillPod:
+        kills[pod_op->endpoint_].push_back(pod_op);
+        break;
+      case kRunPod:
+        runs[pod_op->endpoint_].push_back(pod_op);
+        break;
+      default:
+        LOG(WARNING, "no handle for pod");
+    }
+  }
+  std::map<std::string, std::vector<PodOperation*> >::iterator it = runs.begin();
+  for (; it != runs.end(); ++it) {
+    RunPods(it->first, it->second);
+  }
+  for (it = kills.begin(); it != kills.end(); ++it) {
+    DeletePods(it->first, it->second);
+  }
+  for (size_t offset = 0; offset < pod_ops.size(); ++offset) {
+    delete pod_ops[offset];
+  }
   thread_pool_->AddTask(boost::bind(&NodeManager::WatchPodOpQueue, this));
 }
 
-void NodeManager::RunPod(const std::string& pod_name,
-                         const std::string& endpoint,
-                         const PodSpec& desc) {
+bool NodeManager::GetAgentStub(const std::string& endpoint,
+                               Agent_Stub** stub) {
+  mutex_.AssertHeld();
+  boost::unordered_map<std::string, Agent_Stub*>::iterator agent_it = agent_conns_->find(endpoint);
+  if (agent_it != agent_conns_->end()) {
+    *stub = agent_it->second;
+    return true;
+  }
+  bool ok = rpc_client_->GetStub(endpoint, stub);
+  if (!ok) {
+    LOG(WARNING, "fail to get agent stub with endpoint %s", endpoint.c_str());
+    return false;
+  }
+  agent_conns_->insert(std::make_pair(endpoint, *stub));
+  return true;
+}
+
+void NodeManager::RunPods(const std::string& endpoint,
+                          const std::vector<PodOperation*>& ops) {
   ::baidu::common::MutexLock lock(&mutex_);
-  LOG(INFO, "run pod %s on agent %s", pod_name.c_str(), endpoint.c_str());
+  LOG(INFO, "run %u pods on agent %s", ops.size(), endpoint.c_str());
   const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
   NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.find(endpoint);
   if (endpoint_it == endpoint_idx.end()) {
     LOG(WARNING, "agent with endpoint %s does not exist", endpoint.c_str());
     return;
   }
-  Resource pod_require;
-  for (int32_t cindex = 0; cindex < desc.containers_size(); cindex ++) {
-      bool plus_ok = ResourceUtil::Plus(desc.containers(cindex).requirement(), 
-                                        &pod_require);
-      if (!plus_ok) {
-        LOG(WARNING, "fail to calc total requirement for pod %s", pod_name.c_str());
-        return;
-      }
+  // the resource of pods has been reserved when they are scheduled
+  RunPodsRequest* request = new RunPodsRequest();
+  for (size_t offset = 0; offset < ops.size(); ++offset) {
+    RunPodRequest* pod = request->add_pods();
+    pod->set_pod_name(ops[offset]->name_);
+    pod->mutable_pod()->CopyFrom(ops[offset]->desc_);
   }
-  bool alloc_ok = ResourceUtil::Alloc(pod_require, 
-                                      endpoint_it->status_->mutable_resource());
-  if (!alloc_ok) {
-    LOG(WARNING, "fail to alloc pod %s requirement on agent %s",
-        pod_name.c_str(),
-        endpoint.c_str());
+  if (request->pods_size() == 0) {
+    delete request;
     return;
   }
+  // drop the polls in flight, they may not see the pods
   endpoint_it->status_->set_version(endpoint_it->status_->version() + 1);
+  RecordChange(endpoint, kAgentMod);
   Agent_Stub* agent_stub = NULL;
-  boost::unordered_map<std::string, Agent_Stub*>::iterator agent_it = agent_conns_->find(endpoint);
-  if (agent_it ==  agent_conns_->end()) {
-    bool ok = rpc_client_->GetStub(endpoint, &agent_stub);
-    if (ok) {
-      LOG(WARNING, "fail to get agent stub witn endpoint %s for pod %s",
-          endpoint.c_str(), pod_name.c_str());
-      return;
-    }
-    agent_conns_->insert(std::make_pair(endpoint, agent_stub));
-  } else {
-    agent_stub = agent_it->second;
-  }
-  RunPodRequest* request = new RunPodRequest();
-  request->set_pod_name(pod_name);
-  request->mutable_pod()->CopyFrom(desc);
-  RunPodResponse* response = new RunPodResponse();
-  boost::function<void (const RunPodRequest*, RunPodResponse*, bool, int)> call_back;
-  call_back = boost::bind(&NodeManager::RunPodCallback, this, _1, _2, _3, _4);
-  rpc_client_->AsyncRequest(agent_stub, &Agent_Stub::Run,
+  if (!GetAgentStub(endpoint, &agent_stub)) {
+    delete request;
+    return;
+  }
+  RunPodsResponse* response = new RunPodsResponse();
+  boost::function<void (const RunPodsRequest*, RunPodsResponse*, bool, int)> call_back;
+  call_back = boost::bind(&NodeManager::RunPodsCallback, this, endpoint, _1, _2, _3, _4);
+  rpc_client_->AsyncRequest(agent_stub, &Agent_Stub::RunPods,
                             request, response, call_back,
                             5, 0);
 }
 
-void NodeManager::ScheduleNextPoll() {
-  mutex_.AssertHeld();
-  if (agent_under_polling_.size() != 0) {
-    return;
+void NodeManager::RunPodsCallback(const std::string& endpoint,
+                                  const RunPodsRequest* request,
+                                  RunPodsResponse* response,
+                                  bool failed, int) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
+  NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.find(endpoint);
+  if (failed || response->status() != kRpcOk) {
+    LOG(WARNING, "fail to run %d pods on agent %s",
+        request->pods_size(), endpoint.c_str());
+    // none of the pods may be on agent, release them all and make a
+    // full poll, so pod manager finds the lost ones like the rejected ones
+    if (endpoint_it != endpoint_idx.end()) {
+      for (int32_t index = 0; index < request->pods_size(); ++index) {
+        RemoveReservation(endpoint, request->pods(index).pod_name(),
+                          endpoint_it->status_);
+      }
+      endpoint_it->status_->set_agent_version(0);
+    }
+  } else {
+    int32_t fails = 0;
+    for (int32_t index = 0; index < response->results_size(); ++index) {
+      const PodResult& result = response->results(index);
+      if (result.status() != kRpcOk) {
+        LOG(WARNING, "run pod %s fails for %s", result.pod_name().c_str(),
+            RpcStatus_Name(result.status()).c_str());
+        fails++;
+        if (endpoint_it != endpoint_idx.end()) {
+          RemoveReservation(endpoint, result.pod_name(), endpoint_it->status_);
+        }
+      }
+    }
+    // the rejected pods are not on agent, a full poll makes pod manager
+    // find them lost and put them into pending queue again
+    if (fails > 0 && endpoint_it != endpoint_idx.end()) {
+      endpoint_it->status_->set_agent_version(0);
+    }
+    LOG(INFO, "run %d pods on agent %s, %d fails", request->pods_size(),
+        endpoint.c_str(), fails);
   }
-  thread_pool_->DelayTask(5000, boost::bind(&NodeManager::StartPoll, this));
+  delete request;
+  delete response;
 }
 
-void NodeManager::StartPoll() {
+void NodeManager::DeletePods(const std::string& endpoint,
+                             const std::vector<PodOperation*>& ops) {
   ::baidu::common::MutexLock lock(&mutex_);
-  if (agent_under_polling_.size() != 0) {
+  LOG(INFO, "delete %u pods on agent %s", ops.size(), endpoint.c_str());
+  const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
+  NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.find(endpoint);
+  if (endpoint_it == endpoint_idx.end()) {
+    LOG(WARNING, "agent with endpoint %s does not exist", endpoint.c_str());
     return;
   }
-  LOG(INFO, "start the next poll turn");
-  const NodeEndpointIndex& endpoint_idx = nodes_->get<endpoint_tag>();
-  NodeEndpointIndex::const_iterator endpoint_it = endpoint_idx.begin();
-  for (; endpoint_it != endpoint_idx.end(); ++endpoint_it) {
-    // mark agent is under polling
-    agent_under_polling_.insert(endpoint_it->endpoint_);
-    PollNode(endpoint_it->endpoint_);
+  Agent_Stub* agent_stub = NULL;
+  if (!GetAgentStub(endpoint, &agent_stub)) {
+    return;
+  }
+  DeletePodsRequest* request = new DeletePodsRequest();
+  for (size_t offset = 0; offset < ops.size(); ++offset) {
+    request->add_names(ops[offset]->name_);
+    // the pod may be killed before agent reports it
+    RemoveReservation(endpoint, ops[offset]->name_, endpoint_it->status_);
   }
-  ScheduleNextPoll();
+  DeletePodsResponse* response = new DeletePodsResponse();
+  boost::function<void (const DeletePodsRequest*, DeletePodsResponse*, bool, int)> call_back;
+  call_back = boost::bind(&NodeManager::DeletePodsCallback, this, endpoint, _1, _2, _3, _4);
+  rpc_client_->AsyncRequest(agent_stub, &Agent_Stub::DeletePods,
+                            request, response, call_back,
+                            5, 0);
 }
 
-void NodeManager::RunPodCallback(const RunPodRequest* request,
-                                RunPodResponse* response,
-                                bool failed, int) {
+void NodeManager::DeletePodsCallback(const std::string& endpoint,
+                                     const DeletePodsRequest* request,
+                                     DeletePodsResponse* response,
+                                     bool failed, int) {
   if (failed || response->status() != kRpcOk) {
-    LOG(WARNING, "run pod %s fails", request->pod_name().c_str());
+    LOG(WARNING, "fail to send delete %d pods action to agent %s",
+        request->names_size(), endpoint.c_str());
   } else {
-    LOG(INFO, "run pod %s successfully", request->pod_name().c_str());
+    for (int32_t index = 0; index < response->results_size(); ++index) {
+      const PodResult& result = response->results(index);
+      if (result.status() != kRpcOk) {
+        LOG(WARNING, "fail to delete pod %s on agent %s for %s",
+            result.pod_name().c_str(), endpoint.c_str(),
+            RpcStatus_Name(result.status()).c_str());
+      }
+    }
+    LOG(INFO, "send delete %d pods action to agent %s successfully",
+        request->names_size(), endpoint.c_str());
   }
   delete request;
   delete response;
 }
 
+void NodeManager::ScheduleNextPoll(const std::string& endpoint,
+                                   int64_t poll_seq,
+                                   int32_t delay) {
+  mutex_.AssertHeld();
+  thread_pool_->DelayTask(delay, boost::bind(&NodeManager::StartPoll, this,
+                                             endpoint, poll_seq));
+}
+
+void NodeManager::StartPoll(const std::string& endpoint, int64_t poll_seq) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  if (agent_under_polling_.size() >= (size_t)FLAGS_master_agent_poll_max_inflight) {
+    LOG(DEBUG, "too many polls in flight, agent %s waits", endpoint.c_str());
+    agent_waiting_polling_.push_back(std::make_pair(endpoint, poll_seq));
+    return;
+  }
+  // mark agent is under polling
+  agent_under_polling_.insert(endpoint);
+  if (!PollNode(endpoint, poll_seq)) {
+    agent_under_polling_.erase(endpoint);
+  }
+}
+
+void NodeManager::PollWaitingNodes() {
+  mutex_.AssertHeld();
+  while (!agent_waiting_polling_.empty()
+         && agent_under_polling_.size() < (size_t)FLAGS_master_agent_poll_max_inflight) {
+    std::string endpoint = agent_waiting_polling_.front().first;
+    int64_t poll_seq = agent_waiting_polling_.front().second;
+    agent_waiting_polling_.pop_front();
+    agent_under_polling_.insert(endpoint);
+    if (!PollNode(endpoint, poll_seq)) {
+      agent_under_polling_.erase(endpoint);
+    }
+  }
+}
+
 } // end of dos
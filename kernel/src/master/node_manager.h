@@ -6,9 +6,12 @@
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/unordered_map.hpp>
+#include <deque>
+#include <map>
 
 #include "rpc/rpc_client.h"
-#include "common/blocking_queue.h"
+#include "common/mpmc_queue.h"
+#include "common/liveness_tracker.h"
 #include "master/master_internal_types.h"
 #include "master/idx_tag.h"
 #include "mutex.h"
@@ -40,53 +43,125 @@ typedef boost::multi_index_container<
   >
 > NodeSet;
 
+enum AgentChangeType {
+  kAgentAdd,
+  kAgentMod,
+  kAgentDel
+};
+
+// a record in agent change log, the seq_ is the
+// cluster wide cursor when the change happened
+struct AgentChange {
+  int64_t seq_;
+  std::string endpoint_;
+  AgentChangeType type_;
+};
+
+// the resource held for a pod that has been scheduled to agent but
+// has not been reported by agent
+struct PodReservation {
+  PodOverview pod_;
+  // the time(us) when pod is reserved
+  int64_t time_;
+};
+
+// the fields of agent that scheduler got last time, they confirm that
+// agent does not change when the digests match
+struct ExportedAgent {
+  Resource resource_;
+  // only the pod fields that scheduler uses are kept
+  ::google::protobuf::RepeatedPtrField<PodStatus> pods_;
+};
+
 typedef boost::multi_index::index<NodeSet, hostname_tag>::type NodeHostnameIndex;
 typedef boost::multi_index::index<NodeSet, endpoint_tag>::type NodeEndpointIndex;
 
 typedef google::protobuf::RepeatedPtrField<dos::AgentOverview> AgentOverviewList;
-typedef google::protobuf::RepeatedPtrField<dos::AgentVersion> AgentVersionList;
 typedef google::protobuf::RepeatedPtrField<std::string> StringList;
 
 class NodeManager {
 
 public:
-  NodeManager(FixedBlockingQueue<NodeStatus*>* node_status_queue,
-              FixedBlockingQueue<PodOperation*>* pod_opqueue);
+  NodeManager(BoundedMpmcQueue<NodeStatus*>* node_status_queue,
+              BoundedMpmcQueue<PodOperation*>* pod_opqueue);
   ~NodeManager();
   bool Start();
   void KeepAlive(const std::string& hostname, 
                  const std::string& endpoint);
-  void SyncAgentInfo(const AgentVersionList& versions,
+  // get the agents changed since cursor, when the cursor has fallen
+  // out of change log, all agents will be returned and full_sync will be true
+  void SyncAgentInfo(int64_t cursor,
                      AgentOverviewList* agents,
-                     StringList* del_list);
+                     StringList* del_list,
+                     int64_t* latest_cursor,
+                     bool* full_sync);
+  // hold the requirement of pod on agent until agent reports the pod or
+  // rejects it, return kRpcNoResource when the agent can not hold it
+  RpcStatus ReservePod(const std::string& endpoint, const PodStatus& pod);
+  void CancelReservation(const std::string& endpoint,
+                         const std::string& pod_name);
+  // the agent has sent heart beat to this master
+  bool HasAgent(const std::string& endpoint);
 private:
+  // release the reservation of pod from status
+  void RemoveReservation(const std::string& endpoint,
+                         const std::string& pod_name,
+                         NodeStatus* status);
+  // alloc the reservations of the pods that agent has not reported
+  // on the resource polled from agent, the reported and expired ones
+  // are dropped
+  void ApplyReservations(const std::string& endpoint, NodeStatus* status);
+  // update the digests of status and keep the exported fields of agent,
+  // return true when the resource or pods that scheduler uses change
+  bool UpdateExported(const std::string& endpoint, NodeStatus* status);
+  void FillAgentOverview(const NodeIndex& node, AgentOverview* agent);
   void FillPodsToAgentOverview(const NodeStatus* status, AgentOverview* agent);
+  // append a change to change log and move the cursor forward
+  void RecordChange(const std::string& endpoint, AgentChangeType type);
   bool LoadNodeMeta();
-  void PollNode(const std::string& endpoint);
+  // send poll request to agent, return false when no request is sent
+  // or poll_seq is not the poll chain of agent
+  bool PollNode(const std::string& endpoint, int64_t poll_seq);
   void HandleNodeTimeout(const std::string& endpoint);
   void WatchPodOpQueue();
-  void RunPod(const std::string& pod_name,
-              const std::string& endpoint,
-              const PodSpec& desc);
-  void RunPodCallback(const RunPodRequest* request,
-                      RunPodResponse* response,
-                      bool failed, int);
+  bool GetAgentStub(const std::string& endpoint, Agent_Stub** stub);
+  // run the pods of ops on agent with one request
+  void RunPods(const std::string& endpoint,
+               const std::vector<PodOperation*>& ops);
+  void RunPodsCallback(const std::string& endpoint,
+                       const RunPodsRequest* request,
+                       RunPodsResponse* response,
+                       bool failed, int);
+  // apply the full snapshot or delta in response to the pods of status
+  // and return true when pods change
+  bool MergePolledPods(const PollAgentResponse* response,
+                       NodeStatus* status);
   void PollNodeCallback(const std::string& endpoint,
                         const PollAgentRequest* request,
                         PollAgentResponse* response,
                         bool failed, int,
-                        int32_t version);
+                        int32_t version,
+                        int64_t poll_seq);
 
-  void DeletePod(const std::string& pod_name,
-               const std::string& endpoint);
+  // delete the pods of ops on agent with one request
+  void DeletePods(const std::string& endpoint,
+                  const std::vector<PodOperation*>& ops);
 
-  void DeletePodCallback(const std::string& endpoint,
-                         const DeletePodRequest* request,
-                         DeletePodResponse* response,
-                         bool failed, int);
-  void StartPoll();
-  void ScheduleNextPoll();
+  void DeletePodsCallback(const std::string& endpoint,
+                          const DeletePodsRequest* request,
+                          DeletePodsResponse* response,
+                          bool failed, int);
+  // poll agent now, or queue it when too many polls are in flight
+  void StartPoll(const std::string& endpoint, int64_t poll_seq);
+  // poll agent after delay ms in the poll chain of poll_seq
+  void ScheduleNextPoll(const std::string& endpoint,
+                        int64_t poll_seq,
+                        int32_t delay);
+  // poll the queued agents while in flight limit allows
+  void PollWaitingNodes();
 private:
+  // pod manager locks it with shard mutex held, so never block on
+  // node_status_queue_ or call pod manager with it held
   ::baidu::common::Mutex mutex_;
   NodeSet* nodes_;
   ::galaxy::ins::sdk::InsSDK* nexus_;
@@ -95,13 +170,25 @@ private:
   // endpoint and agent_stub pair
   boost::unordered_map<std::string, Agent_Stub*>* agent_conns_;
   ::baidu::common::ThreadPool* thread_pool_;
-  FixedBlockingQueue<NodeStatus*>* node_status_queue_;
-  FixedBlockingQueue<PodOperation*>* pod_opqueue_;
+  BoundedMpmcQueue<NodeStatus*>* node_status_queue_;
+  BoundedMpmcQueue<PodOperation*>* pod_opqueue_;
   RpcClient* rpc_client_;
   // the agents which is under polling
   std::set<std::string> agent_under_polling_;
+  // the agents that wait for a free poll slot and their poll seqs
+  std::deque<std::pair<std::string, int64_t> > agent_waiting_polling_;
   // the agents which is under first polling 
   std::set<std::string> agent_under_fisrt_polling_;
+  // the seq of the latest change
+  int64_t cursor_;
+  // the bounded agent change log, the seqs in it are continuous
+  std::deque<AgentChange> changes_;
+  // endpoint and the reservations of pods on it
+  boost::unordered_map<std::string, std::map<std::string, PodReservation> >* reservations_;
+  // endpoint and the fields exported to scheduler last time
+  boost::unordered_map<std::string, ExportedAgent>* exported_;
+  // detect the agents whose heart beats time out
+  LivenessTracker* liveness_;
 };
 
 } // end of dos
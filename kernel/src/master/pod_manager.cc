@@ -1,39 +1,57 @@
 #include "master/pod_manager.h"
 
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
+#include <boost/functional/hash.hpp>
+#include <gflags/gflags.h>
 #include "common/resource_util.h"
 #include "logging.h"
 #include "timer.h"
 
+DECLARE_int32(master_pod_shard_count);
+DECLARE_int32(master_queue_pop_batch_size);
+DECLARE_int32(master_restore_grace_period);
+
 using ::baidu::common::INFO;
 using ::baidu::common::WARNING;
 using ::baidu::common::DEBUG;
 
 namespace dos {
 
-PodManager::PodManager(FixedBlockingQueue<PodOperation*>* pod_opqueue,
-                       FixedBlockingQueue<JobOperation*>* job_opqueue,
-                       FixedBlockingQueue<NodeStatus*>* node_opqueue):pods_(NULL),
-  scale_up_jobs_(NULL),
+PodManager::PodManager(BoundedMpmcQueue<PodOperation*>* pod_opqueue,
+                       BoundedMpmcQueue<JobOperation*>* job_opqueue,
+                       BoundedMpmcQueue<NodeStatus*>* node_opqueue,
+                       NodeManager* node_manager,
+                       StateStore* state_store):shards_(),
   scale_down_jobs_(NULL),
   fsm_(NULL),
   state_to_stage_(),
   pod_opqueue_(pod_opqueue),
   job_opqueue_(job_opqueue),
-  job_desc_(NULL),
   tpool_(4),
-  node_opqueue_(node_opqueue){
-  pods_ = new PodSet();
-  scale_up_jobs_ = new std::set<std::string>();
+  node_opqueue_(node_opqueue),
+  offline_mutex_(),
+  offline_agents_(),
+  watch_mutex_(),
+  generation_(0),
+  watchers_(),
+  next_watcher_id_(0),
+  state_store_(state_store),
+  node_manager_(node_manager){
+  // start generation from current time, so the generation that scheduler got
+  // from the previous master will not be equal to it after master failover
+  generation_ = ::baidu::common::timer::get_micros();
+  for (int32_t index = 0; index < FLAGS_master_pod_shard_count; ++index) {
+    shards_.push_back(new PodShard());
+  }
   scale_down_jobs_ = new std::set<std::string>();
   fsm_ = new PodFSM();
   fsm_->insert(std::make_pair(kPodSchedStagePending, 
-                              boost::bind(&PodManager::HandleStagePendingChanged, this, _1)));
+                              boost::bind(&PodManager::HandleStagePendingChanged, this, _1, _2)));
   fsm_->insert(std::make_pair(kPodSchedStageRunning, 
-                              boost::bind(&PodManager::HandleStageRunningChanged, this, _1)));
+                              boost::bind(&PodManager::HandleStageRunningChanged, this, _1, _2)));
   fsm_->insert(std::make_pair(kPodSchedStageRemoved, 
-                              boost::bind(&PodManager::HandleStageRemovedChanged, this, _1)));
-  job_desc_ = new std::map<std::string, JobSpec>();
+                              boost::bind(&PodManager::HandleStageRemovedChanged, this, _1, _2)));
   state_to_stage_.insert(std::make_pair(kPodRunning, kPodSchedStageRunning));
   state_to_stage_.insert(std::make_pair(kPodDeploying, kPodSchedStageRunning));
   state_to_stage_.insert(std::make_pair(kPodDeath, kPodSchedStageDeath));
@@ -41,30 +59,182 @@ PodManager::PodManager(FixedBlockingQueue<PodOperation*>* pod_opqueue,
 
 PodManager::~PodManager(){}
 
+PodShard* PodManager::GetShard(const std::string& job_name) {
+  size_t hash = boost::hash<std::string>()(job_name);
+  return shards_[hash % shards_.size()];
+}
+
+std::string PodManager::GetJobName(const std::string& pod_name) {
+  // the pod name is {offset}_pod.{job_name}
+  size_t pos = pod_name.find("_pod.");
+  if (pos == std::string::npos) {
+    return "";
+  }
+  return pod_name.substr(pos + 5);
+}
+
 void PodManager::Start() {
   tpool_.AddTask(boost::bind(&PodManager::WatchJobOp, this));
   tpool_.AddTask(boost::bind(&PodManager::WatchNodeOp, this));
 }
 
+void PodManager::Restore(const std::vector<JobStatus>& jobs,
+                         const std::vector<PodStatus>& pods) {
+  std::map<std::string, const JobStatus*> job_map;
+  for (size_t index = 0; index < jobs.size(); ++index) {
+    job_map.insert(std::make_pair(jobs[index].name(), &jobs[index]));
+    PodShard* shard = GetShard(jobs[index].name());
+    ::baidu::common::MutexLock lock(&shard->mutex_);
+    shard->job_desc_->insert(std::make_pair(jobs[index].name(), jobs[index].desc()));
+  }
+  int32_t restored = 0;
+  // the agents that restored pods are placed on
+  std::set<std::string> endpoints;
+  for (size_t index = 0; index < pods.size(); ++index) {
+    const PodStatus& logged = pods[index];
+    std::map<std::string, const JobStatus*>::iterator job_it = job_map.find(logged.job_name());
+    if (job_it == job_map.end()) {
+      LOG(WARNING, "drop pod %s for that job %s does not exist",
+          logged.name().c_str(), logged.job_name().c_str());
+      continue;
+    }
+    PodShard* shard = GetShard(logged.job_name());
+    ::baidu::common::MutexLock lock(&shard->mutex_);
+    PodStatus* pod = new PodStatus(logged);
+    pod->mutable_desc()->CopyFrom(job_it->second->desc().pod());
+    PodIndex pod_index;
+    pod_index.name_ = pod->name();
+    pod_index.user_name_ = job_it->second->user_name();
+    pod_index.job_name_ = pod->job_name();
+    pod_index.endpoint_ = pod->endpoint();
+    pod_index.pod_ = pod;
+    shard->pods_->insert(pod_index);
+    UpdateJobStat(shard, pod->job_name(), pod->state(), 1);
+    if (!pod->endpoint().empty()) {
+      endpoints.insert(pod->endpoint());
+    }
+    if (pod->stage() == kPodSchedStagePending) {
+      shard->scale_up_jobs_->insert(pod->job_name());
+    } else if (pod->stage() == kPodSchedStageDeath) {
+      // the kill operation may be lost with the last master
+      PushPodOperation(kKillPod, *pod, pod->endpoint());
+    }
+    restored++;
+  }
+  // the running pods that agents do not report in the first poll
+  // go back to pending in SyncPodsOnAgent, and the ones whose agents
+  // never come back are never polled, reschedule them after a while
+  if (!endpoints.empty()) {
+    tpool_.DelayTask(FLAGS_master_restore_grace_period,
+                     boost::bind(&PodManager::RescheduleLostAgents, this,
+                                 std::vector<std::string>(endpoints.begin(),
+                                                          endpoints.end())));
+  }
+  LOG(INFO, "restore %u jobs and %d pods on %u agents", jobs.size(), restored,
+      endpoints.size());
+}
+
+void PodManager::RescheduleLostAgents(const std::vector<std::string>& endpoints) {
+  std::vector<std::string> lost;
+  for (size_t index = 0; index < endpoints.size(); ++index) {
+    if (!node_manager_->HasAgent(endpoints[index])) {
+      lost.push_back(endpoints[index]);
+    }
+  }
+  if (lost.empty()) {
+    return;
+  }
+  LOG(WARNING, "%u agents of restored pods do not come back in %d ms",
+      lost.size(), FLAGS_master_restore_grace_period);
+  {
+    // the pods left on them are killed when they come back later
+    ::baidu::common::MutexLock lock(&offline_mutex_);
+    offline_agents_.insert(lost.begin(), lost.end());
+  }
+  RescheduleNodes(lost);
+}
+
+void PodManager::DumpState(RecordWriter* snapshot) {
+  for (size_t index = 0; index < shards_.size(); ++index) {
+    PodShard* shard = shards_[index];
+    // copy pods under lock and write them without it, as writing
+    // snapshot may do io
+    std::vector<StateRecord> records;
+    {
+      ::baidu::common::MutexLock lock(&shard->mutex_);
+      const PodNameIndex& name_index = shard->pods_->get<name_tag>();
+      records.resize(name_index.size());
+      PodNameIndex::const_iterator it = name_index.begin();
+      for (size_t offset = 0; it != name_index.end(); ++it, ++offset) {
+        StateStore::BuildPodPut(*it->pod_, &records[offset]);
+      }
+    }
+    for (size_t offset = 0; offset < records.size(); ++offset) {
+      snapshot->Append(records[offset]);
+    }
+  }
+}
+
 void PodManager::WatchNodeOp() {
-  NodeStatus* node_status = node_opqueue_->Pop();
-  std::map<std::string, PodStatus> pods;
-  for (int32_t index = 0; index < node_status->pstatus_size(); ++index) {
-    pods.insert(std::make_pair(node_status->pstatus(index).name(), 
-                node_status->pstatus(index)));
+  std::vector<NodeStatus*> node_statuses;
+  node_opqueue_->PopBatch(&node_statuses, FLAGS_master_queue_pop_batch_size);
+  // node manager pushes the same status of an agent again and again,
+  // sync it once in a batch
+  std::set<NodeStatus*> synced;
+  // the agents that go offline in this batch are handled together
+  std::vector<std::string> offline_endpoints;
+  for (size_t offset = 0; offset < node_statuses.size(); ++offset) {
+    NodeStatus* node_status = node_statuses[offset];
+    if (!synced.insert(node_status).second) {
+      continue;
+    }
+    const std::string& endpoint = node_status->meta().endpoint();
+    if (node_status->state() == kNodeOffline) {
+      offline_endpoints.push_back(endpoint);
+      ::baidu::common::MutexLock lock(&offline_mutex_);
+      offline_agents_.insert(endpoint);
+      continue;
+    }
+    std::map<std::string, PodStatus> pods;
+    for (int32_t index = 0; index < node_status->pstatus_size(); ++index) {
+      pods.insert(std::make_pair(node_status->pstatus(index).name(), 
+                  node_status->pstatus(index)));
+    }
+    // the agent that comes back starts with a full poll, the pods left
+    // on it have been rescheduled and are not reported to master any more
+    bool kill_orphans = false;
+    {
+      ::baidu::common::MutexLock lock(&offline_mutex_);
+      kill_orphans = offline_agents_.erase(endpoint) > 0;
+    }
+    SyncPodsOnAgent(endpoint, pods, kill_orphans);
+  }
+  if (!offline_endpoints.empty()) {
+    RescheduleNodes(offline_endpoints);
   }
-  SyncPodsOnAgent(node_status->meta().endpoint(), pods);
   tpool_.AddTask(boost::bind(&PodManager::WatchNodeOp, this));
 }
 
 void PodManager::WatchJobOp() {
-  JobOperation* job_op = job_opqueue_->Pop();
+  std::vector<JobOperation*> job_ops;
+  job_opqueue_->PopBatch(&job_ops, FLAGS_master_queue_pop_batch_size);
+  for (size_t offset = 0; offset < job_ops.size(); ++offset) {
+    HandleJobOp(job_ops[offset]);
+  }
+  tpool_.AddTask(boost::bind(&PodManager::WatchJobOp, this));
+}
+
+void PodManager::HandleJobOp(JobOperation* job_op) {
   bool ok = false;
   switch(job_op->type_) {
     case kJobNewAdd:
       ok = NewAdd(job_op->job_->name(), job_op->job_->user_name(),
                   job_op->job_->desc().pod(), job_op->job_->desc().replica());
-      job_desc_->insert(std::make_pair(job_op->job_->name(), job_op->job_->desc()));
+      {
+        PodShard* shard = GetShard(job_op->job_->name());
+        ::baidu::common::MutexLock lock(&shard->mutex_);
+        shard->job_desc_->insert(std::make_pair(job_op->job_->name(), job_op->job_->desc()));
+      }
       break;
     case kJobRemove:
       ScaleDownJob(job_op->job_);
@@ -79,25 +249,77 @@ void PodManager::WatchJobOp() {
         job_op->job_->name().c_str());
   }
   delete job_op;
-  tpool_.AddTask(boost::bind(&PodManager::WatchJobOp, this));
+}
+
+void PodManager::WatchScaleUpPods(int64_t generation,
+                                  int32_t timeout,
+                                  const boost::function<void ()>& callback) {
+  ::baidu::common::MutexLock lock(&watch_mutex_);
+  if (generation != generation_) {
+    tpool_.AddTask(callback);
+    return;
+  }
+  int64_t watcher_id = next_watcher_id_++;
+  watchers_.insert(std::make_pair(watcher_id, callback));
+  tpool_.DelayTask(timeout, boost::bind(&PodManager::HandleWatchTimeout, this, watcher_id));
+}
+
+void PodManager::HandleWatchTimeout(int64_t watcher_id) {
+  boost::function<void ()> callback;
+  {
+    ::baidu::common::MutexLock lock(&watch_mutex_);
+    std::map<int64_t, boost::function<void ()> >::iterator it = watchers_.find(watcher_id);
+    if (it == watchers_.end()) {
+      // it has been waked up by changes
+      return;
+    }
+    callback = it->second;
+    watchers_.erase(it);
+  }
+  callback();
+}
+
+void PodManager::NotifyScaleUpChanged() {
+  ::baidu::common::MutexLock lock(&watch_mutex_);
+  ++generation_;
+  std::map<int64_t, boost::function<void ()> >::iterator it = watchers_.begin();
+  for (; it != watchers_.end(); ++it) {
+    tpool_.AddTask(it->second);
+  }
+  watchers_.clear();
 }
 
 void PodManager::GetScaleUpPods(const Condition& condition,
-                                PodOverviewList* pods) {
-  ::baidu::common::MutexLock lock(&mutex_);
-  LOG(DEBUG, "get scale up pods, scale_up_jobs size %u", scale_up_jobs_->size());
-  const PodJobNameIndex& job_name_index = pods_->get<job_name_tag>();
+                                PodOverviewList* pods,
+                                int64_t* generation) {
+  {
+    // the changes after reading generation will move it forward,
+    // so the caller will not miss them
+    ::baidu::common::MutexLock lock(&watch_mutex_);
+    *generation = generation_;
+  }
+  for (size_t index = 0; index < shards_.size(); ++index) {
+    GetShardScaleUpPods(shards_[index], condition, pods);
+  }
+}
+
+void PodManager::GetShardScaleUpPods(PodShard* shard,
+                                     const Condition& condition,
+                                     PodOverviewList* pods) {
+  ::baidu::common::MutexLock lock(&shard->mutex_);
+  LOG(DEBUG, "get scale up pods, scale_up_jobs size %u", shard->scale_up_jobs_->size());
+  const PodJobNameIndex& job_name_index = shard->pods_->get<job_name_tag>();
   std::set<std::string> job_to_remove;
-  std::set<std::string>::iterator it = scale_up_jobs_->begin();
+  std::set<std::string>::iterator it = shard->scale_up_jobs_->begin();
   std::set<PodType> require_types;
   for (int32_t index = 0; index < condition.types_size(); ++index) {
     require_types.insert(condition.types(index));
   }
 
-  for (; it != scale_up_jobs_->end(); ++it) {
+  for (; it != shard->scale_up_jobs_->end(); ++it) {
     std::string job_name = *it;
     JobStat stat;
-    bool get_ok = GetJobStatForInternal(job_name, &stat);
+    bool get_ok = GetJobStatForInternal(shard, job_name, &stat);
     if (!get_ok) {
       LOG(WARNING, "fail get job stat for job %s", job_name.c_str());
       continue;
@@ -108,8 +330,8 @@ void PodManager::GetScaleUpPods(const Condition& condition,
       continue;
     }
     int32_t deploy_step_size = 0;
-    std::map<std::string, JobSpec>::iterator job_it = job_desc_->find(job_name);
-    if (job_it == job_desc_->end()) {
+    std::map<std::string, JobSpec>::iterator job_it = shard->job_desc_->find(job_name);
+    if (job_it == shard->job_desc_->end()) {
       LOG(WARNING, "fail to get job desc for job %s", job_name.c_str());
       continue;
     }
@@ -164,6 +386,7 @@ void PodManager::GetScaleUpPods(const Condition& condition,
       pod_overview->set_name(job_name_it->name_);
       pod_overview->set_job_name(job_name);
       pod_overview->set_type(job_name_it->pod_->desc().type());
+      pod_overview->set_gang(job_it->second.gang());
       // assign sched time
       job_name_it->pod_->set_sched_time(::baidu::common::timer::get_micros());
             pod_overview->mutable_requirement()->CopyFrom(total);
@@ -173,14 +396,14 @@ void PodManager::GetScaleUpPods(const Condition& condition,
   for (; job_to_remove_it != job_to_remove.end(); ++job_to_remove_it) {
     std::string job_name = *job_to_remove_it;
     LOG(INFO, "remove job %s from scale up queue", job_name.c_str());
-    scale_up_jobs_->erase(job_name);
+    shard->scale_up_jobs_->erase(job_name);
   }
 
 }
 
-void PodManager::HandleStageRemovedChanged(const Event& e) {
-  mutex_.AssertHeld();
-  PodNameIndex& name_index = pods_->get<name_tag>();
+void PodManager::HandleStageRemovedChanged(PodShard* shard, const Event& e) {
+  shard->mutex_.AssertHeld();
+  PodNameIndex& name_index = shard->pods_->get<name_tag>();
   const std::string pod_name = boost::get<0>(e);
   const PodSchedStage& to_stage = boost::get<2>(e);
   PodNameIndex::iterator name_it = name_index.find(pod_name);
@@ -198,14 +421,16 @@ void PodManager::HandleStageRemovedChanged(const Event& e) {
     LOG(INFO, "delete pod %s from agent %s", 
         name_it->pod_->name().c_str(),
         name_it->pod_->endpoint().c_str());
+    UpdateJobStat(shard, name_it->job_name_, name_it->pod_->state(), -1);
+    state_store_->DelPod(pod_name);
     delete name_it->pod_;
     name_index.erase(pod_name);
   }
 }
 
-void PodManager::HandleStageRunningChanged(const Event& e) {
-  mutex_.AssertHeld();
-  const PodNameIndex& name_index = pods_->get<name_tag>();
+void PodManager::HandleStageRunningChanged(PodShard* shard, const Event& e) {
+  shard->mutex_.AssertHeld();
+  const PodNameIndex& name_index = shard->pods_->get<name_tag>();
   const std::string pod_name = boost::get<0>(e);
   const PodSchedStage& to_stage = boost::get<2>(e);
   PodNameIndex::const_iterator name_it = name_index.find(pod_name);
@@ -217,11 +442,9 @@ void PodManager::HandleStageRunningChanged(const Event& e) {
   // death
   if (to_stage == kPodSchedStageDeath) {
     // send kill cmd to agent to clean this pod
-    PodOperation* op = new PodOperation();
-    op->pod_ = name_it->pod_;
-    op->type_ = kKillPod;
-    pod_opqueue_->Push(op);
+    PushPodOperation(kKillPod, *name_it->pod_, name_it->endpoint_);
     name_it->pod_->set_stage(kPodSchedStageDeath);
+    state_store_->PutPod(*name_it->pod_);
     LOG(INFO, "clean dead pod %s ", pod_name.c_str());
   } else if (to_stage == kPodSchedStageRunning) {
     // pod is running well
@@ -229,18 +452,18 @@ void PodManager::HandleStageRunningChanged(const Event& e) {
     // pod is lost , reschedule it
     name_it->pod_->set_stage(kPodSchedStagePending);
     // reset pod state
-    name_it->pod_->set_state(kPodPending);
+    SetPodState(shard, name_it->pod_, kPodPending);
     // record pending time
     name_it->pod_->set_start_pending_time(::baidu::common::timer::get_micros());
-    scale_up_jobs_->insert(name_it->job_name_);
+    state_store_->PutPod(*name_it->pod_);
+    shard->scale_up_jobs_->insert(name_it->job_name_);
+    NotifyScaleUpChanged();
     LOG(INFO, "put pod %s into pending queue again", pod_name.c_str());
   } else if (to_stage == kPodSchedStageRemoved) {
     // remove pod , clean it on agent and change stage to kPodSchedStageRemoved
-    PodOperation* op = new PodOperation();
-    op->pod_ = name_it->pod_;
-    op->type_ = kKillPod;
-    pod_opqueue_->Push(op);
+    PushPodOperation(kKillPod, *name_it->pod_, name_it->endpoint_);
     name_it->pod_->set_stage(kPodSchedStageRemoved);
+    state_store_->PutPod(*name_it->pod_);
     LOG(INFO, "kill running pod %s", pod_name.c_str());
   } else {
     LOG(WARNING, "[alert]invalidate incoming stage %s with pod %s",
@@ -249,11 +472,11 @@ void PodManager::HandleStageRunningChanged(const Event& e) {
   }
 }
 
-void PodManager::HandleStagePendingChanged(const Event& e) {
-  mutex_.AssertHeld();
+void PodManager::HandleStagePendingChanged(PodShard* shard, const Event& e) {
+  shard->mutex_.AssertHeld();
   const std::string pod_name = boost::get<0>(e);
   const PodSchedStage& to_stage = boost::get<2>(e);
-  PodNameIndex& name_index = pods_->get<name_tag>();
+  PodNameIndex& name_index = shard->pods_->get<name_tag>();
   PodNameIndex::iterator name_it = name_index.find(pod_name);
   if (name_it == name_index.end()) {
     LOG(WARNING, "no pod with name %s in pod manager", pod_name.c_str());
@@ -263,17 +486,17 @@ void PodManager::HandleStagePendingChanged(const Event& e) {
   if (to_stage == kPodSchedStageRunning) {
     LOG(INFO, "schedule pod %s to agent %s", PodSchedStage_Name(to_stage).c_str(), 
         name_it->endpoint_.c_str());
-    PodOperation* op = new PodOperation();
-    op->pod_ = name_it->pod_;
-    op->type_ = kRunPod;
-    pod_opqueue_->Push(op);
+    PushPodOperation(kRunPod, *name_it->pod_, name_it->endpoint_);
     name_it->pod_->set_stage(kPodSchedStageRunning);
     // init a start state  
-    name_it->pod_->set_state(kPodDeploying);
+    SetPodState(shard, name_it->pod_, kPodDeploying);
+    state_store_->PutPod(*name_it->pod_);
   } else if (to_stage == kPodSchedStageRemoved) {
     // remove pod with pending stage , just clean it
     LOG(INFO, "delete pod %s", pod_name.c_str());
     // free pod status
+    UpdateJobStat(shard, name_it->job_name_, name_it->pod_->state(), -1);
+    state_store_->DelPod(pod_name);
     delete name_it->pod_;
     name_index.erase(name_it);
   } else {
@@ -283,47 +506,69 @@ void PodManager::HandleStagePendingChanged(const Event& e) {
   }
 }
 
-bool PodManager::GetJobStatForInternal(const std::string& job_name,
+bool PodManager::GetJobStatForInternal(PodShard* shard,
+                                       const std::string& job_name,
                                        JobStat* stat) {
   if (stat == NULL) {
     LOG(WARNING, "stat is null");
     return false;
   }
-  mutex_.AssertHeld();
-  const PodJobNameIndex& job_name_index = pods_->get<job_name_tag>();
-  PodJobNameIndex::const_iterator it = job_name_index.find(job_name);
-  // scan all pods with the same job name 
-  for (; it != job_name_index.end(); ++it) {
-    if (it->job_name_ != job_name) {
-      break;
-    }
-    switch (it->pod_->state()) {
-      // the pending is on agent so 
-      case kPodPending:
-        stat->pending_++;
-        break;
-      case kPodDeploying:
-        stat->deploying_++;
-        break;
-      case kPodRunning:
-        stat->running_++;
-        break;
-      case kPodDeath:
-        stat->death_++;
-        break;
-    }
+  shard->mutex_.AssertHeld();
+  boost::unordered_map<std::string, JobStat>::iterator it = shard->job_stats_->find(job_name);
+  if (it != shard->job_stats_->end()) {
+    *stat = it->second;
   }
-  LOG(INFO, "job %s stat pending_ %d, deploying %d, running %d ,death %d",
+  LOG(DEBUG, "job %s stat pending_ %d, deploying %d, running %d ,death %d",
       job_name.c_str(), stat->pending_,
       stat->deploying_, stat->running_,
       stat->death_);
   return true;
 }
 
+void PodManager::UpdateJobStat(PodShard* shard,
+                               const std::string& job_name,
+                               PodState state,
+                               int32_t delta) {
+  shard->mutex_.AssertHeld();
+  JobStat& stat = (*shard->job_stats_)[job_name];
+  switch (state) {
+    // the pending is on agent so 
+    case kPodPending:
+      stat.pending_ += delta;
+      break;
+    case kPodDeploying:
+      stat.deploying_ += delta;
+      break;
+    case kPodRunning:
+      stat.running_ += delta;
+      break;
+    case kPodDeath:
+      stat.death_ += delta;
+      break;
+  }
+  if (stat.pending_ == 0
+      && stat.deploying_ == 0
+      && stat.running_ == 0
+      && stat.death_ == 0) {
+    shard->job_stats_->erase(job_name);
+  }
+}
+
+void PodManager::SetPodState(PodShard* shard, PodStatus* pod, PodState state) {
+  shard->mutex_.AssertHeld();
+  if (pod->state() == state) {
+    return;
+  }
+  UpdateJobStat(shard, pod->job_name(), pod->state(), -1);
+  UpdateJobStat(shard, pod->job_name(), state, 1);
+  pod->set_state(state);
+}
+
 bool PodManager::ScaleDownJob(const JobStatus* job) {
-  ::baidu::common::MutexLock lock(&mutex_);
+  PodShard* shard = GetShard(job->name());
+  ::baidu::common::MutexLock lock(&shard->mutex_);
   JobStat stat;
-  bool get_ok = GetJobStatForInternal(job->name(), &stat);
+  bool get_ok = GetJobStatForInternal(shard, job->name(), &stat);
   if (!get_ok) {
     LOG(WARNING, "fail to get job %s stat", job->name().c_str());
     return false;
@@ -370,7 +615,7 @@ bool PodManager::ScaleDownJob(const JobStatus* job) {
     assert(0);
   }while(false);
 
-  const PodJobNameIndex& job_name_index = pods_->get<job_name_tag>();
+  const PodJobNameIndex& job_name_index = shard->pods_->get<job_name_tag>();
   PodJobNameIndex::const_iterator it = job_name_index.find(job->name());
   std::set<std::string> to_be_removed;
   // scan all pods with the same job name 
@@ -379,15 +624,14 @@ bool PodManager::ScaleDownJob(const JobStatus* job) {
       break;
     } 
     bool need_send_op = false;
-    PodOperation* pod_op = new PodOperation();
-    pod_op->type_ = kKillPod;
-    pod_op->pod_ = it->pod_;
     switch (it->pod_->state()) {
       // the pending is on agent so 
       case kPodPending:
         // remove it directly in memory
         if (pending_count > 0) {
           to_be_removed.insert(it->pod_->name());
+          UpdateJobStat(shard, it->job_name_, kPodPending, -1);
+          state_store_->DelPod(it->pod_->name());
           // free the memory that podstatus occupied
           delete it->pod_;
         }
@@ -416,12 +660,11 @@ bool PodManager::ScaleDownJob(const JobStatus* job) {
         break;
     }
     if (need_send_op) {
-      pod_opqueue_->Push(pod_op);
-    } else {
-      delete pod_op;
+      state_store_->PutPod(*it->pod_);
+      PushPodOperation(kKillPod, *it->pod_, it->endpoint_);
     }
   }
-  PodNameIndex& name_index = pods_->get<name_tag>();
+  PodNameIndex& name_index = shard->pods_->get<name_tag>();
   std::set<std::string>::iterator rm_it = to_be_removed.begin();
   for (; rm_it != to_be_removed.end(); ++rm_it) {
     name_index.erase(*rm_it);
@@ -431,53 +674,283 @@ bool PodManager::ScaleDownJob(const JobStatus* job) {
 
 bool PodManager::GetJobStat(const std::string& job_name,
                             JobStat* stat) {
-  ::baidu::common::MutexLock lock(&mutex_);
-  return GetJobStatForInternal(job_name, stat);
-}
-
-void PodManager::SchedPods(const std::vector<boost::tuple<std::string, std::string> >& pods) {
-  ::baidu::common::MutexLock lock(&mutex_);
-  PodNameIndex& name_index = pods_->get<name_tag>();
-  std::vector<boost::tuple<std::string, std::string> >::const_iterator it = pods.begin();
-  for (; it != pods.end(); ++it) {
-    boost::tuple<std::string, std::string> pod = *it;
-    const std::string pod_name = boost::get<1>(pod);
-    const std::string endpoint = boost::get<0>(pod);
-    PodNameIndex::iterator name_it = name_index.find(pod_name);
-    if (name_it == name_index.end()) {
-      LOG(WARNING, "pod with name %s does not exist", pod_name.c_str());
-      continue;
+  PodShard* shard = GetShard(job_name);
+  ::baidu::common::MutexLock lock(&shard->mutex_);
+  return GetJobStatForInternal(shard, job_name, stat);
+}
+
+void PodManager::SchedPods(const std::vector<boost::tuple<std::string, std::string> >& pods,
+                           std::vector<RpcStatus>* results) {
+  // group pods by shard and job, so every shard is locked once and
+  // the pods of a gang job are checked together
+  std::map<PodShard*, std::map<std::string, std::vector<size_t> > > shard_pods;
+  for (size_t offset = 0; offset < pods.size(); ++offset) {
+    const std::string& pod_name = boost::get<1>(pods[offset]);
+    std::string job_name = GetJobName(pod_name);
+    shard_pods[GetShard(job_name)][job_name].push_back(offset);
+  }
+  results->assign(pods.size(), kRpcNotFound);
+  bool changed = false;
+  std::map<PodShard*, std::map<std::string, std::vector<size_t> > >::iterator shard_it = shard_pods.begin();
+  for (; shard_it != shard_pods.end(); ++shard_it) {
+    PodShard* shard = shard_it->first;
+    ::baidu::common::MutexLock lock(&shard->mutex_);
+    PodNameIndex& name_index = shard->pods_->get<name_tag>();
+    std::map<std::string, std::vector<size_t> >::iterator job_it = shard_it->second.begin();
+    for (; job_it != shard_it->second.end(); ++job_it) {
+      const std::vector<size_t>& offsets = job_it->second;
+      bool all_ok = true;
+      for (size_t index = 0; index < offsets.size(); ++index) {
+        const std::string& pod_name = boost::get<1>(pods[offsets[index]]);
+        PodNameIndex::iterator name_it = name_index.find(pod_name);
+        if (name_it == name_index.end()) {
+          LOG(WARNING, "pod with name %s does not exist", pod_name.c_str());
+          (*results)[offsets[index]] = kRpcNotFound;
+          all_ok = false;
+          continue;
+        }
+        if (name_it->pod_->stage() != kPodSchedStagePending) {
+          LOG(WARNING, "pod with name %s has been scheduled", pod_name.c_str());
+          (*results)[offsets[index]] = kRpcStaleState;
+          all_ok = false;
+          continue;
+        }
+        (*results)[offsets[index]] = kRpcOk;
+      }
+      std::map<std::string, JobSpec>::iterator desc_it = shard->job_desc_->find(job_it->first);
+      bool gang = desc_it != shard->job_desc_->end() && desc_it->second.gang();
+      if (gang && all_ok && !IsFullStep(shard, job_it->first, desc_it->second, offsets.size())) {
+        LOG(WARNING, "%u pods of gang job %s are not a full deploy step",
+            offsets.size(), job_it->first.c_str());
+        all_ok = false;
+      }
+      // reserve the pods on agents, so the over committed proposes
+      // are rejected here and the pods stay pending
+      std::vector<size_t> reserved;
+      for (size_t index = 0; index < offsets.size(); ++index) {
+        size_t offset = offsets[index];
+        if ((*results)[offset] != kRpcOk) {
+          continue;
+        }
+        // a gang step is committed as a whole or not at all
+        if (gang && !all_ok) {
+          (*results)[offset] = kRpcStaleState;
+          continue;
+        }
+        PodNameIndex::iterator name_it = name_index.find(boost::get<1>(pods[offset]));
+        RpcStatus status = node_manager_->ReservePod(boost::get<0>(pods[offset]),
+                                                     *name_it->pod_);
+        if (status != kRpcOk) {
+          (*results)[offset] = status;
+          all_ok = false;
+          continue;
+        }
+        reserved.push_back(offset);
+      }
+      for (size_t index = 0; index < reserved.size(); ++index) {
+        size_t offset = reserved[index];
+        const std::string pod_name = boost::get<1>(pods[offset]);
+        const std::string endpoint = boost::get<0>(pods[offset]);
+        if (gang && !all_ok) {
+          node_manager_->CancelReservation(endpoint, pod_name);
+          (*results)[offset] = kRpcStaleState;
+          continue;
+        }
+        PodNameIndex::iterator name_it = name_index.find(pod_name);
+        PodIndex pod_index = *name_it;
+        pod_index.endpoint_ = endpoint;
+        pod_index.pod_->set_endpoint(pod_index.endpoint_);
+        name_index.replace(name_it, pod_index);
+        DispatchEvent(shard, boost::make_tuple(pod_name, kPodSchedStagePending, kPodSchedStageRunning));
+        changed = true;
+      }
     }
-    if (name_it->pod_->stage() != kPodSchedStagePending) {
-      LOG(WARNING, "pod with name %s has been scheduled", pod_name.c_str());
+  }
+  // the scheduled pods leave pending and make room for next deploy step
+  if (changed) {
+    NotifyScaleUpChanged();
+  }
+}
+
+bool PodManager::IsFullStep(PodShard* shard,
+                            const std::string& job_name,
+                            const JobSpec& job,
+                            size_t count) {
+  shard->mutex_.AssertHeld();
+  JobStat stat;
+  if (!GetJobStatForInternal(shard, job_name, &stat)) {
+    return false;
+  }
+  // the same step that GetShardScaleUpPods gives scheduler
+  int32_t step = (int32_t)job.deploy_step_size() - stat.deploying_ - stat.death_;
+  step = std::min(step, stat.pending_);
+  return step > 0 && (int32_t)count == step;
+}
+
+void PodManager::PreemptPods(const PreemptRequest* request,
+                             std::vector<RpcStatus>* results) {
+  results->assign(request->preemptions_size(), kRpcError);
+  bool changed = false;
+  for (int32_t index = 0; index < request->preemptions_size(); ++index) {
+    const Preemption& preemption = request->preemptions(index);
+    // hold the shards of preemptor and victims from check to evict, so
+    // a preemption is either done or does nothing. they are locked in
+    // the order of address and no other path holds two shards at once
+    std::set<PodShard*> shards;
+    shards.insert(GetShard(GetJobName(preemption.pod_name())));
+    for (int32_t vindex = 0; vindex < preemption.victims_size(); ++vindex) {
+      shards.insert(GetShard(GetJobName(preemption.victims(vindex))));
+    }
+    std::set<PodShard*>::iterator shard_it = shards.begin();
+    for (; shard_it != shards.end(); ++shard_it) {
+      (*shard_it)->mutex_.Lock();
+    }
+    PodType priority = kPodBesteffort;
+    RpcStatus status = CheckPreemption(preemption, &priority);
+    if (status == kRpcOk) {
+      for (int32_t vindex = 0; vindex < preemption.victims_size(); ++vindex) {
+        const std::string& victim = preemption.victims(vindex);
+        EvictPod(GetShard(GetJobName(victim)), victim, preemption.endpoint());
+      }
+    }
+    std::set<PodShard*>::reverse_iterator rshard_it = shards.rbegin();
+    for (; rshard_it != shards.rend(); ++rshard_it) {
+      (*rshard_it)->mutex_.Unlock();
+    }
+    (*results)[index] = status;
+    if (status != kRpcOk) {
+      LOG(WARNING, "pod %s fails to preempt pods on agent %s for %s",
+          preemption.pod_name().c_str(), preemption.endpoint().c_str(),
+          RpcStatus_Name(status).c_str());
       continue;
     }
-    PodIndex index = *name_it;
-    index.endpoint_ = endpoint;
-    index.pod_->set_endpoint(index.endpoint_);
-    name_index.replace(name_it, index);
-    DispatchEvent(boost::make_tuple(pod_name, kPodSchedStagePending, kPodSchedStageRunning));
+    LOG(INFO, "pod %s preempts %d pods on agent %s",
+        preemption.pod_name().c_str(), preemption.victims_size(),
+        preemption.endpoint().c_str());
+    changed = true;
+  }
+  // the victims are pending again
+  if (changed) {
+    NotifyScaleUpChanged();
   }
 }
 
+RpcStatus PodManager::CheckPreemption(const Preemption& preemption,
+                                      PodType* priority) {
+  const std::string& pod_name = preemption.pod_name();
+  PodShard* shard = GetShard(GetJobName(pod_name));
+  shard->mutex_.AssertHeld();
+  const PodNameIndex& name_index = shard->pods_->get<name_tag>();
+  PodNameIndex::const_iterator name_it = name_index.find(pod_name);
+  if (name_it == name_index.end()) {
+    LOG(WARNING, "pod with name %s does not exist", pod_name.c_str());
+    return kRpcNotFound;
+  }
+  if (name_it->pod_->stage() != kPodSchedStagePending) {
+    LOG(WARNING, "pod with name %s has been scheduled", pod_name.c_str());
+    return kRpcStaleState;
+  }
+  *priority = name_it->pod_->desc().type();
+  if (*priority < kPodLongrun || preemption.victims_size() <= 0) {
+    LOG(WARNING, "pod %s with type %s can not preempt others",
+        pod_name.c_str(), PodType_Name(*priority).c_str());
+    return kRpcError;
+  }
+  for (int32_t vindex = 0; vindex < preemption.victims_size(); ++vindex) {
+    RpcStatus status = CheckVictim(preemption.victims(vindex),
+                                   preemption.endpoint(), *priority);
+    if (status != kRpcOk) {
+      return status;
+    }
+  }
+  return kRpcOk;
+}
+
+RpcStatus PodManager::CheckVictim(const std::string& pod_name,
+                                  const std::string& endpoint,
+                                  PodType priority) {
+  PodShard* shard = GetShard(GetJobName(pod_name));
+  shard->mutex_.AssertHeld();
+  const PodNameIndex& name_index = shard->pods_->get<name_tag>();
+  PodNameIndex::const_iterator name_it = name_index.find(pod_name);
+  if (name_it == name_index.end()) {
+    LOG(WARNING, "victim with name %s does not exist", pod_name.c_str());
+    return kRpcNotFound;
+  }
+  if (name_it->pod_->stage() != kPodSchedStageRunning
+      || name_it->endpoint_ != endpoint) {
+    LOG(WARNING, "victim %s is not running on agent %s", pod_name.c_str(),
+        endpoint.c_str());
+    return kRpcStaleState;
+  }
+  PodType type = name_it->pod_->desc().type();
+  if (type >= priority || type >= kPodLongrun) {
+    LOG(WARNING, "victim %s with type %s can not be preempted",
+        pod_name.c_str(), PodType_Name(type).c_str());
+    return kRpcError;
+  }
+  return kRpcOk;
+}
+
+void PodManager::EvictPod(PodShard* shard,
+                          const std::string& pod_name,
+                          const std::string& endpoint) {
+  shard->mutex_.AssertHeld();
+  PodNameIndex& name_index = shard->pods_->get<name_tag>();
+  PodNameIndex::iterator name_it = name_index.find(pod_name);
+  // the kill goes to the agent that victim is running on, it does
+  // not follow the endpoint of victim when victim is scheduled again
+  PushPodOperation(kKillPod, *name_it->pod_, endpoint);
+  // detach victim from agent, so the reports of it are ignored
+  PodIndex index = *name_it;
+  index.endpoint_ = "";
+  name_index.replace(name_it, index);
+  // the stored victim has no agent too, or a failover places it back
+  index.pod_->clear_endpoint();
+  index.pod_->set_stage(kPodSchedStagePending);
+  SetPodState(shard, index.pod_, kPodPending);
+  index.pod_->set_start_pending_time(::baidu::common::timer::get_micros());
+  state_store_->PutPod(*index.pod_);
+  shard->scale_up_jobs_->insert(index.job_name_);
+  LOG(INFO, "evict pod %s from agent %s", pod_name.c_str(), endpoint.c_str());
+}
+
+void PodManager::PushPodOperation(PodOperationType type,
+                                  const PodStatus& pod,
+                                  const std::string& endpoint) {
+  PodOperation* op = new PodOperation();
+  op->type_ = type;
+  op->name_ = pod.name();
+  if (type == kRunPod) {
+    op->desc_.CopyFrom(pod.desc());
+  }
+  op->endpoint_ = endpoint;
+  pod_opqueue_->Push(op);
+}
+
 // add nonexist pod
 bool PodManager::NewAdd(const std::string& job_name,
                         const std::string& user_name,
                         const PodSpec& desc,
                         int32_t replica) {
-  ::baidu::common::MutexLock lock(&mutex_);
+  PodShard* shard = GetShard(job_name);
+  ::baidu::common::MutexLock lock(&shard->mutex_);
   LOG(DEBUG, "create pods for job %s", job_name.c_str());
-  const PodNameIndex& name_index = pods_->get<name_tag>();
+  const PodNameIndex& name_index = shard->pods_->get<name_tag>();
   std::vector<std::string> avilable_name;
   for (int32_t offset = 0; offset < replica; ++offset) {
     std::string pod_name = boost::lexical_cast<std::string>(offset) + "_pod." + job_name;
     PodNameIndex::const_iterator name_it = name_index.find(pod_name);
     if (name_it != name_index.end()) {
-      LOG(WARNING, "fail alloc pod name %s for that it has been used", pod_name.c_str());
-      return false;
+      // the pod has been restored from state store
+      LOG(DEBUG, "pod %s exists, skip it", pod_name.c_str());
+      continue;
     }
     avilable_name.push_back(pod_name);
   }
+  if (avilable_name.empty()) {
+    return true;
+  }
   std::vector<std::string>::iterator pod_name_it = avilable_name.begin();
   for (; pod_name_it != avilable_name.end(); ++pod_name_it) {
     PodStatus* pod = new PodStatus();
@@ -492,21 +965,116 @@ bool PodManager::NewAdd(const std::string& job_name,
     pod_index.user_name_ = user_name;
     pod_index.job_name_ = job_name;
     pod_index.pod_ = pod;
-    pods_->insert(pod_index);
+    shard->pods_->insert(pod_index);
+    UpdateJobStat(shard, job_name, kPodPending, 1);
+    state_store_->PutPod(*pod);
     LOG(INFO, "add new pod %s", pod->name().c_str());
   }
-  scale_up_jobs_->insert(job_name); 
+  shard->scale_up_jobs_->insert(job_name); 
+  NotifyScaleUpChanged();
   return true;
 }
 
+void PodManager::RescheduleNodes(const std::vector<std::string>& endpoints) {
+  int32_t rescheduled = 0;
+  for (size_t index = 0; index < shards_.size(); ++index) {
+    rescheduled += RescheduleShardNodes(shards_[index], endpoints);
+  }
+  LOG(WARNING, "%u agents go offline, %d pods on them are pending again",
+      endpoints.size(), rescheduled);
+  if (rescheduled > 0) {
+    NotifyScaleUpChanged();
+  }
+}
+
+int32_t PodManager::RescheduleShardNodes(PodShard* shard,
+                                         const std::vector<std::string>& endpoints) {
+  ::baidu::common::MutexLock lock(&shard->mutex_);
+  const PodEndpointIndex& endpoint_index = shard->pods_->get<endpoint_tag>();
+  // collect first, detaching pods from agents changes the endpoint index
+  std::vector<std::string> pod_names;
+  for (size_t index = 0; index < endpoints.size(); ++index) {
+    PodEndpointIndex::const_iterator endpoint_it = endpoint_index.find(endpoints[index]);
+    for (; endpoint_it != endpoint_index.end()
+           && endpoint_it->endpoint_ == endpoints[index]; ++endpoint_it) {
+      pod_names.push_back(endpoint_it->name_);
+    }
+  }
+  PodNameIndex& name_index = shard->pods_->get<name_tag>();
+  int64_t now = ::baidu::common::timer::get_micros();
+  int32_t rescheduled = 0;
+  for (size_t index = 0; index < pod_names.size(); ++index) {
+    PodNameIndex::iterator name_it = name_index.find(pod_names[index]);
+    if (name_it == name_index.end()) {
+      continue;
+    }
+    PodStatus* pod = name_it->pod_;
+    if (pod->stage() == kPodSchedStageRemoved) {
+      // the pod to be killed is gone with agent, the kill queued for
+      // it holds a copy of pod, so it's safe to free pod here
+      LOG(INFO, "delete pod %s with offline agent %s", pod->name().c_str(),
+          name_it->endpoint_.c_str());
+      UpdateJobStat(shard, name_it->job_name_, pod->state(), -1);
+      state_store_->DelPod(pod->name());
+      delete pod;
+      name_index.erase(name_it);
+      continue;
+    }
+    PodIndex pod_index = *name_it;
+    pod_index.endpoint_ = "";
+    name_index.replace(name_it, pod_index);
+    pod->clear_endpoint();
+    if (pod->stage() != kPodSchedStagePending) {
+      pod->set_stage(kPodSchedStagePending);
+      SetPodState(shard, pod, kPodPending);
+      pod->set_start_pending_time(now);
+      state_store_->PutPod(*pod);
+      rescheduled++;
+    }
+    shard->scale_up_jobs_->insert(pod_index.job_name_);
+  }
+  return rescheduled;
+}
+
 void PodManager::SyncPodsOnAgent(const std::string& endpoint,
-                                 std::map<std::string, PodStatus>& pods) {
-  ::baidu::common::MutexLock lock(&mutex_);
-  const PodEndpointIndex& endpoint_index = pods_->get<endpoint_tag>();
+                                 std::map<std::string, PodStatus>& pods,
+                                 bool kill_orphans) {
+  bool state_changed = false;
+  std::set<std::string> placed;
+  for (size_t index = 0; index < shards_.size(); ++index) {
+    if (SyncShardPodsOnAgent(shards_[index], endpoint, pods, &placed)) {
+      state_changed = true;
+    }
+  }
+  // the pods that finish deploying make room for next deploy step
+  if (state_changed) {
+    NotifyScaleUpChanged();
+  }
+  if (!kill_orphans) {
+    return;
+  }
+  std::map<std::string, PodStatus>::iterator pod_it = pods.begin();
+  for (; pod_it != pods.end(); ++pod_it) {
+    if (placed.find(pod_it->first) != placed.end()) {
+      continue;
+    }
+    LOG(WARNING, "kill orphan pod %s on agent %s", pod_it->first.c_str(),
+        endpoint.c_str());
+    PushPodOperation(kKillPod, pod_it->second, endpoint);
+  }
+}
+
+bool PodManager::SyncShardPodsOnAgent(PodShard* shard,
+                                      const std::string& endpoint,
+                                      std::map<std::string, PodStatus>& pods,
+                                      std::set<std::string>* placed) {
+  ::baidu::common::MutexLock lock(&shard->mutex_);
+  const PodEndpointIndex& endpoint_index = shard->pods_->get<endpoint_tag>();
   PodEndpointIndex::const_iterator endpoint_it = endpoint_index.find(endpoint);
   std::vector<Event> events;
-  std::set<std::string> processed_pods;
-  for (; endpoint_it != endpoint_index.end(); ++endpoint_it) {
+  bool state_changed = false;
+  for (; endpoint_it != endpoint_index.end()
+         && endpoint_it->endpoint_ == endpoint; ++endpoint_it) {
     std::map<std::string, PodStatus>::iterator pod_it = pods.find(endpoint_it->name_);
     if (pod_it == pods.end()) {
       LOG(WARNING, "pod %s lost from agent %s", endpoint_it->name_.c_str(), endpoint.c_str());
@@ -519,27 +1087,37 @@ void PodManager::SyncPodsOnAgent(const std::string& endpoint,
       LOG(INFO, "pod %s from agent %s with stat: state %s", endpoint_it->name_.c_str(),
           endpoint.c_str(), PodState_Name(pod_it->second.state()).c_str());
       // update status on agent
-      PodSchedStage to_stage = state_to_stage_[pod_it->second.state()];
+      // state_to_stage_ is shared by shards, so it is read only
+      std::map<PodState, PodSchedStage>::const_iterator stage_it =
+        state_to_stage_.find(pod_it->second.state());
+      PodSchedStage to_stage = stage_it == state_to_stage_.end() ?
+                               PodSchedStage() : stage_it->second;
+      bool pod_changed = endpoint_it->pod_->state() != pod_it->second.state();
+      if (pod_changed) {
+        state_changed = true;
+      }
       endpoint_it->pod_->mutable_cstatus()->CopyFrom(pod_it->second.cstatus());
-      endpoint_it->pod_->set_state(pod_it->second.state());
+      SetPodState(shard, endpoint_it->pod_, pod_it->second.state());
+      if (pod_changed) {
+        state_store_->PutPod(*endpoint_it->pod_);
+      }
       endpoint_it->pod_->set_boot_time(pod_it->second.boot_time());
       events.push_back(boost::make_tuple(endpoint_it->name_,
                                          endpoint_it->pod_->stage(),
                                          to_stage));
       // record the processed pods
-      processed_pods.insert(endpoint_it->name_);
+      placed->insert(endpoint_it->name_);
     }
   }
 
   for (size_t i = 0; i < events.size(); i++) {
-    DispatchEvent(events[i]);
+    DispatchEvent(shard, events[i]);
   }
-  // TODO add handle expired pods
-
+  return state_changed;
 }
 
-void PodManager::DispatchEvent(const Event& e) {
-  mutex_.AssertHeld();
+void PodManager::DispatchEvent(PodShard* shard, const Event& e) {
+  shard->mutex_.AssertHeld();
   const std::string pod_name = boost::get<0>(e);
   const PodSchedStage& current = boost::get<1>(e);
   const PodSchedStage& to_stage = boost::get<2>(e); 
@@ -550,19 +1128,20 @@ void PodManager::DispatchEvent(const Event& e) {
         PodSchedStage_Name(to_stage).c_str());
     return;
   }
-  it->second(e);
+  it->second(shard, e);
 }
 
-void PodManager::MergePodStatus(const PodStatus& pod_on_agent,
-                                 PodStatus* pod_on_master) {
-  mutex_.AssertHeld();
+void PodManager::MergePodStatus(PodShard* shard,
+                                const PodStatus& pod_on_agent,
+                                PodStatus* pod_on_master) {
+  shard->mutex_.AssertHeld();
   if (pod_on_master == NULL) {
     LOG(WARNING, "pod_on_master is NULL");
     return;
   }
   pod_on_master->set_boot_time(pod_on_agent.boot_time());
   pod_on_master->set_endpoint(pod_on_agent.endpoint());
-  pod_on_master->set_state(pod_on_agent.state());
+  SetPodState(shard, pod_on_master, pod_on_agent.state());
   pod_on_master->mutable_cstatus()->CopyFrom(pod_on_agent.cstatus());
 }
 
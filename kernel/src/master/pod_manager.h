@@ -9,12 +9,15 @@
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <boost/unordered_map.hpp>
 
 #include "master/idx_tag.h"
 #include "proto/dos.pb.h"
 #include "proto/master.pb.h"
-#include "common/blocking_queue.h"
+#include "common/mpmc_queue.h"
 #include "master/master_internal_types.h"
+#include "master/state_store.h"
+#include "master/node_manager.h"
 #include "mutex.h"
 #include "thread_pool.h"
 
@@ -67,11 +70,35 @@ typedef boost::multi_index::index<PodSet, name_tag>::type PodNameIndex;
 typedef boost::multi_index::index<PodSet, user_name_tag>::type PodUserNameIndex;
 typedef boost::multi_index::index<PodSet, endpoint_tag>::type PodEndpointIndex;
 
+// the pods of the jobs whose names hash to the same shard,
+// all fields are guarded by mutex_
+struct PodShard {
+  ::baidu::common::Mutex mutex_;
+  PodSet* pods_;
+  std::set<std::string>* scale_up_jobs_;
+  // the first key is job name ,the second is job desc
+  std::map<std::string, JobSpec>* job_desc_;
+  // the job name and job stat pair, it is updated with pod state
+  // changes, the job without pods has no stat
+  boost::unordered_map<std::string, JobStat>* job_stats_;
+  PodShard():mutex_(),
+  pods_(NULL),
+  scale_up_jobs_(NULL),
+  job_desc_(NULL),
+  job_stats_(NULL){
+    pods_ = new PodSet();
+    scale_up_jobs_ = new std::set<std::string>();
+    job_desc_ = new std::map<std::string, JobSpec>();
+    job_stats_ = new boost::unordered_map<std::string, JobStat>();
+  }
+  ~PodShard(){}
+};
+
 // the event leads pod to change it's stage,
 // the tuple[0] is pod name , tuple[1] is current stage, tuple[2] is targe stage
 typedef boost::tuple<std::string, PodSchedStage, PodSchedStage> Event;
 
-typedef boost::function<void (const Event& e)> PodEventHandle;
+typedef boost::function<void (PodShard* shard, const Event& e)> PodEventHandle;
 // the current stage handle event pair
 typedef std::map<PodSchedStage, PodEventHandle>  PodFSM;
 
@@ -80,57 +107,160 @@ typedef google::protobuf::RepeatedPtrField<dos::PodOverview> PodOverviewList;
 class PodManager {
 
 public:
-  PodManager(FixedBlockingQueue<PodOperation*>* pod_opqueue,
-             FixedBlockingQueue<JobOperation*>* job_opqueue,
-             FixedBlockingQueue<NodeStatus*>* node_opqueue);
+  PodManager(BoundedMpmcQueue<PodOperation*>* pod_opqueue,
+             BoundedMpmcQueue<JobOperation*>* job_opqueue,
+             BoundedMpmcQueue<NodeStatus*>* node_opqueue,
+             NodeManager* node_manager,
+             StateStore* state_store);
   ~PodManager();
   void Start();
-  // sched pod, the tuple first arg is endpoint, the second is pod name
-  void SchedPods(const std::vector<boost::tuple<std::string, std::string> >& pods);
+  // restore pods loaded from state store before Start, the desc of
+  // pods is copied from their jobs
+  void Restore(const std::vector<JobStatus>& jobs,
+               const std::vector<PodStatus>& pods);
+  // write all pods into snapshot
+  void DumpState(RecordWriter* snapshot);
+  // sched pod, the tuple first arg is endpoint, the second is pod name,
+  // all pods are scheduled under one lock and results has the status
+  // of every pod in order. the pods of a gang job must be a full deploy
+  // step and are rejected together when any of them fails. the resource
+  // of pods is reserved on agents and the pod that agent can not hold
+  // is rejected with kRpcNoResource
+  void SchedPods(const std::vector<boost::tuple<std::string, std::string> >& pods,
+                 std::vector<RpcStatus>* results);
+  // evict the victims on endpoint for the pending pods in preemptions,
+  // the victims must have lower priority than the pod and go back to
+  // pending. every preemption evicts all of its victims or none of them,
+  // results has the status of every preemption in order
+  void PreemptPods(const PreemptRequest* request,
+                   std::vector<RpcStatus>* results);
   // get pods that need to be scheduled, the count of pods in single job will
-  // be limited by job deploy size
+  // be limited by job deploy size, generation is the current generation of
+  // pending pods
   void GetScaleUpPods(const Condition& condition,
-                      PodOverviewList* pods);
+                      PodOverviewList* pods,
+                      int64_t* generation);
+  // run callback in thread pool when the generation of pending pods
+  // is not equal to generation or timeout, the unit of timeout is ms
+  void WatchScaleUpPods(int64_t generation,
+                        int32_t timeout,
+                        const boost::function<void ()>& callback);
   // get jod stat, eg running count, deploying count
   // death count
   bool GetJobStat(const std::string& job_name,
                   JobStat* stat);
 
 private:
-  // sync the pods on agent
+  // sync the pods on agent, kill_orphans kills the pods on agent that
+  // master does not place on it
   void SyncPodsOnAgent(const std::string& endpoint,
-                       std::map<std::string, PodStatus>& pods);
+                       std::map<std::string, PodStatus>& pods,
+                       bool kill_orphans);
   void WatchNodeOp();
+  // put all pods on the offline agents into pending queue at once
+  void RescheduleNodes(const std::vector<std::string>& endpoints);
+  // reschedule the restored pods on the agents that have not sent
+  // heart beat to this master
+  void RescheduleLostAgents(const std::vector<std::string>& endpoints);
+  // return the count of pods that go pending
+  int32_t RescheduleShardNodes(PodShard* shard,
+                               const std::vector<std::string>& endpoints);
   void WatchJobOp();
+  void HandleJobOp(JobOperation* job_op);
   // create new pods
   bool NewAdd(const std::string& job_name,
               const std::string& user_name,
               const PodSpec& desc,
               int32_t replica);
-  void DispatchEvent(const Event& e);
-  void HandleStageRunningChanged(const Event& e);
-  void HandleStagePendingChanged(const Event& e);
-  void HandleStageRemovedChanged(const Event& e);
-  bool GetJobStatForInternal(const std::string& job_name,
+  // the shard that holds the pods of job
+  PodShard* GetShard(const std::string& job_name);
+  // get job name from the pod name that NewAdd makes
+  static std::string GetJobName(const std::string& pod_name);
+  void DispatchEvent(PodShard* shard, const Event& e);
+  void HandleStageRunningChanged(PodShard* shard, const Event& e);
+  void HandleStagePendingChanged(PodShard* shard, const Event& e);
+  void HandleStageRemovedChanged(PodShard* shard, const Event& e);
+  bool GetJobStatForInternal(PodShard* shard,
+                             const std::string& job_name,
                              JobStat* stat);
+  // add delta to the counter of state in job stat
+  void UpdateJobStat(PodShard* shard,
+                     const std::string& job_name,
+                     PodState state,
+                     int32_t delta);
+  // change pod state and move the pod between job stat counters,
+  // all state changes of pods in shards must go through it
+  void SetPodState(PodShard* shard, PodStatus* pod, PodState state);
   // merge PodStatus in agent and master
-  void MergePodStatus(const PodStatus& pod_on_agent,
+  void MergePodStatus(PodShard* shard,
+                      const PodStatus& pod_on_agent,
                       PodStatus* pod_on_master);
+  // sync the pods of shard on agent, return true when pod state changes.
+  // the reported pods that shard places on agent are added to placed
+  bool SyncShardPodsOnAgent(PodShard* shard,
+                            const std::string& endpoint,
+                            std::map<std::string, PodStatus>& pods,
+                            std::set<std::string>* placed);
+  // get pending pods of the scale up jobs in shard
+  void GetShardScaleUpPods(PodShard* shard,
+                           const Condition& condition,
+                           PodOverviewList* pods);
+  // check count is the size of the deploy step that job is waiting for
+  bool IsFullStep(PodShard* shard,
+                  const std::string& job_name,
+                  const JobSpec& job,
+                  size_t count);
   bool ScaleDownJob(const JobStatus* job);
+  // check the preemptor is pending with a type that can preempt and
+  // every victim can be evicted for it, the shards of preemptor and
+  // victims must be locked
+  RpcStatus CheckPreemption(const Preemption& preemption, PodType* priority);
+  // check the victim runs on endpoint with type lower than priority
+  RpcStatus CheckVictim(const std::string& pod_name,
+                        const std::string& endpoint,
+                        PodType priority);
+  // kill the checked victim on endpoint and put it into pending queue
+  // again, the shard of victim must be locked
+  void EvictPod(PodShard* shard,
+                const std::string& pod_name,
+                const std::string& endpoint);
+  // queue the operation of pod on the agent of endpoint
+  void PushPodOperation(PodOperationType type,
+                        const PodStatus& pod,
+                        const std::string& endpoint);
+  // pending pods have changed, move generation forward and
+  // wake up all watchers
+  void NotifyScaleUpChanged();
+  void HandleWatchTimeout(int64_t watcher_id);
 private:
-  PodSet* pods_;
-  std::set<std::string>* scale_up_jobs_;
+  // pods are partitioned by job name, so the operations on
+  // different jobs do not wait for each other
+  std::vector<PodShard*> shards_;
   std::set<std::string>* scale_down_jobs_;
-  ::baidu::common::Mutex mutex_;
   PodFSM* fsm_;
   std::map<PodState, PodSchedStage> state_to_stage_;
-  FixedBlockingQueue<PodOperation*>* pod_opqueue_;
-  FixedBlockingQueue<JobOperation*>* job_opqueue_;
-  // the first key is job name ,the second is job desc
-  std::map<std::string, JobSpec>* job_desc_;
+  BoundedMpmcQueue<PodOperation*>* pod_opqueue_;
+  BoundedMpmcQueue<JobOperation*>* job_opqueue_;
   // the thread pool used for watching job_opqueue
   ::baidu::common::ThreadPool tpool_;
-  FixedBlockingQueue<NodeStatus*>* node_opqueue_;
+  BoundedMpmcQueue<NodeStatus*>* node_opqueue_;
+  // guards offline_agents_
+  ::baidu::common::Mutex offline_mutex_;
+  // the agents that went offline or never came back after restoring and
+  // have not been synced since, their pods have been rescheduled
+  std::set<std::string> offline_agents_;
+  // guards generation_ and watchers_, it can be locked with shard
+  // mutex held but not the other way around
+  ::baidu::common::Mutex watch_mutex_;
+  // the generation of pending pods
+  int64_t generation_;
+  // the watchers that wait pending pods to change
+  std::map<int64_t, boost::function<void ()> > watchers_;
+  int64_t next_watcher_id_;
+  // log the changes of pods, it is owned by master
+  StateStore* state_store_;
+  // reserve the resource of scheduled pods, it is owned by master
+  NodeManager* node_manager_;
 };
 
 }// namespace dos
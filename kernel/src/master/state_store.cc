@@ -0,0 +1,448 @@
+#include "master/state_store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <gflags/gflags.h>
+#include "logging.h"
+#include "timer.h"
+
+DECLARE_int32(master_state_flush_interval);
+DECLARE_bool(master_state_sync);
+
+using ::baidu::common::INFO;
+using ::baidu::common::WARNING;
+
+namespace dos {
+
+// flush the buffer of writer when it grows over it
+static const size_t kMaxWriterBufferSize = 4 * 1024 * 1024;
+
+RecordWriter::RecordWriter():fd_(-1),
+  path_(),
+  buffer_(){}
+
+RecordWriter::~RecordWriter() {
+  Close();
+}
+
+bool RecordWriter::Open(const std::string& path) {
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    LOG(WARNING, "fail to open %s for %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  path_ = path;
+  return true;
+}
+
+void RecordWriter::Encode(const StateRecord& record, std::string* buffer) {
+  std::string data;
+  record.SerializeToString(&data);
+  uint32_t length = data.size();
+  uint32_t crc = crc32(0L, reinterpret_cast<const Bytef*>(data.data()), data.size());
+  buffer->append(reinterpret_cast<const char*>(&length), sizeof(length));
+  buffer->append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+  buffer->append(data);
+}
+
+bool RecordWriter::Decode(const std::string& data, size_t* offset,
+                          StateRecord* record) {
+  size_t header_size = 2 * sizeof(uint32_t);
+  if (*offset + header_size > data.size()) {
+    return false;
+  }
+  uint32_t length = 0;
+  uint32_t crc = 0;
+  memcpy(&length, data.data() + *offset, sizeof(length));
+  memcpy(&crc, data.data() + *offset + sizeof(length), sizeof(crc));
+  if (*offset + header_size + length > data.size()) {
+    return false;
+  }
+  const char* payload = data.data() + *offset + header_size;
+  if (crc32(0L, reinterpret_cast<const Bytef*>(payload), length) != crc) {
+    return false;
+  }
+  if (!record->ParseFromArray(payload, length)) {
+    return false;
+  }
+  *offset += header_size + length;
+  return true;
+}
+
+void RecordWriter::Append(const StateRecord& record) {
+  Encode(record, &buffer_);
+  if (buffer_.size() >= kMaxWriterBufferSize) {
+    Flush(false);
+  }
+}
+
+void RecordWriter::AppendEncoded(const std::string& data) {
+  buffer_.append(data);
+}
+
+bool RecordWriter::Flush(bool sync) {
+  if (fd_ < 0) {
+    return false;
+  }
+  size_t written = 0;
+  while (written < buffer_.size()) {
+    ssize_t ret = ::write(fd_, buffer_.data() + written, buffer_.size() - written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG(WARNING, "fail to write %s for %s", path_.c_str(), strerror(errno));
+      buffer_.erase(0, written);
+      return false;
+    }
+    written += ret;
+  }
+  buffer_.clear();
+  if (sync && ::fdatasync(fd_) != 0) {
+    LOG(WARNING, "fail to sync %s for %s", path_.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void RecordWriter::Close() {
+  if (fd_ >= 0) {
+    Flush(false);
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+StateStore::StateStore(const std::string& dir):dir_(dir),
+  mutex_(),
+  buffer_(),
+  appended_(0),
+  waiters_(),
+  commit_scheduled_(false),
+  flush_mutex_(),
+  wal_(NULL),
+  wal_seq_(0),
+  pool_(1){}
+
+StateStore::~StateStore() {
+  Flush();
+  delete wal_;
+}
+
+std::string StateStore::FileName(const std::string& prefix, int64_t seq) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s.%ld", prefix.c_str(), seq);
+  return dir_ + "/" + name;
+}
+
+bool StateStore::ListSeqs(const std::string& prefix, std::vector<int64_t>* seqs) {
+  DIR* dir = ::opendir(dir_.c_str());
+  if (dir == NULL) {
+    LOG(WARNING, "fail to open dir %s for %s", dir_.c_str(), strerror(errno));
+    return false;
+  }
+  std::string name_prefix = prefix + ".";
+  struct dirent* entry = NULL;
+  while ((entry = ::readdir(dir)) != NULL) {
+    std::string name = entry->d_name;
+    if (name.compare(0, name_prefix.size(), name_prefix) != 0) {
+      continue;
+    }
+    // skip the unfinished files like snapshot.{seq}.tmp
+    char* end = NULL;
+    int64_t seq = strtoll(name.c_str() + name_prefix.size(), &end, 10);
+    if (end == NULL || *end != '\0') {
+      continue;
+    }
+    seqs->push_back(seq);
+  }
+  ::closedir(dir);
+  std::sort(seqs->begin(), seqs->end());
+  return true;
+}
+
+bool StateStore::Replay(const std::string& path,
+                        boost::unordered_map<std::string, JobStatus>* jobs,
+                        boost::unordered_map<std::string, PodStatus>* pods) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    LOG(WARNING, "fail to open %s for %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  std::string data;
+  char buf[64 * 1024];
+  size_t len = 0;
+  while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+    data.append(buf, len);
+  }
+  fclose(file);
+  size_t offset = 0;
+  int64_t count = 0;
+  StateRecord record;
+  while (RecordWriter::Decode(data, &offset, &record)) {
+    switch (record.type()) {
+      case kStateJobPut:
+        (*jobs)[record.job().name()] = record.job();
+        break;
+      case kStateJobDel:
+        jobs->erase(record.name());
+        break;
+      case kStatePodPut:
+        (*pods)[record.pod().name()] = record.pod();
+        break;
+      case kStatePodDel:
+        pods->erase(record.name());
+        break;
+    }
+    count++;
+  }
+  if (offset != data.size()) {
+    // the master died when writing the last record
+    LOG(WARNING, "drop %u bytes of torn record at the end of %s",
+        data.size() - offset, path.c_str());
+  }
+  LOG(INFO, "replay %ld records from %s", count, path.c_str());
+  return true;
+}
+
+bool StateStore::Load(std::vector<JobStatus>* jobs,
+                      std::vector<PodStatus>* pods) {
+  int64_t start = ::baidu::common::timer::get_micros();
+  if (::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+    LOG(WARNING, "fail to create dir %s for %s", dir_.c_str(), strerror(errno));
+    return false;
+  }
+  std::vector<int64_t> snapshot_seqs;
+  std::vector<int64_t> wal_seqs;
+  if (!ListSeqs("snapshot", &snapshot_seqs) || !ListSeqs("wal", &wal_seqs)) {
+    return false;
+  }
+  boost::unordered_map<std::string, JobStatus> job_map;
+  boost::unordered_map<std::string, PodStatus> pod_map;
+  int64_t snapshot_seq = 0;
+  if (!snapshot_seqs.empty()) {
+    snapshot_seq = snapshot_seqs.back();
+    if (!Replay(FileName("snapshot", snapshot_seq), &job_map, &pod_map)) {
+      return false;
+    }
+  }
+  wal_seq_ = snapshot_seq;
+  for (size_t index = 0; index < wal_seqs.size(); ++index) {
+    if (wal_seqs[index] < snapshot_seq) {
+      continue;
+    }
+    if (!Replay(FileName("wal", wal_seqs[index]), &job_map, &pod_map)) {
+      return false;
+    }
+    wal_seq_ = wal_seqs[index];
+  }
+  boost::unordered_map<std::string, JobStatus>::iterator job_it = job_map.begin();
+  for (; job_it != job_map.end(); ++job_it) {
+    jobs->push_back(job_it->second);
+  }
+  pods->reserve(pod_map.size());
+  boost::unordered_map<std::string, PodStatus>::iterator pod_it = pod_map.begin();
+  for (; pod_it != pod_map.end(); ++pod_it) {
+    pods->push_back(pod_it->second);
+  }
+  LOG(INFO, "load %u jobs and %u pods from %s in %ld ms", jobs->size(), pods->size(),
+      dir_.c_str(), (::baidu::common::timer::get_micros() - start) / 1000);
+  return true;
+}
+
+bool StateStore::Open() {
+  ::baidu::common::MutexLock flush_lock(&flush_mutex_);
+  // never append to the wal that may end with a torn record
+  RecordWriter* wal = new RecordWriter();
+  if (!wal->Open(FileName("wal", wal_seq_ + 1))) {
+    delete wal;
+    return false;
+  }
+  wal_seq_++;
+  wal_ = wal;
+  pool_.DelayTask(FLAGS_master_state_flush_interval,
+                  boost::bind(&StateStore::FlushLoop, this));
+  return true;
+}
+
+void StateStore::BuildJobPut(const JobStatus& job, StateRecord* record) {
+  record->set_type(kStateJobPut);
+  record->mutable_job()->CopyFrom(job);
+}
+
+void StateStore::BuildPodPut(const PodStatus& pod, StateRecord* record) {
+  record->set_type(kStatePodPut);
+  PodStatus* logged = record->mutable_pod();
+  logged->set_name(pod.name());
+  logged->set_job_name(pod.job_name());
+  logged->set_stage(pod.stage());
+  logged->set_state(pod.state());
+  logged->set_endpoint(pod.endpoint());
+  logged->set_start_pending_time(pod.start_pending_time());
+}
+
+void StateStore::PutJob(const JobStatus& job) {
+  StateRecord record;
+  BuildJobPut(job, &record);
+  Append(record);
+}
+
+void StateStore::DelJob(const std::string& name) {
+  StateRecord record;
+  record.set_type(kStateJobDel);
+  record.set_name(name);
+  Append(record);
+}
+
+void StateStore::PutPod(const PodStatus& pod) {
+  StateRecord record;
+  BuildPodPut(pod, &record);
+  Append(record);
+}
+
+void StateStore::DelPod(const std::string& name) {
+  StateRecord record;
+  record.set_type(kStatePodDel);
+  record.set_name(name);
+  Append(record);
+}
+
+void StateStore::Append(const StateRecord& record) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  RecordWriter::Encode(record, &buffer_);
+  appended_++;
+}
+
+void StateStore::Commit(const boost::function<void ()>& callback) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  waiters_.push_back(std::make_pair(appended_, callback));
+  if (!commit_scheduled_) {
+    // the callers that come during this flush go to the next one
+    commit_scheduled_ = true;
+    pool_.AddTask(boost::bind(&StateStore::Flush, this));
+  }
+}
+
+void StateStore::Flush() {
+  std::vector<boost::function<void ()> > callbacks;
+  {
+    ::baidu::common::MutexLock flush_lock(&flush_mutex_);
+    if (wal_ == NULL) {
+      return;
+    }
+    std::string data;
+    int64_t flushed = 0;
+    {
+      ::baidu::common::MutexLock lock(&mutex_);
+      data.swap(buffer_);
+      flushed = appended_;
+      commit_scheduled_ = false;
+    }
+    if (!data.empty()) {
+      wal_->AppendEncoded(data);
+      if (!wal_->Flush(FLAGS_master_state_sync)) {
+        // the waiters are not answered until a later flush succeeds
+        LOG(WARNING, "fail to flush wal %s", wal_->Path().c_str());
+        return;
+      }
+    }
+    ::baidu::common::MutexLock lock(&mutex_);
+    size_t kept = 0;
+    for (size_t index = 0; index < waiters_.size(); ++index) {
+      if (waiters_[index].first <= flushed) {
+        callbacks.push_back(waiters_[index].second);
+      } else {
+        waiters_[kept++] = waiters_[index];
+      }
+    }
+    waiters_.resize(kept);
+  }
+  for (size_t index = 0; index < callbacks.size(); ++index) {
+    callbacks[index]();
+  }
+}
+
+void StateStore::FlushLoop() {
+  Flush();
+  pool_.DelayTask(FLAGS_master_state_flush_interval,
+                  boost::bind(&StateStore::FlushLoop, this));
+}
+
+RecordWriter* StateStore::BeginSnapshot(int64_t* seq) {
+  ::baidu::common::MutexLock flush_lock(&flush_mutex_);
+  RecordWriter* wal = new RecordWriter();
+  if (!wal->Open(FileName("wal", wal_seq_ + 1))) {
+    delete wal;
+    return NULL;
+  }
+  RecordWriter* snapshot = new RecordWriter();
+  if (!snapshot->Open(FileName("snapshot", wal_seq_ + 1) + ".tmp")) {
+    delete snapshot;
+    delete wal;
+    return NULL;
+  }
+  // the buffered records go to the old wal, the later ones go to the new
+  std::string data;
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    data.swap(buffer_);
+  }
+  if (wal_ != NULL) {
+    wal_->AppendEncoded(data);
+    wal_->Flush(true);
+    delete wal_;
+  }
+  wal_ = wal;
+  wal_seq_++;
+  *seq = wal_seq_;
+  return snapshot;
+}
+
+bool StateStore::CommitSnapshot(int64_t seq, RecordWriter* snapshot) {
+  std::string tmp_path = snapshot->Path();
+  bool flush_ok = snapshot->Flush(true);
+  delete snapshot;
+  if (!flush_ok) {
+    ::unlink(tmp_path.c_str());
+    return false;
+  }
+  std::string path = FileName("snapshot", seq);
+  if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    LOG(WARNING, "fail to rename %s for %s", tmp_path.c_str(), strerror(errno));
+    ::unlink(tmp_path.c_str());
+    return false;
+  }
+  // make the rename durable before removing the older files
+  int dir_fd = ::open(dir_.c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  std::vector<int64_t> snapshot_seqs;
+  std::vector<int64_t> wal_seqs;
+  ListSeqs("snapshot", &snapshot_seqs);
+  ListSeqs("wal", &wal_seqs);
+  for (size_t index = 0; index < snapshot_seqs.size(); ++index) {
+    if (snapshot_seqs[index] < seq) {
+      ::unlink(FileName("snapshot", snapshot_seqs[index]).c_str());
+    }
+  }
+  for (size_t index = 0; index < wal_seqs.size(); ++index) {
+    if (wal_seqs[index] < seq) {
+      ::unlink(FileName("wal", wal_seqs[index]).c_str());
+    }
+  }
+  LOG(INFO, "commit snapshot %s", path.c_str());
+  return true;
+}
+
+}// namespace dos
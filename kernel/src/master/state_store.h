@@ -0,0 +1,108 @@
+#ifndef KERNEL_MASTER_STATE_STORE_H
+#define KERNEL_MASTER_STATE_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+#include "proto/dos.pb.h"
+#include "proto/master_state.pb.h"
+#include "mutex.h"
+#include "thread_pool.h"
+
+namespace dos {
+
+// write records to a file, every record is stored as
+// [length][crc32 of data][data] and buffered until Flush
+class RecordWriter {
+
+public:
+  RecordWriter();
+  ~RecordWriter();
+  // open file for appending
+  bool Open(const std::string& path);
+  void Append(const StateRecord& record);
+  // append the records encoded by Encode
+  void AppendEncoded(const std::string& data);
+  // write buffered records to file, sync makes them durable
+  bool Flush(bool sync);
+  void Close();
+  const std::string& Path() const {
+    return path_;
+  }
+  static void Encode(const StateRecord& record, std::string* buffer);
+  // decode the record at offset and move offset to the next one,
+  // return false at the end of data or on a torn record
+  static bool Decode(const std::string& data, size_t* offset,
+                     StateRecord* record);
+private:
+  int fd_;
+  std::string path_;
+  std::string buffer_;
+};
+
+// keep the jobs and pods of master in local dir with snapshots and
+// wals named snapshot.{seq} and wal.{seq}, replaying wal.{seq} and the
+// later wals on snapshot.{seq} gives the latest state
+class StateStore {
+
+public:
+  StateStore(const std::string& dir);
+  ~StateStore();
+  // load the latest snapshot and replay the wals after it, the torn
+  // record at the end of wal is dropped
+  bool Load(std::vector<JobStatus>* jobs,
+            std::vector<PodStatus>* pods);
+  // start a new wal and flush it in background, call it after Load
+  bool Open();
+  void PutJob(const JobStatus& job);
+  void DelJob(const std::string& name);
+  void PutPod(const PodStatus& pod);
+  void DelPod(const std::string& name);
+  // run callback in background when the records appended before are
+  // durable, the records of concurrent callers are flushed together
+  void Commit(const boost::function<void ()>& callback);
+  // switch to a new wal and return the writer of the snapshot with
+  // the seq of new wal, the records in new wal may be in snapshot too,
+  // it is fine to replay them. return NULL on io error
+  RecordWriter* BeginSnapshot(int64_t* seq);
+  // make snapshot durable and remove the older files, snapshot is deleted
+  bool CommitSnapshot(int64_t seq, RecordWriter* snapshot);
+
+  static void BuildJobPut(const JobStatus& job, StateRecord* record);
+  // only the fields for restoring a pod are kept
+  static void BuildPodPut(const PodStatus& pod, StateRecord* record);
+private:
+  void Append(const StateRecord& record);
+  // write buffered records to current wal and run the callbacks of
+  // Commit that wait for them
+  void Flush();
+  void FlushLoop();
+  // list seqs of files with prefix in ascending order
+  bool ListSeqs(const std::string& prefix, std::vector<int64_t>* seqs);
+  bool Replay(const std::string& path,
+              boost::unordered_map<std::string, JobStatus>* jobs,
+              boost::unordered_map<std::string, PodStatus>* pods);
+  std::string FileName(const std::string& prefix, int64_t seq);
+private:
+  std::string dir_;
+  // guards buffer_, appended_, waiters_ and commit_scheduled_,
+  // appending never waits for io
+  ::baidu::common::Mutex mutex_;
+  std::string buffer_;
+  // the count of records appended
+  int64_t appended_;
+  // the callbacks of Commit and the count of records they wait for
+  std::vector<std::pair<int64_t, boost::function<void ()> > > waiters_;
+  // a flush for waiters is in pool
+  bool commit_scheduled_;
+  // serializes flush and wal switch
+  ::baidu::common::Mutex flush_mutex_;
+  RecordWriter* wal_;
+  int64_t wal_seq_;
+  ::baidu::common::ThreadPool pool_;
+};
+
+}
+#endif
@@ -0,0 +1,44 @@
+#include "master/node_manager.h"
+
+#include "gtest/gtest.h"
+
+namespace dos {
+
+class NodeManagerTest : public ::testing::Test {
+
+public:
+  NodeManagerTest():node_status_queue_(16, "node_status"),
+                    pod_opqueue_(16, "pod_op"){}
+  ~NodeManagerTest(){}
+protected:
+  BoundedMpmcQueue<NodeStatus*> node_status_queue_;
+  BoundedMpmcQueue<PodOperation*> pod_opqueue_;
+};
+
+TEST_F(NodeManagerTest, SyncTwiceWithoutChange) {
+  NodeManager node_manager(&node_status_queue_, &pod_opqueue_);
+  AgentOverviewList agents;
+  StringList del_list;
+  int64_t cursor = 0;
+  bool full_sync = false;
+  node_manager.SyncAgentInfo(0, &agents, &del_list, &cursor, &full_sync);
+  EXPECT_TRUE(full_sync);
+  EXPECT_EQ(0, agents.size());
+  // no agent has changed, the change log is still empty
+  for (int32_t round = 0; round < 2; ++round) {
+    int64_t latest_cursor = 0;
+    node_manager.SyncAgentInfo(cursor, &agents, &del_list,
+                               &latest_cursor, &full_sync);
+    EXPECT_FALSE(full_sync);
+    EXPECT_EQ(cursor, latest_cursor);
+    EXPECT_EQ(0, agents.size());
+    EXPECT_EQ(0, del_list.size());
+  }
+}
+
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
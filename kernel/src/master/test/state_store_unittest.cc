@@ -0,0 +1,211 @@
+#include "master/state_store.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
+#include <boost/bind.hpp>
+#include <gflags/gflags.h>
+#include "gtest/gtest.h"
+#include "mutex.h"
+
+DECLARE_int32(master_state_flush_interval);
+
+namespace dos {
+
+static JobStatus MakeJob(const std::string& name, int32_t replica) {
+  JobStatus job;
+  job.set_name(name);
+  job.set_user_name("dos");
+  job.mutable_desc()->set_replica(replica);
+  return job;
+}
+
+static PodStatus MakePod(const std::string& name,
+                         const std::string& endpoint,
+                         PodState state) {
+  PodStatus pod;
+  pod.set_name(name);
+  pod.set_job_name("job");
+  pod.set_stage(kPodSchedStageRunning);
+  pod.set_state(state);
+  pod.set_endpoint(endpoint);
+  return pod;
+}
+
+static void SetDone(::baidu::common::Mutex* mutex,
+                    ::baidu::common::CondVar* cond,
+                    bool* done) {
+  ::baidu::common::MutexLock lock(mutex);
+  *done = true;
+  cond->Signal();
+}
+
+class StateStoreTest : public ::testing::Test {
+
+public:
+  StateStoreTest(){}
+  ~StateStoreTest(){}
+protected:
+  void SetUp() {
+    // flush by hand or by Commit in tests
+    FLAGS_master_state_flush_interval = 3600 * 1000;
+    char dir[] = "/tmp/state_store_test.XXXXXX";
+    ASSERT_TRUE(::mkdtemp(dir) != NULL);
+    dir_ = dir;
+  }
+
+  void TearDown() {
+    std::string cmd = "rm -rf " + dir_;
+    ASSERT_EQ(0, ::system(cmd.c_str()));
+  }
+
+  // load the state in dir with a new store, as the master after failover
+  void Load(std::map<std::string, JobStatus>* jobs,
+            std::map<std::string, PodStatus>* pods) {
+    StateStore store(dir_);
+    std::vector<JobStatus> job_list;
+    std::vector<PodStatus> pod_list;
+    ASSERT_TRUE(store.Load(&job_list, &pod_list));
+    for (size_t index = 0; index < job_list.size(); ++index) {
+      (*jobs)[job_list[index].name()] = job_list[index];
+    }
+    for (size_t index = 0; index < pod_list.size(); ++index) {
+      (*pods)[pod_list[index].name()] = pod_list[index];
+    }
+  }
+
+  bool Exists(const std::string& name) {
+    return ::access((dir_ + "/" + name).c_str(), F_OK) == 0;
+  }
+
+  std::string dir_;
+};
+
+TEST_F(StateStoreTest, ReplayWal) {
+  {
+    StateStore store(dir_);
+    std::vector<JobStatus> jobs;
+    std::vector<PodStatus> pods;
+    ASSERT_TRUE(store.Load(&jobs, &pods));
+    EXPECT_TRUE(jobs.empty());
+    ASSERT_TRUE(store.Open());
+    store.PutJob(MakeJob("job", 2));
+    store.PutJob(MakeJob("removed", 1));
+    store.PutPod(MakePod("0_pod.job", "host1:8527", kPodDeploying));
+    store.PutPod(MakePod("1_pod.job", "host2:8527", kPodRunning));
+    store.PutPod(MakePod("0_pod.job", "host1:8527", kPodRunning));
+    store.DelPod("1_pod.job");
+    store.DelJob("removed");
+    // the store flushes its buffer when it's deleted
+  }
+  std::map<std::string, JobStatus> jobs;
+  std::map<std::string, PodStatus> pods;
+  Load(&jobs, &pods);
+  ASSERT_EQ(1u, jobs.size());
+  EXPECT_EQ(2u, jobs["job"].desc().replica());
+  ASSERT_EQ(1u, pods.size());
+  EXPECT_EQ(kPodRunning, pods["0_pod.job"].state());
+  EXPECT_EQ("host1:8527", pods["0_pod.job"].endpoint());
+}
+
+TEST_F(StateStoreTest, SnapshotRoundTrip) {
+  {
+    StateStore store(dir_);
+    std::vector<JobStatus> jobs;
+    std::vector<PodStatus> pods;
+    ASSERT_TRUE(store.Load(&jobs, &pods));
+    ASSERT_TRUE(store.Open());
+    store.PutJob(MakeJob("job", 2));
+    store.PutPod(MakePod("0_pod.job", "host1:8527", kPodRunning));
+    store.PutPod(MakePod("1_pod.job", "host2:8527", kPodRunning));
+    int64_t seq = 0;
+    RecordWriter* snapshot = store.BeginSnapshot(&seq);
+    ASSERT_TRUE(snapshot != NULL);
+    // the changes during snapshot go to the new wal
+    store.DelPod("1_pod.job");
+    store.PutJob(MakeJob("other", 1));
+    StateRecord record;
+    StateStore::BuildJobPut(MakeJob("job", 2), &record);
+    snapshot->Append(record);
+    StateStore::BuildPodPut(MakePod("0_pod.job", "host1:8527", kPodRunning), &record);
+    snapshot->Append(record);
+    StateStore::BuildPodPut(MakePod("1_pod.job", "host2:8527", kPodRunning), &record);
+    snapshot->Append(record);
+    ASSERT_TRUE(store.CommitSnapshot(seq, snapshot));
+    // the wal before snapshot is removed
+    EXPECT_FALSE(Exists("wal.1"));
+    EXPECT_TRUE(Exists("snapshot.2"));
+  }
+  std::map<std::string, JobStatus> jobs;
+  std::map<std::string, PodStatus> pods;
+  Load(&jobs, &pods);
+  EXPECT_EQ(2u, jobs.size());
+  EXPECT_TRUE(jobs.find("other") != jobs.end());
+  ASSERT_EQ(1u, pods.size());
+  EXPECT_TRUE(pods.find("0_pod.job") != pods.end());
+}
+
+TEST_F(StateStoreTest, DropTornRecord) {
+  {
+    StateStore store(dir_);
+    std::vector<JobStatus> jobs;
+    std::vector<PodStatus> pods;
+    ASSERT_TRUE(store.Load(&jobs, &pods));
+    ASSERT_TRUE(store.Open());
+    store.PutJob(MakeJob("job", 2));
+  }
+  // the master dies when writing the second record
+  StateRecord record;
+  StateStore::BuildJobPut(MakeJob("torn", 1), &record);
+  std::string data;
+  RecordWriter::Encode(record, &data);
+  int fd = ::open((dir_ + "/wal.1").c_str(), O_WRONLY | O_APPEND);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ((ssize_t)(data.size() - 3), ::write(fd, data.data(), data.size() - 3));
+  ::close(fd);
+  std::map<std::string, JobStatus> jobs;
+  std::map<std::string, PodStatus> pods;
+  Load(&jobs, &pods);
+  ASSERT_EQ(1u, jobs.size());
+  EXPECT_TRUE(jobs.find("job") != jobs.end());
+  // the next master never appends to the wal with torn record
+  StateStore store(dir_);
+  std::vector<JobStatus> job_list;
+  std::vector<PodStatus> pod_list;
+  ASSERT_TRUE(store.Load(&job_list, &pod_list));
+  ASSERT_TRUE(store.Open());
+  EXPECT_TRUE(Exists("wal.2"));
+}
+
+TEST_F(StateStoreTest, CommitAfterFlush) {
+  StateStore store(dir_);
+  std::vector<JobStatus> jobs;
+  std::vector<PodStatus> pods;
+  ASSERT_TRUE(store.Load(&jobs, &pods));
+  ASSERT_TRUE(store.Open());
+  store.PutJob(MakeJob("job", 2));
+  ::baidu::common::Mutex mutex;
+  ::baidu::common::CondVar cond(&mutex);
+  bool done = false;
+  store.Commit(boost::bind(&SetDone, &mutex, &cond, &done));
+  {
+    ::baidu::common::MutexLock lock(&mutex);
+    while (!done) {
+      cond.Wait();
+    }
+  }
+  // the record is in wal without deleting the store
+  std::map<std::string, JobStatus> loaded_jobs;
+  std::map<std::string, PodStatus> loaded_pods;
+  Load(&loaded_jobs, &loaded_pods);
+  EXPECT_EQ(1u, loaded_jobs.size());
+}
+
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
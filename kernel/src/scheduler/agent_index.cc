@@ -0,0 +1,83 @@
+#include "scheduler/agent_index.h"
+
+namespace dos {
+
+AgentIndex::AgentIndex():buckets_(), locations_(){}
+
+AgentIndex::~AgentIndex(){}
+
+int32_t AgentIndex::BucketOf(uint64_t limit, uint64_t assigned) {
+  if (assigned >= limit) {
+    return 0;
+  }
+  return 64 - __builtin_clzll(limit - assigned);
+}
+
+AgentIndex::BucketKey AgentIndex::KeyOf(const Resource& resource,
+                                        bool use_assigned) {
+  // the requirement uses limit only
+  uint64_t cpu_assigned = use_assigned ? resource.cpu().assigned() : 0;
+  uint64_t mem_assigned = use_assigned ? resource.memory().assigned() : 0;
+  return std::make_pair(BucketOf(resource.cpu().limit(), cpu_assigned),
+                        BucketOf(resource.memory().limit(), mem_assigned));
+}
+
+void AgentIndex::Update(AgentOverview* agent) {
+  BucketKey key = KeyOf(agent->resource(), true);
+  boost::unordered_map<std::string, std::pair<BucketKey, AgentOverview*> >::iterator it =
+    locations_.find(agent->endpoint());
+  if (it != locations_.end()) {
+    if (it->second.first == key && it->second.second == agent) {
+      return;
+    }
+    RemoveFromBucket(it->second.first, it->second.second);
+    it->second = std::make_pair(key, agent);
+  } else {
+    locations_.insert(std::make_pair(agent->endpoint(), std::make_pair(key, agent)));
+  }
+  buckets_[key].insert(agent);
+}
+
+void AgentIndex::Remove(const std::string& endpoint) {
+  boost::unordered_map<std::string, std::pair<BucketKey, AgentOverview*> >::iterator it =
+    locations_.find(endpoint);
+  if (it == locations_.end()) {
+    return;
+  }
+  RemoveFromBucket(it->second.first, it->second.second);
+  locations_.erase(it);
+}
+
+void AgentIndex::Clear() {
+  buckets_.clear();
+  locations_.clear();
+}
+
+void AgentIndex::RemoveFromBucket(const BucketKey& key,
+                                  AgentOverview* agent) {
+  std::map<BucketKey, Bucket>::iterator bucket_it = buckets_.find(key);
+  if (bucket_it == buckets_.end()) {
+    return;
+  }
+  bucket_it->second.erase(agent);
+  if (bucket_it->second.empty()) {
+    buckets_.erase(bucket_it);
+  }
+}
+
+void AgentIndex::Lookup(const Resource& require,
+                        std::vector<AgentOverview*>* agents) const {
+  BucketKey require_key = KeyOf(require, false);
+  // agents in the buckets below require bucket have
+  // less free resource than require for sure
+  std::map<BucketKey, Bucket>::const_iterator bucket_it =
+    buckets_.lower_bound(std::make_pair(require_key.first, 0));
+  for (; bucket_it != buckets_.end(); ++bucket_it) {
+    if (bucket_it->first.second < require_key.second) {
+      continue;
+    }
+    agents->insert(agents->end(), bucket_it->second.begin(), bucket_it->second.end());
+  }
+}
+
+} // namespace dos
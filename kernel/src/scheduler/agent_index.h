@@ -0,0 +1,48 @@
+#ifndef KERNEL_SCHEDULER_AGENT_INDEX_H
+#define KERNEL_SCHEDULER_AGENT_INDEX_H
+
+#include <map>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include "proto/master.pb.h"
+
+namespace dos {
+
+// index agents by free millicores x free memory, the bucket of
+// a value is the bit length of it, so all agents in bucket b
+// have free value in [2^(b-1), 2^b)
+class AgentIndex {
+
+public:
+  AgentIndex();
+  ~AgentIndex();
+  // add agent or move it to the bucket of its current resource
+  void Update(AgentOverview* agent);
+  void Remove(const std::string& endpoint);
+  void Clear();
+  // get the agents whose buckets are not below the cpu and memory of
+  // require, it only drops the agents that can not fit, the index
+  // knows nothing about ports and an agent in the same bucket may still
+  // be short of cpu or memory, so caller must check every agent returned
+  // with ResourceUtil::Alloc
+  void Lookup(const Resource& require,
+              std::vector<AgentOverview*>* agents) const;
+  size_t Size() const {
+    return locations_.size();
+  }
+private:
+  typedef std::pair<int32_t, int32_t> BucketKey;
+  typedef boost::unordered_set<AgentOverview*> Bucket;
+  static int32_t BucketOf(uint64_t limit, uint64_t assigned);
+  static BucketKey KeyOf(const Resource& resource, bool use_assigned);
+  void RemoveFromBucket(const BucketKey& key, AgentOverview* agent);
+private:
+  // only the buckets that are not empty
+  std::map<BucketKey, Bucket> buckets_;
+  // endpoint and the bucket agent is in
+  boost::unordered_map<std::string, std::pair<BucketKey, AgentOverview*> > locations_;
+};
+
+} // namespace dos
+#endif
@@ -0,0 +1,257 @@
+#include "scheduler/agent_table.h"
+
+#include <gflags/gflags.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+DECLARE_int32(scheduler_max_pod_count);
+DECLARE_double(scheduler_score_longrun_pod_factor);
+DECLARE_double(scheduler_score_pod_factor);
+DECLARE_double(scheduler_score_cpu_factor);
+DECLARE_double(scheduler_score_memory_factor);
+
+namespace dos {
+
+// exp(x) = 2^n * 2^f, n = floor(x * log2(e)), f in [0, 1),
+// 2^f is approximated by a polynomial of degree 5
+static const float kExpMax = 80.0f;
+static const float kExpMin = -80.0f;
+static const float kLog2e = 1.44269504f;
+static const float kExp2C0 = 1.0f;
+static const float kExp2C1 = 0.693147181f;
+static const float kExp2C2 = 0.240226507f;
+static const float kExp2C3 = 0.0555041087f;
+static const float kExp2C4 = 0.00961812911f;
+static const float kExp2C5 = 0.00133335581f;
+
+static inline float ScalarExp(float x) {
+  // NaN goes to kExpMax too
+  if (!(x < kExpMax)) {
+    x = kExpMax;
+  }
+  if (x < kExpMin) {
+    x = kExpMin;
+  }
+  float y = x * kLog2e;
+  int32_t n = static_cast<int32_t>(y);
+  if (y < static_cast<float>(n)) {
+    n -= 1;
+  }
+  float f = y - static_cast<float>(n);
+  float p = kExp2C5;
+  p = p * f + kExp2C4;
+  p = p * f + kExp2C3;
+  p = p * f + kExp2C2;
+  p = p * f + kExp2C1;
+  p = p * f + kExp2C0;
+  union {
+    int32_t i;
+    float f;
+  } e;
+  e.i = (n + 127) << 23;
+  return p * e.f;
+}
+
+void BatchExp(const float* x, size_t n, float* out) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128 max_v = _mm_set1_ps(kExpMax);
+  const __m128 min_v = _mm_set1_ps(kExpMin);
+  const __m128 log2e_v = _mm_set1_ps(kLog2e);
+  const __m128i bias_v = _mm_set1_epi32(127);
+  for (; i + 4 <= n; i += 4) {
+    // min_ps returns the second operand when the first is NaN
+    __m128 v = _mm_min_ps(_mm_loadu_ps(x + i), max_v);
+    v = _mm_max_ps(v, min_v);
+    __m128 y = _mm_mul_ps(v, log2e_v);
+    __m128i ni = _mm_cvttps_epi32(y);
+    __m128 nf = _mm_cvtepi32_ps(ni);
+    // truncation rounds negative values up, fix it to floor
+    __m128 fix = _mm_and_ps(_mm_cmplt_ps(y, nf), _mm_set1_ps(1.0f));
+    nf = _mm_sub_ps(nf, fix);
+    ni = _mm_cvttps_epi32(nf);
+    __m128 f = _mm_sub_ps(y, nf);
+    __m128 p = _mm_set1_ps(kExp2C5);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(kExp2C4));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(kExp2C3));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(kExp2C2));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(kExp2C1));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(kExp2C0));
+    __m128 e = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(ni, bias_v), 23));
+    _mm_storeu_ps(out + i, _mm_mul_ps(p, e));
+  }
+#endif
+  for (; i < n; ++i) {
+    out[i] = ScalarExp(x[i]);
+  }
+}
+
+AgentTable::AgentTable():endpoints_(),
+  cpu_limit_(), cpu_assigned_(),
+  mem_limit_(), mem_assigned_(),
+  longrun_count_(), other_count_(),
+  pod_count_(), rows_(){}
+
+AgentTable::~AgentTable(){}
+
+uint32_t AgentTable::AppendRow(const std::string& endpoint) {
+  uint32_t row = endpoints_.size();
+  endpoints_.push_back(endpoint);
+  cpu_limit_.push_back(0);
+  cpu_assigned_.push_back(0);
+  mem_limit_.push_back(0);
+  mem_assigned_.push_back(0);
+  longrun_count_.push_back(0);
+  other_count_.push_back(0);
+  pod_count_.push_back(0);
+  rows_[endpoint] = row;
+  return row;
+}
+
+uint32_t AgentTable::Upsert(const AgentOverview& agent) {
+  uint32_t row = 0;
+  if (!Find(agent.endpoint(), &row)) {
+    row = AppendRow(agent.endpoint());
+  }
+  cpu_limit_[row] = agent.resource().cpu().limit();
+  cpu_assigned_[row] = agent.resource().cpu().assigned();
+  mem_limit_[row] = agent.resource().memory().limit();
+  mem_assigned_[row] = agent.resource().memory().assigned();
+  int32_t long_run_count = 0;
+  for (int32_t index = 0; index < agent.pods_size(); ++index) {
+    const PodOverview& pod = agent.pods(index);
+    if (pod.type() == kPodLongrun
+        || pod.type() == kPodSystem) {
+      long_run_count++;
+    }
+  }
+  longrun_count_[row] = long_run_count;
+  other_count_[row] = agent.pods_size() - long_run_count;
+  pod_count_[row] = agent.pods_size();
+  return row;
+}
+
+uint32_t AgentTable::CopyRow(const AgentTable& from, uint32_t from_row) {
+  uint32_t row = 0;
+  if (!Find(from.endpoints_[from_row], &row)) {
+    row = AppendRow(from.endpoints_[from_row]);
+  }
+  cpu_limit_[row] = from.cpu_limit_[from_row];
+  cpu_assigned_[row] = from.cpu_assigned_[from_row];
+  mem_limit_[row] = from.mem_limit_[from_row];
+  mem_assigned_[row] = from.mem_assigned_[from_row];
+  longrun_count_[row] = from.longrun_count_[from_row];
+  other_count_[row] = from.other_count_[from_row];
+  pod_count_[row] = from.pod_count_[from_row];
+  return row;
+}
+
+void AgentTable::Remove(const std::string& endpoint) {
+  uint32_t row = 0;
+  if (!Find(endpoint, &row)) {
+    return;
+  }
+  uint32_t last = endpoints_.size() - 1;
+  if (row != last) {
+    endpoints_[row] = endpoints_[last];
+    cpu_limit_[row] = cpu_limit_[last];
+    cpu_assigned_[row] = cpu_assigned_[last];
+    mem_limit_[row] = mem_limit_[last];
+    mem_assigned_[row] = mem_assigned_[last];
+    longrun_count_[row] = longrun_count_[last];
+    other_count_[row] = other_count_[last];
+    pod_count_[row] = pod_count_[last];
+    rows_[endpoints_[row]] = row;
+  }
+  endpoints_.pop_back();
+  cpu_limit_.pop_back();
+  cpu_assigned_.pop_back();
+  mem_limit_.pop_back();
+  mem_assigned_.pop_back();
+  longrun_count_.pop_back();
+  other_count_.pop_back();
+  pod_count_.pop_back();
+  rows_.erase(endpoint);
+}
+
+bool AgentTable::Find(const std::string& endpoint, uint32_t* row) const {
+  boost::unordered_map<std::string, uint32_t>::const_iterator it = rows_.find(endpoint);
+  if (it == rows_.end()) {
+    return false;
+  }
+  *row = it->second;
+  return true;
+}
+
+void AgentTable::Clear() {
+  endpoints_.clear();
+  cpu_limit_.clear();
+  cpu_assigned_.clear();
+  mem_limit_.clear();
+  mem_assigned_.clear();
+  longrun_count_.clear();
+  other_count_.clear();
+  pod_count_.clear();
+  rows_.clear();
+}
+
+void AgentTable::AddExp(std::vector<float>* load,
+                        std::vector<float>* scores) {
+  if (load->empty()) {
+    return;
+  }
+  BatchExp(&(*load)[0], load->size(), &(*load)[0]);
+  for (size_t i = 0; i < load->size(); ++i) {
+    (*scores)[i] += (*load)[i];
+  }
+}
+
+void AgentTable::ScoreForLongrunPod(std::vector<float>* scores) const {
+  size_t n = endpoints_.size();
+  scores->assign(n, 0);
+  std::vector<float> load(n);
+  float cpu_factor = FLAGS_scheduler_score_cpu_factor;
+  for (size_t i = 0; i < n; ++i) {
+    load[i] = cpu_assigned_[i] * cpu_factor / cpu_limit_[i];
+  }
+  AddExp(&load, scores);
+  float mem_factor = FLAGS_scheduler_score_memory_factor;
+  for (size_t i = 0; i < n; ++i) {
+    load[i] = mem_assigned_[i] * mem_factor / mem_limit_[i];
+  }
+  AddExp(&load, scores);
+  float longrun_factor = FLAGS_scheduler_score_longrun_pod_factor / FLAGS_scheduler_max_pod_count;
+  for (size_t i = 0; i < n; ++i) {
+    load[i] = longrun_count_[i] * longrun_factor;
+  }
+  AddExp(&load, scores);
+  float pod_factor = FLAGS_scheduler_score_pod_factor / FLAGS_scheduler_max_pod_count;
+  for (size_t i = 0; i < n; ++i) {
+    load[i] = other_count_[i] * pod_factor;
+  }
+  AddExp(&load, scores);
+}
+
+void AgentTable::ScoreForBatchPod(std::vector<float>* scores) const {
+  size_t n = endpoints_.size();
+  scores->assign(n, 0);
+  std::vector<float> load(n);
+  float cpu_factor = FLAGS_scheduler_score_cpu_factor;
+  for (size_t i = 0; i < n; ++i) {
+    load[i] = cpu_assigned_[i] * cpu_factor / cpu_limit_[i];
+  }
+  AddExp(&load, scores);
+  float mem_factor = FLAGS_scheduler_score_memory_factor;
+  for (size_t i = 0; i < n; ++i) {
+    load[i] = mem_assigned_[i] * mem_factor / mem_limit_[i];
+  }
+  AddExp(&load, scores);
+  float pod_factor = FLAGS_scheduler_score_pod_factor / FLAGS_scheduler_max_pod_count;
+  for (size_t i = 0; i < n; ++i) {
+    load[i] = pod_count_[i] * pod_factor;
+  }
+  AddExp(&load, scores);
+}
+
+} // namespace dos
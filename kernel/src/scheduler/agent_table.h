@@ -0,0 +1,62 @@
+#ifndef KERNEL_SCHEDULER_AGENT_TABLE_H
+#define KERNEL_SCHEDULER_AGENT_TABLE_H
+
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include "proto/master.pb.h"
+
+namespace dos {
+
+// a dense struct of arrays snapshot of the agent properties
+// used by scoring, row i of every column belongs to endpoints[i]
+class AgentTable {
+
+public:
+  AgentTable();
+  ~AgentTable();
+  // add agent or overwrite its row, return the row
+  uint32_t Upsert(const AgentOverview& agent);
+  // copy a row from another table, return the row in this table
+  uint32_t CopyRow(const AgentTable& from, uint32_t row);
+  // remove agent by moving the last row to its row
+  void Remove(const std::string& endpoint);
+  bool Find(const std::string& endpoint, uint32_t* row) const;
+  void Clear();
+  size_t Size() const {
+    return endpoints_.size();
+  }
+  const std::string& Endpoint(uint32_t row) const {
+    return endpoints_[row];
+  }
+
+  // calc the scores of all rows, see SchedCell for the formula
+  void ScoreForLongrunPod(std::vector<float>* scores) const;
+  void ScoreForBatchPod(std::vector<float>* scores) const;
+private:
+  uint32_t AppendRow(const std::string& endpoint);
+  // scores[i] += exp(load[i]), load will be overwritten
+  static void AddExp(std::vector<float>* load,
+                     std::vector<float>* scores);
+private:
+  std::vector<std::string> endpoints_;
+  std::vector<float> cpu_limit_;
+  std::vector<float> cpu_assigned_;
+  std::vector<float> mem_limit_;
+  std::vector<float> mem_assigned_;
+  // the count of kPodLongrun and kPodSystem pods
+  std::vector<float> longrun_count_;
+  // the count of the other pods
+  std::vector<float> other_count_;
+  // the count of all pods
+  std::vector<float> pod_count_;
+  boost::unordered_map<std::string, uint32_t> rows_;
+};
+
+// calc exp(x[i]) for n floats with batch exp approximation, x is
+// clamped to [-80, 80] and NaN goes to 80, the relative error is less
+// than 1e-4 in the range
+void BatchExp(const float* x, size_t n, float* out);
+
+} // namespace dos
+#endif
@@ -13,6 +13,11 @@ DECLARE_string(master_endpoint);
 DECLARE_int32(scheduler_sync_agent_info_interval);
 DECLARE_int32(scheduler_feasibility_factor);
 DECLARE_int32(scheduler_max_pod_count);
+DECLARE_int32(scheduler_propose_batch_size);
+DECLARE_int32(scheduler_scale_up_wait_timeout);
+DECLARE_int32(scheduler_reservation_timeout);
+DECLARE_int32(scheduler_max_preempt_pods_per_round);
+DECLARE_int32(scheduler_preempt_nominate_timeout);
 DECLARE_double(scheduler_score_longrun_pod_factor);
 DECLARE_double(scheduler_score_pod_factor);
 DECLARE_double(scheduler_score_cpu_factor);
@@ -28,16 +33,42 @@ static bool SchedCellDesc(const SchedCell& left, const SchedCell& right) {
   return left.priority > right.priority;
 }
 
-static bool AgentScoreAsc(const ProposeCell& left, const ProposeCell& right) {
-  return left.score > right.score;
+// order rows by score desc
+struct RowScoreDesc {
+  const std::vector<float>* scores;
+  bool operator()(uint32_t left, uint32_t right) const {
+    return (*scores)[left] > (*scores)[right];
+  }
+};
+
+// order the victims of preemption by type asc and cpu asc, so the
+// lowest priority and smallest pods are evicted first
+static bool VictimAsc(const PodOverview* left, const PodOverview* right) {
+  if (left->type() != right->type()) {
+    return left->type() < right->type();
+  }
+  return left->requirement().cpu().limit() < right->requirement().cpu().limit();
 }
 
 Scheduler::Scheduler():rpc_client_(NULL),
   master_(NULL), pool_(5),
   mutex_(), agents_(NULL),
-  ins_(NULL), ins_watcher_(NULL){
+  agent_cursor_(0),
+  scale_up_generation_(0),
+  agent_index_(NULL),
+  agent_table_(NULL),
+  ins_(NULL), ins_watcher_(NULL),
+  nominated_(NULL),
+  reservations_(NULL),
+  propose_total_(0),
+  propose_conflicts_(0),
+  preempt_stat_(){
   rpc_client_ = new RpcClient();
+  nominated_ = new std::map<std::string, Nomination>();
+  reservations_ = new boost::unordered_map<std::string, std::map<std::string, ProposeReservation> >();
   agents_ = new boost::unordered_map<std::string, AgentOverview*>();
+  agent_index_ = new AgentIndex();
+  agent_table_ = new AgentTable();
   ins_ = new InsSDK(FLAGS_ins_servers);
 }
 
@@ -51,32 +82,49 @@ bool Scheduler::Start() {
     LOG(WARNING, "fail to watch master endpoint");
     return false;
   }
-  ins_watcher_->GetValue(&master_addr_);
+  std::string master_addr;
+  ins_watcher_->GetValue(&master_addr);
+  return Start(master_addr);
+}
+
+bool Scheduler::Start(const std::string& master_addr) {
+  master_addr_ = master_addr;
   LOG(INFO, "connect to master %s", master_addr_.c_str());
   bool get_ok = rpc_client_->GetStub(master_addr_, &master_);
   if (!get_ok) {
     return false;
   }
   SyncAgentInfo();
-  pool_.DelayTask(1000, boost::bind(&Scheduler::GetScaleUpPods, this));
+  pool_.AddTask(boost::bind(&Scheduler::GetScaleUpPods, this));
   return true;
 }
 
+void Scheduler::GetPreemptStat(PreemptStat* stat) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  *stat = preempt_stat_;
+}
+
 void Scheduler::SyncAgentInfo() {
   ::baidu::common::MutexLock lock(&mutex_);
   SyncAgentInfoRequest request;
-  boost::unordered_map<std::string, AgentOverview*>::iterator agent_it = agents_->begin();
-  for (; agent_it != agents_->end(); ++agent_it) {
-    AgentVersion* version = request.add_versions();
-    version->set_endpoint(agent_it->second->endpoint());
-    version->set_version(agent_it->second->version());
-  }
+  request.set_cursor(agent_cursor_);
+  boost::unordered_map<std::string, AgentOverview*>::iterator agent_it;
   SyncAgentInfoResponse response;
   bool ok = rpc_client_->SendRequest(master_, &Master_Stub::SyncAgentInfo,
                            &request, &response, 5, 1);
   if (!ok || response.status() != kRpcOk) {
     LOG(WARNING, "fail to sync agent info from master %s", master_addr_.c_str());
   } else {
+    if (response.full_sync()) {
+      LOG(INFO, "full sync agent info from master %s with cursor %ld",
+          master_addr_.c_str(), response.cursor());
+      for (agent_it = agents_->begin(); agent_it != agents_->end(); ++agent_it) {
+        delete agent_it->second;
+      }
+      agents_->clear();
+      agent_index_->Clear();
+      agent_table_->Clear();
+    }
     for (int32_t index = 0; index < response.diff_del_size(); ++index) {
       agent_it = agents_->find(response.diff_del(index));
       if (agent_it == agents_->end()) {
@@ -84,6 +132,9 @@ void Scheduler::SyncAgentInfo() {
       }
       LOG(INFO, "delete agent %s from scheduler", response.diff_del(index).c_str());
       // free agent overview
+      agent_index_->Remove(agent_it->first);
+      agent_table_->Remove(agent_it->first);
+      reservations_->erase(agent_it->first);
       delete agent_it->second;
       agents_->erase(agent_it);
     }
@@ -99,8 +150,14 @@ void Scheduler::SyncAgentInfo() {
             new_agent.resource().cpu().limit(),
             ::baidu::common::HumanReadableString(new_agent.resource().memory().limit()).c_str());
         agents_->insert(std::make_pair(new_agent.endpoint(), copied_agent));
+        ApplyReservations(copied_agent);
+        agent_index_->Update(copied_agent);
+        agent_table_->Upsert(*copied_agent);
       } else {
         agent_it->second->CopyFrom(new_agent);
+        ApplyReservations(agent_it->second);
+        agent_index_->Update(agent_it->second);
+        agent_table_->Upsert(*agent_it->second);
         LOG(INFO, "update agent %s with resource cpu total:%ld assigned:%ld  mem total:%s assigned:%s",
             new_agent.endpoint().c_str(),
             new_agent.resource().cpu().limit(),
@@ -110,32 +167,67 @@ void Scheduler::SyncAgentInfo() {
       }
 
     }
+    agent_cursor_ = response.cursor();
   }
   pool_.DelayTask(FLAGS_scheduler_sync_agent_info_interval, 
                   boost::bind(&Scheduler::SyncAgentInfo, this));
 }
 
 void Scheduler::GetScaleUpPods() {
-  LOG(INFO, "get scale up pods from %s", master_addr_.c_str());
   GetScaleUpPodRequest request;
   GetScaleUpPodResponse response;
-  bool rpc_ok = false;
+  std::string master_addr;
   {
     ::baidu::common::MutexLock lock(&mutex_);
-    rpc_ok = rpc_client_->SendRequest(master_, &Master_Stub::GetScaleUpPod,
-                                     &request, &response, 5, 1);
+    master_addr = master_addr_;
+    request.set_generation(scale_up_generation_);
+  }
+  // master holds the request until pending pods change, so the
+  // mutex is not held during the request
+  request.set_wait_timeout(FLAGS_scheduler_scale_up_wait_timeout);
+  LOG(DEBUG, "get scale up pods from %s with generation %ld",
+      master_addr.c_str(), request.generation());
+  Master_Stub* master = NULL;
+  bool get_ok = rpc_client_->GetStub(master_addr, &master);
+  if (!get_ok) {
+    LOG(WARNING, "fail to build stub of master %s", master_addr.c_str());
+    pool_.DelayTask(1000, boost::bind(&Scheduler::GetScaleUpPods, this));
+    return;
   }
-   if (!rpc_ok || response.status() != kRpcOk) {
-    LOG(WARNING, "fail to get scale up pods");
+  bool rpc_ok = rpc_client_->SendRequest(master, &Master_Stub::GetScaleUpPod,
+                                         &request, &response,
+                                         FLAGS_scheduler_scale_up_wait_timeout / 1000 + 5, 1);
+  delete master;
+  if (!rpc_ok || response.status() != kRpcOk) {
+    LOG(WARNING, "fail to get scale up pods from %s", master_addr.c_str());
     pool_.DelayTask(1000, boost::bind(&Scheduler::GetScaleUpPods, this));
-  } else {
+    return;
+  }
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    scale_up_generation_ = response.generation();
+  }
+  if (response.pods_size() > 0) {
+    LOG(INFO, "get %d scale up pods from %s",
+        response.pods_size(), master_addr.c_str());
     std::map<std::string, SchedCell> cells;
     BuildScaleUpSchedCell(response, cells);
     std::vector<SchedCell> sorted_cells;
     SortSchedCell(cells, sorted_cells);
-    ProcessScaleUpCell(sorted_cells);
+    std::vector<SchedCell> feasibile_cells;
+    PreemptRequest preemptions;
+    std::vector<PodOverview> preemptors;
+    ProcessScaleUpCell(sorted_cells, &feasibile_cells, &preemptions, &preemptors);
+    // propose before next request, then master will not return the
+    // pods of this round again
+    if (feasibile_cells.size() > 0) {
+      ProcessScaleUpPropose(feasibile_cells);
+    }
+    if (preemptions.preemptions_size() > 0) {
+      ProcessPreemption(preemptions, preemptors);
+    }
   }
-  pool_.DelayTask(1000, boost::bind(&Scheduler::GetScaleUpPods, this));
+  pool_.AddTask(boost::bind(&Scheduler::GetScaleUpPods, this));
 }
 
 void Scheduler::BuildScaleUpSchedCell(const GetScaleUpPodResponse& response,
@@ -145,6 +237,7 @@ void Scheduler::BuildScaleUpSchedCell(const GetScaleUpPodResponse& response,
     SchedCell& cell = cells[pod.job_name()];
     cell.priority = pod.type();
     cell.type = pod.type();
+    cell.gang = pod.gang();
     cell.job_name = pod.job_name();
     cell.pods.push_back(pod.name());
     cell.resource = pod.requirement();
@@ -162,77 +255,486 @@ void Scheduler::SortSchedCell(const std::map<std::string, SchedCell>& cells,
   std::sort(sorted_cells.begin(), sorted_cells.end(), SchedCellDesc);
 }
 
-void Scheduler::ProcessScaleUpCell(std::vector<SchedCell>& cells) {
+void Scheduler::ProcessScaleUpCell(std::vector<SchedCell>& cells,
+                                   std::vector<SchedCell>* feasibile_cells,
+                                   PreemptRequest* preemptions,
+                                   std::vector<PodOverview>* preemptors) {
   ::baidu::common::MutexLock lock(&mutex_);
   int64_t feasibile_check_start = ::baidu::common::timer::get_micros();
-  std::vector<std::string> endpoints;
-  boost::unordered_map<std::string, AgentOverview*>::iterator a_it = agents_->begin();
-  for (; a_it != agents_->end(); ++a_it) {
-    endpoints.push_back(a_it->first);
-  }
-  Shuffle(endpoints);
-  std::vector<std::string>::iterator e_it = endpoints.begin();
+  // the resource of agents that has been allocated by cells in this turn,
+  // cells are sorted by priority, so higher priority cells alloc first
+  boost::unordered_map<std::string, Resource> allocated;
+  // the pods that have been chosen to evict in this turn
+  std::set<std::string> victims;
   int32_t check_count = 0;
-  for (; e_it !=  endpoints.end(); ++e_it) {
-    a_it = agents_->find(*e_it);
-    AgentOverview* agent = a_it->second;
-    Resource total = agent->resource();
-    std::vector<SchedCell>::iterator cell_it = cells.begin();
-    bool all_fit = true;
-    for (; cell_it != cells.end(); ++cell_it) {
-      if (cell_it->agents.size() >= (size_t)cell_it->feasibile_count) {
+  std::map<std::string, Nomination>::iterator nominated_it = nominated_->begin();
+  while (nominated_it != nominated_->end()) {
+    if (nominated_it->second.expire_ <= feasibile_check_start) {
+      LOG(INFO, "nomination of pod %s on agent %s expires",
+          nominated_it->first.c_str(), nominated_it->second.endpoint_.c_str());
+      preempt_stat_.expired++;
+      nominated_->erase(nominated_it++);
+    } else {
+      ++nominated_it;
+    }
+  }
+  std::vector<SchedCell>::iterator cell_it = cells.begin();
+  for (; cell_it != cells.end(); ++cell_it) {
+    PickPinnedPods(&*cell_it);
+    std::vector<AgentOverview*> candidates;
+    agent_index_->Lookup(cell_it->resource, &candidates);
+    // the agents that this cell has allocated in this turn
+    std::vector<std::string> cell_allocated;
+    // keep spreading pods over the agents that fit
+    Shuffle(candidates);
+    std::vector<AgentOverview*>::iterator a_it = candidates.begin();
+    for (; a_it != candidates.end(); ++a_it) {
+      if (cell_it->agents.Size() >= (size_t)cell_it->feasibile_count) {
         break;
       }
       check_count++;
-      all_fit = false;
+      AgentOverview* agent = *a_it;
+      boost::unordered_map<std::string, Resource>::iterator alloc_it =
+        allocated.find(agent->endpoint());
+      if (alloc_it == allocated.end()) {
+        alloc_it = allocated.insert(std::make_pair(agent->endpoint(),
+                                                   agent->resource())).first;
+      }
+      // the index only narrows candidates by cpu and memory, check
+      // the whole requirement including ports here
       bool alloc_ok = ResourceUtil::Alloc(cell_it->resource,
-                                          &total);
+                                          &alloc_it->second);
       if (alloc_ok) {
+        cell_allocated.push_back(agent->endpoint());
+      }
+      uint32_t row = 0;
+      if (alloc_ok && agent_table_->Find(agent->endpoint(), &row)) {
         LOG(DEBUG, "agent %s fit pod of job %s resource requirement",
-            a_it->second->endpoint().c_str(),
+            agent->endpoint().c_str(),
             cell_it->job_name.c_str());
-        ProposeCell p_cell;
-        p_cell.overview = *agent;
-        cell_it->agents.push_back(p_cell);
+        cell_it->agents.CopyRow(*agent_table_, row);
       }
     }
-    if (all_fit) {
-      break;
+    // a gang cell that can not place all pods gives back the resource
+    // it holds, so the cells after it can use them
+    if (cell_it->gang && cell_it->agents.Size() < cell_it->pods.size()) {
+      LOG(INFO, "only %u agents fit %u pods of gang job %s",
+          cell_it->agents.Size(), cell_it->pods.size(),
+          cell_it->job_name.c_str());
+      for (size_t index = 0; index < cell_allocated.size(); ++index) {
+        ResourceUtil::Release(cell_it->resource, &allocated[cell_allocated[index]]);
+      }
+      cell_it->agents.Clear();
+      continue;
+    }
+    // every agent takes one pod of cell, the rest can only be placed
+    // by evicting lower priority pods
+    if (cell_it->priority >= kPodLongrun
+        && cell_it->agents.Size() < cell_it->pods.size()) {
+      PlanPreemption(*cell_it, &allocated, &victims, preemptions, preemptors);
     }
   }
   int64_t consumed = (::baidu::common::timer::get_micros() - feasibile_check_start)/1000;
-  LOG(INFO, "checking feasibility consumes %ld ms with %d time calculation ",
-      consumed, check_count);
+  LOG(INFO, "checking feasibility consumes %ld ms with %d time calculation in %u agents",
+      consumed, check_count, agent_index_->Size());
   for (size_t cindex = 0; cindex < cells.size(); ++cindex) {
-    if (cells[cindex].agents.size() <=0) {
+    if (cells[cindex].agents.Size() <=0 && cells[cindex].pinned.empty()) {
       continue;
     }
-    pool_.AddTask(boost::bind(&Scheduler::ProcessScaleUpPropose, this, cells[cindex]));
+    feasibile_cells->push_back(cells[cindex]);
   }
 }
 
-void Scheduler::ProcessScaleUpPropose(SchedCell cell) {
-  cell.Score();
-  ScaleUpProposeRequest request;
-  ScaleUpProposeResponse response;
-  size_t agent_cursor = 0;
-  for (size_t index = 0; index < cell.pods.size(); ++index) {
-    if (agent_cursor >= cell.agents.size()){
+void Scheduler::PlanPreemption(const SchedCell& cell,
+                               boost::unordered_map<std::string, Resource>* allocated,
+                               std::set<std::string>* victims,
+                               PreemptRequest* preemptions,
+                               std::vector<PodOverview>* preemptors) {
+  mutex_.AssertHeld();
+  for (size_t index = cell.agents.Size(); index < cell.pods.size(); ++index) {
+    if (preemptions->preemptions_size() >= FLAGS_scheduler_max_preempt_pods_per_round) {
       break;
     }
-    Propose* propose = request.add_proposes();
-    propose->set_pod_name(cell.pods[index]);
-    propose->set_endpoint(cell.agents[agent_cursor].overview.endpoint());
-    agent_cursor++;
+    const std::string& pod_name = cell.pods[index];
+    if (nominated_->find(pod_name) != nominated_->end()) {
+      // the master has not accepted the nominated pod on its agent yet
+      continue;
+    }
+    Preemption best;
+    Resource best_left;
+    boost::unordered_map<std::string, AgentOverview*>::iterator agent_it = agents_->begin();
+    for (; agent_it != agents_->end(); ++agent_it) {
+      AgentOverview* agent = agent_it->second;
+      std::vector<const PodOverview*> candidates;
+      for (int32_t pindex = 0; pindex < agent->pods_size(); ++pindex) {
+        const PodOverview& pod = agent->pods(pindex);
+        if (pod.type() >= cell.type || pod.type() >= kPodLongrun
+            || victims->find(pod.name()) != victims->end()) {
+          continue;
+        }
+        candidates.push_back(&pod);
+      }
+      if (candidates.empty()) {
+        continue;
+      }
+      std::sort(candidates.begin(), candidates.end(), VictimAsc);
+      boost::unordered_map<std::string, Resource>::iterator alloc_it =
+        allocated->find(agent->endpoint());
+      Resource left = alloc_it == allocated->end() ? agent->resource() : alloc_it->second;
+      Preemption preemption;
+      bool fit = false;
+      for (size_t vindex = 0; vindex < candidates.size(); ++vindex) {
+        // this agent can not beat the best one
+        if (best.victims_size() > 0
+            && preemption.victims_size() + 1 >= best.victims_size()) {
+          break;
+        }
+        ResourceUtil::Release(candidates[vindex]->requirement(), &left);
+        preemption.add_victims(candidates[vindex]->name());
+        if (ResourceUtil::Alloc(cell.resource, &left)) {
+          fit = true;
+          break;
+        }
+      }
+      if (!fit) {
+        continue;
+      }
+      preemption.set_endpoint(agent->endpoint());
+      best.Swap(&preemption);
+      best_left.Swap(&left);
+      if (best.victims_size() == 1) {
+        break;
+      }
+    }
+    if (best.victims_size() <= 0) {
+      LOG(DEBUG, "no pods to preempt for pod %s", pod_name.c_str());
+      continue;
+    }
+    best.set_pod_name(pod_name);
+    (*allocated)[best.endpoint()] = best_left;
+    for (int32_t vindex = 0; vindex < best.victims_size(); ++vindex) {
+      victims->insert(best.victims(vindex));
+    }
+    preemptions->add_preemptions()->Swap(&best);
+    PodOverview preemptor;
+    preemptor.set_name(pod_name);
+    preemptor.set_job_name(cell.job_name);
+    preemptor.set_type(cell.type);
+    preemptor.mutable_requirement()->CopyFrom(cell.resource);
+    preemptors->push_back(preemptor);
+  }
+}
+
+void Scheduler::ProcessPreemption(const PreemptRequest& preemptions,
+                                  const std::vector<PodOverview>& preemptors) {
+  std::string master_addr;
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    master_addr = master_addr_;
+  }
+  // master_ may be replaced by HandleMasterChange, so send with a stub
+  // of this call
+  Master_Stub* master = NULL;
+  PreemptResponse response;
+  bool ok = rpc_client_->GetStub(master_addr, &master);
+  if (ok) {
+    ok = rpc_client_->SendRequest(master, &Master_Stub::Preempt,
+                                  &preemptions, &response, 5, 1);
+  } else {
+    LOG(WARNING, "fail to build stub of master %s", master_addr.c_str());
+  }
+  delete master;
+  ::baidu::common::MutexLock lock(&mutex_);
+  preempt_stat_.attempts += preemptions.preemptions_size();
+  if (!ok || response.status() != kRpcOk) {
+    LOG(WARNING, "fail to send %d preemptions to master",
+        preemptions.preemptions_size());
+    preempt_stat_.rejections += preemptions.preemptions_size();
+    return;
+  }
+  int64_t expire = ::baidu::common::timer::get_micros()
+                   + FLAGS_scheduler_preempt_nominate_timeout * 1000L;
+  int32_t accepted = 0;
+  for (int32_t index = 0; index < response.results_size(); ++index) {
+    const ProposeResult& result = response.results(index);
+    if (result.status() != kRpcOk) {
+      LOG(INFO, "master rejects preemption of pod %s on agent %s for %s",
+          result.pod_name().c_str(),
+          result.endpoint().c_str(),
+          RpcStatus_Name(result.status()).c_str());
+      preempt_stat_.rejections++;
+      continue;
+    }
+    accepted++;
+    const Preemption& preemption = preemptions.preemptions(index);
+    preempt_stat_.victims += preemption.victims_size();
+    NominatePod(preemption, preemptors[index], expire);
+  }
+  preempt_stat_.accepted += accepted;
+  LOG(INFO, "preempt for %d pods, accepted %d, total attempts %ld accepted %ld "
+      "victims %ld rejections %ld placed %ld expired %ld",
+      preemptions.preemptions_size(), accepted,
+      preempt_stat_.attempts, preempt_stat_.accepted,
+      preempt_stat_.victims, preempt_stat_.rejections,
+      preempt_stat_.placed, preempt_stat_.expired);
+}
+
+void Scheduler::NominatePod(const Preemption& preemption,
+                            const PodOverview& preemptor,
+                            int64_t expire) {
+  mutex_.AssertHeld();
+  Nomination& nomination = (*nominated_)[preemption.pod_name()];
+  nomination.endpoint_ = preemption.endpoint();
+  nomination.expire_ = expire;
+  boost::unordered_map<std::string, AgentOverview*>::iterator agent_it =
+    agents_->find(preemption.endpoint());
+  if (agent_it == agents_->end()) {
+    return;
+  }
+  std::set<std::string> victims(preemption.victims().begin(),
+                                preemption.victims().end());
+  AgentOverview* agent = agent_it->second;
+  google::protobuf::RepeatedPtrField<PodOverview> kept;
+  for (int32_t index = 0; index < agent->pods_size(); ++index) {
+    const PodOverview& pod = agent->pods(index);
+    if (victims.find(pod.name()) != victims.end()) {
+      ResourceUtil::Release(pod.requirement(), agent->mutable_resource());
+      continue;
+    }
+    kept.Add()->CopyFrom(pod);
   }
-  if (agent_cursor >0) {
-    bool ok = rpc_client_->SendRequest(master_, &Master_Stub::ScaleUpPropose,
+  agent->mutable_pods()->Swap(&kept);
+  // the room of victims is reserved like a propose, so the other pods
+  // can not take it before the preemptor is proposed to this agent
+  ProposeReservation& reservation = (*reservations_)[agent->endpoint()][preemptor.name()];
+  reservation.pod_.CopyFrom(preemptor);
+  reservation.expire_ = expire;
+  ResourceUtil::Alloc(preemptor.requirement(), agent->mutable_resource());
+  agent->add_pods()->CopyFrom(preemptor);
+  agent_index_->Update(agent);
+  agent_table_->Upsert(*agent);
+}
+
+void Scheduler::PickPinnedPods(SchedCell* cell) {
+  mutex_.AssertHeld();
+  std::vector<std::string> pods;
+  for (size_t index = 0; index < cell->pods.size(); ++index) {
+    const std::string& pod_name = cell->pods[index];
+    std::map<std::string, Nomination>::iterator nominated_it = nominated_->find(pod_name);
+    if (nominated_it == nominated_->end()) {
+      pods.push_back(pod_name);
+      continue;
+    }
+    boost::unordered_map<std::string, std::map<std::string, ProposeReservation> >::iterator r_it =
+      reservations_->find(nominated_it->second.endpoint_);
+    if (r_it == reservations_->end()
+        || r_it->second.find(pod_name) == r_it->second.end()) {
+      // the agent is gone or master has rejected the pod on it
+      pods.push_back(pod_name);
+      continue;
+    }
+    cell->pinned.push_back(std::make_pair(pod_name, nominated_it->second.endpoint_));
+  }
+  cell->pods.swap(pods);
+}
+
+void Scheduler::ProcessScaleUpPropose(std::vector<SchedCell> cells) {
+  ScaleUpProposeRequest all;
+  // the cell of every propose in all
+  std::vector<const SchedCell*> owners;
+  // the pods proposed to the agents they nominate
+  std::set<std::string> pinned;
+  std::vector<std::string> placed;
+  for (size_t cindex = 0; cindex < cells.size(); ++cindex) {
+    SchedCell& cell = cells[cindex];
+    cell.Score();
+    if (cell.gang && cell.ranks.size() < cell.pods.size()) {
+      continue;
+    }
+    for (size_t index = 0; index < cell.pinned.size(); ++index) {
+      Propose* propose = all.add_proposes();
+      propose->set_pod_name(cell.pinned[index].first);
+      propose->set_endpoint(cell.pinned[index].second);
+      owners.push_back(&cell);
+      pinned.insert(cell.pinned[index].first);
+    }
+    size_t agent_cursor = 0;
+    for (size_t index = 0; index < cell.pods.size(); ++index) {
+      if (agent_cursor >= cell.ranks.size()){
+        break;
+      }
+      Propose* propose = all.add_proposes();
+      propose->set_pod_name(cell.pods[index]);
+      propose->set_endpoint(cell.agents.Endpoint(cell.ranks[agent_cursor]));
+      owners.push_back(&cell);
+      agent_cursor++;
+    }
+  }
+  std::string master_addr;
+  {
+    ::baidu::common::MutexLock lock(&mutex_);
+    master_addr = master_addr_;
+  }
+  // master_ may be replaced by HandleMasterChange, so send with a stub
+  // of this call
+  Master_Stub* master = NULL;
+  bool get_ok = rpc_client_->GetStub(master_addr, &master);
+  if (!get_ok) {
+    LOG(WARNING, "fail to build stub of master %s", master_addr.c_str());
+    return;
+  }
+  int32_t accepted = 0;
+  int32_t rejected = 0;
+  int32_t end = 0;
+  for (int32_t offset = 0; offset < all.proposes_size(); offset = end) {
+    end = std::min(all.proposes_size(), 
+                   offset + FLAGS_scheduler_propose_batch_size);
+    // master commits the proposes of a gang cell together, so they
+    // must not be split into two requests
+    while (end < all.proposes_size() && owners[end]->gang
+           && owners[end] == owners[end - 1]) {
+      end++;
+    }
+    ScaleUpProposeRequest request;
+    for (int32_t index = offset; index < end; ++index) {
+      request.add_proposes()->CopyFrom(all.proposes(index));
+      ApplyPropose(all.proposes(index).endpoint(),
+                   all.proposes(index).pod_name(),
+                   *owners[index]);
+    }
+    ScaleUpProposeResponse response;
+    bool ok = rpc_client_->SendRequest(master, &Master_Stub::ScaleUpPropose,
                                       &request, &response, 5, 1);
-    if (ok && response.status() == kRpcOk) {
-      LOG(INFO, "propose job %s successfully", cell.job_name.c_str());
-    }else { 
-      LOG(WARNING, "fail to propose job %s ", cell.job_name.c_str());
+    if (!ok || response.status() != kRpcOk) {
+      LOG(WARNING, "fail to propose %d pods to master", end - offset);
+      for (int32_t index = 0; index < request.proposes_size(); ++index) {
+        RevertPropose(request.proposes(index).endpoint(),
+                      request.proposes(index).pod_name());
+      }
+      continue;
+    }
+    for (int32_t index = 0; index < response.results_size(); ++index) {
+      const ProposeResult& result = response.results(index);
+      if (result.status() != kRpcOk) {
+        LOG(INFO, "master rejects pod %s on agent %s for %s",
+            result.pod_name().c_str(),
+            result.endpoint().c_str(),
+            RpcStatus_Name(result.status()).c_str());
+        RevertPropose(result.endpoint(), result.pod_name());
+        rejected++;
+        continue;
+      }
+      accepted++;
+      if (pinned.find(result.pod_name()) != pinned.end()) {
+        placed.push_back(result.pod_name());
+      }
+    }
+  }
+  delete master;
+  ::baidu::common::MutexLock lock(&mutex_);
+  propose_total_ += accepted + rejected;
+  propose_conflicts_ += rejected;
+  for (size_t index = 0; index < placed.size(); ++index) {
+    nominated_->erase(placed[index]);
+  }
+  preempt_stat_.placed += placed.size();
+  LOG(INFO, "propose %d pods of %u jobs, accepted %d, rejected %d, conflict rate %.4f of %ld proposes",
+      all.proposes_size(), cells.size(), accepted, rejected,
+      propose_total_ > 0 ? (double)propose_conflicts_ / propose_total_ : 0.0,
+      propose_total_);
+}
+
+void Scheduler::ApplyPropose(const std::string& endpoint,
+                             const std::string& pod_name,
+                             const SchedCell& cell) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  boost::unordered_map<std::string, AgentOverview*>::iterator agent_it =
+    agents_->find(endpoint);
+  if (agent_it == agents_->end()) {
+    return;
+  }
+  AgentOverview* agent = agent_it->second;
+  std::map<std::string, ProposeReservation>& reserved = (*reservations_)[endpoint];
+  std::map<std::string, ProposeReservation>::iterator pod_it = reserved.find(pod_name);
+  if (pod_it != reserved.end()) {
+    // the room kept for nominated pod has been counted in agent
+    pod_it->second.expire_ = ::baidu::common::timer::get_micros()
+                             + FLAGS_scheduler_reservation_timeout * 1000L;
+    return;
+  }
+  ProposeReservation& reservation = reserved[pod_name];
+  reservation.pod_.set_name(pod_name);
+  reservation.pod_.set_job_name(cell.job_name);
+  reservation.pod_.set_type(cell.type);
+  reservation.pod_.mutable_requirement()->CopyFrom(cell.resource);
+  reservation.expire_ = ::baidu::common::timer::get_micros()
+                        + FLAGS_scheduler_reservation_timeout * 1000L;
+  ResourceUtil::Alloc(cell.resource, agent->mutable_resource());
+  agent->add_pods()->CopyFrom(reservation.pod_);
+  agent_index_->Update(agent);
+  agent_table_->Upsert(*agent);
+}
+
+void Scheduler::RevertPropose(const std::string& endpoint,
+                              const std::string& pod_name) {
+  ::baidu::common::MutexLock lock(&mutex_);
+  boost::unordered_map<std::string, std::map<std::string, ProposeReservation> >::iterator r_it =
+    reservations_->find(endpoint);
+  if (r_it == reservations_->end()) {
+    return;
+  }
+  std::map<std::string, ProposeReservation>::iterator pod_it = r_it->second.find(pod_name);
+  if (pod_it == r_it->second.end()) {
+    return;
+  }
+  boost::unordered_map<std::string, AgentOverview*>::iterator agent_it =
+    agents_->find(endpoint);
+  if (agent_it != agents_->end()) {
+    AgentOverview* agent = agent_it->second;
+    ResourceUtil::Release(pod_it->second.pod_.requirement(), agent->mutable_resource());
+    google::protobuf::RepeatedPtrField<PodOverview> kept;
+    for (int32_t index = 0; index < agent->pods_size(); ++index) {
+      if (agent->pods(index).name() != pod_name) {
+        kept.Add()->CopyFrom(agent->pods(index));
+      }
+    }
+    agent->mutable_pods()->Swap(&kept);
+    agent_index_->Update(agent);
+    agent_table_->Upsert(*agent);
+  }
+  r_it->second.erase(pod_it);
+  if (r_it->second.empty()) {
+    reservations_->erase(r_it);
+  }
+}
+
+void Scheduler::ApplyReservations(AgentOverview* agent) {
+  mutex_.AssertHeld();
+  boost::unordered_map<std::string, std::map<std::string, ProposeReservation> >::iterator r_it =
+    reservations_->find(agent->endpoint());
+  if (r_it == reservations_->end()) {
+    return;
+  }
+  // master exports the pods it has reserved, so the proposes in them
+  // have been counted in the resource of agent
+  std::set<std::string> counted;
+  for (int32_t index = 0; index < agent->pods_size(); ++index) {
+    counted.insert(agent->pods(index).name());
+  }
+  int64_t now = ::baidu::common::timer::get_micros();
+  std::map<std::string, ProposeReservation>::iterator pod_it = r_it->second.begin();
+  while (pod_it != r_it->second.end()) {
+    if (counted.find(pod_it->first) != counted.end()
+        || pod_it->second.expire_ <= now) {
+      r_it->second.erase(pod_it++);
+      continue;
     }
+    ResourceUtil::Alloc(pod_it->second.pod_.requirement(), agent->mutable_resource());
+    agent->add_pods()->CopyFrom(pod_it->second.pod_);
+    ++pod_it;
+  }
+  if (r_it->second.empty()) {
+    reservations_->erase(r_it);
   }
 }
 
@@ -251,54 +753,32 @@ void Scheduler::HandleMasterChange(const std::string& master_endpoint) {
 
 void SchedCell::Score() {
   int64_t score_start = ::baidu::common::timer::get_micros();
-  std::vector<ProposeCell>::iterator a_it = agents.begin();
-  for (; a_it != agents.end(); ++a_it) {
-    std::map<PodType, ScoreFunc>::iterator score_func_it = score_func_map.find(type);
-    if (score_func_it == score_func_map.end()) {
+  std::vector<float> scores;
+  switch (type) {
+    case kPodLongrun:
+    case kPodSystem:
+      agents.ScoreForLongrunPod(&scores);
+      break;
+    case kPodBatch:
+    case kPodBesteffort:
+      agents.ScoreForBatchPod(&scores);
+      break;
+    default:
       LOG(WARNING, "fail to find score func for type %s for job %s",
           PodType_Name(type).c_str(),
           job_name.c_str());
-      a_it->score = 0;
-      continue;
-    }
-    a_it->score = score_func_it->second(a_it->overview);
-    LOG(INFO, "score agent %s with score %f", a_it->overview.endpoint().c_str(),
-        a_it->score);
-  }
-  std::sort(agents.begin(), agents.end(), AgentScoreAsc);
-  int64_t consumed = (::baidu::common::timer::get_micros() - score_start)/1000;
-  LOG(INFO, "scoring agent for job %s consumes %ld ms",
-      job_name.c_str(), consumed);
-}
-
-double SchedCell::ScoreForLongrunPod(const AgentOverview& agent) {
-  double cpu_load = agent.resource().cpu().assigned() * FLAGS_scheduler_score_cpu_factor/
-    agent.resource().cpu().limit();
-  double mem_load = agent.resource().memory().assigned() * FLAGS_scheduler_score_memory_factor/
-    agent.resource().memory().limit();
-  int32_t long_run_count = 0;
-  for (int32_t index = 0; index < agent.pods_size(); ++index) {
-    const PodOverview& pod = agent.pods(index);
-    if (pod.type() == kPodLongrun
-        || pod.type() == kPodSystem) {
-      long_run_count++;
-    }
+      scores.assign(agents.Size(), 0);
   }
-  double long_run_load = long_run_count * FLAGS_scheduler_score_longrun_pod_factor/
-    FLAGS_scheduler_max_pod_count ;
-  double pod_load = (agent.pods_size() - long_run_count) * FLAGS_scheduler_score_pod_factor /
-    FLAGS_scheduler_max_pod_count;
-  return exp(cpu_load) + exp(mem_load) + exp(long_run_load) + exp(pod_load);
-}
-
-double SchedCell::ScoreForBatchPod(const AgentOverview& agent) {
-  double cpu_load = agent.resource().cpu().assigned() * FLAGS_scheduler_score_cpu_factor/
-    agent.resource().cpu().limit();
-  double mem_load = agent.resource().memory().assigned() * FLAGS_scheduler_score_memory_factor/
-    agent.resource().memory().limit();
-  double pod_load = agent.pods_size() * FLAGS_scheduler_score_pod_factor /
-    FLAGS_scheduler_max_pod_count;
-  return exp(cpu_load) + exp(mem_load) + exp(pod_load);
+  ranks.resize(scores.size());
+  for (uint32_t row = 0; row < ranks.size(); ++row) {
+    ranks[row] = row;
+  }
+  RowScoreDesc desc;
+  desc.scores = &scores;
+  std::sort(ranks.begin(), ranks.end(), desc);
+  int64_t consumed = ::baidu::common::timer::get_micros() - score_start;
+  LOG(INFO, "scoring %u agents for job %s consumes %ld us",
+      ranks.size(), job_name.c_str(), consumed);
 }
 
 } // namespace dos
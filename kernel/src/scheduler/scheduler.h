@@ -1,6 +1,7 @@
 #ifndef KERNEL_SCHEDULER_SCHEDULER_H
 #define KERNEL_SCHEDULER_SCHEDULER_H
 
+#include <set>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/unordered_map.hpp>
@@ -10,55 +11,86 @@
 #include "mutex.h"
 #include "ins_sdk.h"
 #include "common/ins_watcher.h"
+#include "scheduler/agent_index.h"
+#include "scheduler/agent_table.h"
 
 namespace dos {
 
 using ::galaxy::ins::sdk::InsSDK;
-typedef boost::function<double (const AgentOverview&)> ScoreFunc;
 
 enum SchedAction {
   ScaleUp, ScaleDown
 };
 
-struct ProposeCell {
-  double score;
-  AgentOverview overview;
-};
-
 struct SchedCell {
   std::string job_name;
   Resource resource;
   std::vector<std::string> pods;
   int32_t feasibile_count;
   int32_t priority;
-  std::vector<ProposeCell> agents;
+  // the snapshot of feasibile agents
+  AgentTable agents;
+  // the rows of agents sorted by score, filled by Score
+  std::vector<uint32_t> ranks;
   SchedAction action;
   PodType type;
-  std::map<PodType, ScoreFunc> score_func_map;
+  // all pods of cell are proposed together or none of them
+  bool gang;
+  // the pods nominated by preemption and the agents that keep the room
+  // for them, they are proposed to these agents directly
+  std::vector<std::pair<std::string, std::string> > pinned;
   SchedCell(): job_name(), resource(), pods(),
-  priority(0), agents(),
-  action(ScaleUp){
-    score_func_map.insert(std::make_pair(kPodLongrun,
-          boost::bind(&SchedCell::ScoreForLongrunPod, this, _1)));
-    score_func_map.insert(std::make_pair(kPodSystem,
-          boost::bind(&SchedCell::ScoreForLongrunPod, this, _1)));
-    score_func_map.insert(std::make_pair(kPodBatch,
-          boost::bind(&SchedCell::ScoreForBatchPod, this, _1)));
-    score_func_map.insert(std::make_pair(kPodBesteffort,
-          boost::bind(&SchedCell::ScoreForBatchPod, this, _1)));
-  }
+  priority(0), agents(), ranks(),
+  action(ScaleUp), gang(false), pinned(){}
+  // score agents for longrun and system pod with
+  //   exp(cpu_load) + exp(mem_load) + exp(long_run_load) + exp(pod_load)
+  // and for batch and besteffort pod with
+  //   exp(cpu_load) + exp(mem_load) + exp(pod_load)
   void Score();
-  double ScoreForLongrunPod(const AgentOverview& agent);
-  double ScoreForBatchPod(const AgentOverview& agent);
   ~SchedCell(){}
 };
 
+// a propose that scheduler has applied to its agents, it is kept until
+// master reports the pod on agent or it expires
+struct ProposeReservation {
+  PodOverview pod_;
+  // the time(us) when the reservation expires
+  int64_t expire_;
+};
+
+// the agent that a preemptor has evicted pods on, the room of victims
+// is reserved for the preemptor there until the nomination expires
+struct Nomination {
+  std::string endpoint_;
+  int64_t expire_;
+};
+
+// the counters of preemption since scheduler starts
+struct PreemptStat {
+  // the preemptions sent to master
+  int64_t attempts;
+  int64_t accepted;
+  // the preemptions master rejects or fails to handle
+  int64_t rejections;
+  // the pods evicted by accepted preemptions
+  int64_t victims;
+  // the preemptors that master accepts on the agent they nominate
+  int64_t placed;
+  // the nominations that expire before the preemptor is placed
+  int64_t expired;
+  PreemptStat():attempts(0), accepted(0), rejections(0),
+  victims(0), placed(0), expired(0){}
+};
+
 class Scheduler {
 
 public:
   Scheduler();
   ~Scheduler();
   bool Start();
+  // connect to master_addr directly without watching nexus
+  bool Start(const std::string& master_addr);
+  void GetPreemptStat(PreemptStat* stat);
 private:
   void GetScaleUpPods();
   void SyncAgentInfo();
@@ -66,7 +98,33 @@ private:
                              std::map<std::string, SchedCell>& cells);
   void SortSchedCell(const std::map<std::string, SchedCell>& cells,
                      std::vector<SchedCell>& sorted_cells);
-  void ProcessScaleUpCell(std::vector<SchedCell>& cells);
+  // check feasibility of cells, the cells that have feasibile
+  // agents will be pushed into feasibile_cells, and the preemptions for
+  // system and longrun pods that no agent fits go into preemptions
+  void ProcessScaleUpCell(std::vector<SchedCell>& cells,
+                          std::vector<SchedCell>* feasibile_cells,
+                          PreemptRequest* preemptions,
+                          std::vector<PodOverview>* preemptors);
+  // choose the agent with the fewest lower priority pods to evict for
+  // every pod of cell that has no feasibile agent, the chosen victims
+  // are put into victims and the room is allocated in allocated, the
+  // preemptor of every preemption is pushed into preemptors
+  void PlanPreemption(const SchedCell& cell,
+                      boost::unordered_map<std::string, Resource>* allocated,
+                      std::set<std::string>* victims,
+                      PreemptRequest* preemptions,
+                      std::vector<PodOverview>* preemptors);
+  // send preemptions to master and nominate the accepted ones
+  void ProcessPreemption(const PreemptRequest& preemptions,
+                         const std::vector<PodOverview>& preemptors);
+  // drop the evicted pods from agent in local and reserve the room
+  // they free for the preemptor until the nomination expires
+  void NominatePod(const Preemption& preemption,
+                   const PodOverview& preemptor,
+                   int64_t expire);
+  // move the pods of cell whose nominated agent still keeps the
+  // room for them into pinned
+  void PickPinnedPods(SchedCell* cell);
 
   template<class T>
   void Shuffle(std::vector<T>& list) {
@@ -77,7 +135,20 @@ private:
       list[target_index] = tmp;
     }
   }
-  void ProcessScaleUpPropose(SchedCell cell);
+  // score cells and send all the proposes of cells to master
+  // in batches
+  void ProcessScaleUpPropose(std::vector<SchedCell> cells);
+  // apply the propose to agent in local before master accepts it,
+  // so the following rounds do not propose the same resource
+  void ApplyPropose(const std::string& endpoint,
+                    const std::string& pod_name,
+                    const SchedCell& cell);
+  // give back the resource of the propose that master rejects
+  void RevertPropose(const std::string& endpoint,
+                     const std::string& pod_name);
+  // apply the reservations that the agent from master does not have,
+  // the ones master has counted or that expire are dropped
+  void ApplyReservations(AgentOverview* agent);
 private:
   void HandleMasterChange(const std::string& master_endpoint);
 private:
@@ -88,8 +159,26 @@ private:
   ::baidu::common::Mutex mutex_;
   // endpoint AgentOverview pair 
   boost::unordered_map<std::string, AgentOverview*>* agents_;
+  // the change cursor of master that agents_ has applied
+  int64_t agent_cursor_;
+  // the generation of pending pods that scheduler got from master
+  int64_t scale_up_generation_;
+  // index agents_ by free resource
+  AgentIndex* agent_index_;
+  // the scoring properties of agents_
+  AgentTable* agent_table_;
   InsSDK* ins_;
   InsWatcher* ins_watcher_;
+  // the pods that have preempted others and their nominations, they
+  // do not preempt again before expiring
+  std::map<std::string, Nomination>* nominated_;
+  // endpoint and the reservations of proposes on it
+  boost::unordered_map<std::string, std::map<std::string, ProposeReservation> >* reservations_;
+  // the counters of proposes since scheduler starts, a conflict is
+  // the propose that master rejects
+  int64_t propose_total_;
+  int64_t propose_conflicts_;
+  PreemptStat preempt_stat_;
 };
 
 } //namespace dos
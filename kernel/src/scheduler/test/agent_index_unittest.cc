@@ -0,0 +1,122 @@
+#include "scheduler/agent_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "common/resource_util.h"
+#include "gtest/gtest.h"
+
+namespace dos {
+
+static void SetAgent(const std::string& endpoint,
+                     uint64_t cpu_limit, uint64_t cpu_assigned,
+                     uint64_t mem_limit, uint64_t mem_assigned,
+                     AgentOverview* agent) {
+  agent->set_endpoint(endpoint);
+  agent->mutable_resource()->mutable_cpu()->set_limit(cpu_limit);
+  agent->mutable_resource()->mutable_cpu()->set_assigned(cpu_assigned);
+  agent->mutable_resource()->mutable_memory()->set_limit(mem_limit);
+  agent->mutable_resource()->mutable_memory()->set_assigned(mem_assigned);
+  agent->mutable_resource()->mutable_port()->mutable_range()->set_start(1000);
+  agent->mutable_resource()->mutable_port()->mutable_range()->set_end(2000);
+}
+
+static Resource MakeRequire(uint64_t cpu, uint64_t mem) {
+  Resource require;
+  require.mutable_cpu()->set_limit(cpu);
+  require.mutable_memory()->set_limit(mem);
+  return require;
+}
+
+static bool Contains(const std::vector<AgentOverview*>& agents,
+                     const AgentOverview* agent) {
+  return std::find(agents.begin(), agents.end(), agent) != agents.end();
+}
+
+TEST(AgentIndexTest, NeverDropAgentThatFits) {
+  std::vector<AgentOverview> agents(500);
+  AgentIndex index;
+  srand(agents.size());
+  for (size_t offset = 0; offset < agents.size(); ++offset) {
+    char endpoint[32];
+    snprintf(endpoint, sizeof(endpoint), "agent%u:8221", (uint32_t)offset);
+    uint64_t cpu_limit = 1000 + rand() % 64000;
+    uint64_t mem_limit = (1L << 20) + rand() % (64L << 30);
+    SetAgent(endpoint, cpu_limit, rand() % cpu_limit,
+             mem_limit, rand() % mem_limit, &agents[offset]);
+    index.Update(&agents[offset]);
+  }
+  ASSERT_EQ(agents.size(), index.Size());
+  for (int32_t round = 0; round < 200; ++round) {
+    Resource require = MakeRequire(1 + rand() % 32000, 1 + rand() % (32L << 30));
+    std::vector<AgentOverview*> candidates;
+    index.Lookup(require, &candidates);
+    for (size_t offset = 0; offset < agents.size(); ++offset) {
+      if (ResourceUtil::Satisfy(&agents[offset].resource(), &require)) {
+        EXPECT_TRUE(Contains(candidates, &agents[offset]));
+      }
+    }
+  }
+}
+
+TEST(AgentIndexTest, SameBucketMayNotFit) {
+  AgentOverview agent;
+  // 5000 and 6000 millicores are both in [4096, 8192)
+  SetAgent("agent:8221", 8000, 3000, 8L << 30, 0, &agent);
+  AgentIndex index;
+  index.Update(&agent);
+  Resource require = MakeRequire(6000, 1L << 30);
+  std::vector<AgentOverview*> candidates;
+  index.Lookup(require, &candidates);
+  ASSERT_TRUE(Contains(candidates, &agent));
+  // so caller must check it again
+  Resource left = agent.resource();
+  EXPECT_FALSE(ResourceUtil::Alloc(require, &left));
+}
+
+TEST(AgentIndexTest, PortsAreNotIndexed) {
+  AgentOverview agent;
+  SetAgent("agent:8221", 32000, 0, 64L << 30, 0, &agent);
+  Resource used = MakeRequire(1000, 1L << 30);
+  used.mutable_port()->add_assigned(1080);
+  ASSERT_TRUE(ResourceUtil::Alloc(used, agent.mutable_resource()));
+  AgentIndex index;
+  index.Update(&agent);
+  std::vector<AgentOverview*> candidates;
+  index.Lookup(used, &candidates);
+  ASSERT_TRUE(Contains(candidates, &agent));
+  // the port has been assigned on agent
+  Resource left = agent.resource();
+  EXPECT_FALSE(ResourceUtil::Alloc(used, &left));
+}
+
+TEST(AgentIndexTest, UpdateAndRemove) {
+  AgentOverview agent;
+  SetAgent("agent:8221", 32000, 0, 64L << 30, 0, &agent);
+  AgentIndex index;
+  index.Update(&agent);
+  Resource require = MakeRequire(16000, 1L << 30);
+  std::vector<AgentOverview*> candidates;
+  index.Lookup(require, &candidates);
+  EXPECT_TRUE(Contains(candidates, &agent));
+  // the agent moves to a lower bucket after its cpu is assigned
+  agent.mutable_resource()->mutable_cpu()->set_assigned(30000);
+  index.Update(&agent);
+  EXPECT_EQ(1u, index.Size());
+  candidates.clear();
+  index.Lookup(require, &candidates);
+  EXPECT_FALSE(Contains(candidates, &agent));
+  index.Remove(agent.endpoint());
+  EXPECT_EQ(0u, index.Size());
+  candidates.clear();
+  index.Lookup(MakeRequire(1, 1), &candidates);
+  EXPECT_TRUE(candidates.empty());
+}
+
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,58 @@
+#include "scheduler/agent_table.h"
+
+#include <math.h>
+#include <limits>
+#include <vector>
+#include "gtest/gtest.h"
+
+namespace dos {
+
+static double RelativeError(float value, double expected) {
+  return fabs(value - expected) / expected;
+}
+
+TEST(BatchExpTest, RelativeError) {
+  std::vector<float> x;
+  for (float v = -80.0f; v <= 80.0f; v += 0.0007f) {
+    x.push_back(v);
+  }
+  std::vector<float> out(x.size());
+  BatchExp(&x[0], x.size(), &out[0]);
+  double max_error = 0;
+  for (size_t index = 0; index < x.size(); ++index) {
+    max_error = std::max(max_error, RelativeError(out[index], exp(x[index])));
+  }
+  EXPECT_LT(max_error, 1e-4);
+}
+
+TEST(BatchExpTest, ScalarTail) {
+  // the first 4 go through sse2 and the last 3 through the scalar loop
+  float x[] = {-3.5f, -0.25f, 0.0f, 1.0f, -3.5f, -0.25f, 1.0f};
+  float out[7];
+  BatchExp(x, 7, out);
+  EXPECT_FLOAT_EQ(out[0], out[4]);
+  EXPECT_FLOAT_EQ(out[1], out[5]);
+  EXPECT_FLOAT_EQ(out[3], out[6]);
+  EXPECT_LT(RelativeError(out[2], 1.0), 1e-4);
+}
+
+TEST(BatchExpTest, ClampOutOfRange) {
+  float x[] = {200.0f, -200.0f, std::numeric_limits<float>::quiet_NaN(),
+               std::numeric_limits<float>::infinity(), 200.0f};
+  float out[5];
+  BatchExp(x, 5, out);
+  for (size_t index = 0; index < 5; ++index) {
+    if (index == 1) {
+      EXPECT_LT(RelativeError(out[index], exp(-80.0)), 1e-4);
+    } else {
+      EXPECT_LT(RelativeError(out[index], exp(80.0)), 1e-4);
+    }
+  }
+}
+
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,459 @@
+// run master, scheduler and thousands of simulated agents in one process,
+// submit a mix of jobs of every pod type and report scheduling throughput,
+// submit to running latency and the cpu and memory of the process.
+// all agents share one rpc server, agent i listens on 127.0.x.y and is
+// found by the local address of the rpc, so no nexus or container is needed
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <gflags/gflags.h>
+#include <sofa/pbrpc/pbrpc.h>
+#include "master/master_impl.h"
+#include "scheduler/scheduler.h"
+#include "proto/agent.pb.h"
+#include "rpc/rpc_client.h"
+#include "common/resource_util.h"
+#include "logging.h"
+#include "mutex.h"
+#include "thread_pool.h"
+#include "timer.h"
+
+DECLARE_string(master_port);
+DECLARE_string(master_state_dir);
+DECLARE_int32(agent_heart_beat_interval);
+
+DEFINE_int32(sim_agent_count, 1000, "the count of simulated agents");
+DEFINE_int32(sim_agent_port, 18527, "the port that simulated agents listen");
+DEFINE_int32(sim_agent_cpu, 32000, "the cpu(millicores) of every simulated agent");
+DEFINE_int64(sim_agent_memory, 64L * 1024 * 1024 * 1024, "the memory(byte) of every simulated agent");
+DEFINE_int32(sim_job_count, 100, "the count of jobs to submit");
+DEFINE_int32(sim_job_replica, 50, "the replica of every job");
+DEFINE_int32(sim_pod_cpu, 1000, "the cpu(millicores) that a pod requires");
+DEFINE_int64(sim_pod_memory, 1024L * 1024 * 1024, "the memory(byte) that a pod requires");
+DEFINE_int32(sim_warmup_time, 5, "the time(s) waiting agents to register before submitting jobs");
+DEFINE_int32(sim_timeout, 300, "the max time(s) waiting all pods to run");
+
+using ::baidu::common::INFO;
+using ::baidu::common::WARNING;
+
+namespace dos {
+
+struct SimPod {
+  PodStatus status_;
+  Resource require_;
+  // the agent version when the pod changes
+  int64_t version_;
+  bool reported_;
+};
+
+struct SimAgent {
+  std::string endpoint_;
+  Resource resource_;
+  std::map<std::string, SimPod> pods_;
+  // the version and name of removed pods
+  std::vector<std::pair<int64_t, std::string> > removed_pods_;
+  int64_t version_;
+};
+
+// implement the agent service for all simulated agents, pods are
+// reported running in the first poll after they are added
+class SimCluster : public Agent {
+
+public:
+  SimCluster():mutex_(),
+  agents_(),
+  submit_times_(),
+  latencies_(),
+  scheduled_(0),
+  last_scheduled_time_(0){}
+  ~SimCluster(){}
+
+  void AddAgent(const std::string& endpoint) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    SimAgent* agent = new SimAgent();
+    agent->endpoint_ = endpoint;
+    agent->resource_.mutable_cpu()->set_limit(FLAGS_sim_agent_cpu);
+    agent->resource_.mutable_cpu()->set_share(FLAGS_sim_agent_cpu);
+    agent->resource_.mutable_cpu()->set_assigned(0);
+    agent->resource_.mutable_memory()->set_limit(FLAGS_sim_agent_memory);
+    agent->resource_.mutable_memory()->set_assigned(0);
+    agent->resource_.mutable_port()->mutable_range()->set_start(4000);
+    agent->resource_.mutable_port()->mutable_range()->set_end(6000);
+    agent->version_ = 1;
+    agents_[endpoint] = agent;
+  }
+
+  void GetEndpoints(std::vector<std::string>* endpoints) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    std::map<std::string, SimAgent*>::iterator it = agents_.begin();
+    for (; it != agents_.end(); ++it) {
+      endpoints->push_back(it->first);
+    }
+  }
+
+  void RecordSubmit(const std::string& job_name) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    submit_times_[job_name] = ::baidu::common::timer::get_micros();
+  }
+
+  // return the count of pods reported running
+  int64_t Stat(int64_t* scheduled, int64_t* last_scheduled_time,
+               std::vector<int64_t>* latencies) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    *scheduled = scheduled_;
+    *last_scheduled_time = last_scheduled_time_;
+    if (latencies != NULL) {
+      latencies->assign(latencies_.begin(), latencies_.end());
+    }
+    return latencies_.size();
+  }
+
+  void Poll(RpcController* controller,
+            const PollAgentRequest* request,
+            PollAgentResponse* response,
+            Closure* done) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    SimAgent* agent = GetAgent(controller);
+    if (agent == NULL) {
+      done->Run();
+      return;
+    }
+    int64_t now = ::baidu::common::timer::get_micros();
+    int64_t since = request->version();
+    bool full = since <= 0 || since > agent->version_;
+    std::map<std::string, SimPod>::iterator it = agent->pods_.begin();
+    for (; it != agent->pods_.end(); ++it) {
+      SimPod& pod = it->second;
+      if (!full && pod.version_ <= since) {
+        continue;
+      }
+      response->mutable_status()->add_pstatus()->CopyFrom(pod.status_);
+      if (!pod.reported_) {
+        pod.reported_ = true;
+        std::map<std::string, int64_t>::iterator submit_it =
+          submit_times_.find(GetJobName(it->first));
+        if (submit_it != submit_times_.end()) {
+          latencies_.push_back(now - submit_it->second);
+        }
+      }
+    }
+    if (!full) {
+      for (size_t index = 0; index < agent->removed_pods_.size(); ++index) {
+        if (agent->removed_pods_[index].first > since) {
+          response->add_removed_pods(agent->removed_pods_[index].second);
+        }
+      }
+    }
+    response->set_version(agent->version_);
+    response->set_full(full);
+    response->mutable_status()->mutable_resource()->CopyFrom(agent->resource_);
+    done->Run();
+  }
+
+  void Run(RpcController* controller,
+           const RunPodRequest* request,
+           RunPodResponse* response,
+           Closure* done) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    SimAgent* agent = GetAgent(controller);
+    response->set_status(agent == NULL ? kRpcNotFound : RunPod(agent, *request));
+    done->Run();
+  }
+
+  void RunPods(RpcController* controller,
+               const RunPodsRequest* request,
+               RunPodsResponse* response,
+               Closure* done) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    SimAgent* agent = GetAgent(controller);
+    for (int32_t index = 0; index < request->pods_size(); ++index) {
+      PodResult* result = response->add_results();
+      result->set_pod_name(request->pods(index).pod_name());
+      result->set_status(agent == NULL ? kRpcNotFound : RunPod(agent, request->pods(index)));
+    }
+    response->set_status(kRpcOk);
+    done->Run();
+  }
+
+  void Delete(RpcController* controller,
+              const DeletePodRequest* request,
+              DeletePodResponse* response,
+              Closure* done) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    SimAgent* agent = GetAgent(controller);
+    response->set_status(agent == NULL ? kRpcNotFound : DeletePod(agent, request->name()));
+    done->Run();
+  }
+
+  void DeletePods(RpcController* controller,
+                  const DeletePodsRequest* request,
+                  DeletePodsResponse* response,
+                  Closure* done) {
+    ::baidu::common::MutexLock lock(&mutex_);
+    SimAgent* agent = GetAgent(controller);
+    for (int32_t index = 0; index < request->names_size(); ++index) {
+      PodResult* result = response->add_results();
+      result->set_pod_name(request->names(index));
+      result->set_status(agent == NULL ? kRpcNotFound : DeletePod(agent, request->names(index)));
+    }
+    response->set_status(kRpcOk);
+    done->Run();
+  }
+
+private:
+  SimAgent* GetAgent(RpcController* controller) {
+    mutex_.AssertHeld();
+    sofa::pbrpc::RpcController* sofa_controller =
+      static_cast<sofa::pbrpc::RpcController*>(controller);
+    std::map<std::string, SimAgent*>::iterator it =
+      agents_.find(sofa_controller->LocalAddress());
+    if (it == agents_.end()) {
+      LOG(WARNING, "no simulated agent on %s", sofa_controller->LocalAddress().c_str());
+      return NULL;
+    }
+    return it->second;
+  }
+
+  RpcStatus RunPod(SimAgent* agent, const RunPodRequest& request) {
+    mutex_.AssertHeld();
+    if (agent->pods_.find(request.pod_name()) != agent->pods_.end()) {
+      return kRpcNameExist;
+    }
+    Resource require;
+    for (int32_t index = 0; index < request.pod().containers_size(); ++index) {
+      ResourceUtil::Plus(request.pod().containers(index).requirement(), &require);
+    }
+    if (!ResourceUtil::Alloc(require, &agent->resource_)) {
+      return kRpcNoResource;
+    }
+    SimPod& pod = agent->pods_[request.pod_name()];
+    pod.require_.CopyFrom(require);
+    pod.status_.set_name(request.pod_name());
+    pod.status_.set_state(kPodRunning);
+    pod.status_.mutable_desc()->set_type(request.pod().type());
+    for (int32_t index = 0; index < request.pod().containers_size(); ++index) {
+      ContainerStatus* container = pod.status_.add_cstatus();
+      container->set_name(boost::lexical_cast<std::string>(index)
+                          + "_container." + request.pod_name());
+      container->set_state(kContainerRunning);
+      container->mutable_spec()->CopyFrom(request.pod().containers(index));
+    }
+    pod.version_ = ++agent->version_;
+    pod.reported_ = false;
+    scheduled_++;
+    last_scheduled_time_ = ::baidu::common::timer::get_micros();
+    return kRpcOk;
+  }
+
+  RpcStatus DeletePod(SimAgent* agent, const std::string& name) {
+    mutex_.AssertHeld();
+    std::map<std::string, SimPod>::iterator it = agent->pods_.find(name);
+    if (it == agent->pods_.end()) {
+      return kRpcNotFound;
+    }
+    ResourceUtil::Release(it->second.require_, &agent->resource_);
+    agent->pods_.erase(it);
+    agent->removed_pods_.push_back(std::make_pair(++agent->version_, name));
+    return kRpcOk;
+  }
+
+  static std::string GetJobName(const std::string& pod_name) {
+    size_t pos = pod_name.find("_pod.");
+    if (pos == std::string::npos) {
+      return "";
+    }
+    return pod_name.substr(pos + 5);
+  }
+
+private:
+  ::baidu::common::Mutex mutex_;
+  std::map<std::string, SimAgent*> agents_;
+  std::map<std::string, int64_t> submit_times_;
+  // the submit to running latency(us) of pods
+  std::vector<int64_t> latencies_;
+  int64_t scheduled_;
+  int64_t last_scheduled_time_;
+};
+
+static void HeartBeat(RpcClient* rpc_client,
+                      Master_Stub* master,
+                      SimCluster* cluster,
+                      ::baidu::common::ThreadPool* pool) {
+  std::vector<std::string> endpoints;
+  cluster->GetEndpoints(&endpoints);
+  for (size_t index = 0; index < endpoints.size(); ++index) {
+    HeartBeatRequest request;
+    HeartBeatResponse response;
+    request.set_hostname(endpoints[index].substr(0, endpoints[index].find(':')));
+    request.set_endpoint(endpoints[index]);
+    rpc_client->SendRequest(master, &Master_Stub::HeartBeat,
+                            &request, &response, 2, 1);
+  }
+  pool->DelayTask(FLAGS_agent_heart_beat_interval,
+                  boost::bind(&HeartBeat, rpc_client, master, cluster, pool));
+}
+
+static int64_t GetCpuMicros() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec * 1000000L + usage.ru_utime.tv_usec
+         + usage.ru_stime.tv_sec * 1000000L + usage.ru_stime.tv_usec;
+}
+
+static int64_t GetMaxRssKb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static int64_t Percentile(const std::vector<int64_t>& sorted, double rate) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(rate * (sorted.size() - 1));
+  return sorted[index];
+}
+
+}// namespace dos
+
+int main(int argc, char* argv[]) {
+  ::google::ParseCommandLineFlags(&argc, &argv, true);
+  ::baidu::common::SetLogLevel(WARNING);
+  // every agent takes a client and a server connection
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  dos::SimCluster* cluster = new dos::SimCluster();
+  for (int32_t index = 0; index < FLAGS_sim_agent_count; ++index) {
+    char endpoint[64];
+    snprintf(endpoint, sizeof(endpoint), "127.0.%d.%d:%d",
+             1 + index / 250, 1 + index % 250, FLAGS_sim_agent_port);
+    cluster->AddAgent(endpoint);
+  }
+  int64_t rss_before_master = dos::GetMaxRssKb();
+  sofa::pbrpc::RpcServerOptions options;
+  sofa::pbrpc::RpcServer agent_server(options);
+  agent_server.RegisterService(cluster, false);
+  std::string agent_listen = "0.0.0.0:" + boost::lexical_cast<std::string>(FLAGS_sim_agent_port);
+  if (!agent_server.Start(agent_listen)) {
+    fprintf(stderr, "fail to listen %s\n", agent_listen.c_str());
+    return 1;
+  }
+
+  // start from an empty master state every time
+  char state_dir[] = "/tmp/sched_bench_state_XXXXXX";
+  if (mkdtemp(state_dir) == NULL) {
+    fprintf(stderr, "fail to create state dir\n");
+    return 1;
+  }
+  FLAGS_master_state_dir = state_dir;
+  dos::MasterImpl* master = new dos::MasterImpl();
+  sofa::pbrpc::RpcServer master_server(options);
+  master_server.RegisterService(master, false);
+  std::string master_endpoint = "127.0.0.1:" + FLAGS_master_port;
+  if (!master_server.Start(master_endpoint)) {
+    fprintf(stderr, "fail to listen %s\n", master_endpoint.c_str());
+    return 1;
+  }
+  master->StartService();
+
+  dos::RpcClient rpc_client;
+  dos::Master_Stub* master_stub = NULL;
+  rpc_client.GetStub(master_endpoint, &master_stub);
+  ::baidu::common::ThreadPool heart_beat_pool(1);
+  heart_beat_pool.AddTask(boost::bind(&dos::HeartBeat, &rpc_client,
+                                      master_stub, cluster, &heart_beat_pool));
+  dos::Scheduler* scheduler = new dos::Scheduler();
+  if (!scheduler->Start(master_endpoint)) {
+    fprintf(stderr, "fail to start scheduler\n");
+    return 1;
+  }
+  sleep(FLAGS_sim_warmup_time);
+
+  const dos::PodType types[] = {dos::kPodLongrun, dos::kPodBatch,
+                                dos::kPodBesteffort, dos::kPodSystem};
+  int64_t total = static_cast<int64_t>(FLAGS_sim_job_count) * FLAGS_sim_job_replica;
+  int64_t cpu_start = dos::GetCpuMicros();
+  int64_t start = ::baidu::common::timer::get_micros();
+  for (int32_t index = 0; index < FLAGS_sim_job_count; ++index) {
+    dos::SubmitJobRequest request;
+    dos::SubmitJobResponse response;
+    request.set_user_name("sim");
+    dos::JobSpec* job = request.mutable_job();
+    job->set_name("sim_job_" + boost::lexical_cast<std::string>(index));
+    job->set_replica(FLAGS_sim_job_replica);
+    job->set_deploy_step_size(FLAGS_sim_job_replica);
+    job->mutable_pod()->set_type(types[index % (sizeof(types) / sizeof(dos::PodType))]);
+    dos::Resource* require = job->mutable_pod()->add_containers()->mutable_requirement();
+    require->mutable_cpu()->set_limit(FLAGS_sim_pod_cpu);
+    require->mutable_memory()->set_limit(FLAGS_sim_pod_memory);
+    cluster->RecordSubmit(job->name());
+    bool ok = rpc_client.SendRequest(master_stub, &dos::Master_Stub::SubmitJob,
+                                     &request, &response, 5, 1);
+    if (!ok || response.status() != dos::kRpcOk) {
+      fprintf(stderr, "fail to submit job %s\n", job->name().c_str());
+      return 1;
+    }
+  }
+
+  int64_t scheduled = 0;
+  int64_t last_scheduled_time = 0;
+  int64_t running = 0;
+  int64_t deadline = start + FLAGS_sim_timeout * 1000000L;
+  int64_t next_progress = start + 5000000L;
+  while (::baidu::common::timer::get_micros() < deadline) {
+    running = cluster->Stat(&scheduled, &last_scheduled_time, NULL);
+    if (running >= total) {
+      break;
+    }
+    int64_t now = ::baidu::common::timer::get_micros();
+    if (now >= next_progress) {
+      fprintf(stdout, "%lds: %ld of %ld pods scheduled, %ld running\n",
+              (now - start) / 1000000, scheduled, total, running);
+      next_progress += 5000000L;
+    }
+    usleep(100000);
+  }
+  int64_t used = ::baidu::common::timer::get_micros() - start;
+  int64_t cpu_used = dos::GetCpuMicros() - cpu_start;
+  std::vector<int64_t> latencies;
+  running = cluster->Stat(&scheduled, &last_scheduled_time, &latencies);
+  std::sort(latencies.begin(), latencies.end());
+
+  fprintf(stdout, "agents %d, jobs %d, pods %ld\n",
+          FLAGS_sim_agent_count, FLAGS_sim_job_count, total);
+  int64_t schedule_used = last_scheduled_time > start ? last_scheduled_time - start : 0;
+  fprintf(stdout, "scheduled %ld pods in %.2f s, %.1f pods/s\n",
+          scheduled, schedule_used / 1000000.0,
+          schedule_used > 0 ? scheduled * 1000000.0 / schedule_used : 0.0);
+  fprintf(stdout, "running %ld pods, submit to running latency ms: "
+          "p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+          running,
+          dos::Percentile(latencies, 0.5) / 1000.0,
+          dos::Percentile(latencies, 0.9) / 1000.0,
+          dos::Percentile(latencies, 0.99) / 1000.0,
+          latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+  // the simulated agents are cheap, most of the cpu is taken by master and scheduler
+  fprintf(stdout, "cpu %.2f s in %.2f s, %.1f%% of one core, max rss %ld MB, %ld MB for master and scheduler\n",
+          cpu_used / 1000000.0, used / 1000000.0, cpu_used * 100.0 / used,
+          dos::GetMaxRssKb() / 1024, (dos::GetMaxRssKb() - rss_before_master) / 1024);
+  dos::PreemptStat preempt;
+  scheduler->GetPreemptStat(&preempt);
+  fprintf(stdout, "preemption attempts %ld, accepted %ld, rejections %ld, "
+          "victims %ld, placed %ld, expired %ld\n",
+          preempt.attempts, preempt.accepted, preempt.rejections,
+          preempt.victims, preempt.placed, preempt.expired);
+  if (running < total) {
+    fprintf(stderr, "timeout with %ld pods not running\n", total - running);
+    return 1;
+  }
+  return 0;
+}
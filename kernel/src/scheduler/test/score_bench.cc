@@ -0,0 +1,93 @@
+// measure the scoring of agents in AgentTable with BatchExp against
+// the same formula with std exp, SchedCell::Score scores the feasibile
+// agents of a cell this way once per round
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <gflags/gflags.h>
+#include "scheduler/agent_table.h"
+#include "timer.h"
+
+DECLARE_int32(scheduler_max_pod_count);
+DECLARE_double(scheduler_score_longrun_pod_factor);
+DECLARE_double(scheduler_score_pod_factor);
+DECLARE_double(scheduler_score_cpu_factor);
+DECLARE_double(scheduler_score_memory_factor);
+
+const int32_t kAgents = 10000;
+const int32_t kRounds = 1000;
+
+struct AgentColumns {
+  std::vector<float> cpu_load;
+  std::vector<float> mem_load;
+  std::vector<float> longrun_count;
+  std::vector<float> pod_count;
+};
+
+// the formula of ScoreForLongrunPod with std exp per agent
+static void ScoreWithExp(const AgentColumns& columns, std::vector<float>* scores) {
+  float cpu_factor = FLAGS_scheduler_score_cpu_factor;
+  float mem_factor = FLAGS_scheduler_score_memory_factor;
+  float longrun_factor = FLAGS_scheduler_score_longrun_pod_factor / FLAGS_scheduler_max_pod_count;
+  float pod_factor = FLAGS_scheduler_score_pod_factor / FLAGS_scheduler_max_pod_count;
+  scores->resize(columns.cpu_load.size());
+  for (size_t i = 0; i < columns.cpu_load.size(); ++i) {
+    (*scores)[i] = expf(columns.cpu_load[i] * cpu_factor)
+                   + expf(columns.mem_load[i] * mem_factor)
+                   + expf(columns.longrun_count[i] * longrun_factor)
+                   + expf(columns.pod_count[i] * pod_factor);
+  }
+}
+
+int main(int argc, char** argv) {
+  ::google::ParseCommandLineFlags(&argc, &argv, true);
+  dos::AgentTable table;
+  AgentColumns columns;
+  srand(kAgents);
+  for (int32_t index = 0; index < kAgents; ++index) {
+    dos::AgentOverview agent;
+    char endpoint[32];
+    snprintf(endpoint, sizeof(endpoint), "agent%d:8221", index);
+    agent.set_endpoint(endpoint);
+    agent.mutable_resource()->mutable_cpu()->set_limit(32000);
+    agent.mutable_resource()->mutable_cpu()->set_assigned(rand() % 32000);
+    agent.mutable_resource()->mutable_memory()->set_limit(64L << 30);
+    agent.mutable_resource()->mutable_memory()->set_assigned(rand() % (64L << 30));
+    int32_t pods = rand() % 32;
+    for (int32_t pindex = 0; pindex < pods; ++pindex) {
+      agent.add_pods()->set_type(pindex % 2 == 0 ? dos::kPodLongrun : dos::kPodBatch);
+    }
+    table.Upsert(agent);
+    columns.cpu_load.push_back(static_cast<float>(agent.resource().cpu().assigned())
+                               / agent.resource().cpu().limit());
+    columns.mem_load.push_back(static_cast<float>(agent.resource().memory().assigned())
+                               / agent.resource().memory().limit());
+    columns.longrun_count.push_back((pods + 1) / 2);
+    columns.pod_count.push_back(pods / 2);
+  }
+  std::vector<float> scores;
+  std::vector<float> expected;
+  int64_t start = ::baidu::common::timer::get_micros();
+  for (int32_t round = 0; round < kRounds; ++round) {
+    table.ScoreForLongrunPod(&scores);
+  }
+  int64_t batch_used = ::baidu::common::timer::get_micros() - start;
+  start = ::baidu::common::timer::get_micros();
+  for (int32_t round = 0; round < kRounds; ++round) {
+    ScoreWithExp(columns, &expected);
+  }
+  int64_t exp_used = ::baidu::common::timer::get_micros() - start;
+  double max_error = 0;
+  for (size_t index = 0; index < scores.size(); ++index) {
+    double error = fabs(scores[index] - expected[index]) / expected[index];
+    if (error > max_error) {
+      max_error = error;
+    }
+  }
+  fprintf(stdout, "score %d agents %d rounds\n", kAgents, kRounds);
+  fprintf(stdout, "batch exp: %.3f ms per round\n", batch_used / 1000.0 / kRounds);
+  fprintf(stdout, "std exp  : %.3f ms per round\n", exp_used / 1000.0 / kRounds);
+  fprintf(stdout, "max relative error of scores %.2e\n", max_error);
+  return 0;
+}
@@ -107,6 +107,9 @@ SdkStatus EngineSdkImpl::ShowAll(std::vector<CInfo>& containers) {
     info.mem_cache_used = response.containers(i).mem_cache_used();
     info.mem_rss_used = response.containers(i).mem_rss_used();
     info.cpu_idle = response.containers(i).cpu_idle();
+    info.image_cache_hit = response.containers(i).image_cache_hit();
+    info.image_pulled_bytes = response.containers(i).image_pulled_bytes();
+    info.image_total_bytes = response.containers(i).image_total_bytes();
     containers.push_back(info);
   }
   return kSdkOk;
@@ -205,6 +208,7 @@ SdkStatus DosSdkImpl::Submit(const JobDescriptor& job) {
   request.mutable_job()->set_name(job.name);
   request.mutable_job()->set_replica(job.replica);
   request.mutable_job()->set_deploy_step_size(job.deploy_step_size);
+  request.mutable_job()->set_gang(job.gang);
   request.mutable_job()->set_raw(job.raw);
   request.mutable_job()->mutable_pod()->set_type(kPodLongrun);
   for (size_t i = 0; i < job.pod.containers.size(); ++i) {
@@ -36,6 +36,9 @@ struct CInfo {
   int64_t mem_cache_used;
   int64_t mem_rss_used;
   int64_t cpu_idle;
+  bool image_cache_hit;
+  int64_t image_pulled_bytes;
+  int64_t image_total_bytes;
 };
 
 struct CLog {
@@ -55,6 +58,8 @@ struct JobDescriptor {
   PodDescritpor pod;
   uint32_t replica;
   uint32_t deploy_step_size;
+  // place the pods of a deploy step all together or none
+  bool gang;
   std::string raw;
 };
 